@@ -38,20 +38,83 @@
 #include "prog3.h"
 #include <stdlib.h>
 #include "helperfunctions.h"
+#include "eventloop.h"
+#include "lexer.h"
+#include "output.h"
 #include <unistd.h>
 
-void handleCommand(int argc, char ** argv);
+void handleCommand(int argc, char ** argv, const int * types);
 
 //i made a change
 
+/***************************************************************************//**
+ * @par Description:
+ * Event loop handler for stdin. Reads one line, makes a call to
+ * handleCommand to handle the given commands and arguments, and displays
+ * the dsh> prompt again. Stops the loop on 'exit' or end of input.
+ *
+ * @param[in] fd - Not used (stdin).
+ * @param[in] events - Not used.
+ * @param[in] arg - Not used.
+ ******************************************************************************/
+static void readCommand(int fd, unsigned int events, void * arg)
+{
+    char ** args;
+    const int * types;
+    int words;
+    int exiting;
+
+    // Get user input.
+    char * input = getInput();
+    if (NULL == input)
+    {
+        outPrintf("\n");
+        loopStop();
+        return;
+    }
+
+    // Break input string into individual arguments (in place).
+    args = lexArgs(input,&words,&types);
+    if (NULL == args)
+    {
+        outPrintf("Syntax error: unterminated quote.\n");
+        words = 0;
+    }
+
+    // Make a function call to handle user commands.
+    handleCommand(words,args,types);
+
+    exiting = (words > 0 && 0 == strcmp(args[0],"exit"));
+
+    // The arguments point into input; only the array was allocated.
+    free(args);
+
+    if (exiting)
+    {
+        loopStop();
+    }
+
+    // Shell prompt, unless a command (dclient) took over stdin.
+    else if (readCommand == loopGetHandler(STDIN_FILENO, NULL))
+    {
+        outPrintf(DSH_PROMPT);
+    }
+
+    free(input);
+    outFlush();
+
+    // Lines read ahead with this one are not seen by epoll.
+    loopSetPending(STDIN_FILENO, inputPending());
+}
+
+
 /***************************************************************************//**
  * @author Joe Lillo
  *
  * @par Description:
- * Entry point of program. Displays dsh> prompt in a
- * loop to get commands from the user. Makes a call
- * to handleCommand to handle the given commands
- * and arguments.
+ * Entry point of program. Displays dsh> prompt and runs the event loop,
+ * which reads commands from the user, reaps child processes, serves socket
+ * clients and fires timers, all from this one thread.
  *
  * @returns Status
  ******************************************************************************/
@@ -59,45 +122,30 @@ int main(void)
 {
     getcwd(_START_CWD,800);
 
-    // Register signals to be handled.
-    startCatchSignals();
-
-    // Used for user input.
-    char * input = NULL;
-    char ** args;
-    int words;
-
-    // Main program loop.
-    do
+    if (0 != loopInit())
     {
-        // Delete previous input.
-        if (NULL != input)
-        {
-            free(input);
-            input = NULL;
-        }
-
-        // Shell prompt.
-        printf("dsh> ");
-
-        // Get user input.
-        input = getInput();
+        outPrintf("Could not create event loop.\n");
+        return 1;
+    }
 
-        // Break input string into individual arguments.
-        args = getArgs(input,&words);
+    // Register signals to be handled.
+    int sigfd = startCatchSignals();
+    if (sigfd < 0 || 0 != loopAdd(sigfd, EPOLLIN, handleSignalEvent, NULL))
+    {
+        outPrintf("Could not catch signals.\n");
+        return 1;
+    }
 
-        // Make a function call to handle user commands.
-        handleCommand(words,args);
+    // Input is read by getInput(), which tells the loop about lines it has
+    // buffered ahead.
+    loopAdd(STDIN_FILENO, EPOLLIN, readCommand, NULL);
 
-        // Free memory allocated for storing arguments.
-        int i = 0;
-        for (i = 0; i < words; i++)
-        {
-            free(args[i]);
-        }
-        free(args);
+    // Shell prompt.
+    outPrintf(DSH_PROMPT);
+    outFlush();
 
-    }while(0 != strcmp(input,"exit"));
+    // Main program loop.
+    loopRun();
 
     onExit();
 
@@ -114,10 +162,12 @@ int main(void)
  *
  * @param[in] argc - the number of arguments
  * @param[in] argv - a 2d array of characters containing the arguments.
+ * @param[in] types - LEX_WORD or LEX_OP for each argument, so quoted
+ *                    operators are not treated as pipes or redirects.
  *
  * @returns 0
  ******************************************************************************/
-void handleCommand(int argc, char ** argv)
+void handleCommand(int argc, char ** argv, const int * types)
 {
     // Error checking
     if(argc < 1)
@@ -129,25 +179,25 @@ void handleCommand(int argc, char ** argv)
         return;
     }
 
-    if ( 0 != isPipe(argc,argv) )
+    if ( 0 != isPipe(argc,argv,types) )
     {
-        printf("\n");
-        doPipe(argc,argv);
-        printf("\n");
+        outPrintf("\n");
+        doPipe(argc,argv,types);
+        outPrintf("\n");
     }
 
-    else if ( 0 != isRedirect(argc,argv) )
+    else if ( 0 != isRedirect(argc,argv,types) )
     {
-        printf("\n");
-        doRedirect(argc, argv);
-        printf("\n");
+        outPrintf("\n");
+        doRedirect(argc, argv, types);
+        outPrintf("\n");
     }
 
-    else if ( 0 != isRemotePipe(argc,argv) )
+    else if ( 0 != isRemotePipe(argc,argv,types) )
     {
-        printf("\n");
+        outPrintf("\n");
         doClient(argc,argv);
-        printf("\n");
+        outPrintf("\n");
     }
 
     else if (0 == strcmp(argv[0],"cmdnm"))
@@ -162,7 +212,7 @@ void handleCommand(int argc, char ** argv)
 
     else if (0 == strcmp(argv[0],"systat"))
     {
-        systat();
+        systat(argc,argv);
     }
 
     else if (0 == strcmp(argv[0], "pid"))
@@ -170,6 +220,21 @@ void handleCommand(int argc, char ** argv)
         getPID(argc, argv);
     }
 
+    else if (0 == strcmp(argv[0], "ptop"))
+    {
+        ptop(argc, argv);
+    }
+
+    else if (0 == strcmp(argv[0], "ptree"))
+    {
+        ptree(argc, argv);
+    }
+
+    else if (0 == strcmp(argv[0], "pwatch"))
+    {
+        pwatch(argc, argv);
+    }
+
     else if (0 == strcmp(argv[0], "dserv"))
     {
         doServer(argc, argv);
@@ -184,7 +249,7 @@ void handleCommand(int argc, char ** argv)
     {
         if (0 != changeDirectory(argc, argv) && argc > 1)
         {
-            printf("Cannot change to directory: %s\n", argv[1]);
+            outPrintf("Cannot change to directory: %s\n", argv[1]);
         }
     }
 
@@ -213,6 +278,56 @@ void handleCommand(int argc, char ** argv)
         copyBox(argc,argv);
     }
 
+    else if (0 == strcmp(argv[0], "mboxhist"))
+    {
+        histBox(argc,argv);
+    }
+
+    else if (0 == strcmp(argv[0], "mboxwait"))
+    {
+        waitBox(argc,argv);
+    }
+
+    else if (0 == strcmp(argv[0], "mboxtxn"))
+    {
+        txnBox(argc,argv);
+    }
+
+    else if (0 == strcmp(argv[0], "mboxbind"))
+    {
+        bindBox(argc,argv);
+    }
+
+    else if (0 == strcmp(argv[0], "mboxstat"))
+    {
+        statBox(argc,argv);
+    }
+
+    else if (0 == strcmp(argv[0], "mboxgrow"))
+    {
+        growBox(argc,argv);
+    }
+
+    else if (0 == strcmp(argv[0], "mboxsync"))
+    {
+        syncBox(argc,argv);
+    }
+
+    else if (0 == strcmp(argv[0], "mboxpub"))
+    {
+        pubBox(argc,argv);
+    }
+
+    else if (0 == strcmp(argv[0], "mboxsub"))
+    {
+        subBox(argc,argv);
+    }
+
+    else if (0 == strcmp(argv[0], "mboxnotify"))
+    {
+        notifyBox(argc,argv);
+    }
+
     else if (0 == strcmp(argv[0],"exit"))
     {
         return;
@@ -220,12 +335,12 @@ void handleCommand(int argc, char ** argv)
 
     else if (strlen(argv[0]) > 0)
     {
-        printf("\n");
-        if (0 != execCmd(argc,argv))
+        outPrintf("\n");
+        if (0 != execCmd(argc,argv,types))
         {
-            printf("Error executing command: %s\n",argv[0]);
+            outPrintf("Error executing command: %s\n",argv[0]);
         }
-        printf("\n");
+        outPrintf("\n");
     }
 
 }
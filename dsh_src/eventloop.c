@@ -0,0 +1,350 @@
+/************************************************************************//**
+ *  @file eventloop.c
+ *
+ *  @brief Single threaded epoll event loop for the shell.
+ *
+ *  Everything the shell waits on -- stdin, the signalfd, sockets, timers --
+ *  is registered here with a handler, and loopRun() dispatches ready file
+ *  descriptors one at a time from the main thread. Handlers must not
+ *  block for long, since nothing else runs while they do.
+ *
+ *  epoll refuses regular files (stdin redirected from a file, for
+ *  example). Those are always ready, so they are kept on a separate list
+ *  and dispatched on every pass without blocking. The same is done for
+ *  descriptors whose input the shell has already read into its own buffer
+ *  (see loopSetPending()).
+ *
+ *  Commands that wait outside the loop can't see the shell's signalfd
+ *  without consuming other signals, so SIGINT also has a signalfd of its
+ *  own (loopInterruptFd()) for them to poll.
+ ***************************************************************************/
+
+#include "eventloop.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+/*!
+ * \brief Handler registered for one file descriptor.
+ */
+struct loopEntry
+{
+    loopHandler fn;
+    void * arg;
+    unsigned int events;
+    int isTimer;                        // Read the expiration count first.
+    int alwaysReady;                    // Not in epoll (regular file).
+    int pending;                        // Input already buffered.
+};
+
+static int _epollFd = -1;
+static struct loopEntry * _entries = NULL;
+static int _numEntries = 0;
+static int _running = 0;
+static int _interruptFd = -1;
+
+/*!
+ * \brief Create the epoll instance.
+ * \return Error code. 0 on success.
+ */
+int loopInit()
+{
+    if (_epollFd >= 0)
+    {
+        return 0;
+    }
+
+    _epollFd = epoll_create1(EPOLL_CLOEXEC);
+    return (_epollFd < 0) ? -1 : 0;
+}
+
+/*!
+ * \brief Get the table entry for a file descriptor, growing the table.
+ * \param fd - File descriptor.
+ * \return Entry, or NULL if out of memory.
+ */
+static struct loopEntry * entryFor(int fd)
+{
+    if (fd >= _numEntries)
+    {
+        int num = _numEntries ? _numEntries : 64;
+        while (num <= fd)
+        {
+            num *= 2;
+        }
+
+        struct loopEntry * entries = realloc(_entries, num * sizeof(struct loopEntry));
+        if (NULL == entries)
+        {
+            return NULL;
+        }
+        memset(entries + _numEntries, 0, (num - _numEntries) * sizeof(struct loopEntry));
+        _entries = entries;
+        _numEntries = num;
+    }
+
+    return &_entries[fd];
+}
+
+/*!
+ * \brief Watch a file descriptor, or replace the handler of one that is
+ *        already watched.
+ * \param fd - File descriptor.
+ * \param events - EPOLLIN and/or EPOLLOUT.
+ * \param fn - Handler.
+ * \param arg - Passed to the handler.
+ * \return Error code. 0 on success.
+ */
+int loopAdd(int fd, unsigned int events, loopHandler fn, void * arg)
+{
+    struct epoll_event ev;
+    struct loopEntry * entry = entryFor(fd);
+
+    if (NULL == entry || _epollFd < 0)
+    {
+        return -1;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+
+    if (NULL != entry->fn)
+    {
+        if (!entry->alwaysReady && entry->events != events &&
+            0 != epoll_ctl(_epollFd, EPOLL_CTL_MOD, fd, &ev))
+        {
+            return -1;
+        }
+    }
+    else if (0 != epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &ev))
+    {
+        if (EPERM != errno)
+        {
+            return -1;
+        }
+        entry->alwaysReady = 1;
+    }
+
+    entry->fn = fn;
+    entry->arg = arg;
+    entry->events = events;
+    return 0;
+}
+
+/*!
+ * \brief Current handler of a file descriptor.
+ * \param fd - File descriptor.
+ * \param arg - Returns the handler's argument (may be NULL).
+ * \return Handler, or NULL if fd is not watched.
+ */
+loopHandler loopGetHandler(int fd, void ** arg)
+{
+    if (fd < 0 || fd >= _numEntries || NULL == _entries[fd].fn)
+    {
+        return NULL;
+    }
+
+    if (NULL != arg)
+    {
+        *arg = _entries[fd].arg;
+    }
+    return _entries[fd].fn;
+}
+
+/*!
+ * \brief Stop watching a file descriptor. It is not closed.
+ * \param fd - File descriptor.
+ * \return Error code. 0 on success.
+ */
+int loopRemove(int fd)
+{
+    if (fd < 0 || fd >= _numEntries || NULL == _entries[fd].fn)
+    {
+        return -1;
+    }
+
+    if (!_entries[fd].alwaysReady)
+    {
+        epoll_ctl(_epollFd, EPOLL_CTL_DEL, fd, NULL);
+    }
+    memset(&_entries[fd], 0, sizeof(struct loopEntry));
+    return 0;
+}
+
+/*!
+ * \brief Mark a watched file descriptor as having buffered input. Such a
+ *        descriptor is dispatched on every pass, like a regular file, until
+ *        the mark is cleared.
+ * \param fd - File descriptor.
+ * \param pending - Non-zero while input is buffered.
+ */
+void loopSetPending(int fd, int pending)
+{
+    if (fd >= 0 && fd < _numEntries && NULL != _entries[fd].fn)
+    {
+        _entries[fd].pending = pending;
+    }
+}
+
+/*!
+ * \brief Call a handler periodically.
+ * \param ms - Period in milliseconds.
+ * \param fn - Handler (its fd argument is the timer ID).
+ * \param arg - Passed to the handler.
+ * \return Timer ID, or -1 on failure.
+ */
+int loopAddTimer(unsigned int ms, loopHandler fn, void * arg)
+{
+    struct itimerspec its;
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (tfd < 0)
+    {
+        return -1;
+    }
+
+    its.it_interval.tv_sec = ms / 1000;
+    its.it_interval.tv_nsec = (ms % 1000) * 1000000L;
+    its.it_value = its.it_interval;
+
+    if (0 != timerfd_settime(tfd, 0, &its, NULL) || 0 != loopAdd(tfd, EPOLLIN, fn, arg))
+    {
+        close(tfd);
+        return -1;
+    }
+
+    _entries[tfd].isTimer = 1;
+    return tfd;
+}
+
+/*!
+ * \brief Stop and close a timer.
+ * \param timer - Timer ID from loopAddTimer().
+ */
+void loopRemoveTimer(int timer)
+{
+    if (0 == loopRemove(timer))
+    {
+        close(timer);
+    }
+}
+
+/*!
+ * \brief Call the handler for a ready file descriptor, if it still has
+ *        one (an earlier handler in the same pass may have removed it).
+ * \param fd - File descriptor.
+ * \param events - Ready events.
+ */
+static void dispatch(int fd, unsigned int events)
+{
+    unsigned long long expirations;
+
+    if (fd >= _numEntries || NULL == _entries[fd].fn)
+    {
+        return;
+    }
+
+    if (_entries[fd].isTimer &&
+        sizeof(expirations) != read(fd, &expirations, sizeof(expirations)))
+    {
+        return;
+    }
+
+    _entries[fd].fn(fd, events, _entries[fd].arg);
+}
+
+/*!
+ * \brief Dispatch events until loopStop() is called.
+ * \return Error code. 0 after loopStop(), -1 if epoll fails.
+ */
+int loopRun()
+{
+    struct epoll_event events[LOOP_MAX_EVENTS];
+    int i, n;
+
+    _running = 1;
+    while (_running)
+    {
+        int timeout = -1;
+
+        // Always ready descriptors are dispatched every pass; don't block
+        // while there are any.
+        for (i = 0; i < _numEntries && timeout < 0; i++)
+        {
+            if (NULL != _entries[i].fn && (_entries[i].alwaysReady || _entries[i].pending))
+            {
+                timeout = 0;
+            }
+        }
+
+        n = epoll_wait(_epollFd, events, LOOP_MAX_EVENTS, timeout);
+        if (n < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            return -1;
+        }
+
+        for (i = 0; i < n && _running; i++)
+        {
+            dispatch(events[i].data.fd, events[i].events);
+        }
+
+        for (i = 0; i < _numEntries && _running && 0 == timeout; i++)
+        {
+            if (NULL != _entries[i].fn && (_entries[i].alwaysReady || _entries[i].pending))
+            {
+                dispatch(i, _entries[i].events);
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*!
+ * \brief Make loopRun() return once the current handler finishes.
+ */
+void loopStop()
+{
+    _running = 0;
+}
+
+/*!
+ * \brief signalfd for SIGINT alone, created on first use. It is readable
+ *        while a SIGINT is pending, which only happens while the signal is
+ *        blocked (as it is in the shell, for its own signalfd).
+ * \return File descriptor, or -1 on failure.
+ */
+int loopInterruptFd()
+{
+    sigset_t mask;
+
+    if (_interruptFd < 0)
+    {
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGINT);
+        _interruptFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    }
+
+    return _interruptFd;
+}
+
+/*!
+ * \brief Consume a pending SIGINT, if there is one.
+ * \return 1 if a SIGINT was pending, 0 otherwise.
+ */
+int loopInterrupted()
+{
+    struct signalfd_siginfo info;
+    int fd = loopInterruptFd();
+
+    return (fd >= 0 && sizeof(info) == read(fd, &info, sizeof(info))) ? 1 : 0;
+}
@@ -0,0 +1,53 @@
+/************************************************************************//**
+ *  @file eventloop.h
+ *
+ *  @brief Single threaded epoll event loop for the shell.
+ ***************************************************************************/
+
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <sys/epoll.h>
+
+// Most events handled per epoll_wait() call.
+#define LOOP_MAX_EVENTS 32
+
+// Called when fd is ready. events holds the EPOLL* flags.
+typedef void (*loopHandler)(int fd, unsigned int events, void * arg);
+
+// Creates the loop. Returns 0 on success.
+int loopInit();
+
+// Watches fd for events, or replaces the handler of a watched fd.
+int loopAdd(int fd, unsigned int events, loopHandler fn, void * arg);
+
+// Current handler of fd (NULL if it is not watched).
+loopHandler loopGetHandler(int fd, void ** arg);
+
+// Stops watching fd (it is not closed).
+int loopRemove(int fd);
+
+// Marks fd as having input buffered by the shell, which epoll can't see.
+// While set, fd is dispatched on every pass without blocking.
+void loopSetPending(int fd, int pending);
+
+// Calls fn every ms milliseconds. Returns the timer ID (a timerfd).
+int loopAddTimer(unsigned int ms, loopHandler fn, void * arg);
+
+// Stops and closes a timer.
+void loopRemoveTimer(int timer);
+
+// Dispatches events until loopStop() is called.
+int loopRun();
+
+// Makes loopRun() return after the current handler.
+void loopStop();
+
+// signalfd that becomes readable on SIGINT while the shell blocks it.
+// Commands that wait outside the loop poll it so Ctrl-C stops them.
+int loopInterruptFd();
+
+// Consumes a pending SIGINT. Returns 1 if there was one.
+int loopInterrupted();
+
+#endif
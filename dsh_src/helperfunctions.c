@@ -8,6 +8,111 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// stdin is read a block at a time into this buffer and split into lines
+// here. Only the main thread reads input.
+static char * _inBuf = NULL;
+static size_t _inStart = 0;             // First unread byte.
+static size_t _inEnd = 0;               // End of buffered data.
+static size_t _inCap = 0;
+static int _inEof = 0;                  // read() returned end of input.
+
+
+/***************************************************************************//**
+ * @par Description:
+ * fork() handler. When stdin is seekable, the file offset is moved back to
+ * the first unread byte and the buffer emptied, so a child that reads stdin
+ * starts where the shell stopped rather than after its read-ahead.
+ ******************************************************************************/
+static void inputForkPrepare()
+{
+    off_t unread = _inEnd - _inStart;
+
+    if (unread > 0 && lseek(STDIN_FILENO, -unread, SEEK_CUR) >= 0)
+    {
+        _inStart = _inEnd = 0;
+    }
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Finds the end of the first buffered line.
+ *
+ * @return char* - The newline, or NULL if no whole line is buffered.
+ ******************************************************************************/
+static char * bufferedLine()
+{
+    if (_inEnd == _inStart)
+    {
+        return NULL;
+    }
+    return memchr(_inBuf + _inStart, '\n', _inEnd - _inStart);
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Reads more of stdin into the line buffer, growing it if it is full.
+ * Blocks until some input arrives.
+ *
+ * @return 1 if data was read, 0 at end of input, -1 on error.
+ ******************************************************************************/
+static int fillInput()
+{
+    // Move the unread part to the front before growing.
+    if (_inStart > 0)
+    {
+        memmove(_inBuf, _inBuf + _inStart, _inEnd - _inStart);
+        _inEnd -= _inStart;
+        _inStart = 0;
+    }
+
+    if (_inEnd == _inCap)
+    {
+        size_t cap = _inCap ? _inCap * 2 : INPUT_BUF_SIZE;
+        char * buf = realloc(_inBuf, cap);
+        if (NULL == buf)
+        {
+            return -1;
+        }
+        if (NULL == _inBuf)
+        {
+            pthread_atfork(inputForkPrepare, NULL, NULL);
+        }
+        _inBuf = buf;
+        _inCap = cap;
+    }
+
+    while (1)
+    {
+        ssize_t n = read(STDIN_FILENO, _inBuf + _inEnd, _inCap - _inEnd);
+        if (n > 0)
+        {
+            _inEnd += n;
+            return 1;
+        }
+        if (0 == n)
+        {
+            return 0;
+        }
+        if (EAGAIN == errno || EWOULDBLOCK == errno)
+        {
+            // stdin was left non-blocking by someone else; wait.
+            struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+            poll(&pfd, 1, -1);
+        }
+        else if (EINTR != errno)
+        {
+            return -1;
+        }
+    }
+}
 
 
 /***************************************************************************//**
@@ -17,31 +122,74 @@
  * Gets a line of input from stdin and returns it.
  * Removes newlines and null terminates the string.
  *
- * @return char* - Input from stdin
+ * stdin is read in blocks into the shell's own buffer instead of through
+ * stdio, so a line costs one read() rather than one per byte, and the
+ * event loop can be told about lines that are already buffered (see
+ * inputPending()).
+ *
+ * @return char* - Input from stdin, NULL at end of input.
  ******************************************************************************/
 char * getInput ()
 {
-    char * input = NULL;
-    size_t size = 0;
+    char * nl;
+    int status = 1;
 
-    // Get a line of input from stdin
-    size_t len = getline(&input, &size, stdin);
+    // Read until a whole line is buffered or the input ends.
+    while (NULL == (nl = bufferedLine()) &&
+           !_inEof && 1 == status)
+    {
+        status = fillInput();
+        if (0 == status)
+        {
+            _inEof = 1;
+        }
+    }
+
+    size_t len = (NULL != nl) ? (size_t)(nl - (_inBuf + _inStart)) : _inEnd - _inStart;
 
-    // Replace newline with null terminator.
-    if('\n' == input[len-1])
+    // End of input. A terminal may still send more after this.
+    if (NULL == nl && 0 == len)
     {
-        input[len-1] = '\0';
+        _inEof = 0;
+        return NULL;
     }
 
+    char * input = malloc(len + 1);
+    if (NULL == input)
+    {
+        return NULL;
+    }
+    memcpy(input, _inBuf + _inStart, len);
+    input[len] = '\0';
+
+    // Skip the newline too.
+    _inStart += len + (NULL != nl);
+
     return input;
 }
 
 
+/***************************************************************************//**
+ * @par Description:
+ * Tells whether getInput() can return without reading stdin: a whole line
+ * is buffered, or the end of input has been reached. epoll does not see
+ * this input, so the shell must keep calling getInput() while it is set.
+ *
+ * @return int - Non-zero if input is pending.
+ ******************************************************************************/
+int inputPending ()
+{
+    return _inEof || NULL != bufferedLine();
+}
+
+
 /***************************************************************************//**
  * @author Joe Lillo
  *
  * @par Description:
- * Seperates the given input into seperate words.
+ * Seperates the given input into seperate words. Splits on single spaces
+ * only; the shell now uses lexArgs() (lexer.c), and this is kept as the
+ * baseline for lexbench.
  *
  * @param[in] input - Input string to tokenize.
  * @param[out] wordCount - Used to return the number of words found.
@@ -152,7 +300,8 @@ char ** getArgs (char * input, int * wordCount)
  * @author Joe Lillo
  *
  * @par Description:
- * Converts a string to an integer. (ie) "101" -> 101.
+ * Converts a string to an integer. (ie) "101" -> 101. Fails on an empty
+ * string, a lone "-", any non-digit, or a value outside the range of int.
  *
  * @param[in] str - String to convert to int.
  * @param[in] ok [out] - Acts as boolean to indicate success of function.
@@ -161,50 +310,45 @@ char ** getArgs (char * input, int * wordCount)
  ******************************************************************************/
 int strToInt (char * str, int * ok)
 {
-    int num = 0;
-    unsigned int i;
+    unsigned int num = 0;
+    const char * p = str;
 
     // Check if the number is negative.
-    int neg = (str[0] == '-');
-
-    // Error checking.
-    if(0 == strlen(str))
-    {
-        *ok = -1;
-        return 0;
-    }
-
-    // Set starting position for loop.
+    int neg = ('-' == *p);
     if (neg)
     {
-        i = 1;
+        p++;
     }
-    else
+
+    // Largest magnitude allowed for the sign.
+    unsigned int limit = neg ? (unsigned int)INT_MAX + 1 : (unsigned int)INT_MAX;
+
+    // Error checking.
+    *ok = -1;
+    if ('\0' == *p)
     {
-        i = 0;
+        return 0;
     }
 
     // Iterate through string. Determine the value of each character.
-    // Add that value to num and multiply num by 10.
-    for (; i < strlen(str); i++)
+    // Multiply num by 10 and add that value, stopping before it overflows.
+    for (; '\0' != *p; p++)
     {
-        int temp = str[i] - '0';
-        if (temp < 0 || temp > 9)
+        unsigned int temp = (unsigned int)(*p - '0');
+        if (temp > 9 || num > (limit - temp) / 10)
         {
-            *ok = -1;
             return 0;
         }
-        num *= 10;
-        num += temp;
+        num = num * 10 + temp;
     }
 
     *ok = 0;
 
     if (neg)
     {
-        num *= -1;
+        return (int)(0U - num);
     }
-    return num;
+    return (int)num;
 }
 
 
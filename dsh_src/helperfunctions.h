@@ -7,9 +7,20 @@
 #ifndef HELPERFUNCTIONS_H
 #define HELPERFUNCTIONS_H
 
+// Shell prompt.
+#define DSH_PROMPT "dsh> "
+
+// Initial size of the stdin line buffer (it grows for longer lines).
+#define INPUT_BUF_SIZE 4096
+
 char ** getArgs (char * input, int * wordCount);
+
+// Reads a line from stdin. Returns NULL at end of input.
 char * getInput ();
 
+// Non-zero if getInput() can return without reading stdin.
+int inputPending ();
+
 // Converts a string to and integer.
 int strToInt (char * str, int * ok);
 
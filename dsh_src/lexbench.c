@@ -0,0 +1,252 @@
+/************************************************************************//**
+ *  @file lexbench.c
+ *
+ *  @brief Command line tokenizer benchmark.
+ *
+ *  Generates command lines of increasing length (words of 1 to 16
+ *  printable characters separated by single spaces, the only input
+ *  getArgs handles correctly) and times tokenizing each one with getArgs
+ *  and with the in place lexer. One CSV row is printed per tokenizer and
+ *  line length:
+ *
+ *      tokenizer,line_bytes,words,lines,ns_per_line,mb_per_sec
+ *
+ *  The lexer rows include copying the line into a scratch buffer first,
+ *  since lexing consumes its input. "lexLine" reuses one token array;
+ *  "lexArgs" allocates an argument array per line like the shell does.
+ *
+ *  Usage: lexbench [-t seconds_per_row] [-s line_bytes]
+ ***************************************************************************/
+
+#include "lexer.h"
+#include "helperfunctions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#define K 1024
+
+// Line lengths used when -s is not given.
+static const int DEFAULT_SIZES[] =
+{
+    64, 256, 1*K, 4*K, 16*K, 64*K
+};
+
+/*!
+ * \brief Current monotonic time in nanoseconds.
+ * \return Nanoseconds.
+ */
+static unsigned long long nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*!
+ * \brief Generate a command line of words separated by single spaces.
+ * \param len - Line length in bytes.
+ * \param words - Returns the number of words.
+ * \return NUL terminated line (free it).
+ */
+static char * makeLine(int len, int * words)
+{
+    // Word characters only; no quotes, escapes or operators.
+    static const char chars[] =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_./=+,:";
+    char * line = malloc(len + 1);
+    int i = 0;
+
+    *words = 0;
+    while (i < len)
+    {
+        int w = 1 + rand() % 16;
+        if (w > len - i)
+        {
+            w = len - i;
+        }
+        while (w-- > 0)
+        {
+            line[i++] = chars[rand() % (sizeof(chars) - 1)];
+        }
+        (*words)++;
+        if (i < len - 1)
+        {
+            line[i++] = ' ';
+        }
+        else if (i < len)
+        {
+            line[i++] = 'x';
+        }
+    }
+    line[len] = '\0';
+
+    return line;
+}
+
+/*!
+ * \brief Check that both tokenizers split a line into the same words.
+ * \param line - Line to check.
+ * \return Error code. 0 when they agree.
+ */
+static int checkLine(const char * line)
+{
+    char * a = strdup(line);
+    char * b = strdup(line);
+    int wa, wb, i;
+    int ret = 0;
+
+    char ** argsA = getArgs(a, &wa);
+    char ** argsB = lexArgs(b, &wb, NULL);
+
+    if (NULL == argsB || wa != wb)
+    {
+        ret = -1;
+    }
+    for (i = 0; i < wa; i++)
+    {
+        if (0 == ret && 0 != strcmp(argsA[i], argsB[i]))
+        {
+            ret = -1;
+        }
+        free(argsA[i]);
+    }
+
+    free(argsA);
+    free(argsB);
+    free(a);
+    free(b);
+    return ret;
+}
+
+/*!
+ * \brief Print one CSV row.
+ */
+static void printRow(const char * name, int len, int words, long lines,
+                     unsigned long long ns)
+{
+    printf("%s,%d,%d,%ld,%.1f,%.1f\n", name, len, words, lines,
+           (double)ns / lines, (double)len * lines / (ns / 1e9) / 1e6);
+    fflush(stdout);
+}
+
+/*!
+ * \brief Time each tokenizer on one line.
+ * \param len - Line length.
+ * \param seconds - Time to spend on each tokenizer.
+ */
+static void runPass(int len, double seconds)
+{
+    int words;
+    char * line = makeLine(len, &words);
+    char * scratch = malloc(len + 1);
+    struct lexToken * toks = NULL;
+    int cap = 0;
+    unsigned long long limit = (unsigned long long)(seconds * 1e9);
+    unsigned long long start, ns;
+    long lines;
+    int i, n;
+
+    if (0 != checkLine(line))
+    {
+        fprintf(stderr, "Tokenizers disagree on a %d byte line.\n", len);
+    }
+
+    // getArgs: one allocation per word plus the array.
+    lines = 0;
+    start = nowNs();
+    do
+    {
+        char ** args = getArgs(line, &n);
+        for (i = 0; i < n; i++)
+        {
+            free(args[i]);
+        }
+        free(args);
+        lines++;
+    } while ((ns = nowNs() - start) < limit);
+    printRow("getArgs", len, words, lines, ns);
+
+    // lexArgs: copy, then one argument array per line.
+    lines = 0;
+    start = nowNs();
+    do
+    {
+        memcpy(scratch, line, len + 1);
+        free(lexArgs(scratch, &n, NULL));
+        lines++;
+    } while ((ns = nowNs() - start) < limit);
+    printRow("lexArgs", len, words, lines, ns);
+
+    // lexLine: copy, then tokens into a reused array.
+    lines = 0;
+    start = nowNs();
+    do
+    {
+        memcpy(scratch, line, len + 1);
+        lexLine(scratch, &toks, &cap);
+        lines++;
+    } while ((ns = nowNs() - start) < limit);
+    printRow("lexLine", len, words, lines, ns);
+
+    free(toks);
+    free(scratch);
+    free(line);
+}
+
+/*!
+ * \brief Benchmark entry point.
+ * \return Status.
+ */
+int main(int argc, char ** argv)
+{
+    double seconds = 0.5;
+    int size = 0;
+    int opt;
+    int ok;
+    unsigned int i;
+
+    while (-1 != (opt = getopt(argc, argv, "t:s:")))
+    {
+        switch (opt)
+        {
+        case 't':
+            seconds = atof(optarg);
+            if (seconds <= 0)
+            {
+                fprintf(stderr, "Invalid time: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 's':
+            size = strToInt(optarg, &ok);
+            if (0 != ok || size < 1)
+            {
+                fprintf(stderr, "Invalid line size: %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: lexbench [-t seconds_per_row] [-s line_bytes]\n");
+            return 1;
+        }
+    }
+
+    srand(1);
+
+    printf("tokenizer,line_bytes,words,lines,ns_per_line,mb_per_sec\n");
+    fflush(stdout);
+
+    for (i = 0; i < sizeof(DEFAULT_SIZES) / sizeof(int); i++)
+    {
+        runPass(size > 0 ? size : DEFAULT_SIZES[i], seconds);
+        if (size > 0)
+        {
+            break;
+        }
+    }
+
+    return 0;
+}
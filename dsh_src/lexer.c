@@ -0,0 +1,360 @@
+/************************************************************************//**
+ *  @file lexer.c
+ *
+ *  @brief In place command line tokenizer.
+ *
+ *  Words are separated by any run of whitespace and by the shell's
+ *  operators (| < > & (( ))). Inside a word, 'single quotes' are literal,
+ *  "double quotes" allow \" and \\, and a backslash outside quotes escapes
+ *  the next character. Quotes may cover part of a word (a"b c"d is the
+ *  word "ab cd").
+ *
+ *  Nothing is copied out of the line. Removing quotes and escapes only
+ *  ever shifts a word's bytes left, so each word is compacted where it
+ *  lies and NUL terminated over the delimiter that ended it. Operators
+ *  are returned as static strings, so their bytes can be overwritten too.
+ *
+ *  Most of a line is ordinary word bytes. The scan for the next byte that
+ *  needs attention (whitespace, quote, backslash or operator) looks at 16
+ *  bytes at a time with SSE2, or 32 with AVX2 when the compiler targets
+ *  it, and falls back to a class table elsewhere.
+ ***************************************************************************/
+
+#include "lexer.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Byte classes.
+#define CLASS_WORD  0
+#define CLASS_SPACE 1
+#define CLASS_OTHER 2               // Quote, backslash or operator.
+
+// Class of every byte value (CLASS_WORD unless listed).
+static const unsigned char lexClass[256] =
+{
+    ['\t'] = CLASS_SPACE, ['\n'] = CLASS_SPACE, ['\v'] = CLASS_SPACE,
+    ['\f'] = CLASS_SPACE, ['\r'] = CLASS_SPACE, [' '] = CLASS_SPACE,
+    ['\''] = CLASS_OTHER, ['"'] = CLASS_OTHER, ['\\'] = CLASS_OTHER,
+    ['|'] = CLASS_OTHER, ['<'] = CLASS_OTHER, ['>'] = CLASS_OTHER,
+    ['&'] = CLASS_OTHER, ['('] = CLASS_OTHER, [')'] = CLASS_OTHER,
+};
+
+/*!
+ * \brief Find the next byte that is not an ordinary word byte.
+ * \param p - Start of the scan.
+ * \param end - End of the line.
+ * \return First non-word byte, or end.
+ */
+static char * scanWord(char * p, char * end)
+{
+#if defined(__AVX2__)
+    // The special bytes are \t..\r, space, ", &..), <, >, \ and |.
+    const __m256i ws = _mm256_set1_epi8(9);
+    const __m256i amp = _mm256_set1_epi8('&');
+    while (end - p >= 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        __m256i a = _mm256_sub_epi8(v, ws);
+        __m256i b = _mm256_sub_epi8(v, amp);
+        __m256i m = _mm256_or_si256(
+            _mm256_cmpeq_epi8(_mm256_min_epu8(a, _mm256_set1_epi8(4)), a),
+            _mm256_cmpeq_epi8(_mm256_min_epu8(b, _mm256_set1_epi8(3)), b));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('<')));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('>')));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('|')));
+
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(m);
+        if (0 != mask)
+        {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+#elif defined(__SSE2__)
+    // The special bytes are \t..\r, space, ", &..), <, >, \ and |.
+    const __m128i ws = _mm_set1_epi8(9);
+    const __m128i amp = _mm_set1_epi8('&');
+    while (end - p >= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        __m128i a = _mm_sub_epi8(v, ws);
+        __m128i b = _mm_sub_epi8(v, amp);
+        __m128i m = _mm_or_si128(
+            _mm_cmpeq_epi8(_mm_min_epu8(a, _mm_set1_epi8(4)), a),
+            _mm_cmpeq_epi8(_mm_min_epu8(b, _mm_set1_epi8(3)), b));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('<')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('>')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('|')));
+
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(m);
+        if (0 != mask)
+        {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#endif
+
+    while (p < end && CLASS_WORD == lexClass[(unsigned char)*p])
+    {
+        p++;
+    }
+    return p;
+}
+
+/*!
+ * \brief Match an operator.
+ * \param p - Position in the line.
+ * \param end - End of the line.
+ * \param len - Returns the operator's length.
+ * \return Static operator string, or NULL if there is none at p.
+ */
+static const char * matchOp(const char * p, const char * end, int * len)
+{
+    *len = 1;
+    switch (*p)
+    {
+    case '|': return "|";
+    case '<': return "<";
+    case '>': return ">";
+    case '&': return "&";
+    case '(':
+    case ')':
+        // A single parenthesis is an ordinary character.
+        if (end - p >= 2 && p[1] == p[0])
+        {
+            *len = 2;
+            return ('(' == *p) ? "((" : "))";
+        }
+        break;
+    }
+    return NULL;
+}
+
+/*!
+ * \brief Append a token, growing the array if needed.
+ * \param toks - Token array.
+ * \param cap - Capacity of the array.
+ * \param count - Number of tokens, advanced.
+ * \return Error code. 0 on success.
+ */
+static int pushToken(struct lexToken ** toks, int * cap, int * count,
+                     const char * str, int len, int type)
+{
+    if (*count == *cap)
+    {
+        int num = *cap ? *cap * 2 : 16;
+        struct lexToken * grown = realloc(*toks, num * sizeof(struct lexToken));
+        if (NULL == grown)
+        {
+            return -1;
+        }
+        *toks = grown;
+        *cap = num;
+    }
+
+    (*toks)[*count].str = str;
+    (*toks)[*count].len = len;
+    (*toks)[*count].type = type;
+    (*count)++;
+    return 0;
+}
+
+/*!
+ * \brief Tokenize a line in place. Words are compacted and NUL terminated
+ *        inside line; the line itself is no longer usable afterwards.
+ * \param line - NUL terminated line.
+ * \param toks - Token array (may be NULL with *cap 0), grown as needed.
+ * \param cap - Capacity of the token array.
+ * \return Number of tokens, or LEX_ERR_QUOTE / LEX_ERR_MEMORY.
+ */
+int lexLine (char * line, struct lexToken ** toks, int * cap)
+{
+    char * p = line;
+    char * end = line + strlen(line);
+    int count = 0;
+    int opLen;
+    const char * op;
+
+    while (1)
+    {
+        while (p < end && CLASS_SPACE == lexClass[(unsigned char)*p])
+        {
+            p++;
+        }
+        if (p == end)
+        {
+            break;
+        }
+
+        if (NULL != (op = matchOp(p, end, &opLen)))
+        {
+            if (0 != pushToken(toks, cap, &count, op, opLen, LEX_OP))
+            {
+                return LEX_ERR_MEMORY;
+            }
+            p += opLen;
+            continue;
+        }
+
+        // Word. out trails p once quotes or escapes have been removed.
+        char * start = p;
+        char * out = p;
+        op = NULL;
+
+        while (p < end)
+        {
+            char * q = scanWord(p, end);
+            if (out != p)
+            {
+                memmove(out, p, q - p);
+            }
+            out += q - p;
+            p = q;
+
+            if (p == end || CLASS_SPACE == lexClass[(unsigned char)*p])
+            {
+                break;
+            }
+
+            if ('\\' == *p)
+            {
+                if (p + 1 < end)
+                {
+                    *out++ = p[1];
+                }
+                p += 2;
+            }
+            else if ('\'' == *p)
+            {
+                q = memchr(p + 1, '\'', end - p - 1);
+                if (NULL == q)
+                {
+                    return LEX_ERR_QUOTE;
+                }
+                memmove(out, p + 1, q - p - 1);
+                out += q - p - 1;
+                p = q + 1;
+            }
+            else if ('"' == *p)
+            {
+                for (p++; p < end && '"' != *p; p++)
+                {
+                    if ('\\' == *p && p + 1 < end && ('"' == p[1] || '\\' == p[1]))
+                    {
+                        p++;
+                    }
+                    *out++ = *p;
+                }
+                if (p == end)
+                {
+                    return LEX_ERR_QUOTE;
+                }
+                p++;
+            }
+            else if (NULL != (op = matchOp(p, end, &opLen)))
+            {
+                // Operator right after the word: match it before the
+                // terminator below overwrites its first byte.
+                break;
+            }
+            else
+            {
+                *out++ = *p++;
+            }
+        }
+
+        if (p > end)
+        {
+            p = end;
+        }
+        *out = '\0';
+        if (0 != pushToken(toks, cap, &count, start, out - start, LEX_WORD))
+        {
+            return LEX_ERR_MEMORY;
+        }
+
+        if (NULL != op)
+        {
+            if (0 != pushToken(toks, cap, &count, op, opLen, LEX_OP))
+            {
+                return LEX_ERR_MEMORY;
+            }
+            p += opLen;
+        }
+        else if (p < end)
+        {
+            // Step over the whitespace that ended the word (it may now
+            // hold the terminator).
+            p++;
+        }
+    }
+
+    return count;
+}
+
+/*!
+ * \brief Tokenize a line in place into an argument array. Operators become
+ *        arguments of their own, as the shell's pipe and redirect code
+ *        expects; their types tell them apart from quoted words with the
+ *        same text ('|').
+ * \param line - NUL terminated line. The words are stored in it.
+ * \param wordCount - Returns the number of arguments.
+ * \param types - If not NULL, returns the type of each argument. The types
+ *        follow the array in the same allocation.
+ * \return NULL terminated array (free the array only). NULL if the line
+ *         has an unterminated quote.
+ */
+char ** lexArgs (char * line, int * wordCount, const int ** types)
+{
+    struct lexToken * toks = NULL;
+    int cap = 0;
+    int i;
+
+    *wordCount = 0;
+    if (NULL != types)
+    {
+        *types = NULL;
+    }
+    if (NULL == line)
+    {
+        return NULL;
+    }
+
+    int count = lexLine(line, &toks, &cap);
+    if (count < 0)
+    {
+        free(toks);
+        return NULL;
+    }
+
+    char ** args = malloc((count + 1) * sizeof(char*) + count * sizeof(int));
+    if (NULL != args)
+    {
+        int * argTypes = (int *)(args + count + 1);
+        for (i = 0; i < count; i++)
+        {
+            args[i] = (char *)toks[i].str;
+            argTypes[i] = toks[i].type;
+        }
+        args[count] = NULL;
+        *wordCount = count;
+        if (NULL != types)
+        {
+            *types = argTypes;
+        }
+    }
+
+    free(toks);
+    return args;
+}
@@ -0,0 +1,48 @@
+/************************************************************************//**
+ *  @file lexer.h
+ *
+ *  @brief In place command line tokenizer.
+ ***************************************************************************/
+
+#ifndef LEXER_H
+#define LEXER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Token types.
+#define LEX_WORD 0
+#define LEX_OP   1                  // | < > & (( ))
+
+// Errors returned by lexLine.
+#define LEX_ERR_QUOTE  -1           // Unterminated quote.
+#define LEX_ERR_MEMORY -2
+
+/*!
+ * \brief One token of a command line. Words point into the line (with
+ *        quotes and escapes removed); operators point to static strings.
+ *        Both are NUL terminated.
+ */
+struct lexToken
+{
+    const char * str;
+    int len;
+    int type;                       // LEX_WORD or LEX_OP.
+};
+
+// Tokenize a line in place. The token array grows as needed and can be
+// reused between calls. Returns the number of tokens or a LEX_ERR code.
+int lexLine (char * line, struct lexToken ** toks, int * cap);
+
+// Tokenize a line in place into a NULL terminated argument array (free the
+// array only, the words live in line). If types is not NULL it returns the
+// LEX_WORD/LEX_OP type of each argument, stored in the same allocation.
+// Returns NULL on a syntax error.
+char ** lexArgs (char * line, int * wordCount, const int ** types);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,283 @@
+/************************************************************************//**
+ *  @file lzcompress.c
+ *
+ *  @brief LZ4 style block compression used for mailbox payloads.
+ *
+ *  The format follows the LZ4 block format: a sequence of tokens, each
+ *  holding a literal length (high nibble) and a match length minus four
+ *  (low nibble), with 255-byte extension bytes for long runs, followed by
+ *  the literals and a 16 bit little endian match offset. The final
+ *  sequence has literals only.
+ ***************************************************************************/
+
+#include "lzcompress.h"
+#include <string.h>
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_LAST_LITERALS 5      // The last bytes are always literals.
+#define LZ_MATCH_LIMIT 12       // No match may start this close to the end.
+
+/*!
+ * \brief Read four unaligned bytes.
+ * \param p - Address.
+ * \return Value.
+ */
+static unsigned int read32(const unsigned char * p)
+{
+    unsigned int v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/*!
+ * \brief Hash table slot for four bytes of input.
+ * \param v - Four input bytes.
+ * \return Slot index.
+ */
+static unsigned int hash32(unsigned int v)
+{
+    return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/*!
+ * \brief Write a length extension (the part of a length above 14).
+ * \param op - Output position, advanced past the extension.
+ * \param end - End of the output buffer.
+ * \param len - Remaining length (already reduced by 15).
+ * \return Error code. 0 on success.
+ */
+static int putLength(unsigned char ** op, unsigned char * end, int len)
+{
+    while (len >= 255)
+    {
+        if (*op >= end)
+        {
+            return -1;
+        }
+        *(*op)++ = 255;
+        len -= 255;
+    }
+    if (*op >= end)
+    {
+        return -1;
+    }
+    *(*op)++ = (unsigned char)len;
+    return 0;
+}
+
+/*!
+ * \brief Emit one sequence: literals, then an optional match.
+ * \param op - Output position, advanced past the sequence.
+ * \param end - End of the output buffer.
+ * \param lit - Literal bytes.
+ * \param litLen - Number of literal bytes.
+ * \param offset - Match offset (ignored without a match).
+ * \param matchLen - Match length, 0 for the final literals-only sequence.
+ * \return Error code. 0 on success.
+ */
+static int putSequence(unsigned char ** op, unsigned char * end,
+                       const unsigned char * lit, int litLen,
+                       int offset, int matchLen)
+{
+    if (*op >= end)
+    {
+        return -1;
+    }
+
+    unsigned char * token = (*op)++;
+    int ml = matchLen - LZ_MIN_MATCH;
+
+    *token = (unsigned char)(((litLen < 15) ? litLen : 15) << 4);
+    if (litLen >= 15 && 0 != putLength(op, end, litLen - 15))
+    {
+        return -1;
+    }
+
+    if (end - *op < litLen)
+    {
+        return -1;
+    }
+    memcpy(*op, lit, litLen);
+    *op += litLen;
+
+    if (0 == matchLen)
+    {
+        return 0;
+    }
+
+    if (end - *op < 2)
+    {
+        return -1;
+    }
+    *(*op)++ = (unsigned char)(offset & 0xff);
+    *(*op)++ = (unsigned char)(offset >> 8);
+
+    *token |= (unsigned char)((ml < 15) ? ml : 15);
+    if (ml >= 15 && 0 != putLength(op, end, ml - 15))
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*!
+ * \brief Compress a block of data.
+ * \param src - Input.
+ * \param srcLen - Input length.
+ * \param dst - Output buffer.
+ * \param dstCap - Size of the output buffer.
+ * \return Compressed size. -1 if the output does not fit in dstCap.
+ */
+int lzCompress (const void * src, int srcLen, void * dst, int dstCap)
+{
+    const unsigned char * in = src;
+    unsigned char * op = dst;
+    unsigned char * end = op + dstCap;
+    int table[1 << LZ_HASH_BITS];
+    int ip = 0;
+    int anchor = 0;
+
+    memset(table, -1, sizeof(table));
+
+    while (ip < srcLen - LZ_MATCH_LIMIT)
+    {
+        unsigned int v = read32(in + ip);
+        unsigned int h = hash32(v);
+        int ref = table[h];
+        table[h] = ip;
+
+        if (ref < 0 || ip - ref > LZ_MAX_OFFSET || read32(in + ref) != v)
+        {
+            ip++;
+            continue;
+        }
+
+        // Extend the match as far as the last literals allow.
+        int len = LZ_MIN_MATCH;
+        while (ip + len < srcLen - LZ_LAST_LITERALS && in[ref + len] == in[ip + len])
+        {
+            len++;
+        }
+
+        if (0 != putSequence(&op, end, in + anchor, ip - anchor, ip - ref, len))
+        {
+            return -1;
+        }
+
+        ip += len;
+        anchor = ip;
+    }
+
+    if (0 != putSequence(&op, end, in + anchor, srcLen - anchor, 0, 0))
+    {
+        return -1;
+    }
+
+    return (int)(op - (unsigned char*)dst);
+}
+
+/*!
+ * \brief Read a length extension.
+ * \param in - Input.
+ * \param ip - Input position, advanced past the extension.
+ * \param srcLen - Input length.
+ * \param len - Length to add the extension to.
+ * \return Error code. 0 on success.
+ */
+static int getLength(const unsigned char * in, int * ip, int srcLen, int * len)
+{
+    unsigned char b;
+    do
+    {
+        if (*ip >= srcLen)
+        {
+            return -1;
+        }
+        b = in[(*ip)++];
+        *len += b;
+    } while (255 == b);
+
+    return 0;
+}
+
+/*!
+ * \brief Decompress a block of data. Output beyond dstCap is dropped, so
+ *        a prefix of a message can be decoded into a short buffer.
+ * \param src - Compressed input.
+ * \param srcLen - Input length.
+ * \param dst - Output buffer.
+ * \param dstCap - Size of the output buffer.
+ * \return Decompressed size (at most dstCap). -1 on malformed input.
+ */
+int lzDecompress (const void * src, int srcLen, void * dst, int dstCap)
+{
+    const unsigned char * in = src;
+    unsigned char * out = dst;
+    int ip = 0;
+    int op = 0;
+
+    while (ip < srcLen)
+    {
+        int token = in[ip++];
+
+        // Literals.
+        int lit = token >> 4;
+        if (15 == lit && 0 != getLength(in, &ip, srcLen, &lit))
+        {
+            return -1;
+        }
+        if (lit > srcLen - ip)
+        {
+            return -1;
+        }
+        if (lit > dstCap - op)
+        {
+            memcpy(out + op, in + ip, dstCap - op);
+            return dstCap;
+        }
+        memcpy(out + op, in + ip, lit);
+        ip += lit;
+        op += lit;
+
+        // The final sequence has no match.
+        if (ip == srcLen)
+        {
+            break;
+        }
+
+        // Match.
+        if (srcLen - ip < 2)
+        {
+            return -1;
+        }
+        int offset = in[ip] | (in[ip + 1] << 8);
+        ip += 2;
+        if (0 == offset || offset > op)
+        {
+            return -1;
+        }
+
+        int len = token & 15;
+        if (15 == len && 0 != getLength(in, &ip, srcLen, &len))
+        {
+            return -1;
+        }
+        len += LZ_MIN_MATCH;
+
+        // Byte by byte: the match may overlap its own output.
+        int i;
+        for (i = 0; i < len && op < dstCap; i++, op++)
+        {
+            out[op] = out[op - offset];
+        }
+        if (op == dstCap && i < len)
+        {
+            return dstCap;
+        }
+    }
+
+    return op;
+}
@@ -0,0 +1,28 @@
+/************************************************************************//**
+ *  @file lzcompress.h
+ *
+ *  @brief LZ4 style block compression used for mailbox payloads.
+ ***************************************************************************/
+
+#ifndef LZCOMPRESS_H
+#define LZCOMPRESS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Largest compressed size of n input bytes.
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+// Compress a block. Returns the compressed size, or -1 if it does not fit.
+int lzCompress (const void * src, int srcLen, void * dst, int dstCap);
+
+// Decompress a block. Returns the decompressed size (at most dstCap), or
+// -1 if the input is malformed.
+int lzDecompress (const void * src, int srcLen, void * dst, int dstCap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,459 @@
+/************************************************************************//**
+ *  @file mboxbench.c
+ *
+ *  @brief Mailbox throughput and latency benchmark.
+ *
+ *  Spawns N reader and M writer processes against a fresh set of mailboxes
+ *  and measures every operation. For each message size (64 B to 1 MB by
+ *  default) and read path (reader/writer lock or seqlock) one CSV row per
+ *  role is printed:
+ *
+ *      mode,size_bytes,payload,compress,readers,writers,boxes,role,ops,
+ *      ops_per_sec,p50_ns,p99_ns,p999_ns,max_ns
+ *
+ *  Messages are one repeated byte ("text", highly compressible) or random
+ *  bytes ("random", incompressible). With -z writers ask for compressed
+ *  storage (MBOX_WRITE_COMPRESS).
+ *
+ *  Usage: mboxbench [-r readers] [-w writers] [-b boxes] [-t seconds]
+ *                   [-m rwlock|seqlock|both] [-s size_bytes]
+ *                   [-p text|random] [-z]
+ ***************************************************************************/
+
+#include "prog3.h"
+#include "helperfunctions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define K 1024
+
+// Latency histogram: 16 linear sub-buckets per power of two (about 6%
+// resolution) covering the full range of a 64 bit nanosecond count.
+#define SUB_BITS 4
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define HIST_BUCKETS (64 * SUB_BUCKETS)
+
+#define ROLE_READER 0
+#define ROLE_WRITER 1
+
+#define PAYLOAD_TEXT   0
+#define PAYLOAD_RANDOM 1
+
+static const char * PAYLOAD_NAMES[] = { "text", "random" };
+
+/*!
+ * \brief Results reported by one benchmark process.
+ */
+struct procResult
+{
+    long ops;
+    unsigned long long max;
+    unsigned long long hist[HIST_BUCKETS];
+};
+
+/*!
+ * \brief State shared between the benchmark driver and its children.
+ */
+struct benchShared
+{
+    volatile int start;
+    struct procResult results[1];   // One per child (allocated larger).
+};
+
+// Message sizes used when -s is not given.
+static const int DEFAULT_SIZES[] =
+{
+    64, 256, 1*K, 4*K, 16*K, 64*K, 256*K, 1024*K
+};
+
+/*!
+ * \brief Current monotonic time in nanoseconds.
+ * \return Nanoseconds.
+ */
+static unsigned long long nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*!
+ * \brief Histogram bucket for a latency.
+ * \param ns - Latency in nanoseconds.
+ * \return Bucket index.
+ */
+static int bucketOf(unsigned long long ns)
+{
+    if (ns < SUB_BUCKETS)
+    {
+        return (int)ns;
+    }
+
+    int exp = 63 - __builtin_clzll(ns);
+    int sub = (ns >> (exp - SUB_BITS)) & (SUB_BUCKETS - 1);
+
+    return (exp - SUB_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+/*!
+ * \brief Smallest latency that falls in a histogram bucket.
+ * \param bucket - Bucket index.
+ * \return Nanoseconds.
+ */
+static unsigned long long bucketValue(int bucket)
+{
+    if (bucket < SUB_BUCKETS)
+    {
+        return bucket;
+    }
+
+    int exp = bucket / SUB_BUCKETS + SUB_BITS - 1;
+    int sub = bucket % SUB_BUCKETS;
+
+    return (unsigned long long)(SUB_BUCKETS + sub) << (exp - SUB_BITS);
+}
+
+/*!
+ * \brief Latency at a given percentile of a histogram.
+ * \param res - Merged results.
+ * \param pct - Percentile (0-100).
+ * \return Nanoseconds.
+ */
+static unsigned long long percentile(struct procResult * res, double pct)
+{
+    unsigned long long target = (unsigned long long)(res->ops * pct / 100.0 + 0.5);
+    unsigned long long seen = 0;
+    int i;
+
+    if (target < 1)
+    {
+        target = 1;
+    }
+
+    for (i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += res->hist[i];
+        if (seen >= target)
+        {
+            return bucketValue(i);
+        }
+    }
+
+    return res->max;
+}
+
+/*!
+ * \brief Fill a message buffer with the chosen payload.
+ * \param buf - Buffer to fill.
+ * \param len - Size of buf.
+ * \param payload - PAYLOAD_TEXT or PAYLOAD_RANDOM.
+ * \param seed - Seed for random payloads.
+ */
+static void fillPayload(char * buf, int len, int payload, unsigned int seed)
+{
+    int i;
+
+    if (PAYLOAD_TEXT == payload)
+    {
+        memset(buf, 'x', len);
+        return;
+    }
+
+    for (i = 0; i < len; i++)
+    {
+        buf[i] = (char)rand_r(&seed);
+    }
+}
+
+/*!
+ * \brief Body of a reader or writer process. Waits for the start flag,
+ *        then runs operations until the deadline and records latencies.
+ * \param shared - Shared benchmark state.
+ * \param res - This process's result slot.
+ * \param shmid - Shared memory ID.
+ * \param role - ROLE_READER or ROLE_WRITER.
+ * \param box - Mailbox to use.
+ * \param msgSize - Message size in bytes.
+ * \param optimistic - Non-zero to read through the seqlock.
+ * \param payload - PAYLOAD_TEXT or PAYLOAD_RANDOM.
+ * \param writeFlags - Flags for writeMailboxData().
+ * \param seconds - Length of the run.
+ */
+static void runChild(struct benchShared * shared, struct procResult * res,
+                     int shmid, int role, int box, int msgSize, int optimistic,
+                     int payload, int writeFlags, int seconds)
+{
+    char * buf = malloc(msgSize);
+    fillPayload(buf, msgSize, payload, getpid());
+
+    while (!shared->start)
+    {
+        usleep(100);
+    }
+
+    unsigned long long end = nowNs() + seconds * 1000000000ULL;
+    unsigned long long t0 = nowNs();
+
+    while (t0 < end)
+    {
+        if (ROLE_WRITER == role)
+        {
+            writeMailboxData(shmid, box, buf, msgSize, writeFlags);
+        }
+        else
+        {
+            readMailboxInto(shmid, box, buf, msgSize, optimistic, NULL);
+        }
+
+        unsigned long long t1 = nowNs();
+        unsigned long long ns = t1 - t0;
+
+        res->hist[bucketOf(ns)]++;
+        if (ns > res->max)
+        {
+            res->max = ns;
+        }
+        res->ops++;
+
+        t0 = t1;
+    }
+
+    free(buf);
+}
+
+/*!
+ * \brief Print one CSV row with the merged results of a role.
+ */
+static void printRow(const char * mode, int msgSize, int payload, int writeFlags,
+                     int readers, int writers, int boxes, const char * role,
+                     struct procResult * res, int seconds)
+{
+    printf("%s,%d,%s,%s,%d,%d,%d,%s,%ld,%.0f,%llu,%llu,%llu,%llu\n",
+           mode, msgSize, PAYLOAD_NAMES[payload],
+           (writeFlags & MBOX_WRITE_COMPRESS) ? "yes" : "no",
+           readers, writers, boxes, role, res->ops,
+           (double)res->ops / seconds,
+           percentile(res, 50.0), percentile(res, 99.0),
+           percentile(res, 99.9), res->max);
+    fflush(stdout);
+}
+
+/*!
+ * \brief Run one benchmark configuration and print its results.
+ * \return Error code. 0 on success.
+ */
+static int runPass(int readers, int writers, int boxes, int msgSize,
+                   int optimistic, int payload, int writeFlags, int seconds)
+{
+    int procs = readers + writers;
+    int i, j;
+
+    // Boxes are sized in KB; round the message size up. A private key
+    // keeps the benchmark clear of a running shell's mailboxes.
+    int shmid = createPrivateMailboxes(boxes, (msgSize + K - 1) / K);
+    if (shmid < 0)
+    {
+        return -1;
+    }
+
+    size_t sharedLen = sizeof(struct benchShared) + sizeof(struct procResult) * procs;
+    struct benchShared * shared = mmap(NULL, sharedLen, PROT_READ | PROT_WRITE,
+                                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == shared)
+    {
+        deleteMailboxes(shmid);
+        return -1;
+    }
+
+    // Give readers something to read.
+    char * init = malloc(msgSize);
+    fillPayload(init, msgSize, payload, 1);
+    for (i = 0; i < boxes; i++)
+    {
+        writeMailboxData(shmid, i, init, msgSize, writeFlags);
+    }
+    free(init);
+
+    for (i = 0; i < procs; i++)
+    {
+        if (0 == fork())
+        {
+            int role = (i < writers) ? ROLE_WRITER : ROLE_READER;
+            runChild(shared, &shared->results[i], shmid, role, i % boxes,
+                     msgSize, optimistic, payload, writeFlags, seconds);
+            exit(0);
+        }
+    }
+
+    shared->start = 1;
+
+    for (i = 0; i < procs; i++)
+    {
+        wait(NULL);
+    }
+
+    // Merge per-process results by role.
+    struct procResult * merged = calloc(2, sizeof(struct procResult));
+    for (i = 0; i < procs; i++)
+    {
+        struct procResult * dst = &merged[(i < writers) ? ROLE_WRITER : ROLE_READER];
+        struct procResult * src = &shared->results[i];
+
+        dst->ops += src->ops;
+        if (src->max > dst->max)
+        {
+            dst->max = src->max;
+        }
+        for (j = 0; j < HIST_BUCKETS; j++)
+        {
+            dst->hist[j] += src->hist[j];
+        }
+    }
+
+    const char * mode = optimistic ? "seqlock" : "rwlock";
+    if (readers > 0)
+    {
+        printRow(mode, msgSize, payload, writeFlags, readers, writers, boxes, "read",
+                 &merged[ROLE_READER], seconds);
+    }
+    if (writers > 0)
+    {
+        printRow(mode, msgSize, payload, writeFlags, readers, writers, boxes, "write",
+                 &merged[ROLE_WRITER], seconds);
+    }
+
+    free(merged);
+    munmap(shared, sharedLen);
+    deleteMailboxes(shmid);
+
+    return 0;
+}
+
+/*!
+ * \brief Parse a non-negative integer option.
+ * \param str - Option value.
+ * \param name - Option name for the error message.
+ * \param val - Returns the value.
+ * \return Error code. 0 on success.
+ */
+static int parseCount(char * str, const char * name, int * val)
+{
+    int ok;
+    *val = strToInt(str, &ok);
+    if (0 != ok || *val < 0)
+    {
+        fprintf(stderr, "Invalid %s: %s\n", name, str);
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * \brief Benchmark entry point.
+ * \return Status.
+ */
+int main(int argc, char ** argv)
+{
+    int readers = 4;
+    int writers = 1;
+    int boxes = 1;
+    int seconds = 2;
+    int size = 0;
+    int modes = 3;      // bit 0: rwlock, bit 1: seqlock
+    int payload = PAYLOAD_TEXT;
+    int writeFlags = 0;
+    int opt;
+    unsigned int i;
+    int m;
+
+    while (-1 != (opt = getopt(argc, argv, "r:w:b:t:m:s:p:z")))
+    {
+        switch (opt)
+        {
+        case 'r':
+            if (0 != parseCount(optarg, "reader count", &readers)) return 1;
+            break;
+        case 'w':
+            if (0 != parseCount(optarg, "writer count", &writers)) return 1;
+            break;
+        case 'b':
+            if (0 != parseCount(optarg, "box count", &boxes)) return 1;
+            break;
+        case 't':
+            if (0 != parseCount(optarg, "run length", &seconds)) return 1;
+            break;
+        case 's':
+            if (0 != parseCount(optarg, "message size", &size)) return 1;
+            break;
+        case 'm':
+            if (0 == strcmp(optarg, "rwlock")) modes = 1;
+            else if (0 == strcmp(optarg, "seqlock")) modes = 2;
+            else if (0 == strcmp(optarg, "both")) modes = 3;
+            else
+            {
+                fprintf(stderr, "Invalid mode: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'p':
+            if (0 == strcmp(optarg, "text")) payload = PAYLOAD_TEXT;
+            else if (0 == strcmp(optarg, "random")) payload = PAYLOAD_RANDOM;
+            else
+            {
+                fprintf(stderr, "Invalid payload: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'z':
+            writeFlags |= MBOX_WRITE_COMPRESS;
+            break;
+        default:
+            fprintf(stderr, "Usage: mboxbench [-r readers] [-w writers] [-b boxes] "
+                            "[-t seconds] [-m rwlock|seqlock|both] [-s size_bytes] "
+                            "[-p text|random] [-z]\n");
+            return 1;
+        }
+    }
+
+    if (boxes < 1 || seconds < 1 || readers + writers < 1)
+    {
+        fprintf(stderr, "Need at least one box, one second and one process.\n");
+        return 1;
+    }
+
+    printf("mode,size_bytes,payload,compress,readers,writers,boxes,role,ops,"
+           "ops_per_sec,p50_ns,p99_ns,p999_ns,max_ns\n");
+    fflush(stdout);
+
+    for (m = 0; m < 2; m++)
+    {
+        if (0 == (modes & (1 << m)))
+        {
+            continue;
+        }
+
+        for (i = 0; i < sizeof(DEFAULT_SIZES) / sizeof(int); i++)
+        {
+            int msgSize = size > 0 ? size : DEFAULT_SIZES[i];
+
+            if (0 != runPass(readers, writers, boxes, msgSize, m, payload, writeFlags, seconds))
+            {
+                return 1;
+            }
+
+            if (size > 0)
+            {
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,297 @@
+/************************************************************************//**
+ *  @file output.c
+ *
+ *  @brief Buffered standard output for the shell's commands.
+ *
+ *  Commands print many short lines. Rather than leaving them to stdio,
+ *  which writes every line on a terminal and every few kilobytes on a
+ *  pipe or socket, everything printed while a command runs is collected
+ *  here and written with one writev() when the shell flushes at the end of
+ *  the command (or of an event handler).
+ *
+ *  The buffer is a set of fixed size chunks that are allocated once and
+ *  reused, so growing it never copies. Each chunk becomes one iovec. When
+ *  every chunk is full the buffer is flushed early, which bounds memory
+ *  use for commands with very large output. Writes larger than a chunk
+ *  are not copied at all; they go out in the same writev() as the buffer.
+ *
+ *  The buffer is flushed before fork(), so children don't inherit and
+ *  repeat unwritten output, and at exit().
+ ***************************************************************************/
+
+#include "output.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+static char * _chunks[OUT_MAX_CHUNKS];
+static int _chunkLen[OUT_MAX_CHUNKS];
+static int _current = 0;                // Chunk being filled.
+static int _registered = 0;
+
+// Commands print only from the main thread, but the mailbox server
+// thread may print too.
+static pthread_mutex_t _outLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*!
+ * \brief Write the buffered chunks and an optional extra block with one
+ *        writev(), finishing partial writes. Empties the buffer.
+ * \param extra - Bytes to write after the buffer (may be NULL).
+ * \param extraLen - Length of extra.
+ * \return Error code. 0 on success.
+ */
+static int flushLocked(const void * extra, size_t extraLen)
+{
+    struct iovec iov[OUT_MAX_CHUNKS + 1];
+    int n = 0;
+    int first = 0;
+    int i;
+
+    for (i = 0; i <= _current; i++)
+    {
+        if (_chunkLen[i] > 0)
+        {
+            iov[n].iov_base = _chunks[i];
+            iov[n].iov_len = _chunkLen[i];
+            n++;
+        }
+        _chunkLen[i] = 0;
+    }
+    _current = 0;
+
+    if (extraLen > 0)
+    {
+        iov[n].iov_base = (void *)extra;
+        iov[n].iov_len = extraLen;
+        n++;
+    }
+
+    while (first < n)
+    {
+        ssize_t len = writev(STDOUT_FILENO, iov + first, n - first);
+        if (len < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            if (EAGAIN == errno || EWOULDBLOCK == errno)
+            {
+                // stdout was left non-blocking by someone else; wait.
+                struct pollfd pfd = { STDOUT_FILENO, POLLOUT, 0 };
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            return -1;
+        }
+
+        while (first < n && (size_t)len >= iov[first].iov_len)
+        {
+            len -= iov[first].iov_len;
+            first++;
+        }
+        if (first < n)
+        {
+            iov[first].iov_base = (char *)iov[first].iov_base + len;
+            iov[first].iov_len -= len;
+        }
+    }
+
+    return 0;
+}
+
+/*!
+ * \brief fork() handlers: flush and hold the lock across the fork, so the
+ *        child starts with an empty buffer and an unlocked mutex.
+ */
+static void forkPrepare()
+{
+    pthread_mutex_lock(&_outLock);
+    flushLocked(NULL, 0);
+}
+
+static void forkDone()
+{
+    pthread_mutex_unlock(&_outLock);
+}
+
+/*!
+ * \brief atexit() handler.
+ */
+static void exitFlush()
+{
+    outFlush();
+}
+
+/*!
+ * \brief Get room for at least len bytes, moving to the next chunk (or
+ *        flushing when there is none) if the current one is too full.
+ * \param len - Bytes needed (at most OUT_CHUNK_SIZE).
+ * \return Free space in the current chunk, or NULL if out of memory.
+ */
+static char * reserve(int len)
+{
+    if (OUT_CHUNK_SIZE - _chunkLen[_current] < len)
+    {
+        if (OUT_MAX_CHUNKS - 1 == _current)
+        {
+            flushLocked(NULL, 0);
+        }
+        else
+        {
+            _current++;
+        }
+    }
+
+    if (NULL == _chunks[_current])
+    {
+        _chunks[_current] = malloc(OUT_CHUNK_SIZE);
+        if (NULL == _chunks[_current])
+        {
+            return NULL;
+        }
+
+        if (!_registered)
+        {
+            pthread_atfork(forkPrepare, forkDone, forkDone);
+            atexit(exitFlush);
+            _registered = 1;
+        }
+    }
+
+    return _chunks[_current] + _chunkLen[_current];
+}
+
+/*!
+ * \brief Append bytes to the buffer, or write them directly (together with
+ *        the buffer) if they are larger than a chunk.
+ * \param data - Bytes to append.
+ * \param len - Number of bytes.
+ * \return Error code. 0 on success.
+ */
+static int writeLocked(const char * data, size_t len)
+{
+    if (len >= OUT_CHUNK_SIZE)
+    {
+        return flushLocked(data, len);
+    }
+
+    while (len > 0)
+    {
+        char * dst = reserve(1);
+        if (NULL == dst)
+        {
+            return -1;
+        }
+
+        size_t n = OUT_CHUNK_SIZE - _chunkLen[_current];
+        if (n > len)
+        {
+            n = len;
+        }
+        memcpy(dst, data, n);
+        _chunkLen[_current] += n;
+        data += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/*!
+ * \brief printf() into the output buffer. Text is formatted straight into
+ *        the current chunk when it fits.
+ * \param fmt - printf() format.
+ * \return Number of characters printed, or -1 if out of memory.
+ */
+int outPrintf (const char * fmt, ...)
+{
+    va_list ap, again;
+    int n;
+
+    pthread_mutex_lock(&_outLock);
+
+    char * dst = reserve(1);
+    if (NULL == dst)
+    {
+        pthread_mutex_unlock(&_outLock);
+        return -1;
+    }
+
+    va_start(ap, fmt);
+    va_copy(again, ap);
+    n = vsnprintf(dst, OUT_CHUNK_SIZE - _chunkLen[_current], fmt, ap);
+    va_end(ap);
+
+    if (n >= OUT_CHUNK_SIZE - _chunkLen[_current])
+    {
+        if (n < OUT_CHUNK_SIZE)
+        {
+            // Didn't fit in what was left of this chunk; use a fresh one.
+            dst = reserve(n + 1);
+            if (NULL == dst)
+            {
+                n = -1;
+            }
+            else
+            {
+                vsnprintf(dst, n + 1, fmt, again);
+                _chunkLen[_current] += n;
+            }
+        }
+        else
+        {
+            char * big = malloc(n + 1);
+            if (NULL == big)
+            {
+                n = -1;
+            }
+            else
+            {
+                vsnprintf(big, n + 1, fmt, again);
+                writeLocked(big, n);
+                free(big);
+            }
+        }
+    }
+    else if (n > 0)
+    {
+        _chunkLen[_current] += n;
+    }
+
+    va_end(again);
+    pthread_mutex_unlock(&_outLock);
+    return n;
+}
+
+/*!
+ * \brief Append bytes to the output buffer.
+ * \param data - Bytes to append.
+ * \param len - Number of bytes.
+ * \return Error code. 0 on success.
+ */
+int outWrite (const void * data, size_t len)
+{
+    pthread_mutex_lock(&_outLock);
+    int ret = writeLocked(data, len);
+    pthread_mutex_unlock(&_outLock);
+    return ret;
+}
+
+/*!
+ * \brief Write everything buffered to stdout with one writev().
+ * \return Error code. 0 on success; on failure the output is dropped.
+ */
+int outFlush ()
+{
+    pthread_mutex_lock(&_outLock);
+    int ret = flushLocked(NULL, 0);
+    pthread_mutex_unlock(&_outLock);
+    return ret;
+}
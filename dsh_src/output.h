@@ -0,0 +1,36 @@
+/************************************************************************//**
+ *  @file output.h
+ *
+ *  @brief Buffered standard output for the shell's commands.
+ ***************************************************************************/
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Output is collected in chunks of this size, which are kept between
+// commands. When all of them are full they are written out.
+#define OUT_CHUNK_SIZE  16384
+#define OUT_MAX_CHUNKS  8
+
+// Formats text into the output buffer. Returns the number of characters,
+// or -1 if out of memory.
+int outPrintf (const char * fmt, ...) __attribute__((format(printf, 1, 2)));
+
+// Appends bytes to the output buffer.
+int outWrite (const void * data, size_t len);
+
+// Writes everything buffered to stdout with a single writev(). Returns 0,
+// or -1 if stdout could not be written (the output is dropped).
+int outFlush ();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,386 @@
+/************************************************************************//**
+ *  @file procparse.c
+ *
+ *  @brief Parsers for /proc/<pid>/stat, statm, status and io, and for
+ *         /proc/stat and /proc/meminfo.
+ *
+ *  Numbers are converted eight digits at a time (SWAR): eight bytes are
+ *  loaded into one 64 bit word, the length of the leading run of digits
+ *  is found with a few mask operations, and the digits are combined with
+ *  three multiplies. Fields the caller did not ask for are skipped with
+ *  memchr() and never converted, and parsing stops after the last
+ *  requested field.
+ ***************************************************************************/
+
+#include "procparse.h"
+#include <string.h>
+
+#define ONES  0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
+const char * const PROC_STATUS_KEYS[PSTATUS_NUM_KEYS] =
+{
+    "PPid:", "Uid:", "Threads:", "VmSize:", "VmRSS:",
+    "voluntary_ctxt_switches:", "nonvoluntary_ctxt_switches:"
+};
+
+const char * const MEMINFO_KEYS[MEMINFO_NUM_KEYS] =
+{
+    "MemTotal:", "MemFree:", "MemAvailable:", "Buffers:", "Cached:"
+};
+
+const char * const PROC_IO_KEYS[PIO_NUM_KEYS] =
+{
+    "read_bytes:", "write_bytes:"
+};
+
+// Powers of ten for combining eight digit chunks.
+static const unsigned long long POW10[9] =
+{
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL
+};
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+/*!
+ * \brief Number of leading decimal digits in eight bytes of text.
+ * \param v - Eight bytes, first character in the low byte.
+ * \return 0 to 8.
+ */
+static int digitRun(unsigned long long v)
+{
+    // A byte is a digit if its high nibble is 3 and adding 6 keeps it 3.
+    // Adding 6 can only carry out of a byte that is not a digit, so the
+    // run before the first non-digit is never disturbed.
+    unsigned long long bad = ((v & (0xF0 * ONES)) ^ (0x30 * ONES)) |
+                             (((v + 0x06 * ONES) & (0xF0 * ONES)) ^ (0x30 * ONES));
+
+    // High bit of every non-zero byte, without carries between bytes.
+    bad = (((bad & (0x7F * ONES)) + 0x7F * ONES) | bad) & HIGHS;
+
+    return bad ? __builtin_ctzll(bad) >> 3 : 8;
+}
+
+/*!
+ * \brief Value of the first n digits of eight bytes of text.
+ * \param v - Eight bytes, first character in the low byte.
+ * \param n - Number of digits (1 to 8).
+ * \return Value.
+ */
+static unsigned long long digitValue(unsigned long long v, int n)
+{
+    // Move the digits to the top; the zero bytes below act as leading
+    // zeros. Then combine pairs of digits, pairs of pairs and so on.
+    v <<= 8 * (8 - n);
+    v = ((v & (0x0F * ONES)) * 2561) >> 8;
+    v = ((v & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+    return ((v & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32;
+}
+#endif
+
+/*!
+ * \brief Parse a decimal number, optionally negative, after any spaces or
+ *        tabs. Anything that is not a digit ends it.
+ * \param p - Text position, advanced past the number.
+ * \param end - End of the text.
+ * \return Value (two's complement if negative). 0 if there are no digits.
+ */
+unsigned long long procParseNumber (const char ** p, const char * end)
+{
+    const char * s = *p;
+    unsigned long long value = 0;
+    int neg = 0;
+
+    while (s < end && (' ' == *s || '\t' == *s))
+    {
+        s++;
+    }
+    if (s < end && '-' == *s)
+    {
+        neg = 1;
+        s++;
+    }
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (end - s >= 8)
+    {
+        unsigned long long v;
+        memcpy(&v, s, sizeof(v));
+
+        int n = digitRun(v);
+        if (n > 0)
+        {
+            value = value * POW10[n] + digitValue(v, n);
+            s += n;
+        }
+        if (n < 8)
+        {
+            *p = s;
+            return neg ? -value : value;
+        }
+    }
+#endif
+
+    // Short tail of the text.
+    while (s < end && *s >= '0' && *s <= '9')
+    {
+        value = value * 10 + (*s - '0');
+        s++;
+    }
+
+    *p = s;
+    return neg ? -value : value;
+}
+
+/*!
+ * \brief Parse /proc/<pid>/stat. The command name is in parentheses and may
+ *        itself contain spaces and parentheses, so it runs to the last ')'
+ *        and the numeric fields are counted from there.
+ * \param buf - File contents.
+ * \param len - Length of the contents.
+ * \param mask - PSTAT() bits of the numeric fields wanted.
+ * \param stat - Returns pid, comm, state and the requested fields.
+ * \return Error code. 0 on success, -1 if the text is malformed or a
+ *         requested field is missing.
+ */
+int procParseStat (const char * buf, int len, unsigned long long mask,
+                   struct procStat * stat)
+{
+    const char * end = buf + len;
+    const char * open = memchr(buf, '(', len);
+    const char * close = NULL;
+    const char * p;
+    int field;
+
+    for (p = end; p > buf && NULL == close; p--)
+    {
+        if (')' == p[-1])
+        {
+            close = p - 1;
+        }
+    }
+
+    if (NULL == open || NULL == close || close < open || end - close < 3 ||
+        ' ' != close[1])
+    {
+        return -1;
+    }
+
+    p = buf;
+    stat->pid = (int)procParseNumber(&p, open);
+
+    int commLen = close - open - 1;
+    if (commLen >= PROC_COMM_LEN)
+    {
+        commLen = PROC_COMM_LEN - 1;
+    }
+    memcpy(stat->comm, open + 1, commLen);
+    stat->comm[commLen] = '\0';
+    stat->state = close[2];
+
+    // Fields 4 onwards, up to the last one requested.
+    mask &= (PSTAT(PSTAT_MAX_FIELD) << 1) - PSTAT(4);
+    if (0 == mask)
+    {
+        return 0;
+    }
+    int last = 63 - __builtin_clzll(mask);
+
+    p = close + 3;
+    for (field = 4; field <= last; field++)
+    {
+        if (p >= end || ' ' != *p)
+        {
+            return -1;
+        }
+        p++;
+
+        if (mask & PSTAT(field))
+        {
+            stat->field[field] = procParseNumber(&p, end);
+        }
+        else
+        {
+            p = memchr(p, ' ', end - p);
+            if (NULL == p)
+            {
+                p = end;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*!
+ * \brief Parse /proc/<pid>/statm.
+ * \param buf - File contents.
+ * \param len - Length of the contents.
+ * \param mask - 1 << PSTATM_* for each field wanted.
+ * \param values - Returns the fields, indexed by PSTATM_* (pages).
+ * \return Error code. 0 on success, -1 if a requested field is missing.
+ */
+int procParseStatm (const char * buf, int len, unsigned int mask,
+                    unsigned long long * values)
+{
+    const char * p = buf;
+    const char * end = buf + len;
+    int i;
+
+    for (i = 0; i < PSTATM_FIELDS && 0 != (mask >> i); i++)
+    {
+        if (p >= end)
+        {
+            return -1;
+        }
+
+        if (mask & (1U << i))
+        {
+            values[i] = procParseNumber(&p, end);
+        }
+        else
+        {
+            p = memchr(p, ' ', end - p);
+            if (NULL == p)
+            {
+                p = end;
+            }
+        }
+        p++;
+    }
+
+    return 0;
+}
+
+/*!
+ * \brief Find which requested key, if any, a line starts with.
+ * \param line - Start of the line.
+ * \param end - End of the text.
+ * \param keys - Keys, including their separator ("MemFree:", "ctxt ").
+ * \param numKeys - Number of keys.
+ * \param mask - Keys still wanted.
+ * \param index - Returns the key's index.
+ * \return Text after the key, or NULL if the line matches none.
+ */
+static const char * matchKey(const char * line, const char * end,
+                             const char * const * keys, int numKeys,
+                             unsigned int mask, int * index)
+{
+    int i;
+
+    for (i = 0; i < numKeys; i++)
+    {
+        if (mask & (1U << i) && keys[i][0] == line[0])
+        {
+            size_t keyLen = strlen(keys[i]);
+            if ((size_t)(end - line) >= keyLen && 0 == memcmp(line, keys[i], keyLen))
+            {
+                *index = i;
+                return line + keyLen;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/*!
+ * \brief Parse a file of "key: value" lines (/proc/<pid>/status,
+ *        /proc/meminfo, /proc/<pid>/io). Stops once every requested key has
+ *        been found.
+ * \param buf - File contents.
+ * \param len - Length of the contents.
+ * \param keys - Keys, including their separator (e.g. MEMINFO_KEYS).
+ * \param numKeys - Number of keys (at most 32).
+ * \param mask - 1 << i for each key wanted.
+ * \param values - Returns the first number after each key found.
+ * \return Mask of the requested keys that were found.
+ */
+unsigned int procParseKeys (const char * buf, int len, const char * const * keys,
+                            int numKeys, unsigned int mask,
+                            unsigned long long * values)
+{
+    const char * line = buf;
+    const char * end = buf + len;
+    unsigned int found = 0;
+    int i;
+
+    while (line < end && found != mask)
+    {
+        const char * p = matchKey(line, end, keys, numKeys, mask & ~found, &i);
+        if (NULL != p)
+        {
+            values[i] = procParseNumber(&p, end);
+            found |= 1U << i;
+        }
+
+        line = memchr(line, '\n', end - line);
+        if (NULL == line)
+        {
+            break;
+        }
+        line++;
+    }
+
+    return found;
+}
+
+/*!
+ * \brief Parse /proc/stat. The long per-CPU and interrupt lines are
+ *        skipped without being parsed.
+ * \param buf - File contents.
+ * \param len - Length of the contents.
+ * \param mask - SSTAT_* bits of the lines wanted.
+ * \param stat - Returns the requested lines.
+ * \return Mask of the requested lines that were found.
+ */
+unsigned int procParseSysStat (const char * buf, int len, unsigned int mask,
+                               struct sysStat * stat)
+{
+    // In SSTAT_* bit order.
+    static const char * const keys[] =
+    {
+        "cpu ", "ctxt ", "btime ", "processes ", "procs_running ", "procs_blocked "
+    };
+    unsigned long long * values[] =
+    {
+        NULL, &stat->ctxt, &stat->btime, &stat->processes, &stat->running,
+        &stat->blocked
+    };
+    const char * line = buf;
+    const char * end = buf + len;
+    unsigned int found = 0;
+    int i, j;
+
+    memset(stat, 0, sizeof(struct sysStat));
+
+    while (line < end && found != mask)
+    {
+        const char * p = matchKey(line, end, keys, 6, mask & ~found, &i);
+        if (NULL != p)
+        {
+            if (0 == i)
+            {
+                // Older kernels have fewer columns; stop at the newline.
+                for (j = 0; j < SSTAT_CPU_FIELDS && p < end && '\n' != *p; j++)
+                {
+                    stat->cpu[j] = procParseNumber(&p, end);
+                }
+            }
+            else
+            {
+                *values[i] = procParseNumber(&p, end);
+            }
+            found |= 1U << i;
+        }
+
+        line = memchr(line, '\n', end - line);
+        if (NULL == line)
+        {
+            break;
+        }
+        line++;
+    }
+
+    return found;
+}
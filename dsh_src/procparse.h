@@ -0,0 +1,146 @@
+/************************************************************************//**
+ *  @file procparse.h
+ *
+ *  @brief Parsers for /proc/<pid>/stat, statm, status and io, and for
+ *         /proc/stat and /proc/meminfo.
+ *
+ *  Each parser takes a mask naming the fields the caller wants. Callers
+ *  pass compile time constants (see PROC_INFO_FIELDS in prog1.h), and only
+ *  those fields are converted; the rest are skipped over.
+ ***************************************************************************/
+
+#ifndef PROCPARSE_H
+#define PROCPARSE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Longest command name kept for a process (kernel threads can use up to 64).
+#define PROC_COMM_LEN 64
+
+// ----------------- /proc/<pid>/stat --------------
+// Field numbers as in proc(5). Fields 1-3 (pid, comm, state) are always
+// parsed; numeric fields are selected with PSTAT(field).
+#define PSTAT_PPID        4
+#define PSTAT_PGRP        5
+#define PSTAT_SESSION     6
+#define PSTAT_MINFLT      10
+#define PSTAT_MAJFLT      12
+#define PSTAT_UTIME       14
+#define PSTAT_STIME       15
+#define PSTAT_PRIORITY    18
+#define PSTAT_NICE        19
+#define PSTAT_THREADS     20
+#define PSTAT_STARTTIME   22
+#define PSTAT_VSIZE       23
+#define PSTAT_RSS         24
+#define PSTAT_PROCESSOR   39
+#define PSTAT_MAX_FIELD   52
+
+#define PSTAT(field) (1ULL << (field))
+
+/*!
+ * \brief Fields of /proc/<pid>/stat. Only the fields named in the mask
+ *        given to procParseStat() are set. Negative fields (priority,
+ *        nice) are stored two's complement.
+ */
+struct procStat
+{
+    int pid;
+    char state;
+    char comm[PROC_COMM_LEN];
+    unsigned long long field[PSTAT_MAX_FIELD + 1];  // Indexed by field number.
+};
+
+// ----------------- /proc/<pid>/statm --------------
+// Fields (in pages), selected with 1 << field.
+#define PSTATM_SIZE       0
+#define PSTATM_RESIDENT   1
+#define PSTATM_SHARED     2
+#define PSTATM_TEXT       3
+#define PSTATM_DATA       5
+#define PSTATM_FIELDS     7
+
+// ----------------- key: value files --------------
+// Keys of /proc/<pid>/status (indexes into PROC_STATUS_KEYS).
+#define PSTATUS_PPID      0
+#define PSTATUS_UID       1       // Real UID (first of four).
+#define PSTATUS_THREADS   2
+#define PSTATUS_VMSIZE    3       // kB
+#define PSTATUS_VMRSS     4       // kB
+#define PSTATUS_VCTXT     5       // Voluntary context switches.
+#define PSTATUS_NVCTXT    6       // Involuntary context switches.
+#define PSTATUS_NUM_KEYS  7
+
+// Keys of /proc/meminfo (indexes into MEMINFO_KEYS), all in kB.
+#define MEMINFO_TOTAL     0
+#define MEMINFO_FREE      1
+#define MEMINFO_AVAILABLE 2
+#define MEMINFO_BUFFERS   3
+#define MEMINFO_CACHED    4
+#define MEMINFO_NUM_KEYS  5
+
+// Keys of /proc/<pid>/io (indexes into PROC_IO_KEYS).
+#define PIO_READ_BYTES    0
+#define PIO_WRITE_BYTES   1
+#define PIO_NUM_KEYS      2
+
+extern const char * const PROC_STATUS_KEYS[PSTATUS_NUM_KEYS];
+extern const char * const MEMINFO_KEYS[MEMINFO_NUM_KEYS];
+extern const char * const PROC_IO_KEYS[PIO_NUM_KEYS];
+
+// ----------------- /proc/stat --------------
+// Lines of /proc/stat, selected with these bits.
+#define SSTAT_CPU         0x01    // Aggregate "cpu" line.
+#define SSTAT_CTXT        0x02
+#define SSTAT_BTIME       0x04
+#define SSTAT_PROCESSES   0x08
+#define SSTAT_RUNNING     0x10
+#define SSTAT_BLOCKED     0x20
+
+// Columns of the cpu line (user nice system idle iowait irq softirq steal
+// guest guest_nice), in clock ticks.
+#define SSTAT_CPU_FIELDS  10
+
+/*!
+ * \brief Selected lines of /proc/stat. Lines not in the mask, or missing
+ *        from the file, are left zero.
+ */
+struct sysStat
+{
+    unsigned long long cpu[SSTAT_CPU_FIELDS];
+    unsigned long long ctxt;            // Context switches since boot.
+    unsigned long long btime;           // Boot time, seconds since the epoch.
+    unsigned long long processes;       // Processes created since boot.
+    unsigned long long running;         // Runnable tasks.
+    unsigned long long blocked;         // Tasks blocked on I/O.
+};
+
+// Parse a decimal number (optionally negative) after any spaces. Advances
+// *p past it.
+unsigned long long procParseNumber (const char ** p, const char * end);
+
+// Parse /proc/<pid>/stat. Returns 0, or -1 if the text is malformed.
+int procParseStat (const char * buf, int len, unsigned long long mask,
+                   struct procStat * stat);
+
+// Parse /proc/<pid>/statm into values (indexed by PSTATM_*).
+int procParseStatm (const char * buf, int len, unsigned int mask,
+                    unsigned long long * values);
+
+// Parse a "key: value" file. values is indexed like keys. Returns the mask
+// of the requested keys that were found.
+unsigned int procParseKeys (const char * buf, int len, const char * const * keys,
+                            int numKeys, unsigned int mask,
+                            unsigned long long * values);
+
+// Parse /proc/stat. Returns the mask of the requested lines that were found.
+unsigned int procParseSysStat (const char * buf, int len, unsigned int mask,
+                               struct sysStat * stat);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -6,7 +6,45 @@
 
 #include "prog1.h"
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <limits.h>
+#include <math.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <pthread.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
 #include "helperfunctions.h"
+#include "prog2.h"
+#include "prog3.h"
+#include "uring.h"
+#include "lexer.h"
+#include "output.h"
+#include "eventloop.h"
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Determines if a signal reports a fault in dsh itself. These can't be
+ * deferred to the event loop, since the faulting instruction would just run
+ * again.
+ *
+ * @param[in] sig - Signal number.
+ *
+ * @return 1 for fault signals, 0 otherwise.
+ ******************************************************************************/
+static int isFaultSignal(int sig)
+{
+    return SIGILL == sig || SIGTRAP == sig || SIGABRT == sig ||
+           SIGBUS == sig || SIGFPE == sig || SIGSEGV == sig;
+}
 
 
 /***************************************************************************//**
@@ -15,14 +53,48 @@
  * @par Description:
  * Registers signals to be caught. The range of
  * signals is given by MIN_SIG -> MAX_SIG in prog1.h
+ *
+ * Fault signals go to handleSignal. The rest (and SIGCHLD) are blocked and
+ * delivered through the returned signalfd, so the event loop handles them
+ * in the main thread with no restrictions on what it may call. Children get
+ * the default handling back after fork.
+ *
+ * @return signalfd for handleSignalEvent, -1 on failure.
  ******************************************************************************/
-void startCatchSignals()
+int startCatchSignals()
 {
+    static int registered = 0;
+    struct sigaction sa;
+    sigset_t mask;
     unsigned int i;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handleSignal;
+    sigemptyset(&sa.sa_mask);
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+
     for (i = MIN_SIG; i < MAX_SIG; i++)
     {
-        signal(i,handleSignal);
+        if (isFaultSignal(i))
+        {
+            sigaction(i, &sa, NULL);
+        }
+        else if (i > 0 && SIGKILL != i && SIGSTOP != i)
+        {
+            sigaddset(&mask, i);
+        }
+    }
+
+    if (!registered)
+    {
+        pthread_atfork(NULL, NULL, stopCatchSignals);
+        registered = 1;
     }
+
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    return signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
 }
 
 
@@ -30,15 +102,21 @@ void startCatchSignals()
  * @author Joe Lillo
  *
  * @par Description: Registers signals to default signal handling function.
+ * Also unblocks them (the signal mask survives exec).
  ******************************************************************************/
 void stopCatchSignals()
 {
+    sigset_t mask;
     unsigned int i;
+
     for (i = MIN_SIG; i < MAX_SIG; i++)
     {
         // Default signal handling.
         signal(i,SIG_DFL);
     }
+
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
 }
 
 
@@ -46,100 +124,118 @@ void stopCatchSignals()
  * @author Joe Lillo
  *
  * @par Description:
- * Callback function for handling signals.
- * Simply prints the signal number that was caught.
+ * Callback function for fault signals. Prints the signal number that was
+ * caught and exits. Only async-signal-safe calls are made: the number is
+ * formatted by hand and written with write().
  *
  * @param[in] sig - Signal number to handle.
  ******************************************************************************/
 void handleSignal(int sig)
 {
-    printf("[SIGNAL] dsh recieved signal: %d.\n", sig);
+    static const char prefix[] = "[SIGNAL] dsh recieved signal: ";
+    char msg[sizeof(prefix) + 16];
+    char digits[12];
+    int len = sizeof(prefix) - 1;
+    int n = 0;
 
-    // Exit with these signals.
-    if (11 == sig || 2 == sig)
+    memcpy(msg, prefix, len);
+    do
+    {
+        digits[n++] = '0' + sig % 10;
+        sig /= 10;
+    } while (sig > 0);
+    while (n > 0)
     {
-        exit(1);
+        msg[len++] = digits[--n];
     }
+    msg[len++] = '.';
+    msg[len++] = '\n';
+
+    write(STDERR_FILENO, msg, len);
+    _exit(1);
 }
 
 
 /***************************************************************************//**
- * @author Joe Lillo
- *
  * @par Description:
- * Displays name and command line information for a
- * given PID.
+ * Event loop handler for the signalfd from startCatchSignals. Reaps finished
+ * children on SIGCHLD and prints any other signal that was caught. SIGINT
+ * exits the shell (after deleting its shared memory).
  *
- * @param[in] argc - Number of arguments in argv
- * @param[in] argv - argv[1] -- PID to display information for.
+ * @param[in] fd - signalfd.
+ * @param[in] events - Not used.
+ * @param[in] arg - Not used.
  ******************************************************************************/
-void cmdnm (int argc, char ** argv)
+void handleSignalEvent(int fd, unsigned int events, void * arg)
 {
-    if (argc < 2 || NULL == argv[1])
+    struct signalfd_siginfo info;
+
+    while (sizeof(info) == read(fd, &info, sizeof(info)))
     {
-        return;
-    }
+        if (SIGCHLD == info.ssi_signo)
+        {
+            reapChildren();
+            continue;
+        }
 
-    // Get process name and command line string that started it.
-    // char * name = getProcName(argv[1]);
-    char * cmdline = getProcCmdline(argv[1]);
+        outPrintf("[SIGNAL] dsh recieved signal: %d.\n", info.ssi_signo);
 
-    // Error checking
-    if (NULL == cmdline)
-    {
-        printf("Cannot find pid: %s\n",argv[1]);
-    }
-    else
-    {
-        // Print process information to stdio
-        //printf(name);
-        //free(name);
-        printf("%s\n", cmdline);
-        free(cmdline);
+        // Exit with this signal.
+        if (SIGINT == info.ssi_signo)
+        {
+            onExit();
+            exit(1);
+        }
     }
 
+    outFlush();
 }
 
+
 /***************************************************************************//**
- * @author Joe Lillo
- *
  * @par Description:
- * Sends a signal to a given PID via the kill function.
+ * Reads PIDs from stdin, whitespace separated, until end of input or an
+ * empty line.
  *
- * @param[in] argc - Number of arguments in argv
- * @param[in] argv - argv[1] is the signal to send to the PID in argv[2].
+ * @param[out] count - Number of PIDs read.
+ *
+ * @return Array of PID strings (free each, then the array).
  ******************************************************************************/
-void sendKill(int argc, char ** argv)
+static char ** readPidList(int * count)
 {
-    // Error checking
-    if (argc < 3 || NULL == argv[1] || NULL == argv[2])
-    {
-        printf("Unable to send signal.\n");
-        return;
-    }
-
-    // Get signal and process numbers from argv[1] and argv[2]
-    int sigOk, pidOk = -1;
-    int sig = strToInt(argv[1], &sigOk);
-    int pid = strToInt(argv[2], &pidOk);
+    char ** pids = NULL;
+    int cap = 0;
+    char * line;
+    int i;
 
-    if(0 != sigOk || 0 != pidOk)
+    *count = 0;
+    while (NULL != (line = getInput()))
     {
-        printf("Unable to send signal %s to process %s.\n", argv[1], argv[2]);
-        return;
-    }
+        int words;
+        char ** args;
 
-    // Send signal to process.
-    int ret = kill(pid,sig);
+        args = lexArgs(line, &words, NULL);
+        if (0 == words)
+        {
+            free(args);
+            free(line);
+            break;
+        }
 
-    if (0 == ret)
-    {
-        printf("Signal %s sent to process %s.\n", argv[1], argv[2]);
-    }
-    else
-    {
-        printf("Unable to send signal %s to process %s\n.", argv[1], argv[2]);
+        for (i = 0; i < words; i++)
+        {
+            if (*count == cap)
+            {
+                cap = cap ? cap * 2 : 64;
+                pids = realloc(pids, cap * sizeof(char*));
+            }
+            pids[(*count)++] = strdup(args[i]);
+        }
+        free(args);
+        free(line);
     }
+
+    return pids;
 }
 
 
@@ -147,137 +243,280 @@ void sendKill(int argc, char ** argv)
  * @author Joe Lillo
  *
  * @par Description:
- * Display system information.
+ * Displays the command lines of one or more processes, in the order the
+ * PIDs were given. "cmdnm -" reads the PIDs from stdin. All of the
+ * /proc/[pid]/cmdline files are read in one batch (see readProcFiles()).
+ *
+ * @param[in] argc - Number of arguments in argv
+ * @param[in] argv - argv[1..] -- PIDs to display information for, or "-".
  ******************************************************************************/
-void systat()
+void cmdnm (int argc, char ** argv)
 {
-
-    // ----------------- Version Information --------------
-
-    FILE * fin = fopen("/proc/version","r");
-    char in[100];
-
-    if(!fin)
+    if (argc < 2 || NULL == argv[1])
     {
         return;
     }
 
-    fgets(in,100,fin);
-    char * end = strchr(in,'(');
-    *end = '\0';
-    printf("%s\n",in);
-    fclose(fin);
-
-    // ----------------- System Uptime --------------
-    fin = fopen("/proc/uptime","r");
-    char time[100];
+    char ** pids = argv + 1;
+    char ** owned = NULL;
+    int count = argc - 1;
+    int ok;
+    int i, j;
 
-    if(!fin)
+    if (0 == strcmp(argv[1], "-"))
     {
-        return;
+        owned = readPidList(&count);
+        pids = owned;
     }
 
-    fgets(time,100,fin);
-    end = strchr(time,' ');
-    *end = '\0';
-    printf("Uptime: %s seconds\n",time);
-    fclose(fin);
+    char ** paths = malloc((count + 1) * sizeof(char*));
+    char * pathBuf = malloc((count + 1) * 32);
+    char * bufs = malloc((size_t)(count + 1) * CMDLINE_LEN);
+    int * lens = malloc((count + 1) * sizeof(int));
 
-    // ----------------- Memory Information --------------
-    fin = fopen("/proc/meminfo","r");
+    if (NULL == paths || NULL == pathBuf || NULL == bufs || NULL == lens)
+    {
+        outPrintf("Out of memory.\n");
+        count = 0;
+    }
 
-    if(!fin)
+    // Anything that is not a PID gets an empty path, which fails to open.
+    for (i = 0; i < count; i++)
     {
-        return;
+        int pid = strToInt(pids[i], &ok);
+        paths[i] = pathBuf + i * 32;
+        paths[i][0] = '\0';
+        if (0 == ok && pid > 0)
+        {
+            snprintf(paths[i], 32, "/proc/%d/cmdline", pid);
+        }
     }
 
-    fgets(in,100,fin);
-    printf("%s",in);
-    fgets(in,100,fin);
-    printf("%s",in);
+    readProcFiles(paths, count, bufs, CMDLINE_LEN, lens);
 
-    fclose(fin);
+    for (i = 0; i < count; i++)
+    {
+        char * cmdline = bufs + (size_t)i * CMDLINE_LEN;
 
-    // ----------------- CPU Information --------------
-    fin = fopen("/proc/cpuinfo","r");
+        if (lens[i] < 0)
+        {
+            outPrintf("Cannot find pid: %s\n", pids[i]);
+            continue;
+        }
 
-    if(!fin)
-    {
-        return;
+        // Arguments are separated by \0; show them separated by spaces.
+        for (j = 0; j < lens[i]; j++)
+        {
+            if ('\0' == cmdline[j])
+            {
+                cmdline[j] = ' ';
+            }
+        }
+
+        if (1 == count)
+        {
+            outPrintf("%s\n", cmdline);
+        }
+        else
+        {
+            outPrintf("%s: %s\n", pids[i], cmdline);
+        }
     }
 
-    unsigned int i = 0;
-    for (i=0; i < 9; i++)
+    if (NULL != owned)
     {
-        fgets(in,100,fin);
-        printf("%s",in);
+        for (i = 0; i < count; i++)
+        {
+            free(owned[i]);
+        }
+        free(owned);
     }
-    printf("\n");
-
-    fclose(fin);
+    free(paths);
+    free(pathBuf);
+    free(bufs);
+    free(lens);
 }
 
 
 /***************************************************************************//**
- * @author Joe Lillo
- *
  * @par Description:
- * Searches through running processes in an attempt
- * to match the given search string to a substring
- * of the name of a process.
- * Prints all of the PIDs that return a positive
- * result.
+ * Reads one small file with open, read and close.
  *
- * @param[in] argc - Number of arguments in argv
- * @param[in] argv - String to represent name of process.
+ * @param[in] path - File to read.
+ * @param[out] buf - Buffer for the contents.
+ * @param[in] size - Size of buf.
+ *
+ * @return Number of bytes read, or -errno.
  ******************************************************************************/
-void getPID(int argc, char ** argv)
+static int readFileSync(const char * path, char * buf, int size)
 {
-    // Error checking.
-    if (argc < 2 || argv[1] == NULL)
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
     {
-        return;
+        return -errno;
     }
 
-    // Open /proc directory.
-    DIR * proc = opendir("/proc");
-
-    if (NULL == proc)
+    int len = read(fd, buf, size);
+    if (len < 0)
     {
-        return;
+        len = -errno;
     }
+    close(fd);
 
-    // Read /proc directory.
-    struct dirent * entry = readdir(proc);
-    char * procName;
+    return len;
+}
 
-    int ok;
 
-    // Keep reading /proc directory looking for directories with numbers
-    // as names. Open [dir]/status to obtain process name. If the given
-    // search string is a substring of that process name, print the PID
-    // to std out.
-    do
+/***************************************************************************//**
+ * @par Description:
+ * Reads the start of each of a list of small files (such as
+ * /proc/[pid]/cmdline). With io_uring, each batch of up to PROC_BATCH
+ * files is one submission: every file gets an openat() into a fixed file
+ * slot, linked to a read() from that slot, so a whole batch costs one
+ * system call. Without io_uring, or on kernels older than 5.15 that lack
+ * direct opens, the files are read one at a time.
+ *
+ * @param[in] paths - Files to read.
+ * @param[in] count - Number of files.
+ * @param[out] bufs - count buffers of bufSize bytes, one per file. Each is
+ *                    null terminated.
+ * @param[in] bufSize - Size of each buffer.
+ * @param[out] lens - Bytes read per file, or -errno.
+ ******************************************************************************/
+void readProcFiles(char ** paths, int count, char * bufs, int bufSize, int * lens)
+{
+    struct uring ring;
+    int batch = (count < PROC_BATCH) ? count : PROC_BATCH;
+    int useRing = 0;
+    int dropRing = 0;
+    int start, i;
+
+    // A single file is not worth setting up a ring for.
+    if (count > 1 && uringHasDirectOpen() && 0 == uringInit(&ring, 2 * batch))
     {
-        if(DT_DIR == entry->d_type)
+        useRing = 1;
+        if (0 != uringRegisterFiles(&ring, batch))
         {
-            strToInt(entry->d_name,&ok);
-            if (0 == ok)
+            uringFree(&ring);
+            useRing = 0;
+        }
+    }
+
+    for (start = 0; start < count; start += batch)
+    {
+        int n = (count - start < batch) ? count - start : batch;
+
+        for (i = start; i < start + n; i++)
+        {
+            lens[i] = 0;
+        }
+
+        if (useRing)
+        {
+            for (i = 0; i < n; i++)
             {
-                procName = getProcName(entry->d_name);
-                if (NULL != procName)
+                struct io_uring_sqe * sqe = uringGetSqe(&ring);
+                sqe->opcode = IORING_OP_OPENAT;
+                sqe->fd = AT_FDCWD;
+                sqe->addr = (unsigned long)paths[start + i];
+                sqe->open_flags = O_RDONLY;
+                sqe->file_index = i + 1;
+                sqe->flags = IOSQE_IO_LINK;
+                sqe->user_data = (unsigned long long)(start + i) << 1;
+
+                sqe = uringGetSqe(&ring);
+                sqe->opcode = IORING_OP_READ;
+                sqe->fd = i;
+                sqe->flags = IOSQE_FIXED_FILE;
+                sqe->addr = (unsigned long)(bufs + (size_t)(start + i) * bufSize);
+                sqe->len = bufSize - 1;
+                sqe->off = 0;
+                sqe->user_data = ((unsigned long long)(start + i) << 1) | 1;
+            }
+
+            if (uringSubmit(&ring, 2 * n) < 0)
+            {
+                uringFree(&ring);
+                useRing = 0;
+            }
+            else
+            {
+                int seen = 0;
+                while (seen < 2 * n)
+                {
+                    struct io_uring_cqe * cqe = uringPeekCqe(&ring);
+                    if (NULL == cqe)
+                    {
+                        uringSubmit(&ring, 1);
+                        continue;
+                    }
+
+                    int index = cqe->user_data >> 1;
+                    if (cqe->user_data & 1)
+                    {
+                        // A failed open cancels its read; keep the open error.
+                        if (-ECANCELED != cqe->res || lens[index] >= 0)
+                        {
+                            lens[index] = cqe->res;
+                        }
+                    }
+                    else if (cqe->res > 0)
+                    {
+                        // The kernel ignored file_index and opened an
+                        // ordinary descriptor; the read then fails on the
+                        // empty slot.
+                        close(cqe->res);
+                        lens[index] = -EBADF;
+                    }
+                    else if (cqe->res < 0)
+                    {
+                        lens[index] = cqe->res;
+                    }
+
+                    uringCqeSeen(&ring);
+                    seen++;
+                }
+
+                // Kernels without direct opens either reject them or
+                // ignore the slot; read those files the ordinary way, and
+                // stop using the ring for later batches.
+                for (i = start; i < start + n; i++)
                 {
-                    if (NULL != strstr(procName, argv[1]))
+                    if (-EINVAL == lens[i] || -EBADF == lens[i])
                     {
-                        printf("%s\n",entry->d_name);
+                        lens[i] = readFileSync(paths[i], bufs + (size_t)i * bufSize, bufSize - 1);
+                        dropRing = 1;
                     }
-                    free(procName);
                 }
             }
         }
-    }while((entry=readdir(proc)));
 
-    closedir(proc);
+        if (!useRing)
+        {
+            for (i = start; i < start + n; i++)
+            {
+                lens[i] = readFileSync(paths[i], bufs + (size_t)i * bufSize, bufSize - 1);
+            }
+        }
+        else if (dropRing)
+        {
+            uringFree(&ring);
+            useRing = 0;
+        }
+
+        for (i = start; i < start + n; i++)
+        {
+            if (lens[i] >= 0)
+            {
+                bufs[(size_t)i * bufSize + lens[i]] = '\0';
+            }
+        }
+    }
+
+    if (useRing)
+    {
+        uringFree(&ring);
+    }
 }
 
 
@@ -285,42 +524,76 @@ void getPID(int argc, char ** argv)
  * @author Joe Lillo
  *
  * @par Description:
- * Returns the name of a process given by PID parameter.
+ * Sends a signal to a given PID via the kill function.
+ * "signal <sig> --match <pattern> [--wait [seconds]]" signals every process
+ * whose name contains pattern instead (see signalMatching()).
  *
- * @param[in] pid - String representation of PID.
+ * @param[in] argc - Number of arguments in argv
+ * @param[in] argv - argv[1] is the signal to send to the PID in argv[2].
  ******************************************************************************/
-char * getProcName(char * pid)
+void sendKill(int argc, char ** argv)
 {
-    // Create filename string.
-    char * fname = malloc (strlen(pid) + sizeof(char)*15);
-    memcpy(fname,"/proc/",6);
-
-    char * temp = fname + 6;
-    memcpy(temp,pid,strlen(pid));
+    // Error checking
+    if (argc < 3 || NULL == argv[1] || NULL == argv[2])
+    {
+        outPrintf("Unable to send signal.\n");
+        return;
+    }
 
-    temp = temp + strlen(pid);
-    memcpy(temp,"/status\0",7);
+    if (0 == strcmp(argv[2], "--match"))
+    {
+        int sigOk;
+        int wait = 0;
+        double timeout = 0;
+        int sig = strToInt(argv[1], &sigOk);
 
-    fname[13+strlen(pid)] = '\0';
+        if (argc > 4 && 0 == strcmp(argv[4], "--wait"))
+        {
+            wait = 1;
+            if (argc > 5)
+            {
+                char * end;
+                timeout = strtod(argv[5], &end);
+                sigOk = ('\0' != *end || timeout < 0) ? -1 : sigOk;
+            }
+        }
+        else if (argc > 4)
+        {
+            sigOk = -1;
+        }
 
-    // Open status file.
-    FILE * fin = fopen(fname,"r");
+        if (argc < 4 || 0 != sigOk || sig < 0)
+        {
+            outPrintf("Usage: signal <sig> --match <pattern> [--wait [seconds]]\n");
+            return;
+        }
 
-    if (NULL == fin)
-    {
-        printf("%d\n",errno);
-        return NULL;
+        signalMatching(sig, argv[3], wait, timeout);
+        return;
     }
 
-    char * name = malloc(sizeof(char)*100);
+    // Get signal and process numbers from argv[1] and argv[2]
+    int sigOk, pidOk = -1;
+    int sig = strToInt(argv[1], &sigOk);
+    int pid = strToInt(argv[2], &pidOk);
 
-    // Read and return first line of file.
-    fgets(name,100,fin);
+    if(0 != sigOk || 0 != pidOk)
+    {
+        outPrintf("Unable to send signal %s to process %s.\n", argv[1], argv[2]);
+        return;
+    }
 
-    fclose(fin);
-    free(fname);
+    // Send signal to process.
+    int ret = kill(pid,sig);
 
-    return name;
+    if (0 == ret)
+    {
+        outPrintf("Signal %s sent to process %s.\n", argv[1], argv[2]);
+    }
+    else
+    {
+        outPrintf("Unable to send signal %s to process %s\n.", argv[1], argv[2]);
+    }
 }
 
 
@@ -328,73 +601,2737 @@ char * getProcName(char * pid)
  * @author Joe Lillo
  *
  * @par Description:
- * Returns the command line string that started the given process.
+ * Display system information. Static information (kernel version, CPU
+ * model) is read once; memory and CPU figures come from a sampler that
+ * keeps its /proc files open, and are shown together with how they changed
+ * since the previous systat (or, the first time, CPU use since boot).
+ *
+ * "systat --watch [seconds] [count]" samples continuously instead; see
+ * systatWatch().
  *
- * @param[in] pid - String representation of process ID.
- * @return Command line string that started pid.
+ * @param[in] argc - Number of arguments in argv
+ * @param[in] argv - Optional "--watch", interval and sample count.
  ******************************************************************************/
-char * getProcCmdline(char * pid)
+void systat(int argc, char ** argv)
 {
-    // Create file name string.
-    char * fname = malloc (strlen(pid) + sizeof(char)*16);
-    memcpy(fname,"/proc/",6);
-
-    char * temp = fname + 6;
-    memcpy(temp,pid,strlen(pid));
-
-    temp = temp + strlen(pid);
-    memcpy(temp,"/cmdline\0",8);
-
-    fname[14+strlen(pid)] = '\0';
-
-    // Open cmdline file
-    FILE * fin;
-    fin = fopen(fname,"r");
+    static struct sysSampler sampler;
+    static struct sysSample prev;
+    static int haveSampler = 0;
+    static char version[100];
+    static char cpuinfo[9][100];
+    struct sysSample cur;
+    unsigned int i;
 
-    if (NULL == fin)
+    if (argc > 1 && 0 == strcmp(argv[1], "--watch"))
     {
-        return NULL;
-    }
-
-    // Allocate memory and set all 300 characters to \0.
-    char * cmdline = malloc(sizeof(char)*300);
-    memset(cmdline,'\0',300);
-
-    // Read first line of file.
-    fgets(cmdline,300,fin);
+        double interval = 1.0;
+        int count = 0;
+        int ok = 0;
+        int countOk = 0;
 
-    char* i = cmdline;
-    int wasNull = 0;
-    int done = 0;
-
-    // Iterate through string, swapping \0 characters with spaces until
-    // the end of the string.
-    do
-    {
-        if('\0' == *i)
+        if (argc > 2)
         {
-            // If two \0 characters occur in a row exit the loop.
-            if(wasNull)
+            char * end;
+            interval = strtod(argv[2], &end);
+            if (end == argv[2] || '\0' != *end || !isfinite(interval) ||
+                interval < SYSTAT_MIN_INTERVAL || interval > SYSTAT_MAX_INTERVAL)
             {
-                done = 1;
+                ok = -1;
             }
-            else
+        }
+        if (argc > 3)
+        {
+            count = strToInt(argv[3], &countOk);
+            if (0 != countOk || count < 0)
             {
-                wasNull = 1;
-                *i = ' ';
+                ok = -1;
             }
         }
-        else
+        if (0 != ok)
         {
-            wasNull = 0;
+            outPrintf("Usage: systat --watch [seconds] [count]\n");
+            return;
         }
-        i += 1;
-    }while(!done);
 
-    fclose(fin);
-    free(fname);
+        systatWatch(interval, count);
+        return;
+    }
+
+    if (!haveSampler)
+    {
+        // ----------------- Version Information --------------
+        FILE * fin = fopen("/proc/version","r");
+        if(!fin)
+        {
+            return;
+        }
+        fgets(version,100,fin);
+        char * end = strchr(version,'(');
+        if (NULL != end)
+        {
+            *end = '\0';
+        }
+        fclose(fin);
 
-    return cmdline;
+        // ----------------- CPU Information --------------
+        fin = fopen("/proc/cpuinfo","r");
+        if(!fin)
+        {
+            return;
+        }
+        for (i=0; i < 9; i++)
+        {
+            if (NULL == fgets(cpuinfo[i],100,fin))
+            {
+                cpuinfo[i][0] = '\0';
+            }
+        }
+        fclose(fin);
+
+        if (0 != openSampler(&sampler))
+        {
+            return;
+        }
+        haveSampler = 1;
+        memset(&prev, 0, sizeof(prev));
+    }
+
+    if (0 != takeSample(&sampler, &cur))
+    {
+        outPrintf("Unable to read system statistics.\n");
+        return;
+    }
+
+    outPrintf("%s\n",version);
+
+    // ----------------- System Uptime --------------
+    outPrintf("Uptime: %.2f seconds\n",cur.uptime);
+
+    // ----------------- Memory Information --------------
+    outPrintf("MemTotal:       %8llu kB\n", cur.memTotal);
+    outPrintf("MemFree:        %8llu kB\n", cur.memFree);
+    outPrintf("MemAvailable:   %8llu kB\n", cur.memAvailable);
+
+    // ----------------- Changes --------------
+    if (0 != prev.timeNs)
+    {
+        double secs = (cur.timeNs - prev.timeNs) / 1e9;
+        outPrintf("Since last systat (%.1f s): CPU %.1f%%, MemFree %+lld kB, "
+               "MemAvailable %+lld kB, %llu context switches, %llu new processes\n",
+               secs, cpuPercent(&prev, &cur),
+               (long long)(cur.memFree - prev.memFree),
+               (long long)(cur.memAvailable - prev.memAvailable),
+               cur.ctxt - prev.ctxt, cur.forks - prev.forks);
+    }
+    else
+    {
+        outPrintf("CPU since boot: %.1f%%\n", cpuPercent(&prev, &cur));
+    }
+    outPrintf("Load average: %.2f %.2f %.2f, %llu running\n",
+           cur.load[0], cur.load[1], cur.load[2], cur.running);
+
+    // ----------------- CPU Information --------------
+    for (i=0; i < 9; i++)
+    {
+        outPrintf("%s",cpuinfo[i]);
+    }
+    outPrintf("\n");
+
+    prev = cur;
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Samples the system every interval seconds, paced by a timerfd, and prints
+ * one line of rates per sample: CPU use, the change in available memory,
+ * context switches and forks per second, and the load average. Runs for
+ * count samples (0 for no limit) or, on a terminal, until Enter is pressed.
+ * The CPU time the watch itself used is reported when it stops.
+ *
+ * @param[in] interval - Seconds between samples (SYSTAT_MIN_INTERVAL to
+ *                       SYSTAT_MAX_INTERVAL).
+ * @param[in] count - Number of samples to print, 0 for no limit.
+ ******************************************************************************/
+void systatWatch(double interval, int count)
+{
+    struct sysSampler sampler;
+    struct sysSample prev, cur;
+    struct itimerspec its;
+    struct timespec cpu0, cpu1;
+    struct pollfd fds[3];
+    unsigned long long ticks;
+    int nfds = 2;
+    int printed = 0;
+
+    // A zero timer would never fire, and NaN or infinity can't be
+    // converted to a timespec.
+    if (!isfinite(interval) || interval < SYSTAT_MIN_INTERVAL ||
+        interval > SYSTAT_MAX_INTERVAL)
+    {
+        outPrintf("Interval must be between %.2f and %.0f s.\n",
+                  SYSTAT_MIN_INTERVAL, SYSTAT_MAX_INTERVAL);
+        return;
+    }
+
+    if (0 != openSampler(&sampler))
+    {
+        outPrintf("Unable to read system statistics.\n");
+        return;
+    }
+
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (tfd < 0)
+    {
+        outPrintf("Unable to create timer: %s\n", strerror(errno));
+        closeSampler(&sampler);
+        return;
+    }
+
+    its.it_interval.tv_sec = (time_t)interval;
+    its.it_interval.tv_nsec = (long)((interval - its.it_interval.tv_sec) * 1e9);
+    its.it_value = its.it_interval;
+    if (0 != timerfd_settime(tfd, 0, &its, NULL))
+    {
+        outPrintf("Unable to start timer: %s\n", strerror(errno));
+        close(tfd);
+        closeSampler(&sampler);
+        return;
+    }
+
+    fds[0].fd = tfd;
+    fds[0].events = POLLIN;
+
+    // Ctrl-C always stops the watch.
+    fds[1].fd = loopInterruptFd();
+    fds[1].events = POLLIN;
+
+    // Only a terminal can stop the watch; piped input is left for the shell.
+    if (isatty(STDIN_FILENO))
+    {
+        fds[2].fd = STDIN_FILENO;
+        fds[2].events = POLLIN;
+        nfds = 3;
+        outPrintf("Sampling every %.2f s, press Enter or Ctrl-C to stop.\n", interval);
+    }
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu0);
+    takeSample(&sampler, &prev);
+
+    outPrintf("%8s %6s %14s %12s %9s %17s %4s\n", "time(s)", "CPU%",
+           "MemAvail(kB)", "ctxt/s", "forks/s", "load 1/5/15", "run");
+    outFlush();
+
+    while (0 == count || printed < count)
+    {
+        if (poll(fds, nfds, -1) < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            break;
+        }
+
+        if ((fds[1].revents & POLLIN) && loopInterrupted())
+        {
+            outPrintf("Interrupted.\n");
+            break;
+        }
+
+        if (nfds > 2 && (fds[2].revents & POLLIN))
+        {
+            // Consume the line that stopped the watch.
+            free(getInput());
+            break;
+        }
+
+        if (!(fds[0].revents & POLLIN) ||
+            sizeof(ticks) != read(tfd, &ticks, sizeof(ticks)) ||
+            0 != takeSample(&sampler, &cur))
+        {
+            continue;
+        }
+
+        double secs = (cur.timeNs - prev.timeNs) / 1e9;
+        outPrintf("%8.1f %6.1f %+14lld %12.0f %9.1f %5.2f %5.2f %5.2f %4llu\n",
+               cur.uptime, cpuPercent(&prev, &cur),
+               (long long)(cur.memAvailable - prev.memAvailable),
+               (cur.ctxt - prev.ctxt) / secs, (cur.forks - prev.forks) / secs,
+               cur.load[0], cur.load[1], cur.load[2], cur.running);
+        outFlush();
+
+        prev = cur;
+        printed++;
+    }
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu1);
+
+    // Overhead: CPU time spent by the watch over the time it ran.
+    double used = (cpu1.tv_sec - cpu0.tv_sec) + (cpu1.tv_nsec - cpu0.tv_nsec) / 1e9;
+    double wall = printed * interval;
+    if (wall > 0)
+    {
+        outPrintf("Watch overhead: %.3f ms CPU in %.1f s (%.4f%% of a core)\n",
+               used * 1e3, wall, 100.0 * used / wall);
+    }
+
+    close(tfd);
+    closeSampler(&sampler);
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Opens the /proc files used to sample system counters. They stay open so
+ * each sample is a pread() per file rather than an open/read/close.
+ *
+ * @param[out] sampler - Sampler to initialize.
+ * @return int - 0 on success.
+ ******************************************************************************/
+int openSampler(struct sysSampler * sampler)
+{
+    sampler->statFd = open("/proc/stat", O_RDONLY | O_CLOEXEC);
+    sampler->memFd = open("/proc/meminfo", O_RDONLY | O_CLOEXEC);
+    sampler->uptimeFd = open("/proc/uptime", O_RDONLY | O_CLOEXEC);
+    sampler->loadFd = open("/proc/loadavg", O_RDONLY | O_CLOEXEC);
+    sampler->bufSize = SAMPLER_BUF_SIZE;
+    sampler->buf = malloc(sampler->bufSize);
+
+    if (sampler->statFd < 0 || sampler->memFd < 0 || sampler->uptimeFd < 0 ||
+            sampler->loadFd < 0 || NULL == sampler->buf)
+    {
+        closeSampler(sampler);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Closes the files and frees the buffer of a sampler.
+ *
+ * @param[in] sampler - Sampler to close.
+ ******************************************************************************/
+void closeSampler(struct sysSampler * sampler)
+{
+    if (sampler->statFd >= 0) close(sampler->statFd);
+    if (sampler->memFd >= 0) close(sampler->memFd);
+    if (sampler->uptimeFd >= 0) close(sampler->uptimeFd);
+    if (sampler->loadFd >= 0) close(sampler->loadFd);
+    free(sampler->buf);
+
+    sampler->statFd = sampler->memFd = sampler->uptimeFd = sampler->loadFd = -1;
+    sampler->buf = NULL;
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Re-reads an open /proc file from the start into the sampler's buffer,
+ * growing the buffer if the file does not fit. The contents are null
+ * terminated.
+ *
+ * @param[in] sampler - Sampler owning the buffer.
+ * @param[in] fd - Open /proc file.
+ * @return long - Number of bytes read. -1 on error.
+ ******************************************************************************/
+static long readProcFile(struct sysSampler * sampler, int fd)
+{
+    size_t len = 0;
+
+    while (1)
+    {
+        ssize_t n = pread(fd, sampler->buf + len, sampler->bufSize - len - 1, len);
+        if (n < 0)
+        {
+            return -1;
+        }
+        if (0 == n)
+        {
+            break;
+        }
+        len += n;
+
+        // Full buffer: grow it (once per size) and keep reading.
+        if (len == sampler->bufSize - 1)
+        {
+            char * bigger = realloc(sampler->buf, sampler->bufSize * 2);
+            if (NULL == bigger)
+            {
+                return -1;
+            }
+            sampler->buf = bigger;
+            sampler->bufSize *= 2;
+        }
+    }
+
+    sampler->buf[len] = '\0';
+    return len;
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Parses a non-negative decimal number with an optional fraction
+ * ("12345.67"), skipping leading spaces.
+ *
+ * @param[in] p - Text to parse.
+ * @param[out] value - Parsed number.
+ * @return const char* - First character after the number.
+ ******************************************************************************/
+static const char * scanDecimal(const char * p, double * value)
+{
+    unsigned long long whole, frac = 0;
+    double scale = 1.0;
+
+    whole = procParseNumber(&p, p + strlen(p));
+    if ('.' == *p)
+    {
+        p++;
+        while (*p >= '0' && *p <= '9')
+        {
+            frac = frac * 10 + (*p - '0');
+            scale *= 10.0;
+            p++;
+        }
+    }
+
+    *value = whole + frac / scale;
+    return p;
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Reads the current system counters from /proc/stat, /proc/meminfo,
+ * /proc/uptime and /proc/loadavg.
+ *
+ * @param[in] sampler - Open sampler.
+ * @param[out] sample - Counters read.
+ * @return int - 0 on success.
+ ******************************************************************************/
+int takeSample(struct sysSampler * sampler, struct sysSample * sample)
+{
+    struct timespec ts;
+    struct sysStat stat;
+    unsigned long long mem[MEMINFO_NUM_KEYS];
+    const char * p;
+    long len;
+    int i;
+
+    memset(sample, 0, sizeof(struct sysSample));
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    sample->timeNs = (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+    // ----------------- /proc/stat --------------
+    // cpu  user nice system idle iowait irq softirq steal guest guest_nice
+    // Guest time is already counted in user and nice.
+    len = readProcFile(sampler, sampler->statFd);
+    if (len < 0 || 0 == (SSTAT_CPU & procParseSysStat(sampler->buf, len, SAMPLE_SYSSTAT_LINES, &stat)))
+    {
+        return -1;
+    }
+    for (i = 0; i < 8; i++)
+    {
+        sample->cpuTotal += stat.cpu[i];
+    }
+    sample->cpuIdle = stat.cpu[3] + stat.cpu[4];
+    sample->ctxt = stat.ctxt;
+    sample->forks = stat.processes;
+    sample->running = stat.running;
+
+    // ----------------- /proc/meminfo --------------
+    len = readProcFile(sampler, sampler->memFd);
+    if (len < 0)
+    {
+        return -1;
+    }
+    memset(mem, 0, sizeof(mem));
+    procParseKeys(sampler->buf, len, MEMINFO_KEYS, MEMINFO_NUM_KEYS, SAMPLE_MEMINFO_KEYS, mem);
+    sample->memTotal = mem[MEMINFO_TOTAL];
+    sample->memFree = mem[MEMINFO_FREE];
+    sample->memAvailable = mem[MEMINFO_AVAILABLE];
+    sample->cached = mem[MEMINFO_CACHED];
+
+    // ----------------- /proc/uptime --------------
+    if (readProcFile(sampler, sampler->uptimeFd) < 0)
+    {
+        return -1;
+    }
+    scanDecimal(sampler->buf, &sample->uptime);
+
+    // ----------------- /proc/loadavg --------------
+    if (readProcFile(sampler, sampler->loadFd) < 0)
+    {
+        return -1;
+    }
+    p = sampler->buf;
+    for (i = 0; i < 3; i++)
+    {
+        p = scanDecimal(p, &sample->load[i]);
+    }
+
+    return 0;
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * CPU utilization (all CPUs, non-idle time) between two samples. A zeroed
+ * previous sample gives the utilization since boot.
+ *
+ * @param[in] prev - Earlier sample.
+ * @param[in] cur - Later sample.
+ * @return double - Utilization in percent.
+ ******************************************************************************/
+double cpuPercent(const struct sysSample * prev, const struct sysSample * cur)
+{
+    unsigned long long total = cur->cpuTotal - prev->cpuTotal;
+    unsigned long long idle = cur->cpuIdle - prev->cpuIdle;
+
+    if (0 == total)
+    {
+        return 0.0;
+    }
+
+    return 100.0 * (double)(total - idle) / (double)total;
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Reads a small file below /proc into buf, null terminated.
+ *
+ * @param[in] procFd - Open /proc directory.
+ * @param[in] path - Path relative to /proc.
+ * @param[out] buf - Buffer for the contents.
+ * @param[in] size - Size of buf.
+ *
+ * @return Number of bytes read, -1 on failure.
+ ******************************************************************************/
+static int readProcEntry(int procFd, const char * path, char * buf, int size)
+{
+    int fd = openat(procFd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    int len = read(fd, buf, size - 1);
+    close(fd);
+
+    if (len < 0)
+    {
+        return -1;
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+
+/*!
+ * \brief What getPID() searches for.
+ */
+struct pidSearch
+{
+    const char * name;                  // Substring of the command name.
+    int verbose;                        // Also print status and statm details.
+};
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Prints a process found by getPID() with its parent, thread count, memory
+ * and context switches, read from [pid]/status and [pid]/statm. Only the
+ * keys in PID_STATUS_KEYS and fields in PID_STATM_FIELDS are parsed.
+ *
+ * @param[in] procFd - Open /proc directory.
+ * @param[in] pid - Process directory name.
+ * @param[in] comm - Command name.
+ ******************************************************************************/
+static void printPidDetails(int procFd, char * pid, const char * comm)
+{
+    unsigned long long status[PSTATUS_NUM_KEYS] = { 0 };
+    unsigned long long statm[PSTATM_FIELDS] = { 0 };
+    long pageKb = sysconf(_SC_PAGESIZE) / 1024;
+    char path[32];
+    char buf[4096];
+    int len;
+
+    snprintf(path, sizeof(path), "%s/status", pid);
+    if ((len = readProcEntry(procFd, path, buf, sizeof(buf))) <= 0 ||
+        PID_STATUS_KEYS != procParseKeys(buf, len, PROC_STATUS_KEYS, PSTATUS_NUM_KEYS,
+                                         PID_STATUS_KEYS, status))
+    {
+        return;
+    }
+
+    // Kernel threads have an empty statm.
+    snprintf(path, sizeof(path), "%s/statm", pid);
+    if ((len = readProcEntry(procFd, path, buf, sizeof(buf))) > 0)
+    {
+        procParseStatm(buf, len, PID_STATM_FIELDS, statm);
+    }
+
+    outPrintf("%7s %7llu %7llu %10llu %10llu %10llu %10llu  %s\n", pid,
+              status[PSTATUS_PPID], status[PSTATUS_THREADS],
+              statm[PSTATM_RESIDENT] * pageKb, statm[PSTATM_SHARED] * pageKb,
+              status[PSTATUS_VCTXT], status[PSTATUS_NVCTXT], comm);
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * walkProcesses() visitor for getPID(). Reads the command name from
+ * [pid]/stat and prints the PID if the search string is a substring of it.
+ *
+ * @param[in] procFd - Open /proc directory.
+ * @param[in] pid - Process directory name.
+ * @param[in] arg - The pidSearch.
+ ******************************************************************************/
+static void printIfNameMatches(int procFd, char * pid, void * arg)
+{
+    struct pidSearch * search = arg;
+    struct procStat stat;
+    char path[32];
+    char buf[1024];
+    int len;
+
+    snprintf(path, sizeof(path), "%s/stat", pid);
+    if ((len = readProcEntry(procFd, path, buf, sizeof(buf))) > 0 &&
+        0 == procParseStat(buf, len, 0, &stat) &&
+        NULL != strstr(stat.comm, search->name))
+    {
+        if (search->verbose)
+        {
+            printPidDetails(procFd, pid, stat.comm);
+        }
+        else
+        {
+            outPrintf("%s\n",pid);
+        }
+    }
+}
+
+
+/***************************************************************************//**
+ * @author Joe Lillo
+ *
+ * @par Description:
+ * Searches through running processes in an attempt
+ * to match the given search string to a substring
+ * of the name of a process.
+ * Prints all of the PIDs that return a positive
+ * result. With -v, each PID is printed with its
+ * parent, threads, memory and context switches.
+ *
+ * Usage: pid [-v] name
+ *
+ * @param[in] argc - Number of arguments in argv
+ * @param[in] argv - String to represent name of process.
+ ******************************************************************************/
+void getPID(int argc, char ** argv)
+{
+    struct pidSearch search;
+
+    search.verbose = (argc > 2 && 0 == strcmp(argv[1], "-v"));
+    search.name = argv[search.verbose ? 2 : 1];
+
+    // Error checking.
+    if (argc < 2 || search.name == NULL)
+    {
+        return;
+    }
+
+    if (search.verbose)
+    {
+        outPrintf("%7s %7s %7s %10s %10s %10s %10s  %s\n", "PID", "PPID", "THREADS",
+                  "RSS(kB)", "SHR(kB)", "VCSW", "NVCSW", "COMMAND");
+    }
+    walkProcesses(printIfNameMatches, &search);
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Reads the /proc directory looking for directories with numbers as names
+ * and calls visit for each one. The open /proc directory is passed along
+ * so visitors can use openat() instead of building full paths.
+ *
+ * @param[in] visit - Called with the /proc descriptor, the PID and arg.
+ * @param[in] arg - Passed to visit.
+ *
+ * @return 0 on success, -1 if /proc cannot be read.
+ ******************************************************************************/
+int walkProcesses(void (*visit)(int procFd, char * pid, void * arg), void * arg)
+{
+    // Open /proc directory.
+    DIR * proc = opendir("/proc");
+
+    if (NULL == proc)
+    {
+        return -1;
+    }
+
+    struct dirent * entry;
+    int procFd = dirfd(proc);
+    int ok;
+
+    while ((entry = readdir(proc)))
+    {
+        if (DT_DIR == entry->d_type)
+        {
+            strToInt(entry->d_name,&ok);
+            if (0 == ok)
+            {
+                visit(procFd, entry->d_name, arg);
+            }
+        }
+    }
+
+    closedir(proc);
+    return 0;
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Fills in a procInfo from the text of /proc/[pid]/stat. Only the fields
+ * in PROC_INFO_FIELDS are parsed (see procParseStat()).
+ *
+ * @param[in] buf - Contents of the stat file.
+ * @param[in] len - Length of the contents.
+ * @param[out] info - Process information.
+ *
+ * @return 0 on success, -1 if the line is malformed.
+ ******************************************************************************/
+static int parseProcStat(const char * buf, int len, struct procInfo * info)
+{
+    static long pageKb = 0;
+    struct procStat stat;
+
+    if (0 != procParseStat(buf, len, PROC_INFO_FIELDS, &stat))
+    {
+        return -1;
+    }
+    if (0 == pageKb)
+    {
+        pageKb = sysconf(_SC_PAGESIZE) / 1024;
+    }
+
+    memcpy(info->comm, stat.comm, PROC_COMM_LEN);
+    info->state = stat.state;
+    info->ppid = (int)stat.field[PSTAT_PPID];
+    info->cpuTicks = stat.field[PSTAT_UTIME] + stat.field[PSTAT_STIME];
+    info->startTime = stat.field[PSTAT_STARTTIME];
+    info->rssKb = stat.field[PSTAT_RSS] * pageKb;
+
+    return 0;
+}
+
+
+/*!
+ * \brief State passed through walkProcesses() by scanProcesses().
+ */
+struct scanState
+{
+    struct procTable * table;
+    int flags;
+};
+
+
+/***************************************************************************//**
+ * @par Description:
+ * walkProcesses() visitor for scanProcesses(). Reads [pid]/stat and, when
+ * asked, [pid]/io into the next slot of the table. Processes that exit
+ * during the scan are skipped; unreadable io files (other users'
+ * processes) leave the I/O counters at zero.
+ *
+ * @param[in] procFd - Open /proc directory.
+ * @param[in] pid - Process directory name.
+ * @param[in] arg - struct scanState.
+ ******************************************************************************/
+static void readProcess(int procFd, char * pid, void * arg)
+{
+    struct scanState * state = arg;
+    struct procTable * table = state->table;
+    char path[32];
+    char buf[2048];
+    int len;
+    int ok;
+
+    if (table->count == table->cap)
+    {
+        int cap = table->cap ? table->cap * 2 : 1024;
+        struct procInfo * procs = realloc(table->procs, cap * sizeof(struct procInfo));
+        if (NULL == procs)
+        {
+            return;
+        }
+        table->procs = procs;
+        table->cap = cap;
+    }
+
+    struct procInfo * info = &table->procs[table->count];
+    memset(info, 0, sizeof(*info));
+    info->pid = strToInt(pid, &ok);
+
+    snprintf(path, sizeof(path), "%s/stat", pid);
+    if ((len = readProcEntry(procFd, path, buf, sizeof(buf))) <= 0 ||
+        0 != parseProcStat(buf, len, info))
+    {
+        return;
+    }
+
+    if (state->flags & PROC_SCAN_IO)
+    {
+        snprintf(path, sizeof(path), "%s/io", pid);
+        if ((len = readProcEntry(procFd, path, buf, sizeof(buf))) > 0)
+        {
+            unsigned long long io[PIO_NUM_KEYS] = { 0, 0 };
+            procParseKeys(buf, len, PROC_IO_KEYS, PIO_NUM_KEYS,
+                          (1 << PIO_READ_BYTES) | (1 << PIO_WRITE_BYTES), io);
+            info->readBytes = io[PIO_READ_BYTES];
+            info->writeBytes = io[PIO_WRITE_BYTES];
+        }
+    }
+
+    table->count++;
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Reads every process in /proc into a table, replacing its previous
+ * contents. The table's array is kept and grown as needed, so repeated
+ * scans do not reallocate.
+ *
+ * @param[in,out] table - Table to fill (zero it before the first scan).
+ * @param[in] flags - PROC_SCAN_IO to also read I/O counters.
+ *
+ * @return 0 on success, -1 if /proc cannot be read.
+ ******************************************************************************/
+int scanProcesses(struct procTable * table, int flags)
+{
+    struct scanState state;
+    struct timespec ts;
+
+    state.table = table;
+    state.flags = flags;
+    table->count = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    table->timeNs = (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+    return walkProcesses(readProcess, &state);
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Frees the memory held by a process table.
+ *
+ * @param[in,out] table - Table to free.
+ ******************************************************************************/
+void freeProcTable(struct procTable * table)
+{
+    free(table->procs);
+    table->procs = NULL;
+    table->count = 0;
+    table->cap = 0;
+}
+
+
+/*!
+ * \brief A process picked by signalMatching(), pinned by a pidfd.
+ */
+struct signalTarget
+{
+    int pid;
+    int pidfd;                          // -1 once released (or never pinned).
+    int err;                            // errno if it could not be signalled.
+};
+
+/*!
+ * \brief State passed through walkProcesses() by signalMatching().
+ */
+struct matchState
+{
+    const char * pattern;
+    int sig;
+    struct signalTarget * targets;
+    int count;
+    int cap;
+    int signalled;                      // Targets before this have been signalled.
+    int released;                       // Signalled early to free their pidfds.
+    int unreadable;                     // Processes skipped for lack of descriptors.
+    int fdLimit;                        // RLIMIT_NOFILE.
+    int usePidfd;
+};
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Sends the signal to every target found since the last call. With release
+ * set, the targets' pidfds are closed afterwards; signal --match does this
+ * when it runs short of file descriptors, so any number of processes can be
+ * matched (those targets can no longer be waited for).
+ *
+ * @param[in,out] state - Match state.
+ * @param[in] release - Non-zero to close the pidfds of the targets.
+ ******************************************************************************/
+static void signalTargets(struct matchState * state, int release)
+{
+    int i;
+
+    for (i = state->signalled; i < state->count; i++)
+    {
+        struct signalTarget * t = &state->targets[i];
+        if (0 == t->err)
+        {
+            int ret = (t->pidfd >= 0) ?
+                      syscall(__NR_pidfd_send_signal, t->pidfd, state->sig, NULL, 0) :
+                      kill(t->pid, state->sig);
+            if (0 != ret)
+            {
+                t->err = errno;
+            }
+        }
+        if (release && t->pidfd >= 0)
+        {
+            close(t->pidfd);
+            t->pidfd = -1;
+            if (0 == t->err)
+            {
+                state->released++;
+            }
+        }
+    }
+    state->signalled = state->count;
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Adds a target to the match state.
+ *
+ * @param[in,out] state - Match state.
+ * @param[in] pid - Process ID.
+ * @param[in] pidfd - pidfd pinning it, or -1.
+ * @param[in] err - errno if it can't be signalled, else 0.
+ *
+ * @return 0 on success, -1 if out of memory.
+ ******************************************************************************/
+static int addTarget(struct matchState * state, int pid, int pidfd, int err)
+{
+    if (state->count == state->cap)
+    {
+        int cap = state->cap ? state->cap * 2 : 16;
+        struct signalTarget * targets = realloc(state->targets, cap * sizeof(struct signalTarget));
+        if (NULL == targets)
+        {
+            return -1;
+        }
+        state->targets = targets;
+        state->cap = cap;
+    }
+
+    state->targets[state->count].pid = pid;
+    state->targets[state->count].pidfd = pidfd;
+    state->targets[state->count].err = err;
+    state->count++;
+    return 0;
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * walkProcesses() visitor for signalMatching(). If the process name
+ * contains the pattern, opens a pidfd for it and then reads its stat file
+ * again: the pidfd pins the PID, so if the start time still matches, the
+ * pidfd refers to the process that matched and not to a later process that
+ * reused the PID. The shell itself and zombies (already exited) are never
+ * targets.
+ *
+ * Pinned targets are signalled and released as a batch when the pidfds
+ * approach RLIMIT_NOFILE, or when pidfd_open() runs out of descriptors. A
+ * process that still can't be pinned becomes a failed target, so it is
+ * reported rather than dropped.
+ *
+ * @param[in] procFd - Open /proc directory.
+ * @param[in] pid - Process directory name.
+ * @param[in] arg - struct matchState.
+ ******************************************************************************/
+static void matchProcess(int procFd, char * pid, void * arg)
+{
+    struct matchState * state = arg;
+    struct procInfo before, after;
+    char path[32];
+    char buf[2048];
+    int len;
+    int ok;
+    int pidfd = -1;
+
+    memset(&before, 0, sizeof(before));
+    memset(&after, 0, sizeof(after));
+    before.pid = strToInt(pid, &ok);
+    if (before.pid == getpid())
+    {
+        return;
+    }
+
+    snprintf(path, sizeof(path), "%s/stat", pid);
+    len = readProcEntry(procFd, path, buf, sizeof(buf));
+    if (len < 0 && EMFILE == errno)
+    {
+        state->unreadable++;
+        return;
+    }
+    if (len <= 0 ||
+        0 != parseProcStat(buf, len, &before) ||
+        'Z' == before.state ||
+        NULL == strstr(before.comm, state->pattern))
+    {
+        return;
+    }
+
+    if (state->usePidfd)
+    {
+        pidfd = syscall(__NR_pidfd_open, before.pid, 0);
+        if (pidfd < 0 && (EMFILE == errno || ENFILE == errno) &&
+            state->signalled < state->count)
+        {
+            // Out of descriptors: signal what is pinned so far and retry.
+            signalTargets(state, 1);
+            pidfd = syscall(__NR_pidfd_open, before.pid, 0);
+        }
+        if (pidfd < 0)
+        {
+            if (ESRCH == errno)
+            {
+                return;         // Already gone.
+            }
+            if (ENOSYS != errno)
+            {
+                addTarget(state, before.pid, -1, errno);
+                return;
+            }
+            state->usePidfd = 0;
+        }
+    }
+
+    if ((len = readProcEntry(procFd, path, buf, sizeof(buf))) <= 0 ||
+        0 != parseProcStat(buf, len, &after) ||
+        after.startTime != before.startTime)
+    {
+        if (pidfd >= 0)
+        {
+            close(pidfd);
+        }
+        return;
+    }
+
+    if (0 != addTarget(state, before.pid, pidfd, 0))
+    {
+        if (pidfd >= 0)
+        {
+            close(pidfd);
+        }
+        return;
+    }
+
+    // Keep room for the directory scan and the next stat file.
+    if (pidfd >= state->fdLimit - SIGNAL_FD_RESERVE)
+    {
+        signalTargets(state, 1);
+    }
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Sends a signal to every process whose name contains pattern. Matches
+ * are found in one /proc scan and each is pinned with a pidfd as it is
+ * found, so a process that exits and has its PID reused before the signal
+ * goes out is never hit. All signals are then sent with
+ * pidfd_send_signal(). With wait set, polls the pidfds (which become
+ * readable when the process exits) until every target is gone or timeout
+ * seconds pass (0 waits forever).
+ *
+ * Kernels without pidfds (before 5.3) fall back to kill(), which leaves a
+ * small window for PID reuse between the scan and the signal. When there
+ * are more matches than free file descriptors, targets are signalled in
+ * batches during the scan; only the last batch can be waited for.
+ *
+ * @param[in] sig - Signal number.
+ * @param[in] pattern - Substring of the process name.
+ * @param[in] wait - Non-zero to wait for the targets to exit.
+ * @param[in] timeout - Longest wait in seconds, 0 for no limit.
+ ******************************************************************************/
+void signalMatching(int sig, char * pattern, int wait, double timeout)
+{
+    struct matchState state;
+    struct rlimit lim;
+    int sent = 0;
+    int i;
+
+    memset(&state, 0, sizeof(state));
+    state.pattern = pattern;
+    state.sig = sig;
+    state.usePidfd = 1;
+    state.fdLimit = INT_MAX;
+    if (0 == getrlimit(RLIMIT_NOFILE, &lim) && RLIM_INFINITY != lim.rlim_cur &&
+        lim.rlim_cur < INT_MAX)
+    {
+        state.fdLimit = (int)lim.rlim_cur;
+    }
+
+    if (0 != walkProcesses(matchProcess, &state))
+    {
+        outPrintf("Unable to read /proc.\n");
+        if (state.released > 0)
+        {
+            outPrintf("Signal %d was already sent to %d process(es).\n", sig, state.released);
+        }
+        for (i = state.signalled; i < state.count; i++)
+        {
+            if (state.targets[i].pidfd >= 0)
+            {
+                close(state.targets[i].pidfd);
+            }
+        }
+        free(state.targets);
+        return;
+    }
+    if (0 == state.count)
+    {
+        outPrintf("No processes match '%s'.\n", pattern);
+    }
+    if (state.unreadable > 0)
+    {
+        outPrintf("Unable to check %d process(es): %s\n", state.unreadable, strerror(EMFILE));
+    }
+    if (0 == state.count)
+    {
+        return;
+    }
+
+    // Send whatever is left, then report.
+    signalTargets(&state, 0);
+    for (i = 0; i < state.count; i++)
+    {
+        if (0 == state.targets[i].err)
+        {
+            sent++;
+        }
+    }
+
+    outPrintf("Signal %d sent to %d of %d process(es) matching '%s':", sig, sent,
+           state.count, pattern);
+    for (i = 0; i < state.count; i++)
+    {
+        if (0 == state.targets[i].err)
+        {
+            outPrintf(" %d", state.targets[i].pid);
+        }
+    }
+    outPrintf("\n");
+    for (i = 0; i < state.count; i++)
+    {
+        if (0 != state.targets[i].err)
+        {
+            outPrintf("Unable to signal %d: %s\n", state.targets[i].pid,
+                      strerror(state.targets[i].err));
+        }
+    }
+
+    if (wait && state.released > 0)
+    {
+        outPrintf("Not waiting for %d process(es) signalled early to free file descriptors.\n",
+                  state.released);
+    }
+
+    if (wait && sent > 0 && !state.usePidfd)
+    {
+        outPrintf("Waiting needs pidfd support.\n");
+    }
+    else if (wait && sent > state.released)
+    {
+        struct pollfd * fds = malloc((state.count + 1) * sizeof(struct pollfd));
+        int * pids = malloc(state.count * sizeof(int));
+        int waiting = 0;
+        struct timespec start, now;
+
+        if (NULL == pids)
+        {
+            free(fds);
+            fds = NULL;
+        }
+
+        // Only signalled targets that still hold a pidfd are waited for;
+        // poll() rejects more entries than RLIMIT_NOFILE, so pack them.
+        for (i = 0; i < state.count && NULL != fds; i++)
+        {
+            if (0 == state.targets[i].err && state.targets[i].pidfd >= 0)
+            {
+                fds[waiting].fd = state.targets[i].pidfd;
+                fds[waiting].events = POLLIN;
+                pids[waiting] = state.targets[i].pid;
+                waiting++;
+            }
+        }
+        int running = waiting;
+
+        // Ctrl-C stops the wait; it is polled after the pidfds.
+        if (NULL != fds)
+        {
+            fds[waiting].fd = loopInterruptFd();
+            fds[waiting].events = POLLIN;
+        }
+
+        // Show what was signalled before blocking.
+        outFlush();
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        while (NULL != fds && running > 0)
+        {
+            int ms = -1;
+            if (timeout > 0)
+            {
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                double left = timeout - (now.tv_sec - start.tv_sec) -
+                              (now.tv_nsec - start.tv_nsec) / 1e9;
+                if (left <= 0)
+                {
+                    break;
+                }
+                ms = (int)(left * 1000) + 1;
+            }
+
+            if (poll(fds, waiting + 1, ms) < 0 && EINTR != errno)
+            {
+                break;
+            }
+
+            if ((fds[waiting].revents & POLLIN) && loopInterrupted())
+            {
+                outPrintf("Interrupted.\n");
+                break;
+            }
+
+            // Exited processes stop being polled (negative fds are skipped).
+            for (i = 0; i < waiting; i++)
+            {
+                if (fds[i].fd >= 0 && (fds[i].revents & (POLLIN | POLLHUP)))
+                {
+                    fds[i].fd = -1;
+                    running--;
+                }
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double waited = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+        if (0 == running)
+        {
+            outPrintf("All %d process(es) exited after %.3f s.\n", waiting, waited);
+        }
+        else if (NULL != fds)
+        {
+            outPrintf("%d process(es) still running after %.3f s:", running, waited);
+            for (i = 0; i < waiting; i++)
+            {
+                if (fds[i].fd >= 0)
+                {
+                    outPrintf(" %d", pids[i]);
+                }
+            }
+            outPrintf("\n");
+        }
+        free(fds);
+        free(pids);
+    }
+
+    for (i = 0; i < state.count; i++)
+    {
+        if (state.targets[i].pidfd >= 0)
+        {
+            close(state.targets[i].pidfd);
+        }
+    }
+    free(state.targets);
+}
+
+
+/*!
+ * \brief A process ranked by ptop, with its counters over the interval.
+ */
+struct ptopEntry
+{
+    struct procInfo * info;
+    unsigned long long cpu;             // Clock ticks used.
+    unsigned long long io;              // Bytes read and written.
+    unsigned long long readBytes;
+    unsigned long long writeBytes;
+};
+
+
+// ptop sort keys, also indexes into the counters ptopLess() compares.
+#define PTOP_SORT_CPU 0
+#define PTOP_SORT_RSS 1
+#define PTOP_SORT_IO 2
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Orders two ptop entries by the chosen key, using the other counters to
+ * break ties (most processes use no CPU in a short interval).
+ *
+ * @param[in] a - First entry.
+ * @param[in] b - Second entry.
+ * @param[in] key - PTOP_SORT_CPU, PTOP_SORT_RSS or PTOP_SORT_IO.
+ *
+ * @return Non-zero if a ranks below b.
+ ******************************************************************************/
+static int ptopLess(const struct ptopEntry * a, const struct ptopEntry * b, int key)
+{
+    unsigned long long va[3] = { a->cpu, a->info->rssKb, a->io };
+    unsigned long long vb[3] = { b->cpu, b->info->rssKb, b->io };
+    int order[3][3] = { {0, 1, 2}, {1, 0, 2}, {2, 0, 1} };
+    int i;
+
+    for (i = 0; i < 3; i++)
+    {
+        int k = order[key][i];
+        if (va[k] != vb[k])
+        {
+            return va[k] < vb[k];
+        }
+    }
+    return a->info->pid > b->info->pid;
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Restores the min-heap order below slot i (the lowest ranked entry is at
+ * the root).
+ *
+ * @param[in,out] heap - Heap array.
+ * @param[in] n - Number of entries in the heap.
+ * @param[in] i - Slot to sift down from.
+ * @param[in] key - Sort key.
+ ******************************************************************************/
+static void ptopSiftDown(struct ptopEntry * heap, int n, int i, int key)
+{
+    while (1)
+    {
+        int low = i;
+        int l = 2 * i + 1;
+        int r = l + 1;
+
+        if (l < n && ptopLess(&heap[l], &heap[low], key))
+        {
+            low = l;
+        }
+        if (r < n && ptopLess(&heap[r], &heap[low], key))
+        {
+            low = r;
+        }
+        if (low == i)
+        {
+            return;
+        }
+
+        struct ptopEntry tmp = heap[i];
+        heap[i] = heap[low];
+        heap[low] = tmp;
+        i = low;
+    }
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Adds an entry to a bounded min-heap of the k highest ranked entries. Once
+ * the heap is full an entry only goes in if it beats the root, which it
+ * then replaces.
+ *
+ * @param[in,out] heap - Heap array with room for k entries.
+ * @param[in,out] n - Number of entries in the heap.
+ * @param[in] k - Heap capacity.
+ * @param[in] entry - Entry to add.
+ * @param[in] key - Sort key.
+ ******************************************************************************/
+static void ptopOffer(struct ptopEntry * heap, int * n, int k,
+                      const struct ptopEntry * entry, int key)
+{
+    int i;
+
+    if (*n < k)
+    {
+        // Sift up.
+        i = (*n)++;
+        heap[i] = *entry;
+        while (i > 0 && ptopLess(&heap[i], &heap[(i - 1) / 2], key))
+        {
+            struct ptopEntry tmp = heap[i];
+            heap[i] = heap[(i - 1) / 2];
+            heap[(i - 1) / 2] = tmp;
+            i = (i - 1) / 2;
+        }
+    }
+    else if (ptopLess(&heap[0], entry, key))
+    {
+        heap[0] = *entry;
+        ptopSiftDown(heap, *n, 0, key);
+    }
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Builds an open addressing hash index from PID to position in a process
+ * table, so two scans can be matched in linear time.
+ *
+ * @param[in] table - Process table.
+ * @param[out] mask - Index size minus one.
+ *
+ * @return Index slots holding table position + 1 (0 is empty), or NULL.
+ ******************************************************************************/
+static int * buildPidIndex(const struct procTable * table, unsigned int * mask)
+{
+    unsigned int size = 1024;
+    int i;
+
+    while (size < 2 * (unsigned int)table->count)
+    {
+        size *= 2;
+    }
+
+    int * index = calloc(size, sizeof(int));
+    if (NULL == index)
+    {
+        return NULL;
+    }
+
+    *mask = size - 1;
+    for (i = 0; i < table->count; i++)
+    {
+        unsigned int h = ((unsigned int)table->procs[i].pid * 2654435761U) & *mask;
+        while (0 != index[h])
+        {
+            h = (h + 1) & *mask;
+        }
+        index[h] = i + 1;
+    }
+
+    return index;
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Finds a PID in an index built by buildPidIndex().
+ *
+ * @return The process, or NULL if it is not in the table.
+ ******************************************************************************/
+static struct procInfo * lookupPid(const struct procTable * table, const int * index,
+                                   unsigned int mask, int pid)
+{
+    unsigned int h = ((unsigned int)pid * 2654435761U) & mask;
+
+    while (0 != index[h])
+    {
+        struct procInfo * info = &table->procs[index[h] - 1];
+        if (info->pid == pid)
+        {
+            return info;
+        }
+        h = (h + 1) & mask;
+    }
+
+    return NULL;
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Shows the processes using the most CPU, memory or storage I/O. /proc is
+ * scanned twice, interval seconds apart; CPU and I/O are the change between
+ * the scans. Only the top count processes are kept, in a bounded heap, so
+ * the cost per process is a comparison against the heap root.
+ *
+ * Usage: ptop [-n count] [-s cpu|rss|io] [-d seconds] [-r refreshes]
+ *
+ * @param[in] argc - Number of arguments in argv
+ * @param[in] argv - Options.
+ ******************************************************************************/
+void ptop(int argc, char ** argv)
+{
+    struct procTable prev, cur;
+    int count = PTOP_DEFAULT_COUNT;
+    int key = PTOP_SORT_CPU;
+    int refreshes = 1;
+    double interval = 1.0;
+    long ticksPerSec = sysconf(_SC_CLK_TCK);
+    int ok = 0;
+    int i, r;
+
+    for (i = 1; i < argc && 0 == ok; i++)
+    {
+        if (i + 1 >= argc)
+        {
+            ok = -1;
+        }
+        else if (0 == strcmp(argv[i], "-n"))
+        {
+            count = strToInt(argv[++i], &ok);
+            ok = (0 == ok && count > 0) ? 0 : -1;
+        }
+        else if (0 == strcmp(argv[i], "-r"))
+        {
+            refreshes = strToInt(argv[++i], &ok);
+            ok = (0 == ok && refreshes > 0) ? 0 : -1;
+        }
+        else if (0 == strcmp(argv[i], "-d"))
+        {
+            char * end;
+            interval = strtod(argv[++i], &end);
+            ok = ('\0' == *end && interval >= 0.01) ? 0 : -1;
+        }
+        else if (0 == strcmp(argv[i], "-s"))
+        {
+            i++;
+            if (0 == strcmp(argv[i], "cpu")) key = PTOP_SORT_CPU;
+            else if (0 == strcmp(argv[i], "rss")) key = PTOP_SORT_RSS;
+            else if (0 == strcmp(argv[i], "io")) key = PTOP_SORT_IO;
+            else ok = -1;
+        }
+        else
+        {
+            ok = -1;
+        }
+    }
+    if (0 != ok)
+    {
+        outPrintf("Usage: ptop [-n count] [-s cpu|rss|io] [-d seconds] [-r refreshes]\n");
+        return;
+    }
+
+    struct ptopEntry * heap = malloc(count * sizeof(struct ptopEntry));
+    memset(&prev, 0, sizeof(prev));
+    memset(&cur, 0, sizeof(cur));
+
+    if (NULL == heap || 0 != scanProcesses(&prev, PROC_SCAN_IO))
+    {
+        outPrintf("Unable to read /proc.\n");
+        free(heap);
+        return;
+    }
+
+    for (r = 0; r < refreshes; r++)
+    {
+        struct timespec delay, t0, t1;
+        unsigned int mask;
+        int n = 0;
+
+        delay.tv_sec = (time_t)interval;
+        delay.tv_nsec = (long)((interval - delay.tv_sec) * 1e9);
+        while (0 != nanosleep(&delay, &delay) && EINTR == errno)
+            ;
+
+        // Time the refresh: the scan, the join with the previous scan and
+        // the ranking.
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+
+        int * index = buildPidIndex(&prev, &mask);
+        if (NULL == index || 0 != scanProcesses(&cur, PROC_SCAN_IO))
+        {
+            outPrintf("Unable to read /proc.\n");
+            free(index);
+            break;
+        }
+
+        for (i = 0; i < cur.count; i++)
+        {
+            struct procInfo * now = &cur.procs[i];
+            struct procInfo * then = lookupPid(&prev, index, mask, now->pid);
+            struct ptopEntry entry;
+
+            // New processes count from zero. A PID that was reused since
+            // the last scan belongs to a process with a different start
+            // time; its counters may even be higher than the old one's.
+            if (NULL == then || then->startTime != now->startTime)
+            {
+                then = NULL;
+            }
+
+            entry.info = now;
+            entry.cpu = now->cpuTicks - (then ? then->cpuTicks : 0);
+            entry.readBytes = now->readBytes - (then ? then->readBytes : 0);
+            entry.writeBytes = now->writeBytes - (then ? then->writeBytes : 0);
+            entry.io = entry.readBytes + entry.writeBytes;
+
+            ptopOffer(heap, &n, count, &entry, key);
+        }
+        free(index);
+
+        // Heap sort what is left: repeatedly move the lowest to the end.
+        for (i = n - 1; i > 0; i--)
+        {
+            struct ptopEntry tmp = heap[0];
+            heap[0] = heap[i];
+            heap[i] = tmp;
+            ptopSiftDown(heap, i, 0, key);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        double secs = (cur.timeNs - prev.timeNs) / 1e9;
+        outPrintf("%d processes, refreshed in %.1f ms, %.1f s interval\n",
+               cur.count, (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6,
+               secs);
+        outPrintf("%7s %6s %10s %12s %12s  %s\n", "PID", "CPU%", "RSS(kB)",
+               "READ(kB/s)", "WRITE(kB/s)", "COMMAND");
+        for (i = 0; i < n; i++)
+        {
+            outPrintf("%7d %6.1f %10llu %12.1f %12.1f  %s\n", heap[i].info->pid,
+                   100.0 * heap[i].cpu / ticksPerSec / secs, heap[i].info->rssKb,
+                   heap[i].readBytes / 1024.0 / secs, heap[i].writeBytes / 1024.0 / secs,
+                   heap[i].info->comm);
+        }
+        outPrintf("\n");
+        outFlush();
+
+        // This scan is the baseline for the next refresh.
+        struct procTable tmp = prev;
+        prev = cur;
+        cur = tmp;
+    }
+
+    free(heap);
+    freeProcTable(&prev);
+    freeProcTable(&cur);
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Builds the parent/child forest of all processes from a single /proc
+ * scan, in linear time: parents are found through a PID index, children
+ * are bucketed by a counting pass into one flat array, and subtree CPU and
+ * RSS totals are summed bottom up over a breadth first order.
+ *
+ * @param[out] tree - Forest to fill (free it with freeProcTree()).
+ *
+ * @return 0 on success, -1 on failure.
+ ******************************************************************************/
+int buildProcTree(struct procTree * tree)
+{
+    int i, head, tail;
+
+    memset(tree, 0, sizeof(*tree));
+    if (0 != scanProcesses(&tree->table, 0))
+    {
+        return -1;
+    }
+
+    int n = tree->table.count;
+    struct procInfo * procs = tree->table.procs;
+
+    tree->pidIndex = buildPidIndex(&tree->table, &tree->pidMask);
+    tree->parent = malloc((n + 1) * sizeof(int));
+    tree->childStart = calloc(n + 1, sizeof(int));
+    tree->children = malloc((n + 1) * sizeof(int));
+    tree->roots = malloc((n + 1) * sizeof(int));
+    tree->subtreeCpu = malloc((n + 1) * sizeof(unsigned long long));
+    tree->subtreeRss = malloc((n + 1) * sizeof(unsigned long long));
+
+    if (NULL == tree->pidIndex || NULL == tree->parent || NULL == tree->childStart ||
+        NULL == tree->children || NULL == tree->roots || NULL == tree->subtreeCpu ||
+        NULL == tree->subtreeRss)
+    {
+        freeProcTree(tree);
+        return -1;
+    }
+
+    // Link each process to its parent and count children. Processes whose
+    // parent is not in the scan (PID 0, or a parent that just exited) are
+    // roots.
+    for (i = 0; i < n; i++)
+    {
+        tree->parent[i] = findProc(tree, procs[i].ppid);
+        if (tree->parent[i] == i)
+        {
+            tree->parent[i] = -1;
+        }
+
+        if (tree->parent[i] < 0)
+        {
+            tree->roots[tree->rootCount++] = i;
+        }
+        else
+        {
+            tree->childStart[tree->parent[i] + 1]++;
+        }
+    }
+
+    // Prefix sums give each parent its slice of the children array.
+    for (i = 0; i < n; i++)
+    {
+        tree->childStart[i + 1] += tree->childStart[i];
+    }
+
+    // Fill the slices, using order as each parent's fill cursor. Children
+    // keep scan (PID) order.
+    int * order = malloc((n + 1) * sizeof(int));
+    if (NULL == order)
+    {
+        freeProcTree(tree);
+        return -1;
+    }
+    for (i = 0; i < n; i++)
+    {
+        order[i] = tree->childStart[i];
+    }
+    for (i = 0; i < n; i++)
+    {
+        int p = tree->parent[i];
+        if (p >= 0)
+        {
+            tree->children[order[p]++] = i;
+        }
+    }
+
+    // Breadth first order from the roots: every process comes after its
+    // parent.
+    tail = 0;
+    for (i = 0; i < tree->rootCount; i++)
+    {
+        order[tail++] = tree->roots[i];
+    }
+    for (head = 0; head < tail; head++)
+    {
+        int c;
+        for (c = tree->childStart[order[head]]; c < tree->childStart[order[head] + 1]; c++)
+        {
+            order[tail++] = tree->children[c];
+        }
+    }
+
+    // Totals, children before parents. Processes in a parent cycle (not
+    // reachable from any root) only count themselves.
+    for (i = 0; i < n; i++)
+    {
+        tree->subtreeCpu[i] = procs[i].cpuTicks;
+        tree->subtreeRss[i] = procs[i].rssKb;
+    }
+    for (i = tail - 1; i >= 0; i--)
+    {
+        int p = tree->parent[order[i]];
+        if (p >= 0)
+        {
+            tree->subtreeCpu[p] += tree->subtreeCpu[order[i]];
+            tree->subtreeRss[p] += tree->subtreeRss[order[i]];
+        }
+    }
+
+    free(order);
+    return 0;
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Frees a process forest.
+ *
+ * @param[in,out] tree - Forest to free.
+ ******************************************************************************/
+void freeProcTree(struct procTree * tree)
+{
+    freeProcTable(&tree->table);
+    free(tree->parent);
+    free(tree->childStart);
+    free(tree->children);
+    free(tree->roots);
+    free(tree->subtreeCpu);
+    free(tree->subtreeRss);
+    free(tree->pidIndex);
+    memset(tree, 0, sizeof(*tree));
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Looks up a PID in a process forest.
+ *
+ * @param[in] tree - Forest.
+ * @param[in] pid - Process ID.
+ *
+ * @return Index into tree->table.procs, -1 if the PID is not there.
+ ******************************************************************************/
+int findProc(const struct procTree * tree, int pid)
+{
+    struct procInfo * info = lookupPid(&tree->table, tree->pidIndex, tree->pidMask, pid);
+
+    return (NULL == info) ? -1 : (int)(info - tree->table.procs);
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Prints the subtree below a process, depth first, one line per process
+ * with the CPU time and RSS of its whole subtree. Uses an explicit stack so
+ * deep fork chains cannot overflow the call stack.
+ *
+ * @param[in] tree - Forest.
+ * @param[in] root - Index of the subtree root.
+ * @param[in,out] stack - Scratch space for 2 * table.count ints.
+ ******************************************************************************/
+static void printProcSubtree(const struct procTree * tree, int root, int * stack)
+{
+    long ticksPerSec = sysconf(_SC_CLK_TCK);
+    int top = 0;
+    int c;
+
+    // Entries are (process, depth) pairs.
+    stack[top++] = root;
+    stack[top++] = 0;
+
+    while (top > 0)
+    {
+        int depth = stack[--top];
+        int i = stack[--top];
+        struct procInfo * info = &tree->table.procs[i];
+
+        outPrintf("%7d %10.2f %10llu  %*s%s\n", info->pid,
+               (double)tree->subtreeCpu[i] / ticksPerSec, tree->subtreeRss[i],
+               2 * depth, "", info->comm);
+
+        // Push in reverse so children print in PID order.
+        for (c = tree->childStart[i + 1] - 1; c >= tree->childStart[i]; c--)
+        {
+            stack[top++] = tree->children[c];
+            stack[top++] = depth + 1;
+        }
+    }
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Prints the process forest, or the subtrees of the given PIDs. /proc is
+ * scanned once no matter how many subtrees are asked for.
+ *
+ * Usage: ptree [pid ...]
+ *
+ * @param[in] argc - Number of arguments in argv
+ * @param[in] argv - PIDs of the subtrees to print.
+ ******************************************************************************/
+void ptree(int argc, char ** argv)
+{
+    struct procTree tree;
+    int ok;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        strToInt(argv[i], &ok);
+        if (0 != ok)
+        {
+            outPrintf("Usage: ptree [pid ...]\n");
+            return;
+        }
+    }
+
+    if (0 != buildProcTree(&tree))
+    {
+        outPrintf("Unable to read /proc.\n");
+        return;
+    }
+
+    int * stack = malloc((2 * tree.table.count + 2) * sizeof(int));
+    if (NULL == stack)
+    {
+        freeProcTree(&tree);
+        return;
+    }
+
+    outPrintf("%7s %10s %10s  %s\n", "PID", "CPU(s)", "RSS(kB)", "COMMAND (subtree totals)");
+
+    if (argc < 2)
+    {
+        for (i = 0; i < tree.rootCount; i++)
+        {
+            printProcSubtree(&tree, tree.roots[i], stack);
+        }
+    }
+    for (i = 1; i < argc; i++)
+    {
+        int index = findProc(&tree, strToInt(argv[i], &ok));
+        if (index < 0)
+        {
+            outPrintf("Cannot find pid: %s\n", argv[i]);
+            continue;
+        }
+        printProcSubtree(&tree, index, stack);
+    }
+
+    free(stack);
+    freeProcTree(&tree);
+}
+
+
+/*!
+ * \brief Process table kept up to date from events, with a PID index that
+ *        supports removal. pidfds[i] belongs to table.procs[i] (-1 if none).
+ */
+struct liveTable
+{
+    struct procTable table;
+    int * pidfds;                       // -1 for processes not pinned.
+    int numPidfds;                      // Open pidfds.
+    int * slots;                        // Index + 1, 0 for an empty slot.
+    unsigned int mask;
+};
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Finds the index slot of a PID in a live table.
+ *
+ * @return Slot holding the PID, or the empty slot where it would go.
+ ******************************************************************************/
+static unsigned int liveSlot(const struct liveTable * live, int pid)
+{
+    unsigned int h = ((unsigned int)pid * 2654435761U) & live->mask;
+
+    while (0 != live->slots[h] && live->table.procs[live->slots[h] - 1].pid != pid)
+    {
+        h = (h + 1) & live->mask;
+    }
+    return h;
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Looks up a process in a live table.
+ *
+ * @return The process, or NULL.
+ ******************************************************************************/
+static struct procInfo * liveFind(const struct liveTable * live, int pid)
+{
+    if (NULL == live->slots)
+    {
+        return NULL;
+    }
+
+    int index = live->slots[liveSlot(live, pid)];
+
+    return index ? &live->table.procs[index - 1] : NULL;
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Adds (or replaces) a process in a live table, growing the array and the
+ * index as needed.
+ *
+ * @param[in,out] live - Table.
+ * @param[in] info - Process to add.
+ * @param[in] pidfd - Its pidfd, or -1.
+ *
+ * @return The stored process, or NULL if out of memory.
+ ******************************************************************************/
+static struct procInfo * liveAdd(struct liveTable * live, const struct procInfo * info, int pidfd)
+{
+    struct procTable * t = &live->table;
+    unsigned int h;
+    int i;
+
+    if (NULL != live->slots && 0 != live->slots[h = liveSlot(live, info->pid)])
+    {
+        i = live->slots[h] - 1;
+        t->procs[i] = *info;
+        if (live->pidfds[i] >= 0)
+        {
+            close(live->pidfds[i]);
+            live->numPidfds--;
+        }
+        live->pidfds[i] = pidfd;
+        live->numPidfds += (pidfd >= 0);
+        return &t->procs[i];
+    }
+
+    if (t->count == t->cap)
+    {
+        int cap = t->cap ? t->cap * 2 : 1024;
+        struct procInfo * procs = realloc(t->procs, cap * sizeof(struct procInfo));
+        int * pidfds = realloc(live->pidfds, cap * sizeof(int));
+        if (NULL != procs)
+        {
+            t->procs = procs;
+        }
+        if (NULL != pidfds)
+        {
+            live->pidfds = pidfds;
+        }
+        if (NULL == procs || NULL == pidfds)
+        {
+            return NULL;
+        }
+        t->cap = cap;
+    }
+
+    // Keep the index at most half full; rebuild it when it grows.
+    if (NULL == live->slots || 2 * (unsigned int)(t->count + 1) > live->mask + 1)
+    {
+        unsigned int size = live->slots ? 2 * (live->mask + 1) : 2048;
+        int * slots = calloc(size, sizeof(int));
+        if (NULL == slots)
+        {
+            return NULL;
+        }
+        free(live->slots);
+        live->slots = slots;
+        live->mask = size - 1;
+        for (i = 0; i < t->count; i++)
+        {
+            live->slots[liveSlot(live, t->procs[i].pid)] = i + 1;
+        }
+    }
+
+    i = t->count++;
+    t->procs[i] = *info;
+    live->pidfds[i] = pidfd;
+    live->numPidfds += (pidfd >= 0);
+    live->slots[liveSlot(live, info->pid)] = i + 1;
+
+    return &t->procs[i];
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Removes a process from a live table: the last entry moves into its place
+ * and the index hole is closed by shifting later entries of the probe run
+ * back.
+ *
+ * @param[in,out] live - Table.
+ * @param[in] pid - Process to remove.
+ ******************************************************************************/
+static void liveRemove(struct liveTable * live, int pid)
+{
+    struct procTable * t = &live->table;
+    unsigned int h, next;
+    int i;
+
+    if (NULL == live->slots || (i = live->slots[h = liveSlot(live, pid)] - 1) < 0)
+    {
+        return;
+    }
+
+    if (live->pidfds[i] >= 0)
+    {
+        close(live->pidfds[i]);
+        live->numPidfds--;
+    }
+
+    // Close the hole in the index.
+    live->slots[h] = 0;
+    for (next = (h + 1) & live->mask; 0 != live->slots[next]; next = (next + 1) & live->mask)
+    {
+        int moved = live->slots[next];
+        live->slots[next] = 0;
+        live->slots[liveSlot(live, t->procs[moved - 1].pid)] = moved;
+    }
+
+    // Move the last entry into the freed position.
+    int last = --t->count;
+    if (i != last)
+    {
+        t->procs[i] = t->procs[last];
+        live->pidfds[i] = live->pidfds[last];
+        live->slots[liveSlot(live, t->procs[i].pid)] = i + 1;
+    }
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Frees a live table, closing its pidfds.
+ ******************************************************************************/
+static void liveFree(struct liveTable * live)
+{
+    int i;
+
+    for (i = 0; i < live->table.count; i++)
+    {
+        if (live->pidfds[i] >= 0)
+        {
+            close(live->pidfds[i]);
+        }
+    }
+    freeProcTable(&live->table);
+    free(live->pidfds);
+    free(live->slots);
+    memset(live, 0, sizeof(*live));
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Reads one process's stat file.
+ *
+ * @param[in] pid - Process ID.
+ * @param[out] info - Process information.
+ *
+ * @return 0 on success, -1 if the process is gone.
+ ******************************************************************************/
+static int readProcInfo(int pid, struct procInfo * info)
+{
+    char path[32];
+    char buf[2048];
+
+    memset(info, 0, sizeof(*info));
+    info->pid = pid;
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+
+    int len = readProcEntry(AT_FDCWD, path, buf, sizeof(buf));
+    if (len <= 0)
+    {
+        return -1;
+    }
+    return parseProcStat(buf, len, info);
+}
+
+
+/*!
+ * \brief State of a running pwatch.
+ */
+struct pwatchState
+{
+    struct liveTable live;
+    const char * pattern;               // NULL to show every process.
+    long long realOffsetNs;             // CLOCK_REALTIME - CLOCK_MONOTONIC.
+    long events;
+    int maxPidfds;                      // Most pidfds to hold at once.
+};
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Checks whether a process matches the pwatch pattern.
+ *
+ * @param[in] state - pwatch state.
+ * @param[in] info - Process.
+ *
+ * @return Non-zero if it matches (every process does without a pattern).
+ ******************************************************************************/
+static int pwatchMatches(const struct pwatchState * state, const struct procInfo * info)
+{
+    return NULL == state->pattern || NULL != strstr(info->comm, state->pattern);
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Pins a process in the live table with a pidfd, so its exit is seen as it
+ * happens. Only processes matching the pattern are pinned, and at most
+ * maxPidfds at a time; the rest are left to the /proc rescan.
+ *
+ * @param[in,out] state - pwatch state.
+ * @param[in] info - Process (an entry of the live table).
+ ******************************************************************************/
+static void pwatchPin(struct pwatchState * state, const struct procInfo * info)
+{
+    struct liveTable * live = &state->live;
+    int i = info - live->table.procs;
+
+    if (live->pidfds[i] >= 0 || live->numPidfds >= state->maxPidfds ||
+        !pwatchMatches(state, info))
+    {
+        return;
+    }
+
+    live->pidfds[i] = syscall(__NR_pidfd_open, info->pid, 0);
+    if (live->pidfds[i] >= 0)
+    {
+        live->numPidfds++;
+    }
+    else if (EMFILE == errno || ENFILE == errno)
+    {
+        // Something else holds descriptors too; stop trying for more.
+        state->maxPidfds = live->numPidfds;
+    }
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Prints one event with a microsecond wall clock timestamp, if the process
+ * matches the pattern.
+ *
+ * @param[in,out] state - pwatch state.
+ * @param[in] monoNs - CLOCK_MONOTONIC time of the event.
+ * @param[in] what - Event name.
+ * @param[in] info - Process.
+ * @param[in] detail - Extra text.
+ ******************************************************************************/
+static void pwatchEvent(struct pwatchState * state, unsigned long long monoNs,
+                        const char * what, const struct procInfo * info,
+                        const char * detail)
+{
+    if (!pwatchMatches(state, info))
+    {
+        return;
+    }
+
+    long long ns = (long long)monoNs + state->realOffsetNs;
+    time_t secs = ns / 1000000000LL;
+    struct tm tm;
+    localtime_r(&secs, &tm);
+
+    outPrintf("%02d:%02d:%02d.%06lld  %-5s %7d  %-16s %s\n", tm.tm_hour, tm.tm_min,
+           tm.tm_sec, (ns % 1000000000LL) / 1000, what, info->pid, info->comm, detail);
+    state->events++;
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Current CLOCK_MONOTONIC time in nanoseconds.
+ ******************************************************************************/
+static unsigned long long monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Subscribes to the kernel proc connector, which multicasts a netlink
+ * message for every fork, exec and exit. Needs CAP_NET_ADMIN and the
+ * initial network namespace.
+ *
+ * @return Netlink socket, or -1 if the connector is unavailable.
+ ******************************************************************************/
+static int openProcConnector()
+{
+    struct sockaddr_nl addr;
+    struct
+    {
+        struct nlmsghdr nl;
+        struct cn_msg cn;
+        enum proc_cn_mcast_op op;
+    } __attribute__((packed)) msg;
+
+    int sock = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+    if (sock < 0)
+    {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = CN_IDX_PROC;
+    addr.nl_pid = 0;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.nl.nlmsg_len = sizeof(msg);
+    msg.nl.nlmsg_type = NLMSG_DONE;
+    msg.nl.nlmsg_pid = 0;
+    msg.cn.id.idx = CN_IDX_PROC;
+    msg.cn.id.val = CN_VAL_PROC;
+    msg.cn.len = sizeof(enum proc_cn_mcast_op);
+    msg.op = PROC_CN_MCAST_LISTEN;
+
+    if (0 != bind(sock, (struct sockaddr*)&addr, sizeof(addr)) ||
+        send(sock, &msg, sizeof(msg), 0) != sizeof(msg))
+    {
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Applies the proc connector messages waiting on the socket to the live
+ * table and prints them. Thread events are ignored. Forked children start
+ * with their parent's name; exec re-reads the name from /proc. Exits are
+ * printed with the name the table remembers, so processes too short lived
+ * to be seen in /proc are still named.
+ *
+ * @param[in,out] state - pwatch state.
+ * @param[in] sock - Proc connector socket.
+ *
+ * @return 0 on success, -1 if the socket failed.
+ ******************************************************************************/
+static int pwatchConnector(struct pwatchState * state, int sock)
+{
+    char buf[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+    struct nlmsghdr * nl;
+    char detail[64];
+
+    int len = recv(sock, buf, sizeof(buf), MSG_DONTWAIT);
+    if (len < 0)
+    {
+        // ENOBUFS means events were dropped; carry on with the rest.
+        if (EAGAIN == errno || EINTR == errno || ENOBUFS == errno)
+        {
+            if (ENOBUFS == errno)
+            {
+                outPrintf("(events lost: receive buffer overflow)\n");
+            }
+            return 0;
+        }
+        return -1;
+    }
+
+    for (nl = (struct nlmsghdr*)buf; NLMSG_OK(nl, (unsigned int)len); nl = NLMSG_NEXT(nl, len))
+    {
+        struct cn_msg * cn = NLMSG_DATA(nl);
+        struct proc_event * ev = (struct proc_event*)cn->data;
+        struct procInfo info;
+        struct procInfo * known;
+
+        if (CN_IDX_PROC != cn->id.idx || CN_VAL_PROC != cn->id.val)
+        {
+            continue;
+        }
+
+        switch (ev->what)
+        {
+        case PROC_EVENT_FORK:
+            if (ev->event_data.fork.child_pid != ev->event_data.fork.child_tgid)
+            {
+                break;
+            }
+            known = liveFind(&state->live, ev->event_data.fork.parent_tgid);
+            memset(&info, 0, sizeof(info));
+            if (NULL != known)
+            {
+                memcpy(info.comm, known->comm, sizeof(info.comm));
+            }
+            info.pid = ev->event_data.fork.child_tgid;
+            info.ppid = ev->event_data.fork.parent_tgid;
+            liveAdd(&state->live, &info, -1);
+            snprintf(detail, sizeof(detail), "parent %d", info.ppid);
+            pwatchEvent(state, ev->timestamp_ns, "fork", &info, detail);
+            break;
+
+        case PROC_EVENT_EXEC:
+            known = liveFind(&state->live, ev->event_data.exec.process_tgid);
+            detail[0] = '\0';
+            if (0 != readProcInfo(ev->event_data.exec.process_tgid, &info))
+            {
+                // Already gone, so the new name is unknown; keep the old.
+                if (NULL == known)
+                {
+                    break;
+                }
+                info = *known;
+                snprintf(detail, sizeof(detail), "(exited before name was read)");
+            }
+            liveAdd(&state->live, &info, -1);
+            pwatchEvent(state, ev->timestamp_ns, "exec", &info, detail);
+            break;
+
+        case PROC_EVENT_EXIT:
+            if (ev->event_data.exit.process_pid != ev->event_data.exit.process_tgid)
+            {
+                break;
+            }
+            known = liveFind(&state->live, ev->event_data.exit.process_tgid);
+            memset(&info, 0, sizeof(info));
+            if (NULL != known)
+            {
+                info = *known;
+            }
+            info.pid = ev->event_data.exit.process_tgid;
+
+            if (WIFSIGNALED(ev->event_data.exit.exit_code))
+            {
+                snprintf(detail, sizeof(detail), "signal %d",
+                         WTERMSIG(ev->event_data.exit.exit_code));
+            }
+            else
+            {
+                snprintf(detail, sizeof(detail), "status %d",
+                         WEXITSTATUS(ev->event_data.exit.exit_code));
+            }
+            pwatchEvent(state, ev->timestamp_ns, "exit", &info, detail);
+            liveRemove(&state->live, info.pid);
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    return 0;
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Fallback when the proc connector is unavailable: rescans /proc and diffs
+ * it against the live table. New PIDs are reported as "new", a changed
+ * name on the same process as "exec", and missing PIDs or zombies as
+ * "exit" (unless a pidfd already reported them). A PID with a new start time is an exit
+ * followed by a new process. Processes that live less than one scan
+ * interval are not seen.
+ *
+ * @param[in,out] state - pwatch state.
+ * @param[in,out] scan - Scratch table for the scan.
+ * @param[in] report - Zero for the initial scan, which only fills the table.
+ *
+ * @return 0 on success, -1 if /proc could not be scanned (errno is set).
+ ******************************************************************************/
+static int pwatchDiff(struct pwatchState * state, struct procTable * scan, int report)
+{
+    struct liveTable * live = &state->live;
+    unsigned long long now;
+    unsigned int mask;
+    int i;
+
+    if (0 != scanProcesses(scan, 0))
+    {
+        return -1;
+    }
+    now = scan->timeNs;
+
+    // Exits: in the table but not in the scan (or reused).
+    int * index = buildPidIndex(scan, &mask);
+    if (NULL == index)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    for (i = 0; i < live->table.count; )
+    {
+        struct procInfo * old = &live->table.procs[i];
+        struct procInfo * cur = lookupPid(scan, index, mask, old->pid);
+
+        if (NULL == cur || cur->startTime != old->startTime || 'Z' == cur->state)
+        {
+            pwatchEvent(state, now, "exit", old, "");
+            liveRemove(live, old->pid);
+            continue;           // Another entry moved into slot i.
+        }
+        i++;
+    }
+    free(index);
+
+    // New processes and execs.
+    for (i = 0; i < scan->count; i++)
+    {
+        struct procInfo * cur = &scan->procs[i];
+        struct procInfo * old = liveFind(live, cur->pid);
+
+        if ('Z' == cur->state)
+        {
+            continue;           // Exited, not yet reaped.
+        }
+        if (NULL == old)
+        {
+            old = liveAdd(live, cur, -1);
+            if (report)
+            {
+                char detail[32];
+                snprintf(detail, sizeof(detail), "parent %d", cur->ppid);
+                pwatchEvent(state, now, "new", cur, detail);
+            }
+        }
+        else if (0 != strcmp(old->comm, cur->comm))
+        {
+            memcpy(old->comm, cur->comm, sizeof(old->comm));
+            pwatchEvent(state, now, "exec", cur, "");
+        }
+
+        // New, renamed into the pattern, or waiting for a free pidfd.
+        if (NULL != old)
+        {
+            pwatchPin(state, old);
+        }
+    }
+
+    return 0;
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Streams process lifecycle events with microsecond timestamps. Uses the
+ * kernel proc connector (fork, exec and exit as they happen, exit status
+ * included) when it is available. Otherwise each process matching the
+ * pattern is held by a pidfd, whose readiness gives the exit time, as far
+ * as RLIMIT_NOFILE allows; /proc is rescanned every PWATCH_SCAN_MS to find
+ * new processes, name changes and exits of unpinned processes. Either way the
+ * process table is updated incrementally rather than rebuilt.
+ *
+ * Runs for the given number of seconds, or until Enter is pressed on a
+ * terminal.
+ *
+ * Usage: pwatch [pattern] [-t seconds] [--poll]
+ *
+ * @param[in] argc - Number of arguments in argv
+ * @param[in] argv - Optional name pattern, run time and "--poll" to skip
+ *                   the proc connector.
+ ******************************************************************************/
+void pwatch(int argc, char ** argv)
+{
+    struct pwatchState state;
+    struct procTable scan;
+    struct timespec real;
+    struct rlimit lim;
+    double seconds = 0;
+    int forcePoll = 0;
+    int scanFailed = 0;
+    int ok = 0;
+    int sock = -1;
+    int i;
+
+    memset(&state, 0, sizeof(state));
+    memset(&scan, 0, sizeof(scan));
+
+    state.maxPidfds = INT_MAX;
+    if (0 == getrlimit(RLIMIT_NOFILE, &lim) && RLIM_INFINITY != lim.rlim_cur &&
+        lim.rlim_cur < INT_MAX)
+    {
+        state.maxPidfds = (int)lim.rlim_cur - PWATCH_FD_RESERVE;
+        if (state.maxPidfds < 0)
+        {
+            state.maxPidfds = 0;
+        }
+    }
+
+    for (i = 1; i < argc && 0 == ok; i++)
+    {
+        if (0 == strcmp(argv[i], "--poll"))
+        {
+            forcePoll = 1;
+        }
+        else if (0 == strcmp(argv[i], "-t") && i + 1 < argc)
+        {
+            char * end;
+            seconds = strtod(argv[++i], &end);
+            ok = ('\0' != *end || seconds <= 0) ? -1 : 0;
+        }
+        else if (NULL == state.pattern && '-' != argv[i][0])
+        {
+            state.pattern = argv[i];
+        }
+        else
+        {
+            ok = -1;
+        }
+    }
+    if (0 != ok)
+    {
+        outPrintf("Usage: pwatch [pattern] [-t seconds] [--poll]\n");
+        return;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &real);
+    state.realOffsetNs = (long long)real.tv_sec * 1000000000LL + real.tv_nsec -
+                         (long long)monotonicNs();
+
+    if (!forcePoll)
+    {
+        sock = openProcConnector();
+    }
+
+    // Seed the table with what is running now. With the connector, names
+    // of already running processes come from here.
+    if (sock >= 0)
+    {
+        scanProcesses(&scan, 0);
+        for (i = 0; i < scan.count; i++)
+        {
+            liveAdd(&state.live, &scan.procs[i], -1);
+        }
+        outPrintf("Watching process events (proc connector)");
+    }
+    else
+    {
+        if (0 != pwatchDiff(&state, &scan, 0))
+        {
+            outPrintf("Unable to scan /proc: %s\n", strerror(errno));
+            freeProcTable(&scan);
+            liveFree(&state.live);
+            return;
+        }
+        outPrintf("Watching process events (%d pidfds, /proc rescan every %d ms)",
+                  state.live.numPidfds, PWATCH_SCAN_MS);
+    }
+    outPrintf(", %d processes%s\n", state.live.table.count,
+           isatty(STDIN_FILENO) ? ", press Enter or Ctrl-C to stop" : ", Ctrl-C to stop");
+    outFlush();
+
+    unsigned long long end = seconds > 0 ? monotonicNs() + (unsigned long long)(seconds * 1e9) : 0;
+    unsigned long long nextScan = monotonicNs() + PWATCH_SCAN_MS * 1000000ULL;
+    struct pollfd * fds = NULL;
+    int * fdPids = NULL;                // PID of each pidfd in fds.
+    int fdCap = 0;
+
+    while (1)
+    {
+        unsigned long long now = monotonicNs();
+        int nfds = 0;
+        int timeout = -1;
+
+        if (0 != end && now >= end)
+        {
+            break;
+        }
+
+        // Poll: SIGINT, stdin (terminal only), then the connector or the
+        // pidfds.
+        int need = 3 + ((sock < 0) ? state.live.numPidfds : 0);
+        if (need > fdCap)
+        {
+            struct pollfd * grownFds = realloc(fds, need * 2 * sizeof(struct pollfd));
+            int * grownPids = realloc(fdPids, need * 2 * sizeof(int));
+            if (NULL != grownFds)
+            {
+                fds = grownFds;
+            }
+            if (NULL != grownPids)
+            {
+                fdPids = grownPids;
+            }
+            if (NULL == grownFds || NULL == grownPids)
+            {
+                outPrintf("Out of memory.\n");
+                break;
+            }
+            fdCap = need * 2;
+        }
+        fds[nfds].fd = loopInterruptFd();
+        fds[nfds++].events = POLLIN;
+        int input = isatty(STDIN_FILENO);
+        if (input)
+        {
+            fds[nfds].fd = STDIN_FILENO;
+            fds[nfds++].events = POLLIN;
+        }
+        int first = nfds;
+        if (sock >= 0)
+        {
+            fds[nfds].fd = sock;
+            fds[nfds++].events = POLLIN;
+        }
+        else
+        {
+            // Only pinned processes; poll() rejects more entries than
+            // RLIMIT_NOFILE.
+            for (i = 0; i < state.live.table.count; i++)
+            {
+                if (state.live.pidfds[i] >= 0)
+                {
+                    fdPids[nfds] = state.live.table.procs[i].pid;
+                    fds[nfds].fd = state.live.pidfds[i];
+                    fds[nfds++].events = POLLIN;
+                }
+            }
+            timeout = (nextScan > now) ? (int)((nextScan - now) / 1000000) + 1 : 0;
+        }
+        if (0 != end)
+        {
+            int left = (int)((end - now) / 1000000) + 1;
+            timeout = (timeout < 0 || left < timeout) ? left : timeout;
+        }
+
+        if (poll(fds, nfds, timeout) < 0 && EINTR != errno)
+        {
+            break;
+        }
+
+        if ((fds[0].revents & POLLIN) && loopInterrupted())
+        {
+            outPrintf("Interrupted.\n");
+            break;
+        }
+
+        if (input && (fds[1].revents & POLLIN))
+        {
+            // Consume the line that stopped the watch.
+            free(getInput());
+            break;
+        }
+
+        if (sock >= 0)
+        {
+            if ((fds[first].revents & POLLIN) && 0 != pwatchConnector(&state, sock))
+            {
+                outPrintf("Proc connector failed: %s\n", strerror(errno));
+                break;
+            }
+        }
+        else
+        {
+            // pidfds that became readable belong to processes that exited.
+            // Collect the PIDs first: removal reorders the table.
+            int exited = 0;
+            for (i = first; i < nfds; i++)
+            {
+                if (fds[i].revents & (POLLIN | POLLHUP))
+                {
+                    fdPids[first + exited++] = fdPids[i];
+                }
+            }
+            for (i = 0; i < exited; i++)
+            {
+                struct procInfo * info = liveFind(&state.live, fdPids[first + i]);
+                if (NULL != info)
+                {
+                    pwatchEvent(&state, monotonicNs(), "exit", info, "");
+                    liveRemove(&state.live, info->pid);
+                }
+            }
+
+            if (monotonicNs() >= nextScan)
+            {
+                // Report a failing rescan once, not every interval.
+                if (0 != pwatchDiff(&state, &scan, 1))
+                {
+                    if (!scanFailed)
+                    {
+                        outPrintf("Unable to scan /proc: %s\n", strerror(errno));
+                    }
+                    scanFailed = 1;
+                }
+                else
+                {
+                    scanFailed = 0;
+                }
+                nextScan = monotonicNs() + PWATCH_SCAN_MS * 1000000ULL;
+            }
+        }
+        outFlush();
+    }
+
+    outPrintf("%ld event(s), %d processes tracked\n", state.events, state.live.table.count);
+
+    free(fds);
+    free(fdPids);
+    if (sock >= 0)
+    {
+        close(sock);
+    }
+    freeProcTable(&scan);
+    liveFree(&state.live);
 }
 
 
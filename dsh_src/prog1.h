@@ -12,37 +12,210 @@
 #include <string.h>
 #include <dirent.h>
 #include <stdlib.h>
+#include "procparse.h"
 
 #define MIN_SIG 0
 #define MAX_SIG 20
 
-// Registers signals to be caught and handled.
-void startCatchSignals();
+// Initial size of the buffer /proc files are read into. It grows if a
+// file (usually /proc/stat on large machines) does not fit.
+#define SAMPLER_BUF_SIZE 16384
+
+// Shortest and longest intervals systat --watch accepts, in seconds.
+#define SYSTAT_MIN_INTERVAL 0.01
+#define SYSTAT_MAX_INTERVAL 86400.0
+
+/*!
+ * \brief System wide counters read from /proc at one point in time.
+ */
+struct sysSample
+{
+    unsigned long long timeNs;          // CLOCK_MONOTONIC time of the sample.
+    unsigned long long cpuTotal;        // All CPU time, in clock ticks.
+    unsigned long long cpuIdle;         // Idle and iowait time, in ticks.
+    unsigned long long ctxt;            // Context switches since boot.
+    unsigned long long forks;           // Processes created since boot.
+    unsigned long long running;         // Runnable tasks.
+    unsigned long long memTotal;        // kB
+    unsigned long long memFree;         // kB
+    unsigned long long memAvailable;    // kB
+    unsigned long long cached;          // kB
+    double uptime;                      // Seconds.
+    double load[3];                     // 1, 5 and 15 minute load averages.
+};
+
+/*!
+ * \brief Open /proc files and a reusable read buffer for taking samples.
+ */
+struct sysSampler
+{
+    int statFd;
+    int memFd;
+    int uptimeFd;
+    int loadFd;
+    char * buf;
+    size_t bufSize;
+};
+
+// Longest command line printed by cmdnm.
+#define CMDLINE_LEN 300
+
+// Files read per io_uring submission by readProcFiles().
+#define PROC_BATCH 64
+
+// File descriptors signal --match leaves free below RLIMIT_NOFILE. Pinned
+// targets are signalled and their pidfds closed before this is reached.
+#define SIGNAL_FD_RESERVE 8
+
+// Processes shown by ptop when -n is not given.
+#define PTOP_DEFAULT_COUNT 15
+
+// Fields of /proc/<pid>/stat read into a procInfo.
+#define PROC_INFO_FIELDS (PSTAT(PSTAT_PPID) | PSTAT(PSTAT_UTIME) | PSTAT(PSTAT_STIME) | \
+                          PSTAT(PSTAT_STARTTIME) | PSTAT(PSTAT_RSS))
+
+// Keys of /proc/<pid>/status and fields of /proc/<pid>/statm shown by
+// pid -v.
+#define PID_STATUS_KEYS ((1 << PSTATUS_PPID) | (1 << PSTATUS_THREADS) | \
+                         (1 << PSTATUS_VCTXT) | (1 << PSTATUS_NVCTXT))
+#define PID_STATM_FIELDS ((1 << PSTATM_RESIDENT) | (1 << PSTATM_SHARED))
+
+// Lines of /proc/stat and keys of /proc/meminfo read by takeSample().
+#define SAMPLE_SYSSTAT_LINES (SSTAT_CPU | SSTAT_CTXT | SSTAT_PROCESSES | SSTAT_RUNNING)
+#define SAMPLE_MEMINFO_KEYS ((1 << MEMINFO_TOTAL) | (1 << MEMINFO_FREE) | \
+                             (1 << MEMINFO_AVAILABLE) | (1 << MEMINFO_CACHED))
+
+// scanProcesses() flags.
+#define PROC_SCAN_IO 0x1        // Also read /proc/<pid>/io (slower).
+
+/*!
+ * \brief One process from a /proc scan.
+ */
+struct procInfo
+{
+    int pid;
+    int ppid;
+    char state;
+    unsigned long long cpuTicks;        // utime + stime, in clock ticks.
+    unsigned long long startTime;       // Clock ticks after boot.
+    unsigned long long rssKb;           // Resident set size.
+    unsigned long long readBytes;       // Bytes read from storage.
+    unsigned long long writeBytes;      // Bytes written to storage.
+    char comm[PROC_COMM_LEN];
+};
+
+/*!
+ * \brief All processes from one /proc scan. The array is reused between
+ *        scans.
+ */
+struct procTable
+{
+    struct procInfo * procs;
+    int count;
+    int cap;
+    unsigned long long timeNs;          // CLOCK_MONOTONIC time of the scan.
+};
+
+/*!
+ * \brief Parent/child forest of all processes from one /proc scan. Children
+ *        are stored as an adjacency list in flat arrays: the children of
+ *        process i are children[childStart[i]] .. children[childStart[i+1]-1]
+ *        (indexes into table.procs). Subtree totals include the process.
+ */
+struct procTree
+{
+    struct procTable table;
+    int * parent;                       // Parent index, -1 for roots.
+    int * childStart;                   // table.count + 1 offsets.
+    int * children;
+    int * roots;
+    int rootCount;
+    unsigned long long * subtreeCpu;    // Clock ticks.
+    unsigned long long * subtreeRss;    // kB.
+    int * pidIndex;                     // PID lookup (see findProc).
+    unsigned int pidMask;
+};
+
+// How often pwatch rescans /proc when the proc connector is unavailable.
+#define PWATCH_SCAN_MS 100
+
+// File descriptors pwatch leaves free below RLIMIT_NOFILE for the /proc
+// rescan. Processes beyond that are watched by rescan alone.
+#define PWATCH_FD_RESERVE 16
+
+// Registers signals to be caught and handled. Returns a signalfd for
+// handleSignalEvent.
+int startCatchSignals();
 
 // Maps signal handling function to default.
 //(No longer catches signals).
 void stopCatchSignals();
 
-// Signal handling callback function.
+// Signal handling callback function (fault signals).
 void handleSignal(int sig);
 
-// Displays name and command line information for given PID
+// Event loop handler for the signalfd from startCatchSignals.
+void handleSignalEvent(int fd, unsigned int events, void * arg);
+
+// Displays the command lines of the given PIDs
 void cmdnm (int argc, char ** argv);
 
+// Reads a list of small files, batched through io_uring when possible.
+void readProcFiles(char ** paths, int count, char * bufs, int bufSize, int * lens);
+
 // Sends a kill signal to a given PID.
 void sendKill(int argc, char ** argv);
 
+// Signals every process whose name contains pattern, through pidfds.
+void signalMatching(int sig, char * pattern, int wait, double timeout);
+
 // Prints system information.
-void systat();
+void systat(int argc, char ** argv);
+
+// Prints system rates every interval seconds.
+void systatWatch(double interval, int count);
+
+// Opens the /proc files used for sampling.
+int openSampler(struct sysSampler * sampler);
+
+// Closes a sampler.
+void closeSampler(struct sysSampler * sampler);
+
+// Reads the current system counters.
+int takeSample(struct sysSampler * sampler, struct sysSample * sample);
+
+// CPU utilization between two samples, in percent.
+double cpuPercent(const struct sysSample * prev, const struct sysSample * cur);
 
 // Prints PIDs that match a given process name.
 void getPID(int argc, char ** argv);
 
-// Returns the name of a given PID.
-char * getProcName(char * pid);
+// Calls visit for every process directory in /proc.
+int walkProcesses(void (*visit)(int procFd, char * pid, void * arg), void * arg);
+
+// Reads every process into a table.
+int scanProcesses(struct procTable * table, int flags);
+
+// Frees the memory held by a process table.
+void freeProcTable(struct procTable * table);
+
+// Shows the processes using the most CPU, memory or I/O.
+void ptop(int argc, char ** argv);
+
+// Builds the process forest from one /proc scan.
+int buildProcTree(struct procTree * tree);
+
+// Frees a process forest.
+void freeProcTree(struct procTree * tree);
+
+// Index of a PID in a process forest, -1 if it is not there.
+int findProc(const struct procTree * tree, int pid);
+
+// Prints the process tree, or the subtrees of the given PIDs.
+void ptree(int argc, char ** argv);
 
-// Returns the command line that started the given PID.
-char * getProcCmdline(char * pid);
+// Streams process fork, exec and exit events.
+void pwatch(int argc, char ** argv);
 
 
 #endif
@@ -22,26 +22,63 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
-#include <pthread.h>
+#include "eventloop.h"
+#include "lexer.h"
+#include "output.h"
+
+
+// Background jobs that have not finished yet.
+static struct bgJob jobs[MAX_JOBS];
+static int numJobs = 0;
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Checks whether argument n is the operator op. A quoted word with the same
+ * text ('|') is an ordinary argument.
+ *
+ * @param[in] argv - Arguments.
+ * @param[in] types - LEX_WORD or LEX_OP for each argument (see lexArgs()).
+ * @param[in] n - Index of the argument.
+ * @param[in] op - Operator text.
+ *
+ * @return 1 if it is the operator, 0 otherwise.
+ ******************************************************************************/
+static int isOperator(char ** argv, const int * types, int n, const char * op)
+{
+    return LEX_OP == types[n] && 0 == strcmp(argv[n], op);
+}
 
 
 /***************************************************************************//**
  * @author Joe Lillo
  *
  * @par Description:
- * Executes the command given in argv in a new process.
+ * Executes the command given in argv in a new process. If the last argument
+ * is "&" the command runs in the background: the shell does not wait, and
+ * reapChildren reports when it finishes.
  *
  * @param[in] argc - Number of arguments in argv
  * @param[in] argv - Process and arguments to execute.
+ * @param[in] types - Type of each argument (see lexArgs()).
  *
  * @return Status returned from executing the process.
  ******************************************************************************/
-int execCmd(int argc, char ** argv)
+int execCmd(int argc, char ** argv, const int * types)
 {
     int pid;
     int status;
     struct rusage use;
+    int background = (argc > 1 && isOperator(argv, types, argc-1, "&"));
 
+    if (background && MAX_JOBS == numJobs)
+    {
+        outPrintf("Too many background jobs (%d max).\n", MAX_JOBS);
+        return 1;
+    }
+
+    // Don't let the child inherit unwritten output.
+    outFlush();
 
     // Create a new process to execute the command.
     pid = fork();
@@ -50,9 +87,21 @@ int execCmd(int argc, char ** argv)
     if ( 0 == pid )
     {
         // Print some information
-        printf("Child process created: pid = %d\n", getpid());
-        printf("Output from command '%s':\n", argv[0]);
-        printf("------------------------------------------\n");
+        outPrintf("Child process created: pid = %d\n", getpid());
+        outPrintf("Output from command '%s':\n", argv[0]);
+        outPrintf("------------------------------------------\n");
+
+        // Background jobs must not compete with the shell for input.
+        if (background)
+        {
+            int nullfd = open("/dev/null", O_RDONLY);
+            dup2(nullfd, STDIN_FILENO);
+            close(nullfd);
+            argv[argc-1] = NULL;
+        }
+
+        // exec discards anything still buffered.
+        outFlush();
 
         // Execute command.
         execvp(argv[0], argv);
@@ -61,22 +110,62 @@ int execCmd(int argc, char ** argv)
         exit(1);
     }
 
+    if (pid < 0)
+    {
+        return 1;
+    }
+
+    if (background)
+    {
+        jobs[numJobs].pid = pid;
+        snprintf(jobs[numJobs].name, sizeof(jobs[numJobs].name), "%s", argv[0]);
+        numJobs++;
+        outPrintf("[bg] %s started: pid = %d\n", argv[0], pid);
+        return 0;
+    }
+
     // Wait for the child to exit.
-    wait(&status);
-    printf("------------------------------------------\n");
+    waitpid(pid, &status, 0);
+    outPrintf("------------------------------------------\n");
         
     // Print child process information.
     getrusage(RUSAGE_CHILDREN, &use);
-    printf("Child process information:\n");
-    printf("Child exited with status: %d\n", status);
-    printf("User CPU Time: %ld.%06ld\n", use.ru_utime.tv_sec, use.ru_utime.tv_usec);
-    printf("System CPU Time: %ld.%06ld\n", use.ru_stime.tv_sec, use.ru_stime.tv_usec);
-    printf("Number of page faults: %ld\n", use.ru_majflt);
-    printf("Number of swaps: %ld\n", use.ru_nswap);
+    outPrintf("Child process information:\n");
+    outPrintf("Child exited with status: %d\n", status);
+    outPrintf("User CPU Time: %ld.%06ld\n", use.ru_utime.tv_sec, use.ru_utime.tv_usec);
+    outPrintf("System CPU Time: %ld.%06ld\n", use.ru_stime.tv_sec, use.ru_stime.tv_usec);
+    outPrintf("Number of page faults: %ld\n", use.ru_majflt);
+    outPrintf("Number of swaps: %ld\n", use.ru_nswap);
     return status;
 }
 
 
+/***************************************************************************//**
+ * @par Description:
+ * Collects every child process that has exited, without blocking. Called
+ * from the event loop on SIGCHLD. Background jobs are reported; other
+ * children (remote requests) are reaped silently.
+ ******************************************************************************/
+void reapChildren()
+{
+    int pid;
+    int status;
+    int i;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+        for (i = 0; i < numJobs && jobs[i].pid != pid; i++)
+            ;
+
+        if (i < numJobs)
+        {
+            outPrintf("\n[bg] %s (pid %d) done, status: %d\n", jobs[i].name, pid, status);
+            jobs[i] = jobs[--numJobs];
+        }
+    }
+}
+
+
 /***************************************************************************//**
  * @author Joe Lillo
  *
@@ -114,10 +203,11 @@ int changeDirectory(int argc, char ** argv)
  *
  * @param[in] argc - Number of arguments in argv
  * @param[in] argv - Commands and pipe information.
+ * @param[in] types - Type of each argument (see lexArgs()).
  *
  * @return Status from the new process.
  ******************************************************************************/
-int doPipe(int argc, char ** argv)
+int doPipe(int argc, char ** argv, const int * types)
 {
     int mPipe[2];
     int pid1, pid2;
@@ -132,7 +222,7 @@ int doPipe(int argc, char ** argv)
     }
 
     // Finds the location of the | symbol in the arguments list.
-    int pLoc = isPipe(argc,argv);
+    int pLoc = isPipe(argc,argv,types);
 
     // Can't find pipe (it shouldn't be at location 0...)
     if ( 0 == pLoc )
@@ -146,6 +236,9 @@ int doPipe(int argc, char ** argv)
     argv[pLoc] = NULL;
     argv2 = &argv[pLoc + 1];
 
+    // Don't let the children inherit unwritten output.
+    outFlush();
+
     // Create a new process
     pid1 = fork();
 
@@ -163,7 +256,8 @@ int doPipe(int argc, char ** argv)
         // through the pipe.
         if ( 0 == pid2 )
         {
-            printf("Process created to handle command '%s' (input to pipe): pid = %d\n", argv[0], getpid());
+            outPrintf("Process created to handle command '%s' (input to pipe): pid = %d\n", argv[0], getpid());
+            outFlush();
 
             // close stoud and replace it with input side of pipe.
             close(1);
@@ -185,13 +279,14 @@ int doPipe(int argc, char ** argv)
         close(mPipe[1]);
 
         // Wait for the grandchild process to complete.
-        wait(&status);
+        waitpid(pid2, &status, 0);
 
         // Print information...
-        printf("Command '%s' finished with status: %d\n", argv[0],status);
-        printf("Process created to handle command '%s' (recieves output from pipe): pid = %d\n", argv2[0], getpid());
-        printf("Output from '%s' command:\n", argv2[0]);
-        printf("------------------------------------------\n");
+        outPrintf("Command '%s' finished with status: %d\n", argv[0],status);
+        outPrintf("Process created to handle command '%s' (recieves output from pipe): pid = %d\n", argv2[0], getpid());
+        outPrintf("Output from '%s' command:\n", argv2[0]);
+        outPrintf("------------------------------------------\n");
+        outFlush();
 
         // Execute command on right side of pipe symbol.
         execvp(argv2[0], argv2);
@@ -199,20 +294,20 @@ int doPipe(int argc, char ** argv)
     }
 
     // wait for child process to finish.
-    wait(&status);
+    waitpid(pid1, &status, 0);
 
-    printf("------------------------------------------\n");
+    outPrintf("------------------------------------------\n");
 
     // Print process information.
     struct rusage use;
     getrusage(RUSAGE_CHILDREN, &use);
 
-    printf("Child process information:\n");
-    printf("Child exited with status: %d\n", status);
-    printf("User CPU Time: %ld.%06ld\n", use.ru_utime.tv_sec, use.ru_utime.tv_usec);
-    printf("System CPU Time: %ld.%06ld\n", use.ru_stime.tv_sec, use.ru_stime.tv_usec);
-    printf("Number of page faults: %ld\n", use.ru_majflt);
-    printf("Number of swaps: %ld\n", use.ru_nswap);
+    outPrintf("Child process information:\n");
+    outPrintf("Child exited with status: %d\n", status);
+    outPrintf("User CPU Time: %ld.%06ld\n", use.ru_utime.tv_sec, use.ru_utime.tv_usec);
+    outPrintf("System CPU Time: %ld.%06ld\n", use.ru_stime.tv_sec, use.ru_stime.tv_usec);
+    outPrintf("Number of page faults: %ld\n", use.ru_majflt);
+    outPrintf("Number of swaps: %ld\n", use.ru_nswap);
 
     // Restore this.
     argv[pLoc]=pipeCmd;
@@ -230,14 +325,15 @@ int doPipe(int argc, char ** argv)
  *
  * @param[in] argc - Number of arguments in argv
  * @param[in] argv - Commands and pipe information.
+ * @param[in] types - Type of each argument (see lexArgs()).
  *
  * @return Location of pipe character in argv.
  ******************************************************************************/
-int isPipe (int argc, char ** argv)
+int isPipe (int argc, char ** argv, const int * types)
 {
     char ** i = argv;
 
-    while ( 0 != strcmp(*i,"|") )
+    while ( !isOperator(argv, types, i-argv, "|") )
     {
         if (i == &argv[argc-1])
         {
@@ -262,10 +358,11 @@ int isPipe (int argc, char ** argv)
  *
  * @param[in] argc - Number of arguments in argv
  * @param[in] argv - Command, file, and redirect information.
+ * @param[in] types - Type of each argument (see lexArgs()).
  *
  * @return Status from the new process.
  ******************************************************************************/
-int doRedirect(int argc, char **argv)
+int doRedirect(int argc, char **argv, const int * types)
 {
     int pid;
     char * redCmd;
@@ -281,7 +378,7 @@ int doRedirect(int argc, char **argv)
 
     // Determine if the > or < character is present and find the location
     // of it in argv.
-    int pLoc = isRedirect(argc,argv);
+    int pLoc = isRedirect(argc,argv,types);
 
     // Error checking.
     if ( 0 == pLoc )
@@ -295,6 +392,9 @@ int doRedirect(int argc, char **argv)
     argv2 = &argv[pLoc + 1];
 
 
+    // Don't let the child inherit unwritten output.
+    outFlush();
+
     // Create a new process.
     pid = fork();
 
@@ -310,17 +410,18 @@ int doRedirect(int argc, char **argv)
             // Close stdin and replace it with the opened file.
             if ( file != -1 )
             {
-                printf("Process created to handle redirection. PID = %d\n", getpid());
-                printf("Using file '%s' as input to command '%s'.\n", argv2[0],argv[0]);
-                printf("Output:\n");
-                printf("------------------------------------------\n");
+                outPrintf("Process created to handle redirection. PID = %d\n", getpid());
+                outPrintf("Using file '%s' as input to command '%s'.\n", argv2[0],argv[0]);
+                outPrintf("Output:\n");
+                outPrintf("------------------------------------------\n");
+                outFlush();
                 close(0);
                 dup(file);
                 close(file);
             }
             else
             {
-                printf("Unable to open file '%s'\n", argv2[0]);
+                outPrintf("Unable to open file '%s'\n", argv2[0]);
                 exit(1);
             }
         }
@@ -332,17 +433,18 @@ int doRedirect(int argc, char **argv)
             // Close stdout and replace it with the output file.
             if ( file != -1 )
             {
-                printf("Process created to handle redirection. PID = %d\n", getpid());
-                printf("Writing output from '%s' to file '%s'\n", argv[0], argv2[0]);
-                printf("Output:\n");
-                printf("------------------------------------------\n");
+                outPrintf("Process created to handle redirection. PID = %d\n", getpid());
+                outPrintf("Writing output from '%s' to file '%s'\n", argv[0], argv2[0]);
+                outPrintf("Output:\n");
+                outPrintf("------------------------------------------\n");
+                outFlush();
                 close(1);
                 dup(file);
                 close(file);
             }
             else
             {
-                printf("Unable to open file '%s'\n", argv2[0]);
+                outPrintf("Unable to open file '%s'\n", argv2[0]);
                 exit(1);
             }
         }
@@ -353,18 +455,18 @@ int doRedirect(int argc, char **argv)
     }
 
     // Wait for the child process to end and return the status.
-    wait(&status);
+    waitpid(pid, &status, 0);
 
     // Print child process information.
     struct rusage use;
     getrusage(RUSAGE_CHILDREN, &use);
-    printf("------------------------------------------\n");
-    printf("Child process information:\n");
-    printf("Child exited with status: %d\n", status);
-    printf("User CPU Time: %ld.%06ld\n", use.ru_utime.tv_sec, use.ru_utime.tv_usec);
-    printf("System CPU Time: %ld.%06ld\n", use.ru_stime.tv_sec, use.ru_stime.tv_usec);
-    printf("Number of page faults: %ld\n", use.ru_majflt);
-    printf("Number of swaps: %ld\n", use.ru_nswap);
+    outPrintf("------------------------------------------\n");
+    outPrintf("Child process information:\n");
+    outPrintf("Child exited with status: %d\n", status);
+    outPrintf("User CPU Time: %ld.%06ld\n", use.ru_utime.tv_sec, use.ru_utime.tv_usec);
+    outPrintf("System CPU Time: %ld.%06ld\n", use.ru_stime.tv_sec, use.ru_stime.tv_usec);
+    outPrintf("Number of page faults: %ld\n", use.ru_majflt);
+    outPrintf("Number of swaps: %ld\n", use.ru_nswap);
 
     return status;
 }
@@ -380,13 +482,16 @@ int doRedirect(int argc, char **argv)
  * @param[in] argc - Number of arguments in argv
  * @param[in] argv - Command, file, and redirect information.
  *
+ * @param[in] types - Type of each argument (see lexArgs()).
+ *
  * @return Index of the redirect character.
  ******************************************************************************/
-int isRedirect (int argc, char ** argv)
+int isRedirect (int argc, char ** argv, const int * types)
 {
     char ** i = argv;
 
-    while ( 0 != strcmp(*i,">") && 0 != strcmp(*i,"<") )
+    while ( !isOperator(argv, types, i-argv, ">") &&
+            !isOperator(argv, types, i-argv, "<") )
     {
         if (i == &argv[argc-1])
         {
@@ -410,13 +515,16 @@ int isRedirect (int argc, char ** argv)
  * @param[in] argc - Number of arguments in argv
  * @param[in] argv - Command, file, and redirect information.
  *
+ * @param[in] types - Type of each argument (see lexArgs()).
+ *
  * @return Index of the redirect character.
  ******************************************************************************/
-int isRemotePipe(int argc, char ** argv)
+int isRemotePipe(int argc, char ** argv, const int * types)
 {
     char ** i = argv;
 
-    while ( 0 != strcmp(*i,"))") && 0 != strcmp(*i,"((")   )
+    while ( !isOperator(argv, types, i-argv, "))") &&
+            !isOperator(argv, types, i-argv, "((") )
     {
         if ( i == &argv[argc-1] )
         {
@@ -430,14 +538,140 @@ int isRemotePipe(int argc, char ** argv)
 }
 
 
+// Socket the server accepts clients on (-1 when not serving).
+static int serverFd = -1;
+
+// Connection to a server while dclient is active (-1 otherwise).
+static int clientFd = -1;
+
+// Stdin handler to restore when dclient exits.
+static loopHandler shellInput = NULL;
+static void * shellInputArg = NULL;
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Stops the socket server: closes the listening socket and one client
+ * connection.
+ *
+ * @param[in] conn - Client connection to close (-1 for none).
+ ******************************************************************************/
+static void stopServer(int conn)
+{
+    if (conn >= 0)
+    {
+        loopRemove(conn);
+        close(conn);
+    }
+
+    if (serverFd >= 0)
+    {
+        loopRemove(serverFd);
+        close(serverFd);
+        serverFd = -1;
+    }
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Event loop handler for a client connection. Each message is a command,
+ * run in a new process with its output sent back across the socket. The
+ * shell does not wait for it; the process is reaped on SIGCHLD.
+ *
+ * @param[in] conn - Socket connection descriptor.
+ * @param[in] events - Not used.
+ * @param[in] arg - Not used.
+ ******************************************************************************/
+static void serverRequest(int conn, unsigned int events, void * arg)
+{
+    int len;
+    char recvBuff[2000];
+    int pid = -1;
+    char ** args;
+    int words;
+
+    len = read(conn, recvBuff, sizeof(recvBuff)-1);
+    if (len <= 0)
+    {
+        outPrintf("\nClient disconnected.\n");
+        loopRemove(conn);
+        close(conn);
+        outFlush();
+        return;
+    }
+    recvBuff[len] = '\0';
+
+    if ( 0 == strcmp("exit",recvBuff) )
+    {
+        outPrintf("\nRecieved exit command from client.\n");
+        stopServer(conn);
+        outFlush();
+        return;
+    }
+    outPrintf("\nRecieved Command: %s\n",recvBuff);
+    outFlush();
+
+    args = lexArgs(recvBuff, &words, NULL);
+
+    if (words > 0)
+    {
+        pid = fork();
+        if ( 0 == pid )
+        {
+            outPrintf("Created Process to handle client request. (PID = %d)\n", getpid());
+            outPrintf("Executing command: %s\n", args[0]);
+            outFlush();
+            dup2( conn, STDOUT_FILENO );
+            close(conn);
+            execvp(args[0],args);
+            outPrintf("Command Failed.\n");
+            exit(1);
+        }
+    }
+
+    free(args);
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Event loop handler for the listening socket. Accepts waiting clients and
+ * adds their connections to the loop.
+ *
+ * @param[in] fd - Listening socket.
+ * @param[in] events - Not used.
+ * @param[in] arg - Not used.
+ ******************************************************************************/
+static void serverAccept(int fd, unsigned int events, void * arg)
+{
+    int conn;
+
+    while ((conn = accept(fd, NULL, NULL)) >= 0)
+    {
+        // Request handlers must not inherit other clients' connections.
+        fcntl(conn, F_SETFD, FD_CLOEXEC);
+
+        if (0 != loopAdd(conn, EPOLLIN, serverRequest, NULL))
+        {
+            close(conn);
+            continue;
+        }
+        outPrintf("\nConnection Established.\n");
+    }
+
+    outFlush();
+}
+
+
 /***************************************************************************//**
  * @author Joe Lillo
  *
  * @par Description:
- * Starts a socket server to listen for clients. When a client connects,
- * this function spins off a new thread to service the client's requests.
- * After the client exits, this function will also exit. This will be changed
- * in the next version to continuously handle multiple client requrests.
+ * Starts a socket server to listen for clients. The listening socket and
+ * every client connection are served from the shell's event loop, so the
+ * shell stays interactive and any number of clients may connect. A client
+ * sending 'exit' shuts the server down.
  *
  * Note: This code was created by modifying the code found at this URL:
  * http://www.mcs.sdsmt.edu/ckarlsso/csc456/spring14/code/ALP-listings/chapter-5/socket-inet-server.c
@@ -448,121 +682,165 @@ int isRemotePipe(int argc, char ** argv)
  ******************************************************************************/
 void doServer(int argc, char ** argv)
 {
-    int listenfd = 0, connfd = 0;
+    int listenfd = 0;
     struct sockaddr_in serv_addr;
     int ok;
     int port;
-    int ret;
-    pthread_t listenThread;
-    void* status;
+    int on = 1;
 
     if ( argc < 2 )
     {
-        printf("Please specify port number\n");
+        outPrintf("Please specify port number\n");
         return;
     }
     port = strToInt(argv[1], &ok);
     if ( 0 != ok )
     {
-        printf("Invalid port number\n");
+        outPrintf("Invalid port number\n");
         return;
     }
 
-    listenfd = socket(AF_INET, SOCK_STREAM, 0);
-    memset(&serv_addr, '0', sizeof(serv_addr));
+    if ( serverFd >= 0 )
+    {
+        outPrintf("Server already running.\n");
+        return;
+    }
+
+    listenfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if ( listenfd < 0 )
+    {
+        outPrintf("Could not create socket.\n");
+        return;
+    }
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    memset(&serv_addr, 0, sizeof(serv_addr));
 
     serv_addr.sin_family = AF_INET;
     serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
     serv_addr.sin_port = htons(port);
 
-    bind(listenfd, (struct sockaddr*)&serv_addr, sizeof(serv_addr));
-
-    listen(listenfd, 10);
-
-    printf("Waiting for client connection...\n");
-
-    connfd = accept(listenfd, (struct sockaddr*)NULL, NULL);
-
-    printf("Connection Established.\nCreating thread to handle connection...\n");
-
-    ret = pthread_create(&listenThread, NULL, serverListen, (void *)&connfd);
-    if ( 0 != ret )
+    if ( 0 != bind(listenfd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) ||
+         0 != listen(listenfd, 10) ||
+         0 != loopAdd(listenfd, EPOLLIN, serverAccept, NULL) )
     {
-        printf("Could not create listener thread.\n");
+        outPrintf("Could not listen on port %d.\n", port);
+        close(listenfd);
         return;
     }
 
-    pthread_join(listenThread, &status);
+    serverFd = listenfd;
 
-    printf("Joined threads.\n");
+    outPrintf("Waiting for client connections on port %d...\n", port);
+}
 
-    close(connfd);
+
+/***************************************************************************//**
+ * @par Description:
+ * Leaves client mode: closes the connection and gives stdin back to the
+ * shell.
+ ******************************************************************************/
+static void stopClient()
+{
+    loopRemove(clientFd);
+    close(clientFd);
+    clientFd = -1;
+
+    loopAdd(STDIN_FILENO, EPOLLIN, shellInput, shellInputArg);
+
+    outPrintf("\n" DSH_PROMPT);
 }
 
 
 /***************************************************************************//**
- * @author Joe Lillo
- *
  * @par Description:
- * This function is meant to run in a thread. It simply watches the socket
- * connection to listen for client requests. On a new request, this function
- * forks a new process to handle the client request. The output from the
- * command is sent back across the socket.
- *
- * @param[in] arg - Socket connection descriptor.
+ * Event loop handler for stdin while dclient is active. Sends each line to
+ * the server. Typing 'exit' (or end of input) leaves client mode and causes
+ * the server to shutdown as well.
  *
+ * @param[in] fd - Not used (stdin).
+ * @param[in] events - Not used.
+ * @param[in] arg - Not used.
  ******************************************************************************/
-void * serverListen(void *arg)
+static void clientInput(int fd, unsigned int events, void * arg)
 {
+    char * in;
+    char * line;
     int len;
-    char recvBuff[2000];
-    int pid = -1;
     char ** args;
     int words;
-    //int i;
-    int status;
-
-    int * connptr = (int*)arg;
-    int conn = *connptr;
 
-    while(1)
+    in = getInput();
+    if (NULL == in)
     {
-        len = read(conn, recvBuff, sizeof(recvBuff)-1);
-        recvBuff[len] = '\0';
+        write(clientFd,"exit",4);
+        stopClient();
+        outFlush();
+        return;
+    }
 
-        if ( 0 == strcmp("exit",recvBuff) )
+    // The line is sent as typed; tokenize a copy.
+    line = strdup(in);
+    args = lexArgs(line, &words, NULL);
+
+    if (words > 0 && 0 == strcmp(args[0], "exit") )
+    {
+        write(clientFd,"exit",4);
+        stopClient();
+    }
+    else
+    {
+        len = strlen(in);
+        if (len >= 2000)
         {
-            printf("Recieved exit command from client.\n");
-            break;
+            outPrintf("Command caused buffer overflow -- (2000 character max)\n");
         }
-        printf("Recieved Command: %s\n",recvBuff);
-
-        args = getArgs(recvBuff, &words);
-
-        if (words > 0)
+        else if (len > 0)
         {
-            pid = fork();
-            if ( 0 == pid )
-            {
-                printf("Created Process to handle client request. (PID = %d)\n", getpid());
-                printf("Executing command: %s\n", args[0]);
-                dup2( conn, STDOUT_FILENO );
-                close(conn);
-                execvp(args[0],args);
-                printf("Command Failed.\n");
-                exit(1);
-            }
-            wait(&status);
+            write(clientFd,in,len);
         }
 
-//        for (i = 0; i < words; i++)
-//        {
-//            free(args[i]);
-//        }
-//        free(args);
+        outPrintf("[dsh]dclient> ");
+    }
+
+    free(args);
+    free(line);
+    free(in);
+    outFlush();
+
+    loopSetPending(STDIN_FILENO, inputPending());
+}
+
+
+/***************************************************************************//**
+ * @par Description:
+ * Event loop handler for the connection to the server. After recieving a
+ * message, the text is printed to stdout.
+ *
+ * @param[in] conn - Socket connection descriptor.
+ * @param[in] events - Not used.
+ * @param[in] arg - Not used.
+ ******************************************************************************/
+static void clientReply(int conn, unsigned int events, void * arg)
+{
+    int len;
+    char recvBuff[2000];
+
+    len = read(conn, recvBuff, sizeof(recvBuff)-1);
+    if (len <= 0)
+    {
+        outPrintf("\nServer closed the connection.\n");
+        stopClient();
+        outFlush();
+        return;
     }
+    recvBuff[len] = '\0';
 
-    pthread_exit(0);
+    outPrintf("\n[Recieved Message from server]:\n");
+    outPrintf("------------------------------------------\n");
+    outPrintf("%s",recvBuff);
+    outPrintf("------------------------------------------\n");
+    outFlush();
 }
 
 
@@ -570,10 +848,10 @@ void * serverListen(void *arg)
  * @author Joe Lillo
  *
  * @par Description:
- * Starts a client socket connection on the given ip address and port. Also
- * starts a prompt for commands to send to the server. Spins off a thread to
- * listen for replies from the server. Typing 'exit' will exit the client
- * prompt and cause the server to shutdown as well.
+ * Starts a client socket connection on the given ip address and port. Until
+ * 'exit' is typed, lines typed at the [dsh]dclient> prompt are sent to the
+ * server and its replies are printed as they arrive, both from the shell's
+ * event loop.
  *
  * Note: This code was created by modifying the code found at this URL:
  * http://www.mcs.sdsmt.edu/ckarlsso/csc456/spring14/code/ALP-listings/chapter-5/socket-inet-client.c
@@ -586,139 +864,67 @@ void * serverListen(void *arg)
 int doClient(int argc, char ** argv)
 {
     int sockfd = 0;
-    char recvBuff[1024];
     struct sockaddr_in serv_addr;
     int port = -1;
     int ok;
-    char * in;
-    int len;
-    char ** args;
-    int words;
-    unsigned int i;
-    pthread_t listenThread;
-    void* status;
-    int ret;
 
     if(argc < 3)
     {
-        printf("Invalid Arguments.\n");
+        outPrintf("Invalid Arguments.\n");
         return 1;
     }
 
     port = strToInt(argv[2], &ok);
     if ( 0 != ok )
     {
-        printf("Invalid port number\n");
+        outPrintf("Invalid port number\n");
         return 1;
     }
 
-    memset(recvBuff, '0', sizeof(recvBuff));
+    if ( clientFd >= 0 )
+    {
+        outPrintf("Already connected.\n");
+        return 1;
+    }
 
-    if((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    if((sockfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
     {
-        printf("\n Error : Could not create socket \n");
+        outPrintf("\n Error : Could not create socket \n");
         return 1;
     }
 
-    memset(&serv_addr, '0', sizeof(serv_addr));
+    memset(&serv_addr, 0, sizeof(serv_addr));
 
     serv_addr.sin_family = AF_INET;
     serv_addr.sin_port = htons(port);
 
     if(inet_pton(AF_INET, argv[1], &serv_addr.sin_addr)<=0)
     {
-        printf("\n inet_pton error occured\n");
+        outPrintf("\n inet_pton error occured\n");
+        close(sockfd);
         return 1;
     }
 
     if( connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
     {
-        printf("\n Error : Connect Failed \n");
+        outPrintf("\n Error : Connect Failed \n");
+        close(sockfd);
         return 1;
     }
 
-    printf("Connection Established.\nCreating listening thread.\n");
-
-    ret = pthread_create(&listenThread, NULL, clientListen, (void *)&sockfd);
-    if ( 0 != ret )
+    if ( 0 != loopAdd(sockfd, EPOLLIN, clientReply, NULL) )
     {
-        printf("Could not create listener thread.\n");
+        close(sockfd);
         return 1;
     }
 
-    while (1)
-    {
-        printf("[dsh]dclient> ");
-        in = getInput();
-
-        args = getArgs(in, &words);
+    // Take over stdin until the client exits.
+    clientFd = sockfd;
+    shellInput = loopGetHandler(STDIN_FILENO, &shellInputArg);
+    loopAdd(STDIN_FILENO, EPOLLIN, clientInput, NULL);
 
-        if (words > 0 && 0 == strcmp(args[0], "exit") )
-        {
-            pthread_cancel(listenThread); // maybe not great practice?
-            write(sockfd,"exit",4);
-            close(sockfd);
-            break;
-        }
-
-        len = strlen(in);
-        if (len >= 2000)
-        {
-            printf("Command caused buffer overflow -- (2000 character max)\n");
-        }
-        else
-        {
-            write(sockfd,in,len);
-        }
-
-        for (i = 0; i < words; i++)
-        {
-            free(args[i]);
-        }
-        free(args);
-
-        free(in);
-    }
-
-    pthread_join(listenThread, &status);
-
-    printf("Joined thread.\n");
-
-    close(sockfd);
+    outPrintf("Connection Established.\n");
+    outPrintf("[dsh]dclient> ");
 
     return 0;
 }
-
-/***************************************************************************//**
- * @author Joe Lillo
- *
- * @par Description:
- * This function is meant to run in a seperate thread. It simply listens to
- * a socket connection to recieve messages from the server. After recieving a
- * message, the text is printed to stdout.
- *
- * @param[in] arg - Socket connection descriptor.
- *
- ******************************************************************************/
-void* clientListen(void *arg)
-{
-    int len;
-    char recvBuff[2000];
-
-    int * connptr= (int*)arg;
-    int conn = *connptr;
-
-    while(1)
-    {
-        len = read(conn, recvBuff, sizeof(recvBuff)-1);
-        recvBuff[len] = '\0';
-
-        printf("\n[Recieved Message from server]:\n");
-        printf("------------------------------------------\n");
-        printf("%s",recvBuff);
-        printf("------------------------------------------\n");
-    }
-
-
-    pthread_exit(0);
-}
@@ -7,37 +7,46 @@
 #ifndef PROG2_H
 #define PROG2_H
 
+// Most background jobs (command &) running at once.
+#define MAX_JOBS 32
+
+/*!
+ * \brief A command running in the background.
+ */
+struct bgJob
+{
+    int pid;
+    char name[64];
+};
+
 // Execute a command in a new process.
-int execCmd(int argc, char ** argv);
+int execCmd(int argc, char ** argv, const int * types);
 
 // Change working directory of process.
 int changeDirectory(int argc, char ** argv);
 
 // Pipe output from one command into the input of another.
-int doPipe(int argc, char ** argv);
+int doPipe(int argc, char ** argv, const int * types);
 
 // Determine if arguments are requesting a pipe.
-int isPipe (int argc, char ** argv);
+int isPipe (int argc, char ** argv, const int * types);
 
 // Do redirection between files and programs.
-int doRedirect(int argc, char ** argv);
+int doRedirect(int argc, char ** argv, const int * types);
 
 // Determine if arguments are calling for redirection.
-int isRedirect (int argc, char ** argv);
+int isRedirect (int argc, char ** argv, const int * types);
 
 // Determine if arguments are calling for remote pipes. (not used)
-int isRemotePipe (int argc, char ** argv);
+int isRemotePipe (int argc, char ** argv, const int * types);
 
-// Start a socket server.
+// Start a socket server, served from the event loop.
 void doServer(int argc, char **argv);
 
-// Thread function for server.
-void* serverListen(void* conn);
-
-// Start a socket client.
+// Start a socket client, served from the event loop.
 int doClient(int argc, char **argv);
 
-// Thread function for client.
-void* clientListen(void* conn);
+// Collect exited children and report finished background jobs.
+void reapChildren();
 
 #endif
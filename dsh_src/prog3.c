@@ -18,11 +18,36 @@
 #include <sys/shm.h>
 #include <pthread.h>
 #include "helperfunctions.h"
-#include <semaphore.h>
+#include "lzcompress.h"
+#include "eventloop.h"
+#include "output.h"
+#include <time.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <signal.h>
 
 #define K 1024
 #define SHMKEY 1066
 #define SOCKET_PORT 5000
+#define LOCK_HIST_BUCKETS 32
+#define PAGE_ALIGN 4096
+#define LOCK_CHECK_MS 200
+#define LOCK_READER_SLOTS 8
+#define SEQ_SPIN_LIMIT 4096
+#define CHAN_MAGIC 0x4348414e    // "CHAN"
+#define CHAN_PAD 0xffffffffu
+#define MAX_SUBSCRIPTIONS 16
+#define BOX_COMPRESSED 0x1
+
+// Working directory of the process on startup.
+char _START_CWD[1000];
 
 /*!
  * \brief Information to describe a shared memory block.
@@ -31,867 +56,4059 @@ struct shmemInfo
 {
     int boxSize;
     int numBoxes;
+    char * path;    // Mailbox file, or NULL for SysV shared memory.
 };
 
 /*!
  * \brief Reader/Writer lock for a shared memory address.
+ *
+ * Writer preferring: once a writer is waiting, new readers queue behind it,
+ * so a steady stream of readers cannot starve writers. The mutex and
+ * condition variables are process shared and live in the segment.
+ *
+ * Time spent waiting for the lock is recorded in log2 nanosecond buckets:
+ * bucket i counts waits in [2^i, 2^(i+1)) ns, the last bucket counts
+ * everything longer.
+ *
+ * The lock survives holders that die. The mutex is robust, and the
+ * writer's PID and up to LOCK_READER_SLOTS readers' PIDs are recorded, so
+ * waiters that time out (every LOCK_CHECK_MS) can release the lock on
+ * behalf of dead processes. Readers beyond the tracked slots are counted
+ * but cannot be recovered.
  */
 struct rwLock
 {
-    sem_t mutex;
-    sem_t rw_mutex;
+    pthread_mutex_t mutex;
+    pthread_cond_t readers;
+    pthread_cond_t writers;
     int readCount;
+    int writing;
+    int writersWaiting;
+    int writerPid;
+    int readerPids[LOCK_READER_SLOTS];
+    unsigned int recoveries;    // Holders found dead and released.
+    unsigned long long readWait[LOCK_HIST_BUCKETS];
+    unsigned long long writeWait[LOCK_HIST_BUCKETS];
 };
 
 /*!
- * \brief Wrapper function for creating shared memory.
- * \param argc - Number of arguments
- * \param argv - argv[1] = number of mailboxes. argv[2] = size of mailboxes.
- * \return Error code. 0 for success.
+ * \brief Per-mailbox header stored in front of the data region.
+ *
+ * seq is a sequence lock counter. Writers make it odd for the duration of
+ * a write and even again afterwards, so optimistic readers can detect that
+ * their copy overlapped a write and retry without touching the lock.
+ * seq doubles as a futex word: waitMailbox() sleeps on it and writers wake
+ * it when waiters is non-zero.
+ *
+ * len is the number of bytes stored in the box and generation counts the
+ * messages written to it; both change only under the write lock.
+ *
+ * With BOX_COMPRESSED set in flags the stored bytes are an lzCompress()
+ * block that expands to rawLen bytes.
  */
-int startSharedMemory(int argc, char ** argv)
+struct boxHeader
 {
-    pthread_t thread;
-    int ret;
-    int ok;
+    // Must stay first: lock recovery finds the header from the lock.
+    struct rwLock lock __attribute__((aligned(CACHE_LINE)));
+
+    // Read by optimistic readers; kept off the lock's cache lines.
+    unsigned int seq __attribute__((aligned(CACHE_LINE)));
+    unsigned int waiters;
+    unsigned int len;
+    unsigned int generation;
+    unsigned int flags;
+    unsigned int rawLen;
+};
 
-    // Contains information about the shared memory block.
-    struct shmemInfo *info = malloc(sizeof(struct shmemInfo));
+/*!
+ * \brief Header of a mailbox used as a pub/sub channel. Lives at the start
+ *        of the box's data, followed by the message log.
+ *
+ * The log is a ring of records addressed by ever increasing byte
+ * positions; [tail, head) holds the records still retained. Publishers
+ * append under the box's write lock and retire the oldest records when the
+ * ring is full, moving tail forward before overwriting them. Subscribers
+ * never lock: they copy a record and then re-check tail, so a record that
+ * was overwritten while being copied is detected and skipped.
+ */
+struct chanHeader
+{
+    unsigned int magic;         // CHAN_MAGIC once the box is a channel.
+    unsigned int reserved;
+    unsigned long long head;    // Position after the newest record.
+    unsigned long long tail;    // Position of the oldest retained record.
+    unsigned long long seq;     // Sequence number of the next message.
+};
 
-    // Error checking
-    if (argc < 3)
-    {
-        return -1;
-    }
+/*!
+ * \brief Header of one record in a channel log. Records are padded to 8
+ *        bytes. A record with len CHAN_PAD (or fewer bytes than a record
+ *        header left before the end of the ring) marks a wrap.
+ */
+struct chanRecord
+{
+    unsigned int len;
+    unsigned int reserved;
+    unsigned long long seq;
+};
 
-    // Check if server is already running...
-    if( 0 < getshmemAddr())
-    {
-        printf("Shared memory already exists.\n");
-        return -1;
-    }
+/*!
+ * \brief Address of the header for a mailbox.
+ * \param addr - Attached shared memory address.
+ * \param boxID - Mailbox ID.
+ * \return Pointer to the mailbox header.
+ */
+static struct boxHeader * getBoxHeader(char * addr, int boxID)
+{
+    return (struct boxHeader*)(addr + sizeof(struct segHeader) + (sizeof(struct boxHeader)*boxID));
+}
 
-    // Get number of mailboxes to create.
-    info->numBoxes = strToInt(argv[1],&ok);
-    if (0 != ok)
-    {
-        return -1;
-    }
+/*!
+ * \brief Address of the statistics for a mailbox.
+ * \param addr - Attached shared memory address.
+ * \param boxID - Mailbox ID.
+ * \return Pointer to the mailbox statistics.
+ */
+static struct mboxStats * getBoxStats(char * addr, int boxID)
+{
+    struct segHeader * seg = (struct segHeader*)addr;
+    return (struct mboxStats*)(addr + seg->statsOffset) + boxID;
+}
 
-    // Get size of mailboxes.
-    info->boxSize = strToInt(argv[2], &ok);
-    if (0 != ok)
-    {
-        return -1;
-    }
+/*!
+ * \brief Address of the data region for a mailbox.
+ * \param addr - Attached shared memory address.
+ * \param boxID - Mailbox ID.
+ * \return Pointer to the first byte of mailbox data.
+ */
+static char * getBoxData(char * addr, int boxID)
+{
+    struct segHeader * seg = (struct segHeader*)addr;
+    return addr + seg->dataOffset + seg->boxStride*boxID;
+}
 
-    // Create a thread to handle the shared memory.
-    // (Either a socket server or a file)
-    ret = pthread_create(&thread, NULL, shmemServer, (void *)info);
+/*!
+ * \brief Round a size up to a multiple of a power of two.
+ * \param len - Size to round.
+ * \param align - Alignment (power of two).
+ * \return Rounded size.
+ */
+static size_t alignUp(size_t len, size_t align)
+{
+    return (len + align - 1) & ~(align - 1);
+}
 
-    if (ret != 0)
-    {
-        printf("Error creating pthread.\n");
-    }
+/*!
+ * \brief A file backed mailbox set mapped into this process.
+ */
+struct mboxFile
+{
+    char path[PATH_MAX];
+    char * addr;        // NULL when the slot is free.
+    size_t len;
+    int fd;
+};
 
-    pthread_detach(thread);
+static struct mboxFile mboxFiles[MBOX_MAX_FILES];
+static pthread_mutex_t mboxFilesLock = PTHREAD_MUTEX_INITIALIZER;
 
-    // Wait for the thread to create the shared memory.
-    // Timeout after requesting the shared memory id too many times.
-    unsigned int i = 0;
-    int shmemid = getshmemAddr();
-    while ( shmemid < 0 && i < 1000000 )
-    {
-        i++;
-        shmemid = getshmemAddr();
-    }
+/*!
+ * \brief Open mailbox file for a handle.
+ * \param handle - Mailbox handle.
+ * \return File, or NULL if the handle is not an open file.
+ */
+static struct mboxFile * getMailboxFile(int handle)
+{
+    int slot = handle - MBOX_FILE_HANDLE;
 
-    if ( shmemid > 0 )
-    {
-        printf("New shared memory created:\n");
-        printf("ID: %d\n", shmemid);
-        printf("Number of mailboxes: %d\n",info->numBoxes);
-        printf("Size of mailboxes: %d KB\n", info->boxSize);
-    }
-    else
+    if (slot < 0 || slot >= MBOX_MAX_FILES || NULL == mboxFiles[slot].addr)
     {
-        printf("Timed out creating shared memory...\n");
+        return NULL;
     }
-    return 0;
+    return &mboxFiles[slot];
 }
 
-#ifdef USE_SHMEM_SOCKET
 /*!
- * \brief Wrapper function to delete the shared memory block.
- * \param argc - Number of arguments.
- * \param argv - Note used.
- * \return Error code. 0 on success.
+ * \brief Map a mailbox segment into this process. File backed sets stay
+ *        mapped while open, so only SysV segments are attached here.
+ * \param shmid - Shared memory ID or mailbox file handle.
+ * \param readOnly - Non-zero to attach SysV segments read only.
+ * \return Segment address, (void*)-1 on error (like shmat()).
  */
-int stopSharedMemory(int argc, char ** argv)
+static char * mapSegment(int shmid, int readOnly)
 {
-    char * ret;
-    int retLen;
-
-    //Send the message "exit" to the shared memory socket server.
-    int ok = shmemClient("exit", &ret, &retLen);
-
-    if (0 != ok)
+    if (shmid >= MBOX_FILE_HANDLE)
     {
-        return -1;
+        struct mboxFile * file = getMailboxFile(shmid);
+        return (NULL == file) ? (char*)-1 : file->addr;
     }
 
-    free(ret);
-
-    printf("Shared memory marked for deletion.\n");
-
-    return 0;
+    return shmat(shmid, 0, readOnly ? SHM_RDONLY : 0);
 }
-#else
+
 /*!
- * \brief Wrapper function to delete the shared memory block.
- * \param argc - Number of arguments.
- * \param argv - Note used.
- * \return Error code. 0 on success.
+ * \brief Release a segment returned by mapSegment().
+ * \param addr - Segment address.
  */
-// Delete the shared memory information file.
-int stopSharedMemory()
+static void unmapSegment(char * addr)
 {
-    char path[1000];
-    int addr = getshmemAddr();
-
-    if(0 < addr)
-    {
-        strcpy(path,_START_CWD);
-        strcat(path,"/.dsh_shmem_info");
-        shmctl(addr, IPC_RMID, 0);
-        unlink(path);
-    }
-    else
+    int i;
+    for (i = 0; i < MBOX_MAX_FILES; i++)
     {
-        return -1;
+        if (addr == mboxFiles[i].addr)
+        {
+            return;
+        }
     }
 
-    printf("Shared memory marked for deletion.\n");
-
-    return 0;
+    shmdt(addr);
 }
-#endif
 
 /*!
- * \brief Wrapper function for reading a shared memory box.
- * \param argc - Number of arguments.
- * \param argv - argv[1] = box ID.
- * \return Error code. 0 on success.
+ * \brief Find the segment holding a mailbox.
+ * \param addr - Attached primary segment.
+ * \param boxID - Global mailbox ID.
+ * \param local - Returns the mailbox index within its segment.
+ * \return -1 for an invalid ID, 0 for the primary segment, otherwise the
+ *         extension index plus one.
  */
-int readBox(int argc, char **argv)
+static int locateBox(char * addr, int boxID, int * local)
 {
-    // Error checking.
-    if (argc < 2)
+    struct segHeader * seg = (struct segHeader*)addr;
+    int i;
+
+    if (boxID < 0)
     {
         return -1;
     }
-
-    // Get mailbox number
-    int ok;
-    int box = strToInt(argv[1], &ok);
-    if (0 != ok)
+    if (boxID < seg->numBoxes)
     {
-        return -1;
+        *local = boxID;
+        return 0;
     }
 
-    // Get the shared memory address.
-    int addr = getshmemAddr();
-    if (addr > 0)
+    // Extensions are only ever appended; the acquire pairs with the
+    // release in growMailboxes() so every counted entry is complete.
+    int n = __atomic_load_n(&seg->numExtents, __ATOMIC_ACQUIRE);
+    for (i = n - 1; i >= 0; i--)
     {
-        // Attempt to read from mailbox.
-        if ( 0 != readMailbox(addr,box) )
+        if (boxID >= seg->extents[i].firstBox)
         {
-            printf("Invalid mailbox ID.\n");
+            break;
         }
     }
-    else
+    if (i < 0 || boxID >= seg->extents[i].firstBox + seg->extents[i].numBoxes)
     {
-        printf("No mailboxes exist.\n");
+        return -1;
     }
-    return 0;
+
+    *local = boxID - seg->extents[i].firstBox;
+    return i + 1;
 }
 
 /*!
- * \brief Wrapper function for writing to a shared memory mailbox.
- * \param argc - Number of arguments.
- * \param argv - argv[1] = Mailbox ID.
- * \return Error code. 0 on success.
+ * \brief Attach the segment that holds a mailbox.
+ * \param shmid - Shared memory ID of the primary segment.
+ * \param boxID - Global mailbox ID on entry, index within the returned
+ *        segment on return.
+ * \return Attached segment, or NULL if the ID is invalid.
  */
-int writeBox(int argc, char ** argv)
+static char * attachBox(int shmid, int * boxID)
 {
-    // Error checking
-    if(argc < 2)
-    {
-        return -1;
-    }
+    char * addr = mapSegment(shmid, 0);
+    int local;
 
-    // Get box ID.
-    int ok;
-    int box = strToInt(argv[1], &ok);
-    if (0 != ok)
+    if ((void*)-1 == addr)
     {
-        return -1;
+        return NULL;
     }
 
-    // Get shared memory address.
-    int addr = getshmemAddr();
-    if (addr > 0)
+    int where = locateBox(addr, *boxID, &local);
+    if (where > 0)
     {
-        // Get data to write to mailbox.
-        printf("Enter message to write to box %d: ", box);
-        char * msg = getInput();
-
-        // Attempt to write to mailbox.
-        if ( 0 !=  writeToMailbox(addr, box, msg))
+        int ext = ((struct segHeader*)addr)->extents[where - 1].shmid;
+        unmapSegment(addr);
+        addr = mapSegment(ext, 0);
+        if ((void*)-1 == addr)
         {
-            printf("Invalid mailbox ID\n");
+            return NULL;
         }
-        free(msg);
     }
-    else
+    else if (where < 0)
     {
-        printf("No mailboxes exist.\n");
+        unmapSegment(addr);
+        return NULL;
     }
-    return 0;
+
+    *boxID = local;
+    return addr;
 }
 
 /*!
- * \brief Wrapper function for copying data from one mailbox to another.
- * \param argc - Number of arguments
- * \param argv - argv[1] = from mailbox, argv[2] = to mailbox.
+ * \brief Every segment of a mailbox set, attached.
+ */
+struct mboxSet
+{
+    char * seg[MBOX_MAX_EXTENTS + 1];   // seg[0] is the primary segment.
+    int numSegs;
+};
+
+/*!
+ * \brief Attach the primary segment and all of its extensions.
+ * \param shmid - Shared memory ID of the primary segment.
+ * \param set - Returns the attached segments.
  * \return Error code. 0 on success.
  */
-int copyBox(int argc, char **argv)
+static int attachSet(int shmid, struct mboxSet * set)
 {
-    // Error checking.
-    if (argc < 3)
-    {
-        return -1;
-    }
+    int i;
 
-    // Get 'from' mailbox ID.
-    int ok;
-    int from = strToInt(argv[1], &ok);
-    if (0 != ok)
+    set->seg[0] = mapSegment(shmid, 0);
+    if ((void*)-1 == set->seg[0])
     {
         return -1;
     }
 
-    // Get 'to' mailbox ID.
-    int to = strToInt(argv[2], &ok);
-    if (0 != ok)
-    {
-        return -1;
-    }
+    struct segHeader * seg = (struct segHeader*)set->seg[0];
+    int n = __atomic_load_n(&seg->numExtents, __ATOMIC_ACQUIRE);
 
-    // Get shared memory address.
-    int addr = getshmemAddr();
-    if (addr > 0)
+    set->numSegs = 1;
+    for (i = 0; i < n; i++)
     {
-        // Attempt to copy data.
-        if ( 0 != copyMailbox(addr,from,to) )
+        char * ext = mapSegment(seg->extents[i].shmid, 0);
+        if ((void*)-1 == ext)
         {
-            printf("Could not copy data from mailbox %d to mailbox %d.\n", from, to);
-            return -1;
+            break;
         }
-    }
-    else
-    {
-        printf("No mailboxes exist.\n");
-        return -1;
+        set->seg[set->numSegs++] = ext;
     }
 
-    printf("Data copied from mailbox %d to %d.\n",from, to);
-
     return 0;
 }
 
 /*!
- * \brief Delete shared memory on exit.
+ * \brief Detach every segment in a set.
+ * \param set - Segments to detach.
  */
-void onExit()
+static void detachSet(struct mboxSet * set)
 {
-    if(getshmemParent() == getpid())
+    int i;
+    for (i = 0; i < set->numSegs; i++)
     {
-        printf("Deleting shared memory.\n");
-        stopSharedMemory(0, NULL);
+        unmapSegment(set->seg[i]);
     }
+    set->numSegs = 0;
 }
 
-#ifdef USE_SHMEM_SOCKETS
 /*!
- * \brief Return the shared memory address (ID).
- * \return Shared memory ID.
+ * \brief Segment of a set that holds a mailbox.
+ * \param set - Attached segments.
+ * \param boxID - Global mailbox ID.
+ * \param local - Returns the mailbox index within its segment.
+ * \return Segment address, or NULL if the ID is invalid.
  */
-int getshmemAddr()
+static char * setBox(struct mboxSet * set, int boxID, int * local)
 {
-    char * ret;
-    int retLen;
-
-    // Contact the socket server for the shared memory ID>
-    int ok = shmemClient("a", (void*)&ret, &retLen);
-
-    if (0 != ok)
+    int where = locateBox(set->seg[0], boxID, local);
+    if (where < 0 || where >= set->numSegs)
     {
-        return -1;
+        return NULL;
     }
-
-    // Get the address.
-    int addr = *((int*)ret);
-
-    free(ret);
-
-    return addr;
+    return set->seg[where];
 }
 
 /*!
- * \brief Returns the process ID that started the shared memory.
- * \return PID.
+ * \brief Total number of mailboxes in a set.
+ * \param set - Attached segments.
+ * \return Number of mailboxes.
  */
-int getshmemParent()
+static int setBoxes(struct mboxSet * set)
 {
-    char * ret;
-    int retLen;
-
-    int ok = shmemClient("parent", (void*)&ret, &retLen);
+    struct segHeader * seg = (struct segHeader*)set->seg[set->numSegs - 1];
+    int first = 0;
+    if (set->numSegs > 1)
+    {
+        first = ((struct segHeader*)set->seg[0])->extents[set->numSegs - 2].firstBox;
+    }
+    return first + seg->numBoxes;
+}
+
+/*!
+ * \brief Initialize a robust, process shared mutex.
+ * \param mutex - Mutex to initialize.
+ * \return Error code. 0 on success.
+ */
+static int sharedMutexInit(pthread_mutex_t * mutex)
+{
+    pthread_mutexattr_t mattr;
+
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+
+    int ret = pthread_mutex_init(mutex, &mattr);
+
+    pthread_mutexattr_destroy(&mattr);
+
+    return (0 == ret) ? 0 : -1;
+}
+
+/*!
+ * \brief Initialize a process shared reader/writer lock.
+ * \param lock - Lock to initialize.
+ * \return Error code. 0 on success.
+ */
+static int rwLockInit(struct rwLock * lock)
+{
+    pthread_condattr_t cattr;
+    int ret = 0;
+
+    memset(lock, 0, sizeof(struct rwLock));
+
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+
+    if (0 != sharedMutexInit(&lock->mutex) ||
+            0 != pthread_cond_init(&lock->readers, &cattr) ||
+            0 != pthread_cond_init(&lock->writers, &cattr))
+    {
+        ret = -1;
+    }
+
+    pthread_condattr_destroy(&cattr);
+
+    return ret;
+}
+
+/*!
+ * \brief Current value of the monotonic clock in nanoseconds.
+ * \return Nanoseconds.
+ */
+static unsigned long long nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*!
+ * \brief Add a lock wait time to a histogram.
+ * \param hist - Histogram with LOCK_HIST_BUCKETS buckets.
+ * \param start - Time the wait began (nowNs()).
+ * \return Length of the wait in nanoseconds.
+ */
+static unsigned long long recordWait(unsigned long long * hist, unsigned long long start)
+{
+    unsigned long long ns = nowNs() - start;
+    int bucket = 0;
+
+    if (ns > 0)
+    {
+        bucket = 63 - __builtin_clzll(ns);
+    }
+    if (bucket >= LOCK_HIST_BUCKETS)
+    {
+        bucket = LOCK_HIST_BUCKETS - 1;
+    }
+
+    hist[bucket]++;
+
+    return ns;
+}
+
+/*!
+ * \brief Check whether a process has exited.
+ * \param pid - Process ID.
+ * \return Non-zero if the process no longer exists.
+ */
+static int pidDead(int pid)
+{
+    return pid > 0 && 0 != kill(pid, 0) && ESRCH == errno;
+}
+
+/*!
+ * \brief Release a lock on behalf of holders that have died.
+ *        Must be called with the lock's mutex held.
+ * \param lock - Lock to check.
+ * \return Number of dead holders released.
+ */
+static int reapDeadHolders(struct rwLock * lock)
+{
+    int reaped = 0;
+    int i;
+
+    if (lock->writing && pidDead(lock->writerPid))
+    {
+        // The writer may have died part way through a write. Close off
+        // the sequence count so optimistic readers stop waiting; the
+        // message itself may be torn.
+        struct boxHeader * hdr = (struct boxHeader*)lock;
+        if (__atomic_load_n(&hdr->seq, __ATOMIC_RELAXED) & 1)
+        {
+            hdr->generation++;
+            __atomic_fetch_add(&hdr->seq, 1, __ATOMIC_RELEASE);
+        }
+
+        lock->writing = 0;
+        lock->writerPid = 0;
+        reaped++;
+    }
+
+    for (i = 0; i < LOCK_READER_SLOTS; i++)
+    {
+        if (pidDead(lock->readerPids[i]))
+        {
+            lock->readerPids[i] = 0;
+            lock->readCount--;
+            reaped++;
+        }
+    }
+
+    if (reaped > 0)
+    {
+        lock->recoveries += reaped;
+        pthread_cond_broadcast(&lock->writers);
+        pthread_cond_broadcast(&lock->readers);
+    }
+
+    return reaped;
+}
+
+/*!
+ * \brief Lock the mutex of a reader/writer lock, recovering it if its
+ *        owner died while holding it.
+ * \param lock - Lock whose mutex to take.
+ */
+static void lockMutex(struct rwLock * lock)
+{
+    if (EOWNERDEAD == pthread_mutex_lock(&lock->mutex))
+    {
+        pthread_mutex_consistent(&lock->mutex);
+        reapDeadHolders(lock);
+    }
+}
+
+/*!
+ * \brief Wait on one of a lock's condition variables for at most
+ *        LOCK_CHECK_MS, then check for dead holders.
+ * \param lock - Lock whose mutex is held.
+ * \param cond - Condition variable to wait on.
+ */
+static void waitLock(struct rwLock * lock, pthread_cond_t * cond)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_nsec += LOCK_CHECK_MS * 1000000L;
+    ts.tv_sec += ts.tv_nsec / 1000000000L;
+    ts.tv_nsec %= 1000000000L;
+
+    int ret = pthread_cond_timedwait(cond, &lock->mutex, &ts);
+    if (EOWNERDEAD == ret)
+    {
+        pthread_mutex_consistent(&lock->mutex);
+        reapDeadHolders(lock);
+    }
+    else if (ETIMEDOUT == ret)
+    {
+        reapDeadHolders(lock);
+    }
+}
+
+/*!
+ * \brief Obtain the read side of a mailbox reader/writer lock.
+ * \param lock - Lock to obtain.
+ * \return Time spent waiting in nanoseconds.
+ */
+static unsigned long long readLock(struct rwLock * lock)
+{
+    unsigned long long waited;
+    unsigned long long start = nowNs();
+    int i;
+
+    lockMutex(lock);
+
+    // Queue behind active and waiting writers.
+    while (lock->writing || lock->writersWaiting > 0)
+    {
+        waitLock(lock, &lock->readers);
+    }
+
+    // Increment the number of readers and record who we are.
+    lock->readCount++;
+    for (i = 0; i < LOCK_READER_SLOTS; i++)
+    {
+        if (0 == lock->readerPids[i])
+        {
+            lock->readerPids[i] = getpid();
+            break;
+        }
+    }
+    waited = recordWait(lock->readWait, start);
+
+    pthread_mutex_unlock(&lock->mutex);
+
+    return waited;
+}
+
+/*!
+ * \brief Release the read side of a mailbox reader/writer lock.
+ * \param lock - Lock to release.
+ */
+static void readUnlock(struct rwLock * lock)
+{
+    int pid = getpid();
+    int i;
+
+    lockMutex(lock);
+
+    // Decrement the reader count.
+    lock->readCount--;
+    for (i = 0; i < LOCK_READER_SLOTS; i++)
+    {
+        if (pid == lock->readerPids[i])
+        {
+            lock->readerPids[i] = 0;
+            break;
+        }
+    }
+
+    // If there are no more readers, hand the lock to a waiting writer.
+    if (lock->readCount == 0 && lock->writersWaiting > 0)
+    {
+        pthread_cond_signal(&lock->writers);
+    }
+
+    pthread_mutex_unlock(&lock->mutex);
+}
+
+/*!
+ * \brief Obtain the write side of a mailbox reader/writer lock.
+ * \param lock - Lock to obtain.
+ * \return Time spent waiting in nanoseconds.
+ */
+static unsigned long long writeLock(struct rwLock * lock)
+{
+    unsigned long long waited;
+    unsigned long long start = nowNs();
+
+    lockMutex(lock);
+
+    // Announce the writer so new readers stop entering.
+    lock->writersWaiting++;
+    while (lock->writing || lock->readCount > 0)
+    {
+        waitLock(lock, &lock->writers);
+    }
+    lock->writersWaiting--;
+    lock->writing = 1;
+    lock->writerPid = getpid();
+    waited = recordWait(lock->writeWait, start);
+
+    pthread_mutex_unlock(&lock->mutex);
+
+    return waited;
+}
+
+/*!
+ * \brief Release the write side of a mailbox reader/writer lock.
+ * \param lock - Lock to release.
+ */
+static void writeUnlock(struct rwLock * lock)
+{
+    lockMutex(lock);
+
+    lock->writing = 0;
+    lock->writerPid = 0;
+
+    // Writers go first; readers only run once no writer is queued.
+    if (lock->writersWaiting > 0)
+    {
+        pthread_cond_signal(&lock->writers);
+    }
+    else
+    {
+        pthread_cond_broadcast(&lock->readers);
+    }
+
+    pthread_mutex_unlock(&lock->mutex);
+}
+
+/*!
+ * \brief Mark the start of a write in the mailbox sequence lock.
+ *        Must be called with the write lock held.
+ * \param hdr - Mailbox header.
+ */
+static void seqWriteBegin(struct boxHeader * hdr)
+{
+    __atomic_fetch_add(&hdr->seq, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/*!
+ * \brief Mark the end of a write in the mailbox sequence lock.
+ * \param hdr - Mailbox header.
+ */
+static void seqWriteEnd(struct boxHeader * hdr)
+{
+    // Sequentially consistent so the waiters check below cannot be
+    // reordered before the counter update (pairs with waitMailbox()).
+    __atomic_fetch_add(&hdr->seq, 1, __ATOMIC_SEQ_CST);
+
+    // Wake processes sleeping in waitMailbox().
+    if (0 != __atomic_load_n(&hdr->waiters, __ATOMIC_SEQ_CST))
+    {
+        syscall(SYS_futex, &hdr->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/*!
+ * \brief Count a read in the mailbox statistics.
+ * \param st - Mailbox statistics.
+ * \param len - Bytes read.
+ * \param waitNs - Time spent waiting for the lock.
+ */
+static void statRead(struct mboxStats * st, unsigned int len, unsigned long long waitNs)
+{
+    __atomic_fetch_add(&st->reads, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&st->bytesRead, len, __ATOMIC_RELAXED);
+    if (waitNs)
+    {
+        __atomic_fetch_add(&st->lockWaitNs, waitNs, __ATOMIC_RELAXED);
+    }
+}
+
+/*!
+ * \brief Count a write in the mailbox statistics.
+ * \param st - Mailbox statistics.
+ * \param len - Bytes written (the new length of the box).
+ * \param waitNs - Time spent waiting for the lock.
+ */
+static void statWrite(struct mboxStats * st, unsigned int len, unsigned long long waitNs)
+{
+    __atomic_fetch_add(&st->writes, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&st->bytesWritten, len, __ATOMIC_RELAXED);
+    if (waitNs)
+    {
+        __atomic_fetch_add(&st->lockWaitNs, waitNs, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&st->lastWriter, getpid(), __ATOMIC_RELAXED);
+    __atomic_store_n(&st->len, len, __ATOMIC_RELAXED);
+}
+
+/*!
+ * \brief Length of a mailbox's message once decompressed.
+ *        Must be called with the lock held.
+ * \param hdr - Mailbox header.
+ * \return Message length in bytes.
+ */
+static unsigned int messageLength(struct boxHeader * hdr)
+{
+    return (hdr->flags & BOX_COMPRESSED) ? hdr->rawLen : hdr->len;
+}
+
+/*!
+ * \brief Copy a stored message out of a mailbox, decompressing it if
+ *        needed.
+ * \param flags - Mailbox flags.
+ * \param stored - Stored bytes.
+ * \param storedLen - Number of stored bytes.
+ * \param buf - Destination.
+ * \param bufLen - Size of buf. Longer messages are truncated.
+ * \return Number of bytes written to buf.
+ */
+static unsigned int unpackMessage(unsigned int flags, const char * stored,
+                                  unsigned int storedLen, char * buf, unsigned int bufLen)
+{
+    if (flags & BOX_COMPRESSED)
+    {
+        int n = lzDecompress(stored, storedLen, buf, bufLen);
+        return (n < 0) ? 0 : n;
+    }
+
+    if (storedLen > bufLen)
+    {
+        storedLen = bufLen;
+    }
+    memcpy(buf, stored, storedLen);
+    return storedLen;
+}
+
+/*!
+ * \brief Copy the message of one mailbox into another. Compressed messages
+ *        are copied as they are; they are only expanded if they do not fit
+ *        the destination, which then keeps a truncated plain copy.
+ *        Must be called with both locks held.
+ * \param from_hdr - Source header.
+ * \param from - Source data.
+ * \param to_hdr - Destination header.
+ * \param to - Destination data.
+ * \param to_size - Capacity of the destination in bytes.
+ * \return Message length (uncompressed) now in the destination.
+ */
+static unsigned int copyMessage(struct boxHeader * from_hdr, char * from,
+                                struct boxHeader * to_hdr, char * to,
+                                unsigned int to_size)
+{
+    unsigned int len = from_hdr->len;
+
+    if (len <= to_size)
+    {
+        memcpy(to, from, len);
+        to_hdr->len = len;
+        to_hdr->flags = from_hdr->flags;
+        to_hdr->rawLen = from_hdr->rawLen;
+    }
+    else
+    {
+        to_hdr->len = unpackMessage(from_hdr->flags, from, len, to, to_size);
+        to_hdr->flags = 0;
+    }
+    to_hdr->generation++;
+
+    return messageLength(to_hdr);
+}
+
+static int createSegment (key_t key, int num, int size);
+static size_t segmentSize (int num, int size);
+static void initSegment (char * addr, int num, int size);
+
+/*!
+ * \brief Wrapper function for creating shared memory.
+ * \param argc - Number of arguments
+ * \param argv - argv[1] = number of mailboxes. argv[2] = size of mailboxes.
+ * \return Error code. 0 for success.
+ */
+int startSharedMemory(int argc, char ** argv)
+{
+#ifdef USE_SHMEM_SOCKETS
+    pthread_t thread;
+    int ret;
+#endif
+    int ok;
+
+    // Contains information about the shared memory block.
+    struct shmemInfo *info = malloc(sizeof(struct shmemInfo));
+
+    // Error checking
+    if (argc < 3)
+    {
+        return -1;
+    }
+
+    // Clean up after a shell that exited without deleting its mailboxes.
+    int parent = getshmemParent();
+    if (parent > 0 && 0 != kill(parent, 0) && ESRCH == errno)
+    {
+        char path[1000];
+        int addr = getshmemAddr();
+
+        if (addr >= 0)
+        {
+            deleteMailboxes(addr);
+        }
+        strcpy(path,_START_CWD);
+        strcat(path,"/.dsh_shmem_info");
+        unlink(path);
+        outPrintf("Removed mailboxes left by exited shell %d.\n", parent);
+    }
+
+    // Check if server is already running...
+    if( 0 < getshmemAddr())
+    {
+        outPrintf("Shared memory already exists.\n");
+        return -1;
+    }
+
+    // Get number of mailboxes to create.
+    info->numBoxes = strToInt(argv[1],&ok);
+    if (0 != ok)
+    {
+        return -1;
+    }
+
+    // Get size of mailboxes.
+    info->boxSize = strToInt(argv[2], &ok);
+    if (0 != ok)
+    {
+        return -1;
+    }
+
+    // Optional file to keep the mailboxes in.
+    info->path = (argc > 3) ? strdup(argv[3]) : NULL;
+
+#ifdef USE_SHMEM_SOCKETS
+    // Create a thread to run the shared memory socket server.
+    ret = pthread_create(&thread, NULL, shmemServer, (void *)info);
+
+    if (ret != 0)
+    {
+        outPrintf("Error creating pthread.\n");
+    }
+
+    pthread_detach(thread);
+#else
+    // The information file is written before this returns; no thread.
+    shmemServer(info);
+#endif
+
+    // Wait for the thread to create the shared memory.
+    // Timeout after requesting the shared memory id too many times.
+    unsigned int i = 0;
+    int shmemid = getshmemAddr();
+    while ( shmemid < 0 && i < 1000000 )
+    {
+        i++;
+        shmemid = getshmemAddr();
+    }
+
+    if ( shmemid > 0 )
+    {
+        outPrintf("New shared memory created:\n");
+        outPrintf("ID: %d\n", shmemid);
+        outPrintf("Number of mailboxes: %d\n",info->numBoxes);
+        outPrintf("Size of mailboxes: %d KB\n", info->boxSize);
+        if (NULL != info->path)
+        {
+            outPrintf("Backed by file: %s\n", info->path);
+        }
+    }
+    else
+    {
+        outPrintf("Timed out creating shared memory...\n");
+    }
+    return 0;
+}
+
+#ifdef USE_SHMEM_SOCKET
+/*!
+ * \brief Wrapper function to delete the shared memory block.
+ * \param argc - Number of arguments.
+ * \param argv - Note used.
+ * \return Error code. 0 on success.
+ */
+int stopSharedMemory(int argc, char ** argv)
+{
+    char * ret;
+    int retLen;
+
+    //Send the message "exit" to the shared memory socket server.
+    int ok = shmemClient("exit", &ret, &retLen);
+
+    if (0 != ok)
+    {
+        return -1;
+    }
+
+    free(ret);
+
+    outPrintf("Shared memory marked for deletion.\n");
+
+    return 0;
+}
+#else
+/*!
+ * \brief Wrapper function to delete the shared memory block.
+ * \param argc - Number of arguments.
+ * \param argv - Note used.
+ * \return Error code. 0 on success.
+ */
+// Delete the shared memory information file.
+int stopSharedMemory()
+{
+    char path[1000];
+    int addr = getshmemAddr();
+
+    if(0 < addr)
+    {
+        strcpy(path,_START_CWD);
+        strcat(path,"/.dsh_shmem_info");
+        deleteMailboxes(addr);
+        unlink(path);
+    }
+    else
+    {
+        return -1;
+    }
+
+    if (addr >= MBOX_FILE_HANDLE)
+    {
+        outPrintf("Mailbox file checkpointed and closed.\n");
+        return 0;
+    }
+
+    outPrintf("Shared memory marked for deletion.\n");
+
+    return 0;
+}
+#endif
+
+/*!
+ * \brief Wrapper function for reading a shared memory box.
+ * \param argc - Number of arguments.
+ * \param argv - argv[1] = box ID.
+ * \return Error code. 0 on success.
+ */
+int readBox(int argc, char **argv)
+{
+    // Error checking.
+    if (argc < 2)
+    {
+        return -1;
+    }
+
+    // Get mailbox number
+    int ok;
+    int box = strToInt(argv[1], &ok);
+    if (0 != ok)
+    {
+        return -1;
+    }
+
+    // Get the shared memory address.
+    int addr = getshmemAddr();
+    if (addr > 0)
+    {
+        // Attempt to read from mailbox.
+#ifdef USE_SEQLOCK_READS
+        if ( 0 != readMailboxSeq(addr,box) )
+#else
+        if ( 0 != readMailbox(addr,box) )
+#endif
+        {
+            outPrintf("Invalid mailbox ID.\n");
+        }
+    }
+    else
+    {
+        outPrintf("No mailboxes exist.\n");
+    }
+    return 0;
+}
+
+/*!
+ * \brief Wrapper function for writing to a shared memory mailbox.
+ * \param argc - Number of arguments.
+ * \param argv - argv[1] = Mailbox ID, or -z (store compressed if smaller)
+ *        followed by the mailbox ID.
+ * \return Error code. 0 on success.
+ */
+int writeBox(int argc, char ** argv)
+{
+    int flags = 0;
+    if (argc > 1 && 0 == strcmp(argv[1], "-z"))
+    {
+        flags = MBOX_WRITE_COMPRESS;
+        argc--;
+        argv++;
+    }
+
+    // Error checking
+    if(argc < 2)
+    {
+        return -1;
+    }
+
+    // Get box ID.
+    int ok;
+    int box = strToInt(argv[1], &ok);
+    if (0 != ok)
+    {
+        return -1;
+    }
+
+    // Get shared memory address.
+    int addr = getshmemAddr();
+    if (addr > 0)
+    {
+        // Get data to write to mailbox.
+        outPrintf("Enter message to write to box %d: ", box);
+        outFlush();
+        char * msg = getInput();
+        if (NULL == msg)
+        {
+            return -1;
+        }
+
+        // Attempt to write to mailbox.
+        if ( 0 !=  writeToMailbox(addr, box, msg, flags))
+        {
+            outPrintf("Invalid mailbox ID\n");
+        }
+        free(msg);
+    }
+    else
+    {
+        outPrintf("No mailboxes exist.\n");
+    }
+    return 0;
+}
+
+/*!
+ * \brief Wrapper function for copying data from one mailbox to another.
+ * \param argc - Number of arguments
+ * \param argv - argv[1] = from mailbox, argv[2] = to mailbox.
+ * \return Error code. 0 on success.
+ */
+int copyBox(int argc, char **argv)
+{
+    // Error checking.
+    if (argc < 3)
+    {
+        return -1;
+    }
+
+    // Get 'from' mailbox ID.
+    int ok;
+    int from = strToInt(argv[1], &ok);
+    if (0 != ok)
+    {
+        return -1;
+    }
+
+    // Get 'to' mailbox ID.
+    int to = strToInt(argv[2], &ok);
+    if (0 != ok)
+    {
+        return -1;
+    }
+
+    // Get shared memory address.
+    int addr = getshmemAddr();
+    if (addr > 0)
+    {
+        // Attempt to copy data.
+        if ( 0 != copyMailbox(addr,from,to) )
+        {
+            outPrintf("Could not copy data from mailbox %d to mailbox %d.\n", from, to);
+            return -1;
+        }
+    }
+    else
+    {
+        outPrintf("No mailboxes exist.\n");
+        return -1;
+    }
+
+    outPrintf("Data copied from mailbox %d to %d.\n",from, to);
+
+    return 0;
+}
+
+/*!
+ * \brief Wrapper function for printing the lock wait histograms of a mailbox.
+ * \param argc - Number of arguments.
+ * \param argv - argv[1] = box ID.
+ * \return Error code. 0 on success.
+ */
+int histBox(int argc, char ** argv)
+{
+    // Error checking.
+    if (argc < 2)
+    {
+        return -1;
+    }
+
+    // Get mailbox number
+    int ok;
+    int box = strToInt(argv[1], &ok);
+    if (0 != ok)
+    {
+        return -1;
+    }
+
+    // Get the shared memory address.
+    int addr = getshmemAddr();
+    if (addr > 0)
+    {
+        if ( 0 != printLockHistogram(addr,box) )
+        {
+            outPrintf("Invalid mailbox ID.\n");
+            return -1;
+        }
+    }
+    else
+    {
+        outPrintf("No mailboxes exist.\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * \brief Wrapper function for waiting on a mailbox to change.
+ * \param argc - Number of arguments.
+ * \param argv - argv[1] = box ID. argv[2] = timeout in milliseconds (optional).
+ * \return Error code. 0 on success.
+ */
+int waitBox(int argc, char ** argv)
+{
+    // Error checking.
+    if (argc < 2)
+    {
+        return -1;
+    }
+
+    // Get mailbox number
+    int ok;
+    int box = strToInt(argv[1], &ok);
+    if (0 != ok)
+    {
+        return -1;
+    }
+
+    // Get optional timeout. Wait forever without one.
+    int timeout = -1;
+    if (argc > 2)
+    {
+        timeout = strToInt(argv[2], &ok);
+        if (0 != ok)
+        {
+            outPrintf("Invalid timeout.\n");
+            return -1;
+        }
+    }
+
+    // Get the shared memory address.
+    int addr = getshmemAddr();
+    if (addr <= 0)
+    {
+        outPrintf("No mailboxes exist.\n");
+        return -1;
+    }
+
+    unsigned int version;
+    if (0 != getMailboxVersion(addr, box, &version))
+    {
+        outPrintf("Invalid mailbox ID.\n");
+        return -1;
+    }
+
+    // Sleep until a writer updates the box, then show the new contents.
+    int ret = waitMailbox(addr, box, &version, timeout);
+    if (0 == ret)
+    {
+        readMailboxSeq(addr, box);
+    }
+    else if (1 == ret)
+    {
+        outPrintf("Timed out waiting for mailbox %d.\n", box);
+    }
+    else if (2 == ret)
+    {
+        outPrintf("Interrupted.\n");
+    }
+    else
+    {
+        outPrintf("Could not wait on mailbox %d.\n", box);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*!
+ * \brief Parse a mailbox ID or an inclusive range of IDs ("3" or "1-32").
+ * \param str - String to parse.
+ * \param first - Returns the first ID.
+ * \param last - Returns the last ID.
+ * \return Error code. 0 on success.
+ */
+static int parseBoxRange(char * str, int * first, int * last)
+{
+    char tmp[32];
+    int ok;
+
+    char * dash = strchr(str, '-');
+    if (NULL == dash || dash == str)
+    {
+        *first = *last = strToInt(str, &ok);
+        return ok;
+    }
+
+    if (dash - str >= (int)sizeof(tmp))
+    {
+        return -1;
+    }
+    memcpy(tmp, str, dash - str);
+    tmp[dash - str] = '\0';
+
+    *first = strToInt(tmp, &ok);
+    if (0 != ok)
+    {
+        return -1;
+    }
+    *last = strToInt(dash + 1, &ok);
+    if (0 != ok || *last < *first)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * \brief Wrapper function for running a batch of mailbox operations.
+ *        Operations are given as a list:
+ *        read <box> | write <box> <word> | copy <from> <to>[-<last>]
+ * \param argc - Number of arguments
+ * \param argv - Operation list starting at argv[1].
+ * \return Error code. 0 on success.
+ */
+int txnBox(int argc, char ** argv)
+{
+    struct mboxOp * ops = NULL;
+    int numOps = 0;
+    int i = 1;
+    int first, last, ok;
+
+    // Get shared memory address.
+    int addr = getshmemAddr();
+    if (addr <= 0)
+    {
+        outPrintf("No mailboxes exist.\n");
+        return -1;
+    }
+
+    // Ranges are checked against the set before anything is allocated.
+    int numBoxes = getMailboxCount(addr);
+    if (numBoxes < 0)
+    {
+        outPrintf("Invalid mailbox transaction.\n");
+        return -1;
+    }
+
+    while (i < argc)
+    {
+        int need = 0;
+        if (0 == strcmp(argv[i], "read") && i + 1 < argc)
+        {
+            if (0 != parseBoxRange(argv[i+1], &first, &last))
+            {
+                break;
+            }
+            need = 2;
+        }
+        else if (0 == strcmp(argv[i], "write") && i + 2 < argc)
+        {
+            first = last = strToInt(argv[i+1], &ok);
+            if (0 != ok)
+            {
+                break;
+            }
+            need = 3;
+        }
+        else if (0 == strcmp(argv[i], "copy") && i + 2 < argc)
+        {
+            if (0 != parseBoxRange(argv[i+2], &first, &last))
+            {
+                break;
+            }
+            need = 3;
+        }
+        else
+        {
+            break;
+        }
+
+        if (first < 0 || last >= numBoxes)
+        {
+            outPrintf("Invalid mailbox ID: %s\n", argv[i + need - 1]);
+            free(ops);
+            return -1;
+        }
+
+        // One operation per box in the range.
+        struct mboxOp * grown = realloc(ops, sizeof(struct mboxOp) * (numOps + last - first + 1));
+        if (NULL == grown)
+        {
+            outPrintf("Out of memory.\n");
+            free(ops);
+            return -1;
+        }
+        ops = grown;
+        for (; first <= last; first++)
+        {
+            struct mboxOp * op = &ops[numOps++];
+            memset(op, 0, sizeof(struct mboxOp));
+            op->box = first;
+
+            if ('r' == argv[i][0])
+            {
+                op->type = MBOX_OP_READ;
+            }
+            else if ('w' == argv[i][0])
+            {
+                op->type = MBOX_OP_WRITE;
+                op->data = argv[i+2];
+                op->len = strlen(argv[i+2]);
+            }
+            else
+            {
+                op->type = MBOX_OP_COPY;
+                op->from = strToInt(argv[i+1], &ok);
+                if (0 != ok)
+                {
+                    op->from = -1;
+                }
+            }
+        }
+
+        i += need;
+    }
+
+    if (i < argc || 0 == numOps)
+    {
+        outPrintf("Usage: mboxtxn read <box> | write <box> <word> | copy <from> <to>[-<last>] ...\n");
+        free(ops);
+        return -1;
+    }
+
+    if (0 != mailboxTransaction(addr, ops, numOps))
+    {
+        outPrintf("Invalid mailbox transaction.\n");
+        free(ops);
+        return -1;
+    }
+
+    outPrintf("Transaction of %d operations complete.\n", numOps);
+
+    free(ops);
+    return 0;
+}
+
+/*!
+ * \brief Wrapper function for binding mailboxes to a NUMA node.
+ * \param argc - Number of arguments
+ * \param argv - argv[1] = box ID or range (first-last), argv[2] = node.
+ * \return Error code. 0 on success.
+ */
+int bindBox(int argc, char ** argv)
+{
+    int first, last, ok;
+
+    // Error checking.
+    if (argc < 3 || 0 != parseBoxRange(argv[1], &first, &last))
+    {
+        outPrintf("Usage: mboxbind <box>[-<last>] <node>\n");
+        return -1;
+    }
+
+    int node = strToInt(argv[2], &ok);
+    if (0 != ok)
+    {
+        outPrintf("Invalid NUMA node.\n");
+        return -1;
+    }
+
+    // Get shared memory address.
+    int addr = getshmemAddr();
+    if (addr <= 0)
+    {
+        outPrintf("No mailboxes exist.\n");
+        return -1;
+    }
+
+    for (; first <= last; first++)
+    {
+        if (0 != bindMailbox(addr, first, node))
+        {
+            outPrintf("Could not bind mailbox %d to node %d.\n", first, node);
+            return -1;
+        }
+    }
+
+    outPrintf("Mailboxes bound to node %d.\n", node);
+
+    return 0;
+}
+
+/*!
+ * \brief Wrapper function for printing mailbox statistics.
+ * \param argc - Number of arguments
+ * \param argv - argv[1] = box ID (optional, all boxes without it).
+ * \return Error code. 0 on success.
+ */
+int statBox(int argc, char ** argv)
+{
+    int box = -1;
+    int ok;
+
+    if (argc > 1)
+    {
+        box = strToInt(argv[1], &ok);
+        if (0 != ok || box < 0)
+        {
+            outPrintf("Invalid mailbox ID.\n");
+            return -1;
+        }
+    }
+
+    // Get shared memory address.
+    int addr = getshmemAddr();
+    if (addr <= 0)
+    {
+        outPrintf("No mailboxes exist.\n");
+        return -1;
+    }
+
+    if (0 != printMailboxStats(addr, box))
+    {
+        outPrintf("Invalid mailbox ID.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*!
+ * \brief Wrapper function for adding mailboxes to the shared memory.
+ * \param argc - Number of arguments
+ * \param argv - argv[1] = number of mailboxes. argv[2] = size of mailboxes.
+ * \return Error code. 0 on success.
+ */
+int growBox(int argc, char ** argv)
+{
+    int ok;
+
+    // Error checking
+    if (argc < 3)
+    {
+        outPrintf("Usage: mboxgrow <num> <size KB>\n");
+        return -1;
+    }
+
+    int num = strToInt(argv[1], &ok);
+    if (0 != ok || num < 1)
+    {
+        outPrintf("Invalid number of mailboxes.\n");
+        return -1;
+    }
+
+    int size = strToInt(argv[2], &ok);
+    if (0 != ok || size < 1)
+    {
+        outPrintf("Invalid mailbox size.\n");
+        return -1;
+    }
+
+    // Get shared memory address.
+    int addr = getshmemAddr();
+    if (addr <= 0)
+    {
+        outPrintf("No mailboxes exist.\n");
+        return -1;
+    }
+
+    int first = growMailboxes(addr, num, size);
+    if (first < 0)
+    {
+        outPrintf("Could not add mailboxes.\n");
+        return -1;
+    }
+
+    outPrintf("Added mailboxes %d-%d (%d KB).\n", first, first + num - 1, size);
+
+    return 0;
+}
+
+/*!
+ * \brief Wrapper function for checkpointing a file backed mailbox set.
+ * \param argc - Number of arguments
+ * \param argv - Not used.
+ * \return Error code. 0 on success.
+ */
+int syncBox(int argc, char ** argv)
+{
+    UNUSED(argc);
+    UNUSED(argv);
+
+    // Get shared memory address.
+    int addr = getshmemAddr();
+    if (addr <= 0)
+    {
+        outPrintf("No mailboxes exist.\n");
+        return -1;
+    }
+
+    if (addr < MBOX_FILE_HANDLE)
+    {
+        outPrintf("Mailboxes are not backed by a file.\n");
+        return -1;
+    }
+
+    if (0 != syncMailboxFile(addr))
+    {
+        perror("msync");
+        return -1;
+    }
+
+    outPrintf("Mailboxes checkpointed.\n");
+
+    return 0;
+}
+
+/*!
+ * \brief Wrapper function for publishing a message to a channel.
+ * \param argc - Number of arguments
+ * \param argv - argv[1] = box ID. argv[2..] = message (prompted for if
+ *        missing).
+ * \return Error code. 0 on success.
+ */
+int pubBox(int argc, char ** argv)
+{
+    int ok;
+    int i;
+
+    // Error checking
+    if (argc < 2)
+    {
+        outPrintf("Usage: mboxpub <box> [message]\n");
+        return -1;
+    }
+
+    int box = strToInt(argv[1], &ok);
+    if (0 != ok)
+    {
+        outPrintf("Invalid mailbox ID.\n");
+        return -1;
+    }
+
+    // Get shared memory address.
+    int addr = getshmemAddr();
+    if (addr <= 0)
+    {
+        outPrintf("No mailboxes exist.\n");
+        return -1;
+    }
+
+    // Message from the command line, or prompt for it.
+    char * msg;
+    if (argc > 2)
+    {
+        size_t len = 0;
+        for (i = 2; i < argc; i++)
+        {
+            len += strlen(argv[i]) + 1;
+        }
+        msg = malloc(len);
+        if (NULL == msg)
+        {
+            outPrintf("Out of memory.\n");
+            return -1;
+        }
+        msg[0] = '\0';
+        for (i = 2; i < argc; i++)
+        {
+            strcat(msg, argv[i]);
+            if (i < argc - 1)
+            {
+                strcat(msg, " ");
+            }
+        }
+    }
+    else
+    {
+        outPrintf("Enter message to publish to box %d: ", box);
+        outFlush();
+        msg = getInput();
+        if (NULL == msg)
+        {
+            return -1;
+        }
+    }
+
+    int ret = mailboxPublish(addr, box, msg, strlen(msg));
+    if (ret < 0)
+    {
+        outPrintf("Could not publish to mailbox %d (invalid ID or message too large).\n", box);
+    }
+    else
+    {
+        outPrintf("Published %d bytes to channel %d.\n", ret, box);
+    }
+
+    free(msg);
+
+    return (ret < 0) ? -1 : 0;
+}
+
+/*!
+ * \brief Print every message waiting for a subscriber.
+ * \param sub - Subscription.
+ * \param buf - Buffer of at least sub->maxLen bytes.
+ * \return Number of messages printed.
+ */
+static int drainSubscription(struct mboxSub * sub, char * buf)
+{
+    unsigned long long lost = sub->lost;
+    int count = 0;
+    int len;
+
+    while (1 == mailboxNext(sub, buf, sub->maxLen, &len, NULL))
+    {
+        outPrintf("Message: ");
+        outWrite(buf, len);
+        outPrintf("\n");
+        count++;
+    }
+
+    if (sub->lost > lost)
+    {
+        outPrintf("Missed %llu message(s): fell behind the publisher.\n", sub->lost - lost);
+    }
+
+    return count;
+}
+
+/*!
+ * \brief Wrapper function for reading a channel. The shell keeps one
+ *        subscription per box, so each call shows only messages published
+ *        since the previous one.
+ * \param argc - Number of arguments
+ * \param argv - argv[1] = box ID. argv[2] = optional time in ms to wait
+ *        for a message if none are pending.
+ * \return Error code. 0 on success.
+ */
+int subBox(int argc, char ** argv)
+{
+    static struct mboxSub subs[MAX_SUBSCRIPTIONS];
+    static int numSubs = 0;
+    int ok;
+    int i;
+
+    // Error checking
+    if (argc < 2)
+    {
+        outPrintf("Usage: mboxsub <box> [timeout ms]\n");
+        return -1;
+    }
+
+    int box = strToInt(argv[1], &ok);
+    if (0 != ok)
+    {
+        outPrintf("Invalid mailbox ID.\n");
+        return -1;
+    }
+
+    int timeout = 0;
+    if (argc > 2)
+    {
+        timeout = strToInt(argv[2], &ok);
+        if (0 != ok)
+        {
+            outPrintf("Invalid timeout.\n");
+            return -1;
+        }
+    }
+
+    // Get shared memory address.
+    int addr = getshmemAddr();
+    if (addr <= 0)
+    {
+        outPrintf("No mailboxes exist.\n");
+        return -1;
+    }
+
+    // Find this shell's subscription, starting one at the oldest retained
+    // message the first time.
+    struct mboxSub * sub = NULL;
+    for (i = 0; i < numSubs; i++)
+    {
+        if (subs[i].shmid == addr && subs[i].box == box)
+        {
+            sub = &subs[i];
+        }
+    }
+    if (NULL == sub)
+    {
+        if (numSubs == MAX_SUBSCRIPTIONS)
+        {
+            outPrintf("Too many subscriptions.\n");
+            return -1;
+        }
+        if (0 != mailboxSubscribe(addr, box, &subs[numSubs], 1))
+        {
+            outPrintf("Invalid mailbox ID.\n");
+            return -1;
+        }
+        sub = &subs[numSubs++];
+    }
+
+    char * buf = malloc(sub->maxLen);
+    unsigned int version;
+
+    if (NULL == buf)
+    {
+        outPrintf("Out of memory.\n");
+        return -1;
+    }
+
+    // Sample the version first so a message published after the drain
+    // still ends the wait.
+    getMailboxVersion(addr, box, &version);
+    if (0 == drainSubscription(sub, buf) && 0 != timeout)
+    {
+        int ret = waitMailbox(addr, box, &version, timeout);
+        if (0 == ret)
+        {
+            drainSubscription(sub, buf);
+        }
+        else if (2 == ret)
+        {
+            outPrintf("Interrupted.\n");
+        }
+        else
+        {
+            outPrintf("No messages on channel %d.\n", box);
+        }
+    }
+
+    free(buf);
+
+    return 0;
+}
+
+/*!
+ * \brief A mailbox watched by mboxnotify.
+ */
+struct mboxNotify
+{
+    int box;
+    unsigned int version;
+};
+
+static struct mboxNotify mboxNotifies[MBOX_MAX_NOTIFY];
+static int numNotifies = 0;
+static int notifyTimer = -1;
+
+/*!
+ * \brief Stop watching every mailbox.
+ */
+static void stopNotifies()
+{
+    numNotifies = 0;
+    if (notifyTimer >= 0)
+    {
+        loopRemoveTimer(notifyTimer);
+        notifyTimer = -1;
+    }
+}
+
+/*!
+ * \brief Event loop timer: report watched mailboxes whose version moved.
+ *        Futexes have no file descriptor to wait on, so the versions are
+ *        sampled instead (a few loads per box).
+ * \param fd - Timer (not used).
+ * \param events - Not used.
+ * \param arg - Not used.
+ */
+static void checkNotifies(int fd, unsigned int events, void * arg)
+{
+    unsigned int version;
+    int i;
+
+    int addr = getshmemAddr();
+    if (addr <= 0)
+    {
+        outPrintf("\n[mbox] Mailboxes deleted, notifications stopped.\n");
+        stopNotifies();
+        outFlush();
+        return;
+    }
+
+    for (i = 0; i < numNotifies; i++)
+    {
+        if (0 == getMailboxVersion(addr, mboxNotifies[i].box, &version) &&
+            version != mboxNotifies[i].version)
+        {
+            mboxNotifies[i].version = version;
+            outPrintf("\n[mbox] Box %d changed.\n", mboxNotifies[i].box);
+        }
+    }
+    outFlush();
+}
+
+/*!
+ * \brief Wrapper function for watching a mailbox from the event loop. A
+ *        message is printed whenever the box is written.
+ * \param argc - Number of arguments.
+ * \param argv - argv[1] = box ID. argv[2] = "off" to stop watching it.
+ * \return Error code. 0 on success.
+ */
+int notifyBox(int argc, char ** argv)
+{
+    int i;
+    int ok;
+
+    // Error checking.
+    if (argc < 2)
+    {
+        return -1;
+    }
+
+    int box = strToInt(argv[1], &ok);
+    if (0 != ok)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < numNotifies && mboxNotifies[i].box != box; i++)
+        ;
+
+    if (argc > 2 && 0 == strcmp(argv[2], "off"))
+    {
+        if (i == numNotifies)
+        {
+            outPrintf("Box %d is not being watched.\n", box);
+            return -1;
+        }
+        mboxNotifies[i] = mboxNotifies[--numNotifies];
+        if (0 == numNotifies)
+        {
+            stopNotifies();
+        }
+        outPrintf("Stopped watching box %d.\n", box);
+        return 0;
+    }
+
+    if (i < numNotifies)
+    {
+        outPrintf("Box %d is already being watched.\n", box);
+        return 0;
+    }
+    if (MBOX_MAX_NOTIFY == numNotifies)
+    {
+        outPrintf("Too many watched boxes (%d max).\n", MBOX_MAX_NOTIFY);
+        return -1;
+    }
+
+    int addr = getshmemAddr();
+    if (addr <= 0)
+    {
+        outPrintf("No mailboxes exist.\n");
+        return -1;
+    }
+
+    unsigned int version;
+    if (0 != getMailboxVersion(addr, box, &version))
+    {
+        outPrintf("Invalid mailbox ID.\n");
+        return -1;
+    }
+
+    if (notifyTimer < 0)
+    {
+        notifyTimer = loopAddTimer(MBOX_NOTIFY_MS, checkNotifies, NULL);
+        if (notifyTimer < 0)
+        {
+            outPrintf("Could not start the notification timer.\n");
+            return -1;
+        }
+    }
+
+    mboxNotifies[numNotifies].box = box;
+    mboxNotifies[numNotifies].version = version;
+    numNotifies++;
+
+    outPrintf("Watching box %d for changes.\n", box);
+
+    return 0;
+}
+
+/*!
+ * \brief Delete shared memory on exit.
+ */
+void onExit()
+{
+    if(getshmemParent() == getpid())
+    {
+        outPrintf("Deleting shared memory.\n");
+        stopSharedMemory(0, NULL);
+    }
+}
+
+#ifdef USE_SHMEM_SOCKETS
+/*!
+ * \brief Return the shared memory address (ID).
+ * \return Shared memory ID.
+ */
+int getshmemAddr()
+{
+    char * ret;
+    int retLen;
+
+    // Contact the socket server for the shared memory ID>
+    int ok = shmemClient("a", (void*)&ret, &retLen);
+
+    if (0 != ok)
+    {
+        return -1;
+    }
+
+    // Get the address.
+    int addr = *((int*)ret);
+
+    free(ret);
+
+    return addr;
+}
+
+/*!
+ * \brief Returns the process ID that started the shared memory.
+ * \return PID.
+ */
+int getshmemParent()
+{
+    char * ret;
+    int retLen;
+
+    int ok = shmemClient("parent", (void*)&ret, &retLen);
+
+    if (0 != ok)
+    {
+        return -1;
+    }
+
+    int addr = *((int*)ret);
+
+    free(ret);
+
+    return addr;
+}
+#else
+
+/*!
+ * \brief Return the shared memory address (ID).
+ * \return Shared memory ID.
+ */
+int getshmemAddr()
+{
+    char path[1000];
+    FILE* f = NULL;
+    int pid = -1;
+    int addr = -1;
+
+    // Create file path.
+    strcpy(path,_START_CWD);
+    strcat(path,"/.dsh_shmem_info");
+
+    // Open shared memory information file.
+    f = fopen(path,"r");
+    if (f)
+    {
+        fread(&pid,sizeof(int),1,f);
+        fread(&addr,sizeof(int),1,f);
+
+        // Mailbox file: map it (once) in this process.
+        if (MBOX_FILE_HANDLE == addr)
+        {
+            char file[PATH_MAX];
+            size_t len = fread(file,1,sizeof(file) - 1,f);
+            file[len] = '\0';
+            addr = openMailboxFile(file, 0, 0);
+        }
+        fclose(f);
+    }
+    else
+    {
+        DEBUG_PROG3("getshmemAddr: Shared memory does not exist\n",0);
+    }
+
+    return addr;
+}
+
+/*!
+ * \brief Returns the process ID that started the shared memory.
+ * \return PID.
+ */
+int getshmemParent()
+{
+    char path[1000];
+    FILE* f = NULL;
+    int pid = -1;
+    int addr = -1;
+
+    // Create file path.
+    strcpy(path,_START_CWD);
+    strcat(path,"/.dsh_shmem_info");
+
+    // Open shared memory information file.
+    f = fopen(path,"r");
+    if (f)
+    {
+        fread(&pid,sizeof(int),1,f);
+        fread(&addr,sizeof(int),1,f);
+        fclose(f);
+    }
+    else
+    {
+        DEBUG_PROG3("getshmemParent: Shared memory does not exist\n",0);
+    }
+
+    return pid;
+}
+#endif
+
+#ifdef USE_SHMEM_SOCKETS
+/*!
+ * \brief Socket server for handling shared memory information.
+ * \param arg - Used to pass number and size of mailboxes to function.
+ * \return
+ */
+void* shmemServer (void* arg)
+{
+    struct shmemInfo * info = arg;
+    int listenfd = 0, connfd = 0;
+    struct sockaddr_in serv_addr;
+    int len;
+    char recvBuff[2000];
+
+    // Get the PID that started the shared memory
+    int parent = getpid();
+    DEBUG_PROG3("Shared memory server pid",parent);
+
+    outPrintf("\n");
+
+    // Create the shared memory.
+    int shmid = createMailboxes(info->numBoxes, info->boxSize);
+    if (shmid < 0)
+    {
+        return NULL;
+    }
+
+    // Setup socket
+    listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&serv_addr, '0', sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    serv_addr.sin_port = htons(SOCKET_PORT);
+    bind(listenfd, (struct sockaddr*)&serv_addr, sizeof(serv_addr));
+    listen(listenfd, 10);
+
+    // Accept and process client requests.
+    while (1)
+    {
+        // Accept client connection.
+        connfd = accept(listenfd, (struct sockaddr*)NULL, NULL);
+
+        DEBUG_PROG3("Shared memory server accepted connection",connfd);
+
+        // Read message from client.
+        len = read(connfd, recvBuff, sizeof(recvBuff)-1);
+        recvBuff[len] = '\0';
+
+        // Handle exit command.
+        if (0 == strcmp("exit",recvBuff))
+        {
+            DEBUG_PROG3("Shared memory server exiting",0);
+            write(connfd, "OK\0", 3);
+            break;
+        }
+
+        // Send PID that started the shared memory.
+        else if (0 == strcmp("parent",recvBuff))
+        {
+            DEBUG_PROG3("Shared memory server writing parent ID",0);
+            write(connfd, &parent, sizeof(int));
+        }
+
+        // Send the shared memory ID.
+        else
+        {
+            DEBUG_PROG3("Shared memory server writing shared memory id",0);
+            write(connfd, &shmid, sizeof(int));
+        }
+
+        close(connfd);
+    }
+
+    // Delete shared memory.
+    shmctl(shmid, IPC_RMID, 0);
+
+    shutdown(listenfd, 2);
+
+    pthread_exit(0);
+}
+#else
+/*!
+ * \brief File server for handling shared memory information.
+ * \param arg - Used to pass number and size of mailboxes to function.
+ * \return
+ */
+// This implementation of the socket server uses a file
+// to distribute shared memory information.
+void* shmemServer (void* arg)
+{
+    char path[1000];
+    struct shmemInfo * info = arg;
+    FILE* f = NULL;
+
+    // Construct the path to the shmem file.
+    strcpy(path,_START_CWD);
+    strcat(path,"/.dsh_shmem_info");
+
+    // Determine if the file exists.
+    f = fopen(path,"r");
+    if (f)
+    {
+        fclose(f);
+        outPrintf("Error: Shared memory already exists.\n");
+        return NULL;
+    }
+
+    // Open the file for writing.
+    f = fopen(path, "w");
+    if(NULL == f)
+    {
+        outPrintf("Error creating shared memory info file.\n");
+        return NULL;
+    }
+
+    // Create shared memory, or open the mailbox file.
+    int shmid;
+    if (NULL != info->path)
+    {
+        shmid = openMailboxFile(info->path, info->numBoxes, info->boxSize);
+    }
+    else
+    {
+        shmid = createMailboxes(info->numBoxes, info->boxSize);
+    }
+    if (shmid < 0)
+    {
+        fclose(f);
+        unlink(path);
+        return NULL;
+    }
+
+    // Write PID and shared memory ID to file. Mailbox files are recorded
+    // by path, since handles are only meaningful inside one process.
+    int pid = getpid();
+    fwrite(&pid,sizeof(int),1,f);
+    if (NULL != info->path)
+    {
+        int marker = MBOX_FILE_HANDLE;
+        fwrite(&marker,sizeof(int),1,f);
+        fwrite(info->path,1,strlen(info->path) + 1,f);
+    }
+    else
+    {
+        fwrite(&shmid,sizeof(int),1,f);
+    }
+
+    fclose(f);
+
+    return NULL;
+}
+#endif
+
+
+#ifdef USE_SHMEM_SOCKETS
+/*!
+ * \brief Used to connect with shared memory socket server.
+ * \param cmd - Command to send to server.
+ * \param ret - Return data from server.
+ * \param retLen - Length of return data
+ * \return Error code. 0 on success.
+ */
+int shmemClient(char * cmd, void ** ret, int *retLen)
+{
+    int sockfd = 0;
+    char * recvBuff = malloc(2000);
+    struct sockaddr_in serv_addr;
+    int len;
+
+
+    memset(recvBuff, '0', 2000);
+
+    if((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    {
+        outPrintf("\n Error : Could not create socket \n");
+        return -1;
+    }
+
+    memset(&serv_addr, '0', sizeof(serv_addr));
+
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port = htons(SOCKET_PORT);
+    serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+
+    if( connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+    {
+        //printf("\n Error : Connect Failed \n");
+        return -1;
+    }
+
+    write(sockfd, cmd, strlen(cmd));
+    len = read(sockfd, recvBuff, 1999);
+    //recvBuff[len] = '\0';
+
+    *ret = recvBuff;
+    *retLen = len;
+
+    close(sockfd);
+
+    return 0;
+}
+#else
+/*!
+ * \brief Used to connect with shared memory socket server.
+ * \param cmd - Command to send to server.
+ * \param ret - Return data from server.
+ * \param retLen - Length of return data
+ * \return Error code. 0 on success.
+ */
+int shmemClient(char *cmd, void **ret, int *retLen)
+{
+    UNUSED(cmd);
+    UNUSED(ret);
+    UNUSED(retLen);
+    return -1;
+}
+#endif
+
+/*!
+ * \brief Create shared memory
+ * \param num - Number of mailboxes.
+ * \param size - Size of mailboxes.
+ * \return
+ */
+int createMailboxes (int num, int size)
+{
+    return createSegment(SHMKEY, num, size);
+}
+
+/*!
+ * \brief Create a mailbox set under a private key, so it never collides
+ *        with the shell's own set (used by mboxbench).
+ * \param num - Number of mailboxes.
+ * \param size - Size of mailboxes in KB.
+ * \return Shared memory ID. -1 on error.
+ */
+int createPrivateMailboxes (int num, int size)
+{
+    return createSegment(IPC_PRIVATE, num, size);
+}
+
+/*!
+ * \brief Create and initialize one mailbox segment.
+ * \param key - SysV key (IPC_PRIVATE for extension segments).
+ * \param num - Number of mailboxes.
+ * \param size - Size of mailboxes in KB.
+ * \return Shared memory ID. -1 on error.
+ */
+static int createSegment (key_t key, int num, int size)
+{
+    // Obtain a shared memory ID.
+    int shmid = shmget(key, segmentSize(num, size), IPC_CREAT | IPC_EXCL | 0666);
+
+    // Error checking.
+    if ( shmid < 0)
+    {
+      outPrintf("***ERROR: shmid is %d\n", shmid);
+      perror("shmget failed");
+      return -1;
+    }
+
+    DEBUG_PROG3("New shared memory ID",shmid);
+
+    // Setup header data.
+    char * addr =  shmat(shmid, 0, 0);
+    initSegment(addr, num, size);
+
+    // Release shared memory from this process.
+    shmdt(addr);
+    return shmid;
+}
+
+/*!
+ * \brief Total size of a mailbox segment.
+ * \param num - Number of mailboxes.
+ * \param size - Size of mailboxes in KB.
+ * \return Size in bytes.
+ */
+static size_t segmentSize (int num, int size)
+{
+    size_t statsOffset = sizeof(struct segHeader) + (sizeof(struct boxHeader)*num);
+    size_t infoLen = alignUp(statsOffset + (sizeof(struct mboxStats)*num), PAGE_ALIGN);
+
+    return infoLen + alignUp((size_t)size*K, PAGE_ALIGN)*num;
+}
+
+/*!
+ * \brief Write the segment header and initialize every mailbox.
+ * \param addr - Mapped segment of segmentSize(num, size) bytes.
+ * \param num - Number of mailboxes.
+ * \param size - Size of mailboxes in KB.
+ */
+static void initSegment (char * addr, int num, int size)
+{
+    size_t statsOffset = sizeof(struct segHeader) + (sizeof(struct boxHeader)*num);
+
+    struct segHeader * seg = (struct segHeader*)addr;
+    seg->magic = MBOX_MAGIC;
+    seg->version = MBOX_LAYOUT_VERSION;
+    seg->numBoxes = num;
+    seg->boxSize = size;
+    seg->dataOffset = alignUp(statsOffset + (sizeof(struct mboxStats)*num), PAGE_ALIGN);
+    seg->boxStride = alignUp((size_t)size*K, PAGE_ALIGN);
+    seg->statsOffset = statsOffset;
+    seg->layoutGen = 0;
+    seg->totalBoxes = num;
+    seg->numExtents = 0;
+    sharedMutexInit(&seg->growLock);
+
+    // Iterate over mailbox headers.
+    int i = 0;
+    for (i = 0; i < num; i++)
+    {
+        struct boxHeader * hdr = getBoxHeader(addr, i);
+
+        // Initialize reader/writer lock.
+        if (0 != rwLockInit(&hdr->lock))
+        {
+            outPrintf("Error initializing reader/writer lock #%d\n",i);
+            break;
+        }
+        hdr->seq = 0;
+        hdr->waiters = 0;
+        hdr->len = 0;
+        hdr->generation = 0;
+        hdr->flags = 0;
+        hdr->rawLen = 0;
+        memset(getBoxStats(addr, i), 0, sizeof(struct mboxStats));
+    }
+}
+
+/*!
+ * \brief Reset the lock state of a mailbox file nobody else has mapped.
+ *
+ * Whatever processes last used the file are gone, so any lock they held,
+ * any write they were part way through, and any waiter they registered is
+ * stale. Messages, lengths, generations and statistics are kept.
+ *
+ * \param addr - Mapped mailbox file.
+ * \return Number of mailboxes that were locked or mid-write.
+ */
+static int recoverSegment (char * addr)
+{
+    struct segHeader * seg = (struct segHeader*)addr;
+    int recovered = 0;
+    int i;
+
+    for (i = 0; i < seg->numBoxes; i++)
+    {
+        struct boxHeader * hdr = getBoxHeader(addr, i);
+
+        if (hdr->lock.readCount || hdr->lock.writing || (hdr->seq & 1))
+        {
+            recovered++;
+        }
+
+        // The histograms survive the re-initialization.
+        unsigned long long readWait[LOCK_HIST_BUCKETS];
+        unsigned long long writeWait[LOCK_HIST_BUCKETS];
+        memcpy(readWait, hdr->lock.readWait, sizeof(readWait));
+        memcpy(writeWait, hdr->lock.writeWait, sizeof(writeWait));
+
+        rwLockInit(&hdr->lock);
+
+        memcpy(hdr->lock.readWait, readWait, sizeof(readWait));
+        memcpy(hdr->lock.writeWait, writeWait, sizeof(writeWait));
+
+        // An interrupted write leaves seq odd; the message may be torn
+        // but readers must not spin on it forever.
+        if (hdr->seq & 1)
+        {
+            hdr->seq++;
+            hdr->generation++;
+        }
+        hdr->waiters = 0;
+    }
+
+    return recovered;
+}
+
+/*!
+ * \brief Open (or create) a file backed mailbox set.
+ *
+ * The file is mapped MAP_SHARED, so every process that opens it sees the
+ * same mailboxes and the contents survive restarts. Each process holds a
+ * shared flock on the file while it has it mapped; a process that can
+ * take the lock exclusively is the only user, and resets lock state left
+ * behind by processes that died.
+ *
+ * A new mailbox set is only written to a file that is empty (or did not
+ * exist). Any other file that is not a current mailbox file is rejected,
+ * never truncated.
+ *
+ * \param path - Mailbox file.
+ * \param num - Number of mailboxes if the file has to be created. 0 to
+ *        only open an existing file.
+ * \param size - Size of mailboxes in KB if the file has to be created.
+ * \return Mailbox handle. -1 on error.
+ */
+int openMailboxFile (const char * path, int num, int size)
+{
+    int slot = -1;
+    int i;
+
+    pthread_mutex_lock(&mboxFilesLock);
+
+    // Already open in this process?
+    for (i = 0; i < MBOX_MAX_FILES; i++)
+    {
+        if (NULL != mboxFiles[i].addr && 0 == strcmp(mboxFiles[i].path, path))
+        {
+            pthread_mutex_unlock(&mboxFilesLock);
+            return MBOX_FILE_HANDLE + i;
+        }
+        if (NULL == mboxFiles[i].addr && slot < 0)
+        {
+            slot = i;
+        }
+    }
+
+    if (slot < 0 || strlen(path) >= sizeof(mboxFiles[slot].path))
+    {
+        pthread_mutex_unlock(&mboxFilesLock);
+        return -1;
+    }
+
+    int fd = open(path, O_RDWR | (num > 0 ? O_CREAT : 0), 0666);
+    if (fd < 0)
+    {
+        pthread_mutex_unlock(&mboxFilesLock);
+        return -1;
+    }
+
+    // Alone on the file: safe to (re)initialize or recover it.
+    int alone = (0 == flock(fd, LOCK_EX | LOCK_NB));
+
+    struct stat st;
+    struct segHeader hdr;
+    int create = 0;
+    size_t len = 0;
+
+    if (0 != fstat(fd, &st))
+    {
+        st.st_size = -1;
+    }
+
+    if (st.st_size >= (off_t)sizeof(hdr) &&
+        sizeof(hdr) == pread(fd, &hdr, sizeof(hdr), 0) &&
+        MBOX_MAGIC == hdr.magic && MBOX_LAYOUT_VERSION == hdr.version)
+    {
+        len = segmentSize(hdr.numBoxes, hdr.boxSize);
+    }
+    else if (alone && num > 0 && size > 0 && 0 == st.st_size)
+    {
+        // Only an empty file is initialized; anything else (another file,
+        // or a mailbox file of an older layout) is left untouched.
+        create = 1;
+        len = segmentSize(num, size);
+        if (0 != ftruncate(fd, len))
+        {
+            len = 0;
+        }
+    }
+
+    if (0 == len || (!create && (off_t)len > st.st_size))
+    {
+        outPrintf("Not a mailbox file: %s\n", path);
+        close(fd);
+        pthread_mutex_unlock(&mboxFilesLock);
+        return -1;
+    }
+
+    char * addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == addr)
+    {
+        close(fd);
+        pthread_mutex_unlock(&mboxFilesLock);
+        return -1;
+    }
+
+    if (create)
+    {
+        initSegment(addr, num, size);
+        msync(addr, len, MS_SYNC);
+    }
+    else if (alone)
+    {
+        int recovered = recoverSegment(addr);
+        if (recovered > 0)
+        {
+            outPrintf("Recovered %d mailbox(es) left locked in %s\n", recovered, path);
+        }
+    }
+
+    // Stay registered as a user of the file until it is closed.
+    flock(fd, LOCK_SH);
+
+    strcpy(mboxFiles[slot].path, path);
+    mboxFiles[slot].fd = fd;
+    mboxFiles[slot].len = len;
+    mboxFiles[slot].addr = addr;
+
+    pthread_mutex_unlock(&mboxFilesLock);
+
+    return MBOX_FILE_HANDLE + slot;
+}
+
+/*!
+ * \brief Flush a file backed mailbox set to disk.
+ * \param handle - Mailbox handle from openMailboxFile().
+ * \return Error code. 0 on success.
+ */
+int syncMailboxFile (int handle)
+{
+    struct mboxFile * file = getMailboxFile(handle);
+    if (NULL == file)
+    {
+        return -1;
+    }
+
+    return msync(file->addr, file->len, MS_SYNC);
+}
+
+/*!
+ * \brief Checkpoint and unmap a file backed mailbox set. The file itself
+ *        is kept.
+ * \param handle - Mailbox handle from openMailboxFile().
+ * \return Error code. 0 on success.
+ */
+int closeMailboxFile (int handle)
+{
+    struct mboxFile * file = getMailboxFile(handle);
+    if (NULL == file)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&mboxFilesLock);
+
+    msync(file->addr, file->len, MS_SYNC);
+    munmap(file->addr, file->len);
+    close(file->fd);    // Drops the flock.
+    file->addr = NULL;
+
+    pthread_mutex_unlock(&mboxFilesLock);
+
+    return 0;
+}
+
+/*!
+ * \brief Write a text message to a mailbox.
+ * \param shmid - Shared memory ID.
+ * \param boxID - Mailbox ID.
+ * \param message - Data to write to mailbox.
+ * \param flags - Flags for writeMailboxData().
+ * \return error code - 0 on success.
+ */
+int writeToMailbox (int shmid, int boxID, char * message, int flags)
+{
+    int len = strlen(message);
+
+    // Display information about write.
+    outPrintf("msg: %s\n", message);
+
+    int written = writeMailboxData(shmid, boxID, message, len, flags);
+
+    // Error checking.
+    if (written < 0)
+    {
+        return -1;
+    }
+
+    if (written < len)
+    {
+        outPrintf("Message length of size %d is greater than mailbox size %d bytes.\n Truncating message to %d bytes.\n", len, written, written);
+    }
+
+    return 0;
+}
+
+/*!
+ * \brief Write binary data to a mailbox. The box keeps exactly the bytes
+ *        written; data longer than the box is truncated. With
+ *        MBOX_WRITE_COMPRESS, messages of at least MBOX_COMPRESS_MIN bytes
+ *        are stored compressed when that makes them smaller, so they may be
+ *        longer than the box. Compressed boxes can not be viewed in place.
+ * \param shmid - Shared memory ID.
+ * \param boxID - Mailbox ID.
+ * \param data - Data to write to mailbox.
+ * \param len - Number of bytes in data.
+ * \param flags - MBOX_WRITE_COMPRESS or 0.
+ * \return Number of bytes stored. -1 on error.
+ */
+int writeMailboxData (int shmid, int boxID, const void * data, int len, int flags)
+{
+    // Error checking.
+    if (len < 0)
+    {
+        return -1;
+    }
+
+    char * addr = attachBox(shmid, &boxID);
+    if (NULL == addr)
+    {
+        return -1;
+    }
+    unsigned int size = ((struct segHeader*)addr)->boxSize;
+
+    // Address of header (reader/writer lock and sequence) for mailbox.
+    struct boxHeader* hdr = getBoxHeader(addr, boxID);
+    struct rwLock* lock = &hdr->lock;
+
+    // Address of mailbox data.
+    char * box = getBoxData(addr, boxID);
+
+    // Compress before taking the lock; keep the result only if it is
+    // smaller than the message and fits in the box.
+    char * packed = NULL;
+    int packedLen = -1;
+#ifdef MBOX_COMPRESS_MIN
+    if ((flags & MBOX_WRITE_COMPRESS) && len >= MBOX_COMPRESS_MIN)
+    {
+        int cap = ((unsigned int)len - 1 < size*K) ? len - 1 : (int)(size*K);
+        packed = malloc(cap);
+        if (NULL != packed)
+        {
+            packedLen = lzCompress(data, len, packed, cap);
+        }
+    }
+#else
+    (void)flags;
+#endif
+
+    // Truncate anything that does not fit in the mailbox.
+    if (packedLen < 0 && (unsigned int)len > size*K)
+    {
+        len = size*K;
+    }
+
+    // Obtain the write lock for the box.
+    unsigned long long waited = writeLock(lock);
+    seqWriteBegin(hdr);
+
+    // Copy the message into the mailbox.
+    BLOCK_WRITE
+    if (packedLen >= 0)
+    {
+        memcpy(box, packed, packedLen);
+        hdr->len = packedLen;
+        hdr->flags = BOX_COMPRESSED;
+        hdr->rawLen = len;
+    }
+    else
+    {
+        memcpy(box, data, len);
+        hdr->len = len;
+        hdr->flags = 0;
+    }
+    hdr->generation++;
+    statWrite(getBoxStats(addr, boxID), len, waited);
+
+    // Release the lock.
+    seqWriteEnd(hdr);
+    writeUnlock(lock);
+
+    free(packed);
+    unmapSegment(addr);
+
+    return len;
+}
+
+/*!
+ * \brief Read data from a shared mailbox. Write to stdout
+ * \param shmid - Shared memory ID.
+ * \param boxID - Mailbox ID.
+ * \return Error code - 0 on success.
+ */
+int readMailbox (int shmid, int boxID)
+{
+    struct mboxView view;
+
+    if (0 != mailboxViewAcquire(shmid, boxID, &view))
+    {
+        return -1;
+    }
+
+    // Perform read.
+    BLOCK_READ
+    outPrintf("Read addr: %p\n", view.data);
+    outPrintf("Message: ");
+    outWrite(view.data, view.len);
+    outPrintf("\n");
+
+    mailboxViewRelease(&view);
+
+    return 0;
+}
+
+/*!
+ * \brief Get a read-locked view of a mailbox without copying it.
+ *
+ * On success view->data points directly at the message in shared memory,
+ * view->len is its length and view->generation its generation. The box
+ * stays read locked, and the segment attached, until
+ * mailboxViewRelease() is called; writers to the box block until then, so
+ * views should be released promptly. Only a message written with
+ * MBOX_WRITE_COMPRESS and stored compressed is not viewed in place; it is
+ * expanded into a private buffer instead.
+ *
+ * \param shmid - Shared memory ID.
+ * \param boxID - Mailbox ID.
+ * \param view - View to fill in.
+ * \return Error code - 0 on success.
+ */
+int mailboxViewAcquire (int shmid, int boxID, struct mboxView * view)
+{
+    char * addr = attachBox(shmid, &boxID);
+    if (NULL == addr)
+    {
+        return -1;
+    }
+
+    struct boxHeader* hdr = getBoxHeader(addr, boxID);
+
+    unsigned long long waited = readLock(&hdr->lock);
+    statRead(getBoxStats(addr, boxID), messageLength(hdr), waited);
+
+    view->data = getBoxData(addr, boxID);
+    view->len = hdr->len;
+    view->generation = hdr->generation;
+    view->addr = addr;
+    view->boxID = boxID;
+    view->copy = NULL;
+
+    if (hdr->flags & BOX_COMPRESSED)
+    {
+        view->copy = malloc(hdr->rawLen + 1);
+        if (NULL == view->copy)
+        {
+            mailboxViewRelease(view);
+            return -1;
+        }
+        view->len = unpackMessage(hdr->flags, view->data, hdr->len,
+                                  view->copy, hdr->rawLen);
+        view->data = view->copy;
+    }
+
+    return 0;
+}
+
+/*!
+ * \brief Release a view obtained from mailboxViewAcquire(). The view's
+ *        data pointer must not be used afterwards.
+ * \param view - View to release.
+ */
+void mailboxViewRelease (struct mboxView * view)
+{
+    if (NULL == view->addr)
+    {
+        return;
+    }
+
+    readUnlock(&getBoxHeader(view->addr, view->boxID)->lock);
+    unmapSegment(view->addr);
+    free(view->copy);
+
+    view->copy = NULL;
+    view->data = NULL;
+    view->len = 0;
+    view->addr = NULL;
+}
+
+/*!
+ * \brief Read data from a shared mailbox without taking its lock. The box
+ *        is copied out under the sequence lock and printed to stdout.
+ * \param shmid - Shared memory ID.
+ * \param boxID - Mailbox ID.
+ * \return Error code - 0 on success.
+ */
+int readMailboxSeq (int shmid, int boxID)
+{
+    int local = boxID;
+    char * addr = attachBox(shmid, &local);
+    if (NULL == addr)
+    {
+        return -1;
+    }
+    int size = ((struct segHeader*)addr)->boxSize*K;
+    struct boxHeader * hdr = getBoxHeader(addr, local);
+
+    // Compressed messages can be longer than the box. The size is only a
+    // hint; a longer message written meanwhile is caught below.
+    char * buf = NULL;
+    int len;
+    do
+    {
+        int raw = __atomic_load_n(&hdr->rawLen, __ATOMIC_RELAXED);
+        if (raw > size)
+        {
+            size = raw;
+        }
+
+        free(buf);
+        buf = malloc(size);
+        if (NULL == buf)
+        {
+            unmapSegment(addr);
+            return -1;
+        }
+
+        len = readMailboxInto(shmid, boxID, buf, size, 1, NULL);
+    } while (len == size && __atomic_load_n(&hdr->rawLen, __ATOMIC_RELAXED) > (unsigned int)size);
+
+    unmapSegment(addr);
+
+    if (len < 0)
+    {
+        free(buf);
+        return -1;
+    }
+
+    BLOCK_READ
+    outPrintf("Message: ");
+    outWrite(buf, len);
+    outPrintf("\n");
+
+    free(buf);
+
+    return 0;
+}
+
+/*!
+ * \brief Copy the contents of a mailbox into a local buffer. Exactly the
+ *        stored length is copied (bounded by bufLen); no terminator is
+ *        added.
+ *
+ * With optimistic set the copy is made without taking any lock: the
+ * mailbox sequence counter is sampled before and after the copy and the
+ * copy is retried if a writer was active or finished in between. Readers
+ * on this path never write to the shared segment. Otherwise the read side
+ * of the reader/writer lock is held for the copy.
+ *
+ * \param shmid - Shared memory ID.
+ * \param boxID - Mailbox ID.
+ * \param buf - Destination buffer.
+ * \param bufLen - Size of buf in bytes.
+ * \param optimistic - Non-zero to use the sequence lock.
+ * \param generation - Returns the generation of the copied message. May be
+ *        NULL.
+ * \return Number of bytes copied. -1 on error.
+ */
+int readMailboxInto (int shmid, int boxID, char * buf, int bufLen, int optimistic,
+                     unsigned int * generation)
+{
+    // Error checking
+    if (bufLen < 0)
+    {
+        return -1;
+    }
+
+    char * addr = attachBox(shmid, &boxID);
+    if (NULL == addr)
+    {
+        return -1;
+    }
+    int size = ((struct segHeader*)addr)->boxSize;
+
+    struct boxHeader* hdr = getBoxHeader(addr, boxID);
+    char * box = getBoxData(addr, boxID);
+
+    // Never copy more than the box or the destination can hold.
+    unsigned int max = size*K;
+    if (max > (unsigned int)bufLen)
+    {
+        max = bufLen;
+    }
+
+    unsigned int len;
+    unsigned int gen;
+    unsigned int flags;
+
+    if (optimistic)
+    {
+        unsigned int before, after;
+        do
+        {
+            // Wait out any write in progress. A writer that stays in
+            // its write this long may have died; taking the lock checks
+            // for that and closes the write off if so.
+            int spins = 0;
+            while ((before = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE)) & 1)
+            {
+                if (++spins == SEQ_SPIN_LIMIT)
+                {
+                    readLock(&hdr->lock);
+                    readUnlock(&hdr->lock);
+                    spins = 0;
+                }
+                sched_yield();
+            }
+
+            // The length may be torn by a concurrent write; it is only
+            // trusted once the counter check below passes.
+            len = __atomic_load_n(&hdr->len, __ATOMIC_RELAXED);
+            gen = __atomic_load_n(&hdr->generation, __ATOMIC_RELAXED);
+            flags = __atomic_load_n(&hdr->flags, __ATOMIC_RELAXED);
+            if (flags & BOX_COMPRESSED)
+            {
+                // Expand straight from the box. lzDecompress() checks every
+                // offset and length, so a torn message only yields garbage,
+                // which the counter check below throws away.
+                if (len > (unsigned int)size*K)
+                {
+                    len = size*K;
+                }
+                len = unpackMessage(flags, box, len, buf, bufLen);
+            }
+            else
+            {
+                if (len > max)
+                {
+                    len = max;
+                }
+                memcpy(buf, box, len);
+            }
+
+            // Order the copy before the second sample of the counter.
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            after = __atomic_load_n(&hdr->seq, __ATOMIC_RELAXED);
+        } while (before != after);
+
+#ifdef STAT_SEQLOCK_READS
+        statRead(getBoxStats(addr, boxID), len, 0);
+#endif
+    }
+    else
+    {
+        unsigned long long waited = readLock(&hdr->lock);
+        gen = hdr->generation;
+        len = unpackMessage(hdr->flags, box, hdr->len, buf,
+                            (hdr->flags & BOX_COMPRESSED) ? (unsigned int)bufLen : max);
+        readUnlock(&hdr->lock);
 
-    if (0 != ok)
+        statRead(getBoxStats(addr, boxID), len, waited);
+    }
+
+    if (NULL != generation)
+    {
+        *generation = gen;
+    }
+
+    unmapSegment(addr);
+
+    return (int)len;
+}
+
+/*!
+ * \brief Copy data from one mailbox to another.
+ * \param shmid - Shared memory ID.
+ * \param fromBox - 'From' mailbox ID.
+ * \param toBox - 'To' mailbox ID.
+ * \return error code - 0 on success.
+ */
+int copyMailbox(int shmid, int fromBox, int toBox)
+{
+    struct mboxSet set;
+    int fromLocal, toLocal;
+
+    if (0 != attachSet(shmid, &set))
     {
         return -1;
     }
 
-    int addr = *((int*)ret);
+    char * to_seg = setBox(&set, toBox, &toLocal);
+    char * from_seg = setBox(&set, fromBox, &fromLocal);
 
-    free(ret);
+    // Error checking.
+    if (NULL == to_seg || NULL == from_seg || fromBox == toBox)
+    {
+        detachSet(&set);
+        return -1;
+    }
 
-    return addr;
+    // R/W lock and data address for the "to" mailbox.
+    struct boxHeader* to_hdr = getBoxHeader(to_seg, toLocal);
+    struct rwLock* to_lock = &to_hdr->lock;
+    char * to_boxAddr = getBoxData(to_seg, toLocal);
+    unsigned int to_size = ((struct segHeader*)to_seg)->boxSize * K;
+
+    // R/W lock and data address for the "from" mailbox.
+    struct boxHeader* from_hdr = getBoxHeader(from_seg, fromLocal);
+    struct rwLock* from_lock = &from_hdr->lock;
+    char * from_boxAddr = getBoxData(from_seg, fromLocal);
+
+    // Locks are always taken in ascending box order so concurrent copies
+    // in opposite directions cannot deadlock.
+    unsigned long long readWaited, writeWaited;
+    if (fromBox < toBox)
+    {
+        readWaited = readLock(from_lock);
+        writeWaited = writeLock(to_lock);
+    }
+    else
+    {
+        writeWaited = writeLock(to_lock);
+        readWaited = readLock(from_lock);
+    }
+    seqWriteBegin(to_hdr);
+
+    // Copy data (only the bytes actually stored, truncated if the 'to'
+    // box is smaller).
+    unsigned int len = copyMessage(from_hdr, from_boxAddr, to_hdr, to_boxAddr, to_size);
+
+    statRead(getBoxStats(from_seg, fromLocal), len, readWaited);
+    statWrite(getBoxStats(to_seg, toLocal), len, writeWaited);
+
+    seqWriteEnd(to_hdr);
+
+    // Release in reverse order.
+    if (fromBox < toBox)
+    {
+        writeUnlock(to_lock);
+        readUnlock(from_lock);
+    }
+    else
+    {
+        readUnlock(from_lock);
+        writeUnlock(to_lock);
+    }
+
+    detachSet(&set);
+
+    return 0;
 }
-#else
 
 /*!
- * \brief Return the shared memory address (ID).
- * \return Shared memory ID.
+ * \brief Perform a batch of mailbox operations as one transaction.
+ *
+ * The segment is attached once and every box involved is locked once, in
+ * ascending box order, for the whole batch: boxes that are only read get
+ * the read lock, boxes that are written or copied into get the write lock.
+ * The operations then run in order and the locks are released in reverse
+ * order. All operations are validated before anything is locked; if any is
+ * invalid nothing is done.
+ *
+ * Read operations copy into op->buf (op->len bytes at most) or, when buf
+ * is NULL, print the message to stdout. op->result receives the number of
+ * bytes read, written or copied.
+ *
+ * \param shmid - Shared memory ID.
+ * \param ops - Operations to perform.
+ * \param numOps - Number of operations.
+ * \return Error code - 0 on success.
  */
-int getshmemAddr()
+int mailboxTransaction(int shmid, struct mboxOp * ops, int numOps)
 {
-    char path[1000];
-    FILE* f = NULL;
-    int pid = -1;
-    int addr = -1;
+    struct mboxSet set;
+    int i, local;
 
-    // Create file path.
-    strcpy(path,_START_CWD);
-    strcat(path,"/.dsh_shmem_info");
+    if (0 != attachSet(shmid, &set))
+    {
+        return -1;
+    }
 
-    // Open shared memory information file.
-    f = fopen(path,"r");
-    if (f)
+    int numBoxes = setBoxes(&set);
+
+    // Lock mode needed for each box: 0 none, 1 read, 2 write.
+    char * mode = calloc(numBoxes, sizeof(char));
+    if (NULL == mode)
     {
-        fread(&pid,sizeof(int),1,f);
-        fread(&addr,sizeof(int),1,f);
-        fclose(f);
+        detachSet(&set);
+        return -1;
     }
-    else
+
+    // Validate every operation and work out the lock set.
+    for (i = 0; i < numOps; i++)
     {
-        DEBUG_PROG3("getshmemAddr: Shared memory does not exist\n",0);
+        struct mboxOp * op = &ops[i];
+
+        if (op->box >= numBoxes || op->box < 0)
+        {
+            break;
+        }
+
+        if (MBOX_OP_READ == op->type)
+        {
+            if (0 == mode[op->box])
+            {
+                mode[op->box] = 1;
+            }
+        }
+        else if (MBOX_OP_WRITE == op->type && op->len >= 0)
+        {
+            mode[op->box] = 2;
+        }
+        else if (MBOX_OP_COPY == op->type && op->from < numBoxes &&
+                 op->from >= 0 && op->from != op->box)
+        {
+            mode[op->box] = 2;
+            if (0 == mode[op->from])
+            {
+                mode[op->from] = 1;
+            }
+        }
+        else
+        {
+            break;
+        }
     }
 
-    return addr;
+    if (i < numOps)
+    {
+        free(mode);
+        detachSet(&set);
+        return -1;
+    }
+
+    // Acquire locks in ascending box order.
+    for (i = 0; i < numBoxes; i++)
+    {
+        if (0 == mode[i])
+        {
+            continue;
+        }
+
+        char * seg = setBox(&set, i, &local);
+        struct boxHeader * hdr = getBoxHeader(seg, local);
+        unsigned long long waited = 0;
+        if (1 == mode[i])
+        {
+            waited = readLock(&hdr->lock);
+        }
+        else
+        {
+            waited = writeLock(&hdr->lock);
+            seqWriteBegin(hdr);
+        }
+        if (waited)
+        {
+            __atomic_fetch_add(&getBoxStats(seg, local)->lockWaitNs, waited, __ATOMIC_RELAXED);
+        }
+    }
+
+    // Perform operations in order.
+    for (i = 0; i < numOps; i++)
+    {
+        struct mboxOp * op = &ops[i];
+        char * seg = setBox(&set, op->box, &local);
+        struct boxHeader * hdr = getBoxHeader(seg, local);
+        char * box = getBoxData(seg, local);
+        unsigned int size = ((struct segHeader*)seg)->boxSize * K;
+        unsigned int len;
+
+        if (MBOX_OP_READ == op->type)
+        {
+            if (NULL == op->buf)
+            {
+                char * msg = box;
+                len = hdr->len;
+                if (hdr->flags & BOX_COMPRESSED)
+                {
+                    msg = malloc(hdr->rawLen);
+                    len = (NULL == msg) ? 0 : unpackMessage(hdr->flags, box, hdr->len, msg, hdr->rawLen);
+                }
+                outPrintf("Message (box %d): ", op->box);
+                outWrite(msg, len);
+                outPrintf("\n");
+                if (msg != box)
+                {
+                    free(msg);
+                }
+            }
+            else
+            {
+                len = unpackMessage(hdr->flags, box, hdr->len, op->buf, op->len);
+            }
+            statRead(getBoxStats(seg, local), len, 0);
+        }
+        else if (MBOX_OP_WRITE == op->type)
+        {
+            len = op->len;
+            if (len > size)
+            {
+                len = size;
+            }
+            // Stored plain: compressing here would hold every lock in
+            // the transaction for the duration.
+            memcpy(box, op->data, len);
+            hdr->len = len;
+            hdr->flags = 0;
+            hdr->generation++;
+            statWrite(getBoxStats(seg, local), len, 0);
+        }
+        else
+        {
+            int fromLocal;
+            char * from_seg = setBox(&set, op->from, &fromLocal);
+            struct boxHeader * from_hdr = getBoxHeader(from_seg, fromLocal);
+            len = copyMessage(from_hdr, getBoxData(from_seg, fromLocal), hdr, box, size);
+            statRead(getBoxStats(from_seg, fromLocal), len, 0);
+            statWrite(getBoxStats(seg, local), len, 0);
+        }
+
+        op->result = len;
+    }
+
+    // Release locks in descending box order.
+    for (i = numBoxes - 1; i >= 0; i--)
+    {
+        if (0 == mode[i])
+        {
+            continue;
+        }
+
+        char * seg = setBox(&set, i, &local);
+        struct boxHeader * hdr = getBoxHeader(seg, local);
+        if (1 == mode[i])
+        {
+            readUnlock(&hdr->lock);
+        }
+        else
+        {
+            seqWriteEnd(hdr);
+            writeUnlock(&hdr->lock);
+        }
+    }
+
+    free(mode);
+    detachSet(&set);
+
+    return 0;
 }
 
 /*!
- * \brief Returns the process ID that started the shared memory.
- * \return PID.
+ * \brief Print the reader and writer lock wait histograms for a mailbox.
+ * \param shmid - Shared memory ID.
+ * \param boxID - Mailbox ID.
+ * \return Error code - 0 on success.
  */
-int getshmemParent()
+int printLockHistogram(int shmid, int boxID)
 {
-    char path[1000];
-    FILE* f = NULL;
-    int pid = -1;
-    int addr = -1;
+    unsigned long long readWait[LOCK_HIST_BUCKETS];
+    unsigned long long writeWait[LOCK_HIST_BUCKETS];
+    int i;
+    int local = boxID;
 
-    // Create file path.
-    strcpy(path,_START_CWD);
-    strcat(path,"/.dsh_shmem_info");
+    char * addr = attachBox(shmid, &local);
+    if (NULL == addr)
+    {
+        return -1;
+    }
 
-    // Open shared memory information file.
-    f = fopen(path,"r");
-    if (f)
+    // Take a consistent snapshot of the counters.
+    struct rwLock* lock = &getBoxHeader(addr, local)->lock;
+    lockMutex(lock);
+    memcpy(readWait, lock->readWait, sizeof(readWait));
+    memcpy(writeWait, lock->writeWait, sizeof(writeWait));
+    unsigned int recoveries = lock->recoveries;
+    pthread_mutex_unlock(&lock->mutex);
+
+    unmapSegment(addr);
+
+    if (recoveries > 0)
     {
-        fread(&pid,sizeof(int),1,f);
-        fread(&addr,sizeof(int),1,f);
-        fclose(f);
+        outPrintf("Lock released for %u dead holder(s).\n", recoveries);
     }
-    else
+
+    outPrintf("Lock wait times for mailbox %d:\n", boxID);
+    outPrintf("%14s %12s %12s\n", "wait (ns)", "readers", "writers");
+    for (i = 0; i < LOCK_HIST_BUCKETS; i++)
     {
-        DEBUG_PROG3("getshmemParent: Shared memory does not exist\n",0);
+        if (0 == readWait[i] && 0 == writeWait[i])
+        {
+            continue;
+        }
+
+        if (LOCK_HIST_BUCKETS - 1 == i)
+        {
+            outPrintf("%13llu+ %12llu %12llu\n", 1ULL << i, readWait[i], writeWait[i]);
+        }
+        else
+        {
+            outPrintf("%14llu %12llu %12llu\n", 1ULL << i, readWait[i], writeWait[i]);
+        }
     }
 
-    return pid;
+    return 0;
 }
-#endif
 
-#ifdef USE_SHMEM_SOCKETS
 /*!
- * \brief Socket server for handling shared memory information.
- * \param arg - Used to pass number and size of mailboxes to function.
- * \return
+ * \brief Number of mailboxes in a set, including extension segments.
+ * \param shmid - Shared memory ID.
+ * \return Number of mailboxes. -1 on error.
  */
-void* shmemServer (void* arg)
+int getMailboxCount(int shmid)
 {
-    struct shmemInfo * info = arg;
-    int listenfd = 0, connfd = 0;
-    struct sockaddr_in serv_addr;
-    int len;
-    char recvBuff[2000];
+    struct mboxSet set;
 
-    // Get the PID that started the shared memory
-    int parent = getpid();
-    DEBUG_PROG3("Shared memory server pid",parent);
+    if (0 != attachSet(shmid, &set))
+    {
+        return -1;
+    }
 
-    printf("\n");
+    int num = setBoxes(&set);
+    detachSet(&set);
 
-    // Create the shared memory.
-    int shmid = createMailboxes(info->numBoxes, info->boxSize);
-    if (shmid < 0)
+    return num;
+}
+
+/*!
+ * \brief Get the current version of a mailbox. The version changes every
+ *        time a write to the box completes.
+ * \param shmid - Shared memory ID.
+ * \param boxID - Mailbox ID.
+ * \param version - Returns the version.
+ * \return Error code - 0 on success.
+ */
+int getMailboxVersion(int shmid, int boxID, unsigned int * version)
+{
+    char * addr = attachBox(shmid, &boxID);
+    if (NULL == addr)
     {
-        return NULL;
+        return -1;
     }
 
-    // Setup socket
-    listenfd = socket(AF_INET, SOCK_STREAM, 0);
-    memset(&serv_addr, '0', sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    serv_addr.sin_port = htons(SOCKET_PORT);
-    bind(listenfd, (struct sockaddr*)&serv_addr, sizeof(serv_addr));
-    listen(listenfd, 10);
+    // An odd sequence means a write is in progress; report the version the
+    // box had before it so the waiter picks up that write.
+    *version = __atomic_load_n(&getBoxHeader(addr, boxID)->seq, __ATOMIC_ACQUIRE) & ~1U;
 
-    // Accept and process client requests.
-    while (1)
+    unmapSegment(addr);
+
+    return 0;
+}
+
+/*!
+ * \brief Block until a mailbox is written.
+ *
+ * Sleeps on a futex on the box sequence counter, so no CPU is used while
+ * waiting and the waiter is woken as soon as the write completes. Returns
+ * immediately if the box has already moved past version.
+ *
+ * In the shell SIGINT is blocked and would never end the futex wait, so
+ * there the wait is split into MBOX_WAIT_SLICE_MS slices and a pending
+ * SIGINT is consumed and ends it.
+ *
+ * \param shmid - Shared memory ID.
+ * \param boxID - Mailbox ID.
+ * \param version - Last version seen by the caller (see
+ *        getMailboxVersion()). Updated to the new version on return.
+ * \param timeoutMs - Timeout in milliseconds. Negative to wait forever.
+ * \return 0 when the box changed, 1 on timeout, 2 if interrupted, -1 on
+ *         error.
+ */
+int waitMailbox(int shmid, int boxID, unsigned int * version, int timeoutMs)
+{
+    int ret = 1;
+    sigset_t blocked;
+
+    pthread_sigmask(SIG_BLOCK, NULL, &blocked);
+    int sliced = sigismember(&blocked, SIGINT);
+
+    char * addr = attachBox(shmid, &boxID);
+    if (NULL == addr)
     {
-        // Accept client connection.
-        connfd = accept(listenfd, (struct sockaddr*)NULL, NULL);
+        return -1;
+    }
 
-        DEBUG_PROG3("Shared memory server accepted connection",connfd);
+    struct boxHeader* hdr = getBoxHeader(addr, boxID);
+    unsigned long long deadline = nowNs() + (unsigned long long)timeoutMs * 1000000ULL;
 
-        // Read message from client.
-        len = read(connfd, recvBuff, sizeof(recvBuff)-1);
-        recvBuff[len] = '\0';
+    // Register as a waiter before sampling the counter so a writer that
+    // finishes after the sample is guaranteed to issue a wake.
+    __atomic_fetch_add(&hdr->waiters, 1, __ATOMIC_SEQ_CST);
 
-        // Handle exit command.
-        if (0 == strcmp("exit",recvBuff))
+    while (1)
+    {
+        unsigned int seq = __atomic_load_n(&hdr->seq, __ATOMIC_SEQ_CST);
+
+        // A completed write the caller has not seen yet.
+        if (0 == (seq & 1) && seq != *version)
         {
-            DEBUG_PROG3("Shared memory server exiting",0);
-            write(connfd, "OK\0", 3);
+            *version = seq;
+            ret = 0;
             break;
         }
 
-        // Send PID that started the shared memory.
-        else if (0 == strcmp("parent",recvBuff))
+        if (sliced && loopInterrupted())
         {
-            DEBUG_PROG3("Shared memory server writing parent ID",0);
-            write(connfd, &parent, sizeof(int));
+            ret = 2;
+            break;
         }
 
-        // Send the shared memory ID.
-        else
+        struct timespec ts;
+        struct timespec * tsp = NULL;
+        unsigned long long left = sliced ? MBOX_WAIT_SLICE_MS * 1000000ULL : 0;
+        if (timeoutMs >= 0)
         {
-            DEBUG_PROG3("Shared memory server writing shared memory id",0);
-            write(connfd, &shmid, sizeof(int));
+            unsigned long long now = nowNs();
+            if (now >= deadline)
+            {
+                break;
+            }
+            if (!sliced || deadline - now < left)
+            {
+                left = deadline - now;
+            }
+        }
+        if (left > 0)
+        {
+            ts.tv_sec = left / 1000000000ULL;
+            ts.tv_nsec = left % 1000000000ULL;
+            tsp = &ts;
+        }
+
+        // Sleep while the counter still holds the sampled value.
+        if (0 != syscall(SYS_futex, &hdr->seq, FUTEX_WAIT, seq, tsp, NULL, 0) &&
+                EAGAIN != errno && EINTR != errno && ETIMEDOUT != errno)
+        {
+            ret = -1;
+            break;
         }
-
-        close(connfd);
     }
 
-    // Delete shared memory.
-    shmctl(shmid, IPC_RMID, 0);
+    __atomic_fetch_sub(&hdr->waiters, 1, __ATOMIC_SEQ_CST);
 
-    shutdown(listenfd, 2);
+    unmapSegment(addr);
 
-    pthread_exit(0);
+    return ret;
 }
-#else
+
 /*!
- * \brief File server for handling shared memory information.
- * \param arg - Used to pass number and size of mailboxes to function.
- * \return
+ * \brief Bind the data pages of a mailbox to a NUMA node. Pages already
+ *        in memory are migrated; new pages are allocated on the node.
+ * \param shmid - Shared memory ID.
+ * \param boxID - Mailbox ID.
+ * \param node - NUMA node number.
+ * \return Error code - 0 on success.
  */
-// This implementation of the socket server uses a file
-// to distribute shared memory information.
-void* shmemServer (void* arg)
+int bindMailbox(int shmid, int boxID, int node)
 {
-    char path[1000];
-    struct shmemInfo * info = arg;
-    FILE* f = NULL;
-
-    // Construct the path to the shmem file.
-    strcpy(path,_START_CWD);
-    strcat(path,"/.dsh_shmem_info");
+    unsigned long mask[4] = {0};
+    int bits = sizeof(mask) * 8;
 
-    // Determine if the file exists.
-    f = fopen(path,"r");
-    if (f)
+    // Error checking
+    if (node < 0 || node >= bits)
     {
-        fclose(f);
-        printf("Error: Shared memory already exists.\n");
-        return NULL;
+        return -1;
     }
 
-    // Open the file for writing.
-    f = fopen(path, "w");
-    if(NULL == f)
+    char * addr = attachBox(shmid, &boxID);
+    if (NULL == addr)
     {
-        printf("Error creating shared memory info file.\n");
-        return NULL;
+        return -1;
     }
+    struct segHeader * seg = (struct segHeader*)addr;
 
-    // Create shared memory.
-    int shmid = createMailboxes(info->numBoxes, info->boxSize);
-    if (shmid < 0)
-    {
-        return NULL;
-    }
+    mask[node / (sizeof(unsigned long) * 8)] = 1UL << (node % (sizeof(unsigned long) * 8));
 
-    // Write PID and shared memory ID to file.
-    int pid = getpid();
-    fwrite(&pid,sizeof(int),1,f);
-    fwrite(&shmid,sizeof(int),1,f);
+    // Box data is page aligned and padded, so binding one box never moves
+    // another box's pages.
+    long ret = syscall(SYS_mbind, getBoxData(addr, boxID), seg->boxStride,
+                       MPOL_BIND, mask, bits + 1, MPOL_MF_MOVE);
 
-    fclose(f);
+    unmapSegment(addr);
 
-    pthread_exit(0);
+    return (0 == ret) ? 0 : -1;
 }
-#endif
 
-
-#ifdef USE_SHMEM_SOCKETS
 /*!
- * \brief Used to connect with shared memory socket server.
- * \param cmd - Command to send to server.
- * \param ret - Return data from server.
- * \param retLen - Length of return data
- * \return Error code. 0 on success.
+ * \brief Print usage statistics for mailboxes. Reads the counters without
+ *        taking any lock, through a read-only attachment. Seqlock reads are
+ *        only counted when built with STAT_SEQLOCK_READS.
+ * \param shmid - Shared memory ID.
+ * \param boxID - Mailbox ID, or -1 for every mailbox.
+ * \return Error code - 0 on success.
  */
-int shmemClient(char * cmd, void ** ret, int *retLen)
+int printMailboxStats(int shmid, int boxID)
 {
-    int sockfd = 0;
-    char * recvBuff = malloc(2000);
-    struct sockaddr_in serv_addr;
-    int len;
+    struct mboxSet set;
+    int i, j;
 
-
-    memset(recvBuff, '0', 2000);
-
-    if((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    // Read only attachment of every segment.
+    set.seg[0] = mapSegment(shmid, 1);
+    if ((void*)-1 == set.seg[0])
     {
-        printf("\n Error : Could not create socket \n");
         return -1;
     }
 
-    memset(&serv_addr, '0', sizeof(serv_addr));
-
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(SOCKET_PORT);
-    serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    struct segHeader * primary = (struct segHeader*)set.seg[0];
+    int n = __atomic_load_n(&primary->numExtents, __ATOMIC_ACQUIRE);
 
+    set.numSegs = 1;
+    for (i = 0; i < n; i++)
+    {
+        char * ext = mapSegment(primary->extents[i].shmid, 1);
+        if ((void*)-1 == ext)
+        {
+            break;
+        }
+        set.seg[set.numSegs++] = ext;
+    }
 
-    if( connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+    // Error checking
+    if (boxID >= setBoxes(&set))
     {
-        //printf("\n Error : Connect Failed \n");
+        detachSet(&set);
         return -1;
     }
 
-    write(sockfd, cmd, strlen(cmd));
-    len = read(sockfd, recvBuff, 1999);
-    //recvBuff[len] = '\0';
+    outPrintf("%4s %8s %12s %12s %14s %14s %14s %8s %10s\n", "box", "size KB",
+           "reads", "writes", "bytes read", "bytes written", "lock wait ns",
+           "writer", "length");
 
-    *ret = recvBuff;
-    *retLen = len;
+    for (i = 0; i < set.numSegs; i++)
+    {
+        struct segHeader * seg = (struct segHeader*)set.seg[i];
+        int first = (0 == i) ? 0 : primary->extents[i - 1].firstBox;
 
-    close(sockfd);
+        for (j = 0; j < seg->numBoxes; j++)
+        {
+            struct mboxStats * st = getBoxStats(set.seg[i], j);
+
+            if (boxID >= 0 && boxID != first + j)
+            {
+                continue;
+            }
+
+            outPrintf("%4d %8d %12llu %12llu %14llu %14llu %14llu %8d %10u\n",
+                   first + j, seg->boxSize,
+                   __atomic_load_n(&st->reads, __ATOMIC_RELAXED),
+                   __atomic_load_n(&st->writes, __ATOMIC_RELAXED),
+                   __atomic_load_n(&st->bytesRead, __ATOMIC_RELAXED),
+                   __atomic_load_n(&st->bytesWritten, __ATOMIC_RELAXED),
+                   __atomic_load_n(&st->lockWaitNs, __ATOMIC_RELAXED),
+                   __atomic_load_n(&st->lastWriter, __ATOMIC_RELAXED),
+                   __atomic_load_n(&st->len, __ATOMIC_RELAXED));
+        }
+    }
+
+    outPrintf("Layout generation: %u\n", __atomic_load_n(&primary->layoutGen, __ATOMIC_ACQUIRE));
+
+    detachSet(&set);
 
     return 0;
 }
-#else
+
 /*!
- * \brief Used to connect with shared memory socket server.
- * \param cmd - Command to send to server.
- * \param ret - Return data from server.
- * \param retLen - Length of return data
- * \return Error code. 0 on success.
+ * \brief Add mailboxes to an existing set without disturbing the boxes
+ *        already in it.
+ *
+ * The new boxes live in a new extension segment whose ID is published in
+ * the primary segment's extent table, after which the layout generation
+ * is incremented. Existing boxes keep their locks and data, so readers and
+ * writers on them carry on while the set grows. New boxes may be larger
+ * than the existing ones.
+ *
+ * \param shmid - Shared memory ID of the primary segment.
+ * \param num - Number of mailboxes to add.
+ * \param size - Size of the new mailboxes in KB.
+ * \return Global ID of the first new mailbox. -1 on error.
  */
-int shmemClient(char *cmd, void **ret, int *retLen)
+int growMailboxes(int shmid, int num, int size)
 {
-    UNUSED(cmd);
-    UNUSED(ret);
-    UNUSED(retLen);
-    return -1;
+    // File backed sets have a fixed size.
+    if (num < 1 || size < 1 || shmid >= MBOX_FILE_HANDLE)
+    {
+        return -1;
+    }
+
+    char * addr = mapSegment(shmid, 0);
+    if ((void*)-1 == addr)
+    {
+        return -1;
+    }
+
+    struct segHeader * seg = (struct segHeader*)addr;
+
+    // Serialize concurrent growers. The extent table is only changed by
+    // the stores that publish a new entry, so a grower that died holding
+    // the lock left it consistent.
+    if (EOWNERDEAD == pthread_mutex_lock(&seg->growLock))
+    {
+        pthread_mutex_consistent(&seg->growLock);
+    }
+
+    int n = seg->numExtents;
+    int first = -1;
+
+    if (n < MBOX_MAX_EXTENTS)
+    {
+        int ext = createSegment(IPC_PRIVATE, num, size);
+        if (ext >= 0)
+        {
+            first = seg->totalBoxes;
+            seg->extents[n].shmid = ext;
+            seg->extents[n].firstBox = first;
+            seg->extents[n].numBoxes = num;
+
+            // Publish the entry before the count that makes it visible.
+            __atomic_store_n(&seg->numExtents, n + 1, __ATOMIC_RELEASE);
+            __atomic_store_n(&seg->totalBoxes, first + num, __ATOMIC_RELEASE);
+            __atomic_fetch_add(&seg->layoutGen, 1, __ATOMIC_RELEASE);
+        }
+    }
+
+    pthread_mutex_unlock(&seg->growLock);
+
+    unmapSegment(addr);
+
+    return first;
 }
-#endif
 
 /*!
- * \brief Create shared memory
- * \param num - Number of mailboxes.
- * \param size - Size of mailboxes.
- * \return
+ * \brief Remove a mailbox set: the primary segment and every extension.
+ *        File backed sets are closed instead; the file is kept.
+ * \param shmid - Shared memory ID of the primary segment.
+ * \return Error code - 0 on success.
  */
-int createMailboxes (int num, int size)
+int deleteMailboxes(int shmid)
 {
-    // Shared memory size.
-    int infoLen = (sizeof(int)*2) + (sizeof(struct rwLock)*num) + (sizeof(char*)*num);
-    int dataLen =  (num*size*K);
+    // Mailbox files outlive the shell; just checkpoint and close them.
+    if (shmid >= MBOX_FILE_HANDLE)
+    {
+        return closeMailboxFile(shmid);
+    }
 
-    // Obtain a shared memory ID.
-    int shmid = shmget(SHMKEY, infoLen + dataLen , IPC_CREAT | IPC_EXCL | 0666);
+    char * addr = mapSegment(shmid, 0);
+    int i;
 
-    // Error checking.
-    if ( shmid < 0)
+    if ((void*)-1 != addr)
     {
-      printf("***ERROR: shmid is %d\n", shmid);
-      perror("shmget failed");
-      return -1;
+        struct segHeader * seg = (struct segHeader*)addr;
+        for (i = 0; i < seg->numExtents; i++)
+        {
+            shmctl(seg->extents[i].shmid, IPC_RMID, 0);
+        }
+        unmapSegment(addr);
     }
 
-    DEBUG_PROG3("New shared memory ID",shmid);
+    return shmctl(shmid, IPC_RMID, 0);
+}
 
-    // Setup header data.
-    char * addr =  shmat(shmid, 0, 0);
+/*!
+ * \brief Bytes of log space in a channel.
+ * \param addr - Segment holding the channel's box.
+ * \return Capacity in bytes (a multiple of 8).
+ */
+static unsigned long long chanCapacity(char * addr)
+{
+    struct segHeader * seg = (struct segHeader*)addr;
+    return ((unsigned long long)seg->boxSize*K - sizeof(struct chanHeader)) & ~7ULL;
+}
+
+/*!
+ * \brief Size of the log entry at a position: a record, or the space
+ *        skipped at the end of the ring.
+ * \param ring - Start of the log.
+ * \param cap - Log capacity.
+ * \param pos - Position of the entry.
+ * \return Size in bytes.
+ */
+static unsigned long long chanEntrySize(char * ring, unsigned long long cap,
+                                        unsigned long long pos)
+{
+    unsigned long long off = pos % cap;
+    struct chanRecord * rec = (struct chanRecord*)(ring + off);
 
-    int * info = (int*)addr;
-    *info = num;
-    info++;
-    *info = size;
+    if (cap - off < sizeof(struct chanRecord) || CHAN_PAD == rec->len)
+    {
+        return cap - off;
+    }
+    return alignUp(sizeof(struct chanRecord) + rec->len, 8);
+}
 
-    // Reader/Write lock pointer.
-    struct rwLock * lock = (struct rwLock*)(addr + sizeof(int)*2);
+/*!
+ * \brief Sequence number of the oldest message retained in a channel.
+ *        Must be called with the box locked.
+ * \param ch - Channel header.
+ * \param cap - Log capacity.
+ * \return Sequence number of the record at the tail, or of the next
+ *         message to be published if the log is empty.
+ */
+static unsigned long long chanOldestSeq(struct chanHeader * ch, unsigned long long cap)
+{
+    char * ring = (char*)(ch + 1);
+    unsigned long long pos = ch->tail;
 
-    // Iterate over reader/writer locks.
-    int i = 0;
-    for (i = 0; i < num; i++)
+    // Skip the space left unused at the end of the ring.
+    while (pos < ch->head)
     {
-        // Initialize reader/writer lock.
-        if (0 != sem_init(&lock->rw_mutex,1,1))
-        {
-            printf("Error initializing rw mutex semaphore #%d\n",i);
-            break;
-        }
-        // Initialize mutex lock.
-        if (0 != sem_init(&lock->mutex,1,1))
+        unsigned long long off = pos % cap;
+        struct chanRecord * rec = (struct chanRecord*)(ring + off);
+
+        if (cap - off >= sizeof(struct chanRecord) && CHAN_PAD != rec->len)
         {
-            printf("Error initializing mutex semaphore #%d\n",i);
-            break;
+            return rec->seq;
         }
-        lock->readCount = 0;
-        lock ++;
+        pos += cap - off;
     }
 
-    // Release shared memory from this process.
-    shmdt(addr);
-    return shmid;
+    return ch->seq;
 }
 
 /*!
- * \brief Write data to a mailbox.
+ * \brief Append a message to a channel. The box becomes a channel on the
+ *        first publish. Never waits for subscribers: when the log is full
+ *        the oldest messages are dropped.
  * \param shmid - Shared memory ID.
  * \param boxID - Mailbox ID.
- * \param message - Data to write to mailbox.
- * \return error code - 0 on success.
+ * \param data - Message.
+ * \param len - Message length in bytes.
+ * \return Message length. -1 on error or if the message cannot fit.
  */
-int writeToMailbox (int shmid, int boxID, char * message)
+int mailboxPublish(int shmid, int boxID, const void * data, int len)
 {
-    char * addr =  shmat(shmid, 0, 0);
-    int * temp = (int*)addr;
-    int numBoxes = *temp;
-    temp++;
-    unsigned int size = *temp;
-
     // Error checking.
-    if (boxID >= numBoxes || boxID < 0)
+    if (len < 0)
     {
         return -1;
     }
 
-    // Address of reader/writer lock structor for mailbox.
-    struct rwLock* lock = (struct rwLock*)(addr + sizeof(int)*2 + (sizeof(struct rwLock)*boxID));
+    char * addr = attachBox(shmid, &boxID);
+    if (NULL == addr)
+    {
+        return -1;
+    }
 
-    // Address of mailbox data.
-    char * box = addr + sizeof(int)*2 + (sizeof(struct rwLock)*numBoxes) + (size*K)*boxID;
+    struct boxHeader * hdr = getBoxHeader(addr, boxID);
+    struct chanHeader * ch = (struct chanHeader*)getBoxData(addr, boxID);
+    char * ring = (char*)(ch + 1);
+    unsigned long long cap = chanCapacity(addr);
+    unsigned long long need = alignUp(sizeof(struct chanRecord) + len, 8);
 
-    // Display information about write.
-    printf("Write addr: %p\n", box);
-    printf("msg: %s\n", message);
+    if (need > cap)
+    {
+        unmapSegment(addr);
+        return -1;
+    }
 
-    // If the message fits in the mailbox...
-    if (strlen(message) < (size*K - 1))
+    // Publishers are serialized by the write lock; subscribers do not
+    // take it.
+    unsigned long long waited = writeLock(&hdr->lock);
+    seqWriteBegin(hdr);
+
+    if (CHAN_MAGIC != ch->magic)
     {
-        // Obtain the read/write mutex for the box.
-        sem_wait(&lock->rw_mutex);
+        memset(ch, 0, sizeof(struct chanHeader));
+        hdr->len = 0;
+        hdr->flags = 0;
+        __atomic_store_n(&ch->magic, CHAN_MAGIC, __ATOMIC_RELEASE);
+    }
 
-        // Copy the message into the mailbox.
-        BLOCK_WRITE
-        memcpy(box, message, strlen(message));
+    // Records never wrap; skip what is left at the end of the ring.
+    unsigned long long head = ch->head;
+    unsigned long long off = head % cap;
+    unsigned long long skip = (cap - off < need) ? cap - off : 0;
 
-        // Release the mutex.
-        sem_post(&lock->rw_mutex);
+    // Retire the oldest records until the new one fits.
+    unsigned long long tail = ch->tail;
+    while (tail < head && head + skip + need - tail > cap)
+    {
+        tail += chanEntrySize(ring, cap, tail);
     }
-    else
+    if (head + skip + need - tail > cap)
     {
-        // Obtain the read/write mutex for the box.
-        sem_wait(&lock->rw_mutex);
-
-        // Write the data (end at the max mailbox size).
-        BLOCK_WRITE
-        memcpy(box, message, size*K - 1);        
-        box[size*K-1]='\0';
+        tail = head + skip;
+    }
 
-        // Release the mutex.
-        sem_post(&lock->rw_mutex);
+    // Publish the new tail before overwriting what it retired.
+    __atomic_store_n(&ch->tail, tail, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
 
-        printf("Message length of size %d is greater than mailbox size %d KB.\n Truncating message to %d KB.\n",(int)strlen(message),size,size);
+    if (skip >= sizeof(struct chanRecord))
+    {
+        ((struct chanRecord*)(ring + off))->len = CHAN_PAD;
     }
+    head += skip;
+    off = head % cap;
 
-    shmdt(addr);
+    struct chanRecord rec;
+    rec.len = len;
+    rec.reserved = 0;
+    rec.seq = ch->seq;
+    memcpy(ring + off, &rec, sizeof(rec));
+    memcpy(ring + off + sizeof(rec), data, len);
 
-    return 0;
+    __atomic_store_n(&ch->seq, rec.seq + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&ch->head, head + need, __ATOMIC_RELEASE);
+    hdr->generation++;
+    statWrite(getBoxStats(addr, boxID), len, waited);
+
+    // Ending the write wakes subscribers blocked in waitMailbox().
+    seqWriteEnd(hdr);
+    writeUnlock(&hdr->lock);
+
+    unmapSegment(addr);
+
+    return len;
 }
 
 /*!
- * \brief Read data from a shared mailbox. Write to stdout
+ * \brief Start a subscription to a channel.
  * \param shmid - Shared memory ID.
  * \param boxID - Mailbox ID.
- * \return Error code - 0 on success.
+ * \param sub - Subscription to initialize.
+ * \param fromOldest - Non-zero to start at the oldest retained message,
+ *        zero to receive only messages published from now on.
+ * \return Error code. 0 on success.
  */
-int readMailbox (int shmid, int boxID)
+int mailboxSubscribe(int shmid, int boxID, struct mboxSub * sub, int fromOldest)
 {
-    char * addr =  shmat(shmid, 0, 0);
-    int * temp = (int*)addr;
-    int numBoxes = *temp;
-    temp++;
-    int size = *temp;
+    int local = boxID;
 
-    // Error checking
-    if (boxID >= numBoxes || boxID < 0)
+    char * addr = attachBox(shmid, &local);
+    if (NULL == addr)
     {
         return -1;
     }
 
-    // Reader/Write lock structure for this mailbox.
-    struct rwLock* lock = (struct rwLock*)(addr + sizeof(int)*2 + (sizeof(struct rwLock)*boxID));
-
-    // Data address for this mailbox.
-    char * box = addr + sizeof(int)*2 + (sizeof(struct rwLock)*numBoxes) + (size*K)*boxID;
-
-    // Get reader mutex lock.
-    sem_wait(&lock->mutex);
+    struct boxHeader * hdr = getBoxHeader(addr, local);
+    struct chanHeader * ch = (struct chanHeader*)getBoxData(addr, local);
 
-    // Increment the number of readers.
-    lock->readCount++;
+    sub->shmid = shmid;
+    sub->box = boxID;
+    sub->maxLen = (int)(chanCapacity(addr) - sizeof(struct chanRecord));
+    sub->lost = 0;
 
-    // If this is the first reader lock the reader/writer mutex.
-    if(lock->readCount == 1)
+    // Read head, tail and seq together.
+    readLock(&hdr->lock);
+    if (CHAN_MAGIC == ch->magic && !fromOldest)
     {
-        sem_wait(&lock->rw_mutex);
+        sub->cursor = ch->head;
+        sub->nextSeq = ch->seq;
     }
-
-    // Release the reader mutex.
-    sem_post(&lock->mutex);
-
-    // Perform read.
-    BLOCK_READ
-    printf("Read addr: %p\n", box);
-    printf("Message: %s\n", box);
-
-    // Obtain the reader mutex lock.
-    sem_wait(&lock->mutex);
-    // Decrement the reader count.
-    lock->readCount--;
-
-    // If there are no more readers, release the reader/writer mutex.
-    if(lock->readCount == 0)
+    else if (CHAN_MAGIC == ch->magic)
     {
-        sem_post(&lock->rw_mutex);
+        // Messages retired before subscribing were never missed.
+        sub->cursor = ch->tail;
+        sub->nextSeq = chanOldestSeq(ch, chanCapacity(addr));
     }
+    else
+    {
+        sub->cursor = 0;
+        sub->nextSeq = 0;
+    }
+    readUnlock(&hdr->lock);
 
-    // Release the reader mutex.
-    sem_post(&lock->mutex);
-
-    shmdt(addr);
+    unmapSegment(addr);
 
     return 0;
 }
 
 /*!
- * \brief Copy data from one mailbox to another.
- * \param shmid - Shared memory ID.
- * \param fromBox - 'From' mailbox ID.
- * \param toBox - 'To' mailbox ID.
- * \return error code - 0 on success.
+ * \brief Read the next message of a subscription without locking.
+ *
+ * A subscriber that falls more than a full log behind the publisher skips
+ * ahead to the oldest retained message; the skipped messages are added to
+ * sub->lost.
+ *
+ * \param sub - Subscription.
+ * \param buf - Destination buffer.
+ * \param bufLen - Size of buf. Longer messages are truncated.
+ * \param len - Returns the full message length.
+ * \param behind - If not NULL, returns how many newer messages are waiting
+ *        after this one (the subscriber's lag).
+ * \return 1 if a message was read, 0 if none are waiting, -1 on error.
  */
-int copyMailbox(int shmid, int fromBox, int toBox)
+int mailboxNext(struct mboxSub * sub, void * buf, int bufLen, int * len,
+                unsigned long long * behind)
 {
-    char * addr =  shmat(shmid, 0, 0);
-    int * temp = (int*)addr;
-    int numBoxes = *temp;
-    temp++;
-    int size = *temp;
+    int boxID = sub->box;
+    int ret = 0;
 
-    // Error checking.
-    if (fromBox >= numBoxes || fromBox < 0 ||
-            toBox >= numBoxes || toBox < 0)
-    {
-        return -1;
-    }
-    if (fromBox == toBox)
+    char * addr = attachBox(sub->shmid, &boxID);
+    if (NULL == addr || bufLen < 0)
     {
         return -1;
     }
 
-    // R/W lock and data address for the "to" mailbox.
-    struct rwLock* to_lock = (struct rwLock*)(addr + sizeof(int)*2 + (sizeof(struct rwLock)*toBox));
-    char * to_boxAddr = addr + sizeof(int)*2 + (sizeof(struct rwLock)*numBoxes) + (size*K)*toBox;
+    struct chanHeader * ch = (struct chanHeader*)getBoxData(addr, boxID);
+    char * ring = (char*)(ch + 1);
+    unsigned long long cap = chanCapacity(addr);
 
-    // R/W lock and data address for the "from" mailbox.
-    struct rwLock* from_lock = (struct rwLock*)(addr + sizeof(int)*2 + (sizeof(struct rwLock)*fromBox));
-    char * from_boxAddr = addr + sizeof(int)*2 + (sizeof(struct rwLock)*numBoxes) + (size*K)*fromBox;
+    while (CHAN_MAGIC == __atomic_load_n(&ch->magic, __ATOMIC_ACQUIRE))
+    {
+        unsigned long long tail = __atomic_load_n(&ch->tail, __ATOMIC_ACQUIRE);
+        unsigned long long head = __atomic_load_n(&ch->head, __ATOMIC_ACQUIRE);
+        unsigned long long cursor = sub->cursor;
 
-    // wait on write lock for 'to' box. +++++++++++++
-    sem_wait(&to_lock->rw_mutex);
+        // Lapped by the publisher, or the channel was recreated.
+        if (cursor < tail || cursor > head)
+        {
+            sub->cursor = cursor = tail;
+        }
+        if (cursor == head)
+        {
+            break;
+        }
 
+        unsigned long long off = cursor % cap;
+        if (cap - off < sizeof(struct chanRecord))
+        {
+            sub->cursor += cap - off;
+            continue;
+        }
 
-    // ------ Wait on read lock for 'from' box ------
-    sem_wait(&from_lock->mutex);
-    from_lock->readCount++;
-    if(from_lock->readCount == 1)
-    {
-        sem_wait(&from_lock->rw_mutex);
-    }
-    sem_post(&from_lock->mutex);
+        struct chanRecord rec;
+        unsigned int n = 0;
+        memcpy(&rec, ring + off, sizeof(rec));
+        if (CHAN_PAD != rec.len)
+        {
+            // The header may be torn; never copy outside the ring.
+            n = rec.len;
+            if (n > cap - off - sizeof(rec))
+            {
+                n = cap - off - sizeof(rec);
+            }
+            if (n > (unsigned int)bufLen)
+            {
+                n = bufLen;
+            }
+            memcpy(buf, ring + off + sizeof(rec), n);
+        }
 
-    // Copy data
-    strcpy(to_boxAddr,from_boxAddr);
+        // Discard the copy if the publisher retired the record meanwhile.
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&ch->tail, __ATOMIC_RELAXED) > cursor)
+        {
+            continue;
+        }
 
-    sem_wait(&from_lock->mutex);
-    from_lock->readCount--;
-    if(from_lock->readCount == 0)
-    {
-        sem_post(&from_lock->rw_mutex);
-    }
-    sem_post(&from_lock->mutex);
-    // ------- End read lock ---------
+        if (CHAN_PAD == rec.len)
+        {
+            sub->cursor += cap - off;
+            continue;
+        }
 
+        if (rec.seq > sub->nextSeq)
+        {
+            sub->lost += rec.seq - sub->nextSeq;
+        }
+        sub->nextSeq = rec.seq + 1;
+        sub->cursor += alignUp(sizeof(rec) + rec.len, 8);
 
-    sem_post(&to_lock->rw_mutex);
-    // End write lock ++++++++++++++++++++++++++++++++++
+        *len = rec.len;
+        if (NULL != behind)
+        {
+            *behind = __atomic_load_n(&ch->seq, __ATOMIC_RELAXED) - sub->nextSeq;
+        }
 
+#ifdef STAT_SEQLOCK_READS
+        statRead(getBoxStats(addr, boxID), n, 0);
+#endif
+        ret = 1;
+        break;
+    }
 
-    shmdt(addr);
+    unmapSegment(addr);
 
-    return 0;
+    return ret;
 }
-
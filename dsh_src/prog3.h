@@ -7,6 +7,13 @@
 #ifndef PROG3_H
 #define PROG3_H
 
+#include <stddef.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 //#define USE_SHMEM_SOCKETS       // Use sockets to communicate shared
                                   // memory address.
 
@@ -22,15 +29,176 @@
 #define BLOCK_READ                // Do not block reads
 
 
+// Read mailboxes optimistically through the per-box sequence lock instead of
+// taking the reader/writer lock. (Uncomment one or the other)
+#define USE_SEQLOCK_READS         // Seqlock reads
+//#undef USE_SEQLOCK_READS        // Reader/writer lock reads
+
+
+// Count optimistic (seqlock) reads in the mailbox statistics. Costs an
+// atomic update of the box's shared statistics line per read, which every
+// reader then contends on; off by default so optimistic readers never write
+// shared memory. (Uncomment one or the other)
+//#define STAT_SEQLOCK_READS      // Count seqlock reads
+#undef STAT_SEQLOCK_READS         // Seqlock reads do not write shared memory
+
+
+// Writes that ask for it (MBOX_WRITE_COMPRESS, mboxwrite -z) store messages
+// of at least this many bytes compressed (LZ4 style) when that makes them
+// smaller. Other writes are always stored as is. (Uncomment one or the other)
+#define MBOX_COMPRESS_MIN 512     // Compress large messages on request
+//#undef MBOX_COMPRESS_MIN        // Never compress
+
+
+// How often (ms) mboxnotify checks watched mailboxes, and how many boxes it
+// can watch.
+#define MBOX_NOTIFY_MS 100
+#define MBOX_MAX_NOTIFY 16
+
+// A futex wait can't see the shell's blocked SIGINT, so while SIGINT is
+// blocked waitMailbox() sleeps at most this long (ms) between checks for it.
+#define MBOX_WAIT_SLICE_MS 200
+
+
 // Extra debugging statements. (Uncomment one or the other)
 //#define DEBUG_PROG3(str, num) printf("PROG3 DEBUG: %s -- %d\n",str,num);
 #define DEBUG_PROG3(str, num)
 
+// Operation types for mailboxTransaction().
+#define MBOX_OP_READ  0
+#define MBOX_OP_WRITE 1
+#define MBOX_OP_COPY  2
+
+// Flags for writeMailboxData().
+#define MBOX_WRITE_COMPRESS 0x1   // Store compressed if it saves space
+
+// Mailbox segment identification (struct segHeader).
+#define MBOX_MAGIC 0x44534842     // "DSHB"
+#define MBOX_LAYOUT_VERSION 5
+
+// Maximum number of extension segments added by growMailboxes().
+#define MBOX_MAX_EXTENTS 16
+
+// File backed mailbox sets (openMailboxFile()). Their handles start at
+// MBOX_FILE_HANDLE, above any SysV shared memory ID in practical use.
+#define MBOX_MAX_FILES 8
+#define MBOX_FILE_HANDLE 0x7fff0000
+
+#define CACHE_LINE 64
+
 // For unused parameters... gets rid of compiler warnings.
 #define UNUSED(x) (void)(x)
 
+/*!
+ * \brief Extension segment holding mailboxes added after creation.
+ */
+struct mboxExtent
+{
+    int shmid;      // Shared memory ID of the extension segment.
+    int firstBox;   // Global ID of its first mailbox.
+    int numBoxes;   // Number of mailboxes in it.
+};
+
+/*!
+ * \brief Header at the start of the mailbox shared memory segment.
+ *
+ * Segment layout:
+ *   [segHeader][boxHeader 0]..[boxHeader n-1][mboxStats 0]..[mboxStats n-1]
+ *   [pad to 4 KB][box 0 data][pad to 4 KB]..[box n-1 data][pad to 4 KB]
+ * Each box header sits on its own cache lines so writers to different
+ * boxes never share a line, and each box's data starts on a page boundary
+ * so it can be bound to a NUMA node on its own.
+ *
+ * This header and the statistics array are a stable export: an external
+ * process may attach the segment read only (SHM_RDONLY), check magic and
+ * version, and read the statistics at statsOffset without taking locks.
+ *
+ * Mailboxes added later live in extension segments with the same layout.
+ * The primary segment lists them in extents; box IDs continue from one
+ * segment to the next. layoutGen changes whenever an extension is added.
+ *
+ * A mailbox file (openMailboxFile()) holds a single segment with exactly
+ * this layout, so it can be inspected offline with the same definitions.
+ */
+struct segHeader
+{
+    unsigned int magic;     // MBOX_MAGIC
+    unsigned int version;   // MBOX_LAYOUT_VERSION
+    int numBoxes;
+    int boxSize;            // KB
+    size_t dataOffset;      // Offset of box 0 data.
+    size_t boxStride;       // Distance between boxes' data.
+    size_t statsOffset;     // Offset of the mboxStats array.
+
+    // Growth (only used in the primary segment).
+    unsigned int layoutGen; // Incremented whenever extents change.
+    int totalBoxes;         // Mailboxes across all segments.
+    int numExtents;
+    pthread_mutex_t growLock;   // Robust, process shared.
+    struct mboxExtent extents[MBOX_MAX_EXTENTS];
+} __attribute__((aligned(CACHE_LINE)));
+
+/*!
+ * \brief Usage counters for one mailbox. Updated with relaxed atomics;
+ *        each box's counters sit on their own cache line.
+ */
+struct mboxStats
+{
+    unsigned long long reads;
+    unsigned long long writes;
+    unsigned long long bytesRead;
+    unsigned long long bytesWritten;
+    unsigned long long lockWaitNs;  // Total time spent waiting for the lock.
+    int lastWriter;                 // PID of the last writer.
+    unsigned int len;               // Current message length.
+} __attribute__((aligned(CACHE_LINE)));
+
+/*!
+ * \brief One operation in a mailbox transaction.
+ */
+struct mboxOp
+{
+    int type;           // MBOX_OP_READ, MBOX_OP_WRITE or MBOX_OP_COPY.
+    int box;            // Box read, written, or copied into.
+    int from;           // Source box for copies.
+    const void * data;  // Data to write.
+    void * buf;         // Read destination. NULL prints to stdout.
+    int len;            // Bytes to write / size of buf.
+    int result;         // Bytes read, written or copied.
+};
+
+/*!
+ * \brief Read-locked, zero-copy view of a mailbox.
+ *        See mailboxViewAcquire().
+ */
+struct mboxView
+{
+    const void * data;          // Message bytes in shared memory.
+    int len;                    // Message length in bytes.
+    unsigned int generation;    // Message generation.
+
+    // Private: used to release the view.
+    char * addr;
+    int boxID;
+    char * copy;    // Expanded copy of a compressed message.
+};
+
+/*!
+ * \brief A subscriber's position in a pub/sub channel.
+ *        See mailboxSubscribe() and mailboxNext().
+ */
+struct mboxSub
+{
+    int shmid;
+    int box;
+    int maxLen;                     // Largest message the channel holds.
+    unsigned long long cursor;      // Log position of the next message.
+    unsigned long long nextSeq;     // Sequence number expected next.
+    unsigned long long lost;        // Messages dropped before being read.
+};
+
 // Used to store the working directory of the process on startup.
-char _START_CWD[1000];
+extern char _START_CWD[1000];
 
 // -------- Shell intrinsic functions --------
 // Create shared mailboxes.
@@ -43,6 +211,26 @@ int readBox(int argc, char ** argv);
 int writeBox(int argc, char ** argv);
 // Copy data from one mailbox to another.
 int copyBox(int argc, char ** argv);
+// Print lock wait histograms for a mailbox.
+int histBox(int argc, char ** argv);
+// Wait for a mailbox to be written, then print it.
+int waitBox(int argc, char ** argv);
+// Run a batch of mailbox operations.
+int txnBox(int argc, char ** argv);
+// Bind mailboxes to a NUMA node.
+int bindBox(int argc, char ** argv);
+// Print mailbox statistics.
+int statBox(int argc, char ** argv);
+// Add mailboxes to the shared memory.
+int growBox(int argc, char ** argv);
+// Checkpoint file backed mailboxes to disk.
+int syncBox(int argc, char ** argv);
+// Publish a message to a channel.
+int pubBox(int argc, char ** argv);
+// Print new messages from a channel.
+int subBox(int argc, char ** argv);
+// Report writes to a mailbox from the event loop.
+int notifyBox(int argc, char ** argv);
 // -------------------------------------------
 
 // Cleans up shared memory on exit.
@@ -51,17 +239,82 @@ void onExit();
 // Shared Memory Functions
 int createMailboxes (int num, int size);
 
+// Create a mailbox set that is not tied to the shell's key.
+int createPrivateMailboxes (int num, int size);
+
+// Add mailboxes in a new extension segment.
+int growMailboxes (int shmid, int num, int size);
+
+// Delete a mailbox set and all of its extension segments.
+int deleteMailboxes (int shmid);
+
+// Open or create mailboxes kept in a memory mapped file.
+int openMailboxFile (const char * path, int num, int size);
+
+// Flush a mailbox file to disk.
+int syncMailboxFile (int handle);
+
+// Checkpoint and close a mailbox file.
+int closeMailboxFile (int handle);
+
 // Read data from a mailbox.
 int readMailbox (int shmid, int boxID);
 
-// Write data to a mailbox.
-int writeToMailbox (int shmid, int boxID, char * message);
+// Read lock a mailbox and return a view of its contents (no copy).
+int mailboxViewAcquire (int shmid, int boxID, struct mboxView * view);
+
+// Release a mailbox view.
+void mailboxViewRelease (struct mboxView * view);
+
+// Read data from a mailbox without locking (seqlock retry).
+int readMailboxSeq (int shmid, int boxID);
+
+// Copy the contents of a mailbox into a local buffer.
+int readMailboxInto (int shmid, int boxID, char * buf, int bufLen, int optimistic,
+                     unsigned int * generation);
+
+// Write a text message to a mailbox.
+int writeToMailbox (int shmid, int boxID, char * message, int flags);
+
+// Write binary data to a mailbox.
+int writeMailboxData (int shmid, int boxID, const void * data, int len, int flags);
 
 // Copy data from one mailbox to another.
 int copyMailbox(int shmid, int fromBox, int toBox);
 
-// Socket server for distributing shared memory information.
-// Runs in a seperate thread.
+// Perform a batch of mailbox operations holding each lock once.
+int mailboxTransaction(int shmid, struct mboxOp * ops, int numOps);
+
+// Bind the data of a mailbox to a NUMA node.
+int bindMailbox(int shmid, int boxID, int node);
+
+// Print usage statistics for one mailbox (or all with boxID < 0).
+int printMailboxStats(int shmid, int boxID);
+
+// Print lock wait histograms for a mailbox.
+int printLockHistogram(int shmid, int boxID);
+
+// Number of mailboxes in a set.
+int getMailboxCount(int shmid);
+
+// Get the current version of a mailbox.
+int getMailboxVersion(int shmid, int boxID, unsigned int * version);
+
+// Block until a mailbox moves past the given version, a timeout or SIGINT.
+int waitMailbox(int shmid, int boxID, unsigned int * version, int timeoutMs);
+
+// Append a message to a pub/sub channel.
+int mailboxPublish(int shmid, int boxID, const void * data, int len);
+
+// Start reading a pub/sub channel.
+int mailboxSubscribe(int shmid, int boxID, struct mboxSub * sub, int fromOldest);
+
+// Read the next message from a channel subscription.
+int mailboxNext(struct mboxSub * sub, void * buf, int bufLen, int * len,
+                unsigned long long * behind);
+
+// Socket server for distributing shared memory information. Runs in a
+// seperate thread (the file version returns once the file is written).
 void* shmemServer (void* conn);
 
 // Used to connect to the shared memory socket server.
@@ -74,4 +327,8 @@ int getshmemAddr();
 // Return the PID that started the shared memory.
 int getshmemParent();
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,246 @@
+/************************************************************************//**
+ *  @file uring.c
+ *
+ *  @brief Minimal io_uring wrapper (raw system calls, no liburing).
+ *
+ *  Only what batched file reads need: ring setup and teardown, a sparse
+ *  fixed file table, getting submission entries, submitting and reaping
+ *  completions. The kernel and this process share the ring indexes, so
+ *  head and tail accesses use acquire/release ordering.
+ ***************************************************************************/
+
+#include "uring.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+
+/*!
+ * \brief Tear down a ring. Safe on a partly initialized ring.
+ * \param ring - Ring.
+ */
+void uringFree (struct uring * ring)
+{
+    if (NULL != ring->sqes)
+    {
+        munmap(ring->sqes, ring->sqesSize);
+    }
+    if (NULL != ring->cqRing && ring->cqRing != ring->sqRing)
+    {
+        munmap(ring->cqRing, ring->cqRingSize);
+    }
+    if (NULL != ring->sqRing)
+    {
+        munmap(ring->sqRing, ring->sqRingSize);
+    }
+    if (ring->fd >= 0)
+    {
+        close(ring->fd);
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+/*!
+ * \brief Create a ring and map its rings.
+ * \param ring - Ring to initialize.
+ * \param entries - Submission queue size (rounded up by the kernel).
+ * \return 0 on success, -errno on failure (ENOSYS or EPERM when io_uring
+ *         is not available).
+ */
+int uringInit (struct uring * ring, unsigned entries)
+{
+    struct io_uring_params p;
+    int err;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0)
+    {
+        ring->fd = -1;
+        return -errno;
+    }
+    ring->entries = p.sq_entries;
+
+    ring->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cqRingSize > ring->sqRingSize)
+        {
+            ring->sqRingSize = ring->cqRingSize;
+        }
+        ring->cqRingSize = ring->sqRingSize;
+    }
+
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (MAP_FAILED == ring->sqRing)
+    {
+        ring->sqRing = NULL;
+        goto fail;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->cqRing = ring->sqRing;
+    }
+    else
+    {
+        ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (MAP_FAILED == ring->cqRing)
+        {
+            ring->cqRing = NULL;
+            goto fail;
+        }
+    }
+
+    ring->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (MAP_FAILED == ring->sqes)
+    {
+        ring->sqes = NULL;
+        goto fail;
+    }
+
+    ring->sqHead = (unsigned*)((char*)ring->sqRing + p.sq_off.head);
+    ring->sqTail = (unsigned*)((char*)ring->sqRing + p.sq_off.tail);
+    ring->sqMask = (unsigned*)((char*)ring->sqRing + p.sq_off.ring_mask);
+    ring->sqArray = (unsigned*)((char*)ring->sqRing + p.sq_off.array);
+    ring->cqHead = (unsigned*)((char*)ring->cqRing + p.cq_off.head);
+    ring->cqTail = (unsigned*)((char*)ring->cqRing + p.cq_off.tail);
+    ring->cqMask = (unsigned*)((char*)ring->cqRing + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)((char*)ring->cqRing + p.cq_off.cqes);
+
+    return 0;
+
+fail:
+    err = -errno;
+    uringFree(ring);
+    return err;
+}
+
+/*!
+ * \brief Register a sparse fixed file table, so operations can open files
+ *        straight into table slots and later operations can use them.
+ * \param ring - Ring.
+ * \param count - Number of slots.
+ * \return 0 on success, -errno on failure.
+ */
+int uringRegisterFiles (struct uring * ring, int count)
+{
+    int * fds = malloc(count * sizeof(int));
+    int ret;
+
+    if (NULL == fds)
+    {
+        return -ENOMEM;
+    }
+    memset(fds, -1, count * sizeof(int));
+
+    ret = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES, fds, count);
+    free(fds);
+
+    return (ret < 0) ? -errno : 0;
+}
+
+/*!
+ * \brief Check whether the kernel can open files straight into fixed file
+ *        slots. Older kernels accept IORING_OP_OPENAT but ignore its
+ *        file_index and hand back an ordinary descriptor instead.
+ * \return 1 on Linux 5.15 or later, 0 otherwise.
+ */
+int uringHasDirectOpen ()
+{
+    struct utsname name;
+    int major = 0, minor = 0;
+
+    if (0 != uname(&name) || sscanf(name.release, "%d.%d", &major, &minor) < 2)
+    {
+        return 0;
+    }
+
+    return (major > 5 || (5 == major && minor >= 15)) ? 1 : 0;
+}
+
+/*!
+ * \brief Get the next free submission entry.
+ * \param ring - Ring.
+ * \return Zeroed entry, or NULL if the submission queue is full.
+ */
+struct io_uring_sqe * uringGetSqe (struct uring * ring)
+{
+    unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring->sqTail + ring->queued;
+
+    if (tail - head >= ring->entries)
+    {
+        return NULL;
+    }
+
+    unsigned index = tail & *ring->sqMask;
+    struct io_uring_sqe * sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sqArray[index] = index;
+    ring->queued++;
+
+    return sqe;
+}
+
+/*!
+ * \brief Submit the queued entries and wait for completions.
+ * \param ring - Ring.
+ * \param waitNr - Number of completions to wait for.
+ * \return Number of entries submitted, or -errno.
+ */
+int uringSubmit (struct uring * ring, unsigned waitNr)
+{
+    unsigned toSubmit = ring->queued;
+    int ret;
+
+    __atomic_store_n(ring->sqTail, *ring->sqTail + toSubmit, __ATOMIC_RELEASE);
+    ring->queued = 0;
+
+    do
+    {
+        ret = syscall(__NR_io_uring_enter, ring->fd, toSubmit, waitNr,
+                      waitNr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (ret < 0 && EINTR == errno);
+
+    return (ret < 0) ? -errno : ret;
+}
+
+/*!
+ * \brief Oldest completion that has not been consumed.
+ * \param ring - Ring.
+ * \return Completion, or NULL if there is none.
+ */
+struct io_uring_cqe * uringPeekCqe (struct uring * ring)
+{
+    unsigned head = *ring->cqHead;
+
+    if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+    {
+        return NULL;
+    }
+
+    return &ring->cqes[head & *ring->cqMask];
+}
+
+/*!
+ * \brief Consume the completion returned by uringPeekCqe().
+ * \param ring - Ring.
+ */
+void uringCqeSeen (struct uring * ring)
+{
+    __atomic_store_n(ring->cqHead, *ring->cqHead + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,63 @@
+/************************************************************************//**
+ *  @file uring.h
+ *
+ *  @brief Minimal io_uring wrapper (raw system calls, no liburing).
+ ***************************************************************************/
+
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+/*!
+ * \brief An io_uring instance with its mapped submission and completion
+ *        rings.
+ */
+struct uring
+{
+    int fd;
+    unsigned * sqHead;
+    unsigned * sqTail;
+    unsigned * sqMask;
+    unsigned * sqArray;
+    unsigned * cqHead;
+    unsigned * cqTail;
+    unsigned * cqMask;
+    struct io_uring_sqe * sqes;
+    struct io_uring_cqe * cqes;
+    void * sqRing;
+    size_t sqRingSize;
+    void * cqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+    unsigned entries;
+    unsigned queued;                    // SQEs handed out but not submitted.
+};
+
+// Creates a ring with room for entries submissions. Returns 0 or -errno.
+int uringInit (struct uring * ring, unsigned entries);
+
+// Tears down a ring.
+void uringFree (struct uring * ring);
+
+// Registers a sparse table of count fixed files. Returns 0 or -errno.
+int uringRegisterFiles (struct uring * ring, int count);
+
+// Nonzero if the kernel supports opening files into fixed slots (5.15+).
+int uringHasDirectOpen ();
+
+// Next free (zeroed) submission entry, NULL if the ring is full.
+struct io_uring_sqe * uringGetSqe (struct uring * ring);
+
+// Submits queued entries and waits for waitNr completions. Returns the
+// number submitted or -errno.
+int uringSubmit (struct uring * ring, unsigned waitNr);
+
+// Oldest unconsumed completion, NULL if there is none.
+struct io_uring_cqe * uringPeekCqe (struct uring * ring);
+
+// Marks the completion returned by uringPeekCqe() as consumed.
+void uringCqeSeen (struct uring * ring);
+
+#endif
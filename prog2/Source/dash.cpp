@@ -7,7 +7,8 @@
  *     Dash is a shell that implements the following commands:
  *         - cmdnm
  *              Return the command string (name) that started 
- *              the process for a given process id
+ *              the process for a given process id (or several, or
+ *              pids read from stdin with "cmdnm -")
  * 
  *         - pid
  *              Return the process ids for a given command string
@@ -20,6 +21,7 @@
  *              print memory usage information: memtotal and memfree. 
  *              print cpu information: vendor id through cache size. 
  *              using /proc/'*' files
+ *              "systat --watch" prints rates at a fixed interval
  * 
  *         - exit
  *              Exits the shell
@@ -94,7 +96,7 @@ int main(int argc, char const *argv[])
         {
             if(command[6] == ' ' || command[6] == '\t' || command.size() == 6 )
             {
-                systat();
+                systat(command);
                 invalid = false;
             }
         }
@@ -30,6 +30,7 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <sstream>
 #include <string.h>
 #include <stdlib.h>
 #include <vector>
@@ -44,13 +45,33 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 
+// Needed for the /proc sampler (open, pread, clock_gettime)
+#include <fcntl.h>
+#include <time.h>
+
+// Needed for batched reads in cmdnm (raw io_uring system calls)
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <sys/utsname.h>
+
+// Needed for systat --watch
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <math.h>
+
 
 
 using namespace std;
 
 // Usage strings
-const string CMDNM_USAGE = "cmdnm <pid>";
+const string CMDNM_USAGE = "cmdnm <pid> [pid ...] | cmdnm -";
 const string PID_USAGE = "pid <command>";
-const string SYSTAT_USAGE = "systat";
+const string SYSTAT_USAGE = "systat [--watch [seconds] [count]]";
+
+// Shortest and longest intervals systat --watch accepts, in seconds
+const double SYSTAT_MIN_INTERVAL = 0.01;
+const double SYSTAT_MAX_INTERVAL = 86400.0;
 
 const bool DEBUGGING = false;
\ No newline at end of file
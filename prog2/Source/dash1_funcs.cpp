@@ -69,72 +69,351 @@ string parse_first_arg(string command, string usage)
 }
 
 
+/**
+ * Function: read_file_sync
+ *
+ * Description: reads the start of one file with open, read and close
+ *
+ * Args:
+ *     const string &path: file to read
+ *     string &data: contents read
+ *
+ * Return:
+ *     int: 0 on success, -errno on failure
+ */
+int read_file_sync(const string &path, string &data)
+{
+    char buf[4096];
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if( fd < 0 )
+        return -errno;
+
+    int len = read(fd, buf, sizeof(buf));
+    int err = len < 0 ? -errno : 0;
+    close(fd);
+
+    if( len > 0 )
+        data.assign(buf, len);
+    return err;
+}
+
+/**
+ * Class: UringBatch
+ *
+ * Description: reads many small files with io_uring (raw system calls).
+ *              Every file gets an openat() into a fixed file slot, linked
+ *              to a read() from that slot, so each batch of files costs a
+ *              single system call.
+ */
+class UringBatch
+{
+public:
+    static const unsigned BATCH = 64;   // Files per submission
+
+    UringBatch() : ring_fd(-1), sq_ring(NULL), cq_ring(NULL), sqes(NULL)
+    {
+        struct io_uring_params p;
+        memset(&p, 0, sizeof(p));
+
+        // Before 5.15 the kernel ignores file_index on openat
+        if( !has_direct_open() )
+            return;
+
+        ring_fd = syscall(__NR_io_uring_setup, 2 * BATCH, &p);
+        if( ring_fd < 0 )
+            return;
+
+        sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+        sq_ring = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring_fd, IORING_OFF_SQ_RING);
+        cq_ring = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring_fd, IORING_OFF_CQ_RING);
+        sqes = (struct io_uring_sqe *)mmap(NULL, sqes_size, PROT_READ | PROT_WRITE,
+                                           MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+        if( sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes == MAP_FAILED )
+        {
+            release();
+            return;
+        }
+
+        sq_tail = (unsigned *)((char *)sq_ring + p.sq_off.tail);
+        sq_mask = (unsigned *)((char *)sq_ring + p.sq_off.ring_mask);
+        sq_array = (unsigned *)((char *)sq_ring + p.sq_off.array);
+        cq_head = (unsigned *)((char *)cq_ring + p.cq_off.head);
+        cq_tail = (unsigned *)((char *)cq_ring + p.cq_off.tail);
+        cq_mask = (unsigned *)((char *)cq_ring + p.cq_off.ring_mask);
+        cqes = (struct io_uring_cqe *)((char *)cq_ring + p.cq_off.cqes);
+
+        // Sparse fixed file table for the direct opens
+        vector<int> fds(BATCH, -1);
+        if( syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_FILES,
+                    &fds[0], BATCH) < 0 )
+            release();
+    }
+
+    ~UringBatch()
+    {
+        release();
+    }
+
+    bool ok() const
+    {
+        return ring_fd >= 0;
+    }
+
+    /**
+     * Function: read_files
+     *
+     * Description: reads up to bufsize bytes from each file
+     *
+     * Args:
+     *     const vector<string> &paths: files to read
+     *     vector<string> &data: contents read, one per path
+     *     vector<int> &errors: 0 or -errno, one per path
+     *     unsigned bufsize: bytes to read per file
+     *
+     * Return:
+     *     bool: false if io_uring failed (nothing was read)
+     */
+    bool read_files(const vector<string> &paths, vector<string> &data,
+                    vector<int> &errors, unsigned bufsize)
+    {
+        vector<char> bufs((size_t)BATCH * bufsize);
+        vector<int> lens(BATCH);
+
+        data.assign(paths.size(), "");
+        errors.assign(paths.size(), 0);
+
+        for( size_t start = 0; start < paths.size(); start += BATCH )
+        {
+            unsigned n = min((size_t)BATCH, paths.size() - start);
+            unsigned tail = *sq_tail;
+
+            for( unsigned i = 0; i < n; i++ )
+            {
+                struct io_uring_sqe *sqe = next_sqe(tail++);
+                sqe->opcode = IORING_OP_OPENAT;
+                sqe->fd = AT_FDCWD;
+                sqe->addr = (unsigned long)paths[start + i].c_str();
+                sqe->open_flags = O_RDONLY;
+                sqe->file_index = i + 1;
+                sqe->flags = IOSQE_IO_LINK;
+                sqe->user_data = i << 1;
+
+                sqe = next_sqe(tail++);
+                sqe->opcode = IORING_OP_READ;
+                sqe->fd = i;
+                sqe->flags = IOSQE_FIXED_FILE;
+                sqe->addr = (unsigned long)&bufs[(size_t)i * bufsize];
+                sqe->len = bufsize;
+                sqe->user_data = (i << 1) | 1;
+                lens[i] = 0;
+            }
+            __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+
+            int ret;
+            do{
+                ret = syscall(__NR_io_uring_enter, ring_fd, 2 * n, 2 * n,
+                              IORING_ENTER_GETEVENTS, NULL, 0);
+            }while( ret < 0 && errno == EINTR );
+            if( ret < 0 )
+                return false;
+
+            for( unsigned seen = 0; seen < 2 * n; )
+            {
+                unsigned head = *cq_head;
+                if( head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE) )
+                {
+                    syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+                    continue;
+                }
+
+                struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+                unsigned i = cqe->user_data >> 1;
+
+                // A failed open cancels its read; keep the open's error
+                if( cqe->user_data & 1 )
+                {
+                    if( cqe->res != -ECANCELED || lens[i] >= 0 )
+                        lens[i] = cqe->res;
+                }
+                else if( cqe->res > 0 )
+                {
+                    // file_index was ignored: an ordinary fd came back and
+                    // the read from the empty slot fails
+                    close(cqe->res);
+                    lens[i] = -EBADF;
+                }
+                else if( cqe->res < 0 )
+                {
+                    lens[i] = cqe->res;
+                }
+
+                __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+                seen++;
+            }
+
+            for( unsigned i = 0; i < n; i++ )
+            {
+                // Kernels without direct opens reject them with EINVAL
+                // or leave the slot empty (EBADF)
+                if( lens[i] == -EINVAL || lens[i] == -EBADF )
+                    errors[start + i] = read_file_sync(paths[start + i], data[start + i]);
+                else if( lens[i] < 0 )
+                    errors[start + i] = lens[i];
+                else
+                    data[start + i].assign(&bufs[(size_t)i * bufsize], lens[i]);
+            }
+        }
+
+        return true;
+    }
+
+private:
+    static bool has_direct_open()
+    {
+        struct utsname name;
+        int major = 0, minor = 0;
+
+        if( uname(&name) != 0 || sscanf(name.release, "%d.%d", &major, &minor) < 2 )
+            return false;
+        return major > 5 || ( major == 5 && minor >= 15 );
+    }
+
+    struct io_uring_sqe *next_sqe(unsigned tail)
+    {
+        unsigned index = tail & *sq_mask;
+        sq_array[index] = index;
+        memset(&sqes[index], 0, sizeof(struct io_uring_sqe));
+        return &sqes[index];
+    }
+
+    void release()
+    {
+        if( sqes != NULL && sqes != MAP_FAILED ) munmap(sqes, sqes_size);
+        if( cq_ring != NULL && cq_ring != MAP_FAILED ) munmap(cq_ring, cq_size);
+        if( sq_ring != NULL && sq_ring != MAP_FAILED ) munmap(sq_ring, sq_size);
+        if( ring_fd >= 0 ) close(ring_fd);
+        ring_fd = -1;
+        sq_ring = cq_ring = NULL;
+        sqes = NULL;
+    }
+
+    int ring_fd;
+    void *sq_ring, *cq_ring;
+    size_t sq_size, cq_size, sqes_size;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+};
+
 /**
  * Function: cmdnm
  *
- * Description: returns the name of the process that started
- *                 the function with the pid provided by the user
+ * Description: prints the command line that started each process in a
+ *              list of pids, in the order given. "cmdnm -" reads the pids
+ *              from stdin until an empty line. The /proc/<pid>/cmdline
+ *              files are read as one io_uring batch, or one at a time if
+ *              io_uring is unavailable.
  *
  * Args:
  *     string command: String provided by user
  */
 void cmdnm(string command)
 {
-    // Get the argument
-    ifstream fin;
-    string prog_name;
-    string file_name;
+    vector<string> pids;
+    vector<string> paths;
+    vector<string> data;
+    vector<int> errors;
+    string word, line;
+
+    // Collect the pids (everything after the command name)
+    istringstream args(command);
+    args >> word;
+    while( args >> word )
+        pids.push_back(word);
+
+    if( pids.empty() )
+    {
+        cout << "Usage: " << CMDNM_USAGE << endl;
+        return;
+    }
 
-    // Get the first command line arg
-    string arg = parse_first_arg(command, CMDNM_USAGE);
+    if( pids.size() == 1 && pids[0] == "-" )
+    {
+        pids.clear();
+        while( getline(cin, line) && line.find_first_not_of(" \t") != string::npos )
+        {
+            istringstream words(line);
+            while( words >> word )
+                pids.push_back(word);
+        }
+    }
 
     if(DEBUGGING)
     {
-        cout << "CMDNM ARG: |" << arg << "|" << endl;
+        cout << "CMDNM ARGS: " << pids.size() << endl;
     }
 
-    // Check if the argument was an integer. If an empty string, there was no arg
-    if( (!atoi(arg.c_str()) && arg.length() != 0) 
-        || arg.find_first_not_of("1234567890") != string::npos ){
-        cout << "Expected an integer pid. Got '" << arg << "'" << endl;
-        return;
-    }
-    else if( arg.length() == 0 )
+    // Anything that is not a pid gets an empty path, which fails to open
+    for( unsigned int i = 0; i < pids.size(); i++ )
     {
-        return;
+        if( pids[i].find_first_not_of("1234567890") != string::npos )
+            paths.push_back("");
+        else
+            paths.push_back("/proc/" + pids[i] + "/cmdline");
     }
 
-    // Open the process's file in /proc
-    file_name = "/proc/" + arg + "/cmdline";
-    fin.open( file_name.c_str() );
-
-    // If we couldn't open the file, then the process pid isn't running
-    if(!fin)
+    // A single file is not worth setting up a ring for
+    bool batched = false;
+    if( paths.size() > 1 )
     {
-        cout << "Process " << atoi(arg.c_str()) << " is not currently running" << endl;
-        return;
+        UringBatch ring;
+        batched = ring.ok() && ring.read_files(paths, data, errors, 4096);
+    }
+    if( !batched )
+    {
+        data.assign(paths.size(), "");
+        errors.assign(paths.size(), 0);
+        for( unsigned int i = 0; i < paths.size(); i++ )
+            errors[i] = read_file_sync(paths[i], data[i]);
     }
 
-    // Get the first line of the status file and put in prog_name
-    getline( fin, prog_name );
+    for( unsigned int i = 0; i < pids.size(); i++ )
+    {
+        if( paths[i].empty() )
+        {
+            cout << "Expected an integer pid. Got '" << pids[i] << "'" << endl;
+            continue;
+        }
+
+        // If we couldn't open the file, then the process pid isn't running
+        if( errors[i] != 0 )
+        {
+            cout << "Process " << atoi(pids[i].c_str()) << " is not currently running" << endl;
+            continue;
+        }
 
-    // Comment out if you want to only print the process name, not its args
-    //prog_name = parse_first_arg(prog_name, "Broke Program Name Parsing");
-    // Replace nulls with spaces
-    for( unsigned int j=0; j < prog_name.length(); j++ ){
+        // Replace nulls with spaces
+        string prog_name = data[i];
+        for( unsigned int j=0; j < prog_name.length(); j++ ){
 
-        if( prog_name[j] == '\0' ){
-            prog_name[j] = ' ';
+            if( prog_name[j] == '\0' ){
+                prog_name[j] = ' ';
+            }
         }
-    }
 
-    // TODO: Figure out how to get this thing to output with the weird characters
-    //cout << "pid-> " << arg << ": " << prog_name << endl;
-    printf("pid-> %6s: %-50s", arg.c_str(), prog_name.substr(0,50).c_str());
+        printf("pid-> %6s: %-50s", pids[i].c_str(), prog_name.substr(0,50).c_str());
 
-    if( prog_name.length() > 50 )
-        printf("...(command >50 characters)");
-    printf("\n");
+        if( prog_name.length() > 50 )
+            printf("...(command >50 characters)");
+        printf("\n");
+    }
 
     return;
 }
@@ -236,90 +515,526 @@ void pid(string command)
     return;
 }
 
+/**
+ * Struct: SysSample
+ *
+ * Description: System wide counters read from /proc at one point in time.
+ */
+struct SysSample
+{
+    unsigned long long time_ns;         // CLOCK_MONOTONIC time of the sample
+    unsigned long long cpu_total;       // All cpu time in clock ticks
+    unsigned long long cpu_idle;        // Idle and iowait ticks
+    unsigned long long ctxt;            // Context switches since boot
+    unsigned long long forks;           // Processes created since boot
+    unsigned long long running;         // Runnable tasks
+    unsigned long long mem_total;       // kB
+    unsigned long long mem_free;        // kB
+    unsigned long long mem_available;   // kB
+    unsigned long long cached;          // kB
+    double uptime;                      // Seconds
+    double load[3];                     // 1, 5 and 15 minute load averages
+};
+
+/**
+ * Function: scan_number
+ *
+ * Description: parses an unsigned decimal number, skipping leading spaces
+ *
+ * Args:
+ *     const char *p: text to parse
+ *     unsigned long long &value: parsed number
+ *
+ * Return:
+ *     const char *: first character after the number
+ */
+const char *scan_number(const char *p, unsigned long long &value)
+{
+    value = 0;
+
+    while( *p == ' ' || *p == '\t' )
+        p++;
+
+    while( *p >= '0' && *p <= '9' )
+    {
+        value = value * 10 + (*p - '0');
+        p++;
+    }
+
+    return p;
+}
+
+/**
+ * Function: scan_decimal
+ *
+ * Description: parses a number with an optional fraction ("1234.56")
+ *
+ * Args:
+ *     const char *p: text to parse
+ *     double &value: parsed number
+ *
+ * Return:
+ *     const char *: first character after the number
+ */
+const char *scan_decimal(const char *p, double &value)
+{
+    unsigned long long whole, frac = 0;
+    double scale = 1.0;
+
+    p = scan_number(p, whole);
+    if( *p == '.' )
+    {
+        p++;
+        while( *p >= '0' && *p <= '9' )
+        {
+            frac = frac * 10 + (*p - '0');
+            scale *= 10.0;
+            p++;
+        }
+    }
+
+    value = whole + frac / scale;
+    return p;
+}
+
+/**
+ * Function: find_key
+ *
+ * Description: finds the line of a /proc file that starts with key
+ *
+ * Args:
+ *     const char *buf: file contents (null terminated)
+ *     const char *key: key including its separator ("ctxt ", "MemFree:")
+ *
+ * Return:
+ *     const char *: text following the key, NULL if it is missing
+ */
+const char *find_key(const char *buf, const char *key)
+{
+    size_t key_len = strlen(key);
+    const char *line = buf;
+
+    while( line != NULL && *line != '\0' )
+    {
+        if( strncmp(line, key, key_len) == 0 )
+            return line + key_len;
+
+        line = strchr(line, '\n');
+        if( line != NULL )
+            line++;
+    }
+
+    return NULL;
+}
+
+/**
+ * Class: SysSampler
+ *
+ * Description: keeps /proc/stat, /proc/meminfo, /proc/uptime and
+ *              /proc/loadavg open and re-reads them with pread() into one
+ *              reusable buffer, so a sample costs a read per file instead
+ *              of an open, a read and a close.
+ */
+class SysSampler
+{
+public:
+    SysSampler()
+    {
+        stat_fd = open("/proc/stat", O_RDONLY | O_CLOEXEC);
+        mem_fd = open("/proc/meminfo", O_RDONLY | O_CLOEXEC);
+        uptime_fd = open("/proc/uptime", O_RDONLY | O_CLOEXEC);
+        load_fd = open("/proc/loadavg", O_RDONLY | O_CLOEXEC);
+        buf.resize(16384);
+    }
+
+    ~SysSampler()
+    {
+        if( stat_fd >= 0 ) close(stat_fd);
+        if( mem_fd >= 0 ) close(mem_fd);
+        if( uptime_fd >= 0 ) close(uptime_fd);
+        if( load_fd >= 0 ) close(load_fd);
+    }
+
+    /**
+     * Function: sample
+     *
+     * Description: reads the current counters
+     *
+     * Args:
+     *     SysSample &out: counters read
+     *
+     * Return:
+     *     bool: true on success
+     */
+    bool sample(SysSample &out)
+    {
+        struct timespec ts;
+        unsigned long long v;
+        const char *p;
+
+        memset(&out, 0, sizeof(out));
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        out.time_ns = (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+        // cpu  user nice system idle iowait irq softirq steal guest guest_nice
+        // (guest time is already part of user and nice)
+        if( !read_file(stat_fd) || (p = find_key(&buf[0], "cpu ")) == NULL )
+            return false;
+
+        for( int i = 0; i < 8; i++ )
+        {
+            p = scan_number(p, v);
+            out.cpu_total += v;
+            if( i == 3 || i == 4 )
+                out.cpu_idle += v;
+        }
+        key_number("ctxt ", out.ctxt);
+        key_number("processes ", out.forks);
+        key_number("procs_running ", out.running);
+
+        if( !read_file(mem_fd) )
+            return false;
+        key_number("MemTotal:", out.mem_total);
+        key_number("MemFree:", out.mem_free);
+        key_number("MemAvailable:", out.mem_available);
+        key_number("Cached:", out.cached);
+
+        if( !read_file(uptime_fd) )
+            return false;
+        scan_decimal(&buf[0], out.uptime);
+
+        if( !read_file(load_fd) )
+            return false;
+        p = &buf[0];
+        for( int i = 0; i < 3; i++ )
+            p = scan_decimal(p, out.load[i]);
+
+        return true;
+    }
+
+private:
+    /**
+     * Function: read_file
+     *
+     * Description: re-reads an open /proc file from offset 0 into buf,
+     *              growing buf if the file does not fit
+     */
+    bool read_file(int fd)
+    {
+        size_t len = 0;
+        ssize_t n;
+
+        if( fd < 0 )
+            return false;
+
+        while( (n = pread(fd, &buf[len], buf.size() - len - 1, len)) > 0 )
+        {
+            len += n;
+            if( len == buf.size() - 1 )
+                buf.resize(buf.size() * 2);
+        }
+
+        buf[len] = '\0';
+        return n == 0;
+    }
+
+    /**
+     * Function: key_number
+     *
+     * Description: reads the number following key in buf (if present)
+     */
+    void key_number(const char *key, unsigned long long &value)
+    {
+        const char *p = find_key(&buf[0], key);
+        if( p != NULL )
+            scan_number(p, value);
+    }
+
+    int stat_fd;
+    int mem_fd;
+    int uptime_fd;
+    int load_fd;
+    vector<char> buf;
+};
+
+/**
+ * Function: cpu_percent
+ *
+ * Description: cpu utilization between two samples (all cpus). A zeroed
+ *              previous sample gives the utilization since boot.
+ *
+ * Args:
+ *     const SysSample &prev: earlier sample
+ *     const SysSample &cur: later sample
+ *
+ * Return:
+ *     double: utilization in percent
+ */
+double cpu_percent(const SysSample &prev, const SysSample &cur)
+{
+    unsigned long long total = cur.cpu_total - prev.cpu_total;
+    unsigned long long idle = cur.cpu_idle - prev.cpu_idle;
+
+    if( total == 0 )
+        return 0.0;
+
+    return 100.0 * (double)(total - idle) / (double)total;
+}
+
+/**
+ * Function: systat_watch
+ *
+ * Description: samples the system every interval seconds, paced by a
+ *              timerfd, and prints one line of rates per sample: cpu use,
+ *              the change in available memory, context switches and forks
+ *              per second, and the load average. Runs for count samples
+ *              (0 for no limit) or, on a terminal, until Enter is pressed,
+ *              then reports how much cpu the watch itself used.
+ *
+ * Args:
+ *     double interval: seconds between samples
+ *     int count: number of samples to print, 0 for no limit
+ */
+void systat_watch(double interval, int count)
+{
+    SysSampler sampler;
+    SysSample prev, cur;
+    struct itimerspec its;
+    struct timespec cpu0, cpu1;
+    struct pollfd fds[2];
+    unsigned long long ticks;
+    int nfds = 1;
+    int printed = 0;
+
+    // A zero timer would never fire, and nan or inf can't become a timespec
+    if( !isfinite(interval) || interval < SYSTAT_MIN_INTERVAL ||
+        interval > SYSTAT_MAX_INTERVAL )
+    {
+        cout << "Usage: " << SYSTAT_USAGE << endl;
+        return;
+    }
+
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if( tfd < 0 )
+    {
+        cout << "Could not create timer." << endl;
+        return;
+    }
+
+    its.it_interval.tv_sec = (time_t)interval;
+    its.it_interval.tv_nsec = (long)((interval - its.it_interval.tv_sec) * 1e9);
+    its.it_value = its.it_interval;
+    if( timerfd_settime(tfd, 0, &its, NULL) != 0 )
+    {
+        cout << "Could not start timer: " << strerror(errno) << endl;
+        close(tfd);
+        return;
+    }
+
+    fds[0].fd = tfd;
+    fds[0].events = POLLIN;
+
+    // Only a terminal can stop the watch; piped input is left for the shell
+    if( isatty(STDIN_FILENO) )
+    {
+        fds[1].fd = STDIN_FILENO;
+        fds[1].events = POLLIN;
+        nfds = 2;
+        printf("Sampling every %.2f s, press Enter to stop.\n", interval);
+    }
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu0);
+    if( !sampler.sample(prev) )
+    {
+        cout << "Could not read system statistics." << endl;
+        close(tfd);
+        return;
+    }
+
+    printf("%8s %6s %14s %12s %9s %17s %4s\n", "time(s)", "CPU%",
+           "MemAvail(kB)", "ctxt/s", "forks/s", "load 1/5/15", "run");
+    fflush(stdout);
+
+    while( count == 0 || printed < count )
+    {
+        if( poll(fds, nfds, -1) < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+            break;
+        }
+
+        // Enter stops the watch; throw the line away
+        if( nfds > 1 && (fds[1].revents & POLLIN) )
+        {
+            string line;
+            getline(cin, line);
+            break;
+        }
+
+        if( !(fds[0].revents & POLLIN) ||
+            read(tfd, &ticks, sizeof(ticks)) != sizeof(ticks) ||
+            !sampler.sample(cur) )
+            continue;
+
+        double secs = (cur.time_ns - prev.time_ns) / 1e9;
+        printf("%8.1f %6.1f %+14lld %12.0f %9.1f %5.2f %5.2f %5.2f %4llu\n",
+               cur.uptime, cpu_percent(prev, cur),
+               (long long)(cur.mem_available - prev.mem_available),
+               (cur.ctxt - prev.ctxt) / secs, (cur.forks - prev.forks) / secs,
+               cur.load[0], cur.load[1], cur.load[2], cur.running);
+        fflush(stdout);
+
+        prev = cur;
+        printed++;
+    }
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu1);
+
+    // Overhead: cpu time used by the watch over the time it ran
+    double used = (cpu1.tv_sec - cpu0.tv_sec) + (cpu1.tv_nsec - cpu0.tv_nsec) / 1e9;
+    double wall = printed * interval;
+    if( wall > 0 )
+        printf("Watch overhead: %.3f ms CPU in %.1f s (%.4f%% of a core)\n",
+               used * 1e3, wall, 100.0 * used / wall);
+
+    close(tfd);
+}
+
 /**
  * Function: systat
  *
- * Description: prints out system data and statistics
+ * Description: prints out system data and statistics. Version and cpu
+ *              information are read once; memory and cpu use come from a
+ *              sampler that keeps its /proc files open, along with how
+ *              they changed since the last systat.
+ *
+ *              "systat --watch [seconds] [count]" samples continuously
+ *              instead (see systat_watch).
  *
  * Args:
- *     None
+ *     string command: String provided by user
  */
-void systat()
+void systat(string command)
 {
+    static SysSampler sampler;
+    static SysSample prev;
+    static bool have_prev = false;
+    static string version;
+    static vector<string> cpu_info;
+    SysSample cur;
     ifstream fin;
     string output;
+    string word;
+    istringstream args(command);
+
+    // Skip the command name and look for --watch
+    args >> word;
+    if( args >> word )
+    {
+        string interval_arg = "1";
+        string count_arg = "0";
+        char *interval_end, *count_end;
+
+        args >> interval_arg >> count_arg;
+        double interval = strtod(interval_arg.c_str(), &interval_end);
+        long count = strtol(count_arg.c_str(), &count_end, 10);
+
+        if( word != "--watch" || *interval_end != '\0' || !isfinite(interval) ||
+            interval < SYSTAT_MIN_INTERVAL || interval > SYSTAT_MAX_INTERVAL ||
+            *count_end != '\0' || count < 0 )
+        {
+            cout << "Usage: " << SYSTAT_USAGE << endl;
+            return;
+        }
+
+        systat_watch(interval, count);
+        return;
+    }
 
     // Extra space for easier readability
     cout << endl;
 
-    // Get linux version info
-    fin.open("/proc/version");
-
-    if(!fin)
+    // Get linux version info (once)
+    if( version.empty() )
     {
-        cout << "Could not open linux version information." << endl << endl;
+        fin.open("/proc/version");
+        if( fin )
+        {
+            getline( fin, version );
+            fin.close();
+        }
     }
+
+    if( version.empty() )
+        cout << "Could not open linux version information." << endl << endl;
     else
+        cout << "Linux Version:\n" << version << endl << endl;
+
+    if( !sampler.sample(cur) )
     {
-        getline( fin, output );
-        cout << "Linux Version:\n" << output << endl << endl;
-        fin.close();
+        cout << "Could not read system statistics." << endl << endl;
+        return;
     }
 
     // Get System Uptime
-    fin.open("/proc/uptime");
+    printf("Uptime: %.2f\n\n\n", cur.uptime);
+
+    // Get memory usage information
+    cout << "Meminfo: " << endl;
+    printf("    MemTotal:     %10llu kB\n", cur.mem_total);
+    printf("    MemFree:      %10llu kB\n", cur.mem_free);
+    printf("    MemAvailable: %10llu kB\n", cur.mem_available);
+    printf("    Cached:       %10llu kB\n", cur.cached);
+    cout << endl;
 
-    if(!fin)
+    // Changes since the last call (or since boot)
+    if( have_prev )
     {
-        cout << "Could not open uptime information." << endl << endl;
+        printf("Since last systat (%.1f s):\n", (cur.time_ns - prev.time_ns) / 1e9);
+        printf("    CPU:                %.1f%%\n", cpu_percent(prev, cur));
+        printf("    MemFree change:     %+lld kB\n", (long long)(cur.mem_free - prev.mem_free));
+        printf("    MemAvailable change:%+lld kB\n", (long long)(cur.mem_available - prev.mem_available));
+        printf("    Context switches:   %llu\n", cur.ctxt - prev.ctxt);
+        printf("    New processes:      %llu\n", cur.forks - prev.forks);
     }
     else
     {
-        fin >> output;
-        cout << "Uptime: " << output << endl << endl;
-        fin.close();
+        SysSample boot;
+        memset(&boot, 0, sizeof(boot));
+        printf("CPU since boot: %.1f%%\n", cpu_percent(boot, cur));
     }
-    cout << endl;
-
-    // Get memory usage information: memtotal and memfree 
-    fin.open("/proc/meminfo");
+    printf("Load average: %.2f %.2f %.2f (%llu running)\n\n",
+           cur.load[0], cur.load[1], cur.load[2], cur.running);
 
-    if(!fin)
+    // Get cpu information: vendor id through cache size (once)
+    if( cpu_info.empty() )
     {
-        cout << "Could not open memory information." << endl;
-    }
-    else
-    {
-        cout << "Meminfo: " << endl;
-
-        do{
-            getline( fin, output );
-            cout << "    " << output << endl;
-        }while(output.substr(0,6) != "Cached");
-        fin.close();
+        fin.open("/proc/cpuinfo");
+        if( fin )
+        {
+            do{
+                getline( fin, output );
+                cpu_info.push_back(output);
+            }while(fin && output.substr(0,10) != "cache size");
+            fin.close();
+        }
     }
-    cout << endl;
 
-    // Get cpu information: vendor id through cache size.
-    fin.open("/proc/cpuinfo");
-
-    if(!fin)
+    if( cpu_info.empty() )
     {
         cout << "Could not open cpu information." << endl;
     }
     else
     {
         cout << "CPU Info: " << endl;
-
-        do{
-            getline( fin, output );
-            cout << "    " << output << endl;
-        }while(output.substr(0,10) != "cache size");
-
-        fin.close();
+        for( unsigned int i = 0; i < cpu_info.size(); i++ )
+            cout << "    " << cpu_info[i] << endl;
     }
     cout << endl;
 
+    prev = cur;
+    have_prev = true;
 
     return;
 }